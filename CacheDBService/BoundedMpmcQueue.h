@@ -0,0 +1,129 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+// Bounded lock-free multi-producer, multi-consumer queue (Vyukov's array-based design). Producers and
+// consumers claim a slot with one CAS on their position counter and publish it through the slot's
+// sequence number, so there is no shared lock. The flush loop is the regular consumer, but producers
+// pop as well when the drop-oldest backpressure policy makes room.
+template <typename T>
+class BoundedMpmcQueue
+{
+public:
+	explicit BoundedMpmcQueue(size_t capacity)
+		: capacity_(round_up_power_of_two(capacity < 2 ? 2 : capacity))
+		, mask_(capacity_ - 1)
+		, cells_(std::make_unique<Cell[]>(capacity_))
+		, enqueue_position_(0)
+		, dequeue_position_(0)
+	{
+		for (size_t index = 0; index < capacity_; ++index)
+		{
+			cells_[index].sequence.store(index, std::memory_order_relaxed);
+		}
+	}
+
+	BoundedMpmcQueue(const BoundedMpmcQueue&) = delete;
+	BoundedMpmcQueue& operator=(const BoundedMpmcQueue&) = delete;
+
+	auto try_push(T&& value) -> bool
+	{
+		auto position = enqueue_position_.load(std::memory_order_relaxed);
+		while (true)
+		{
+			auto& cell = cells_[position & mask_];
+			auto sequence = cell.sequence.load(std::memory_order_acquire);
+			auto difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position);
+			if (difference == 0)
+			{
+				if (enqueue_position_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+				{
+					cell.value = std::move(value);
+					cell.sequence.store(position + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (difference < 0)
+			{
+				return false;
+			}
+			else
+			{
+				position = enqueue_position_.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	auto try_pop(T& value) -> bool
+	{
+		auto position = dequeue_position_.load(std::memory_order_relaxed);
+		while (true)
+		{
+			auto& cell = cells_[position & mask_];
+			auto sequence = cell.sequence.load(std::memory_order_acquire);
+			auto difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position + 1);
+			if (difference == 0)
+			{
+				if (dequeue_position_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+				{
+					value = std::move(cell.value);
+					cell.value = T();
+					cell.sequence.store(position + mask_ + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (difference < 0)
+			{
+				return false;
+			}
+			else
+			{
+				position = dequeue_position_.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	auto capacity() const -> size_t
+	{
+		return capacity_;
+	}
+
+	// Exact only when no push or pop is in progress
+	auto size_approx() const -> size_t
+	{
+		auto enqueued = enqueue_position_.load(std::memory_order_relaxed);
+		auto dequeued = dequeue_position_.load(std::memory_order_relaxed);
+		return enqueued > dequeued ? enqueued - dequeued : 0;
+	}
+
+private:
+	static auto round_up_power_of_two(size_t value) -> size_t
+	{
+		size_t result = 1;
+		while (result < value)
+		{
+			result <<= 1;
+		}
+		return result;
+	}
+
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		T value;
+	};
+
+	static constexpr size_t CACHE_LINE_SIZE = 64;
+
+	const size_t capacity_;
+	const size_t mask_;
+	std::unique_ptr<Cell[]> cells_;
+
+	// Producers and the consumer hammer different counters; keep them off each other's cache line
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> enqueue_position_;
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> dequeue_position_;
+	char padding_[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+};
@@ -1,11 +1,17 @@
 #include "CacheDBService.h"
 
+#include "JsonValidator.h"
 #include "Logger.h"
-#include "JobPool.h"
+#include "OperationCodec.h"
 
 #include "fmt/format.h"
 #include <algorithm>
+#include <cctype>
+#include <charconv>
 #include <chrono>
+#include <cmath>
+#include <iterator>
+#include <random>
 #include <thread>
 #include <utility>
 #include <future>
@@ -15,12 +21,230 @@
 
 using namespace Utilities;
 
+namespace
+{
+	// Initial arena for one flush cycle's parsed operations; larger cycles grow it from the heap until release
+	constexpr size_t parse_buffer_bytes = 1 << 20;
+	// Closes a JSON envelope of unrelated writes, which MainDBService commits and dead-letters one by one
+	constexpr std::string_view packed_suffix = "],\"packed\":true}";
+
+	auto to_reply(const redisReply& reply) -> RedisReply
+	{
+		auto scalar = [](const redisReply& item) -> std::optional<std::string>
+		{
+			switch (item.type)
+			{
+			case REDIS_REPLY_STRING:
+			case REDIS_REPLY_STATUS:
+				return std::string(item.str, item.len);
+			case REDIS_REPLY_INTEGER:
+				return std::to_string(item.integer);
+			default:
+				return std::nullopt;
+			}
+		};
+
+		RedisReply result;
+		switch (reply.type)
+		{
+		case REDIS_REPLY_ERROR:
+			result.error = std::string(reply.str, reply.len);
+			break;
+		case REDIS_REPLY_ARRAY:
+			result.elements.reserve(reply.elements);
+			for (size_t index = 0; index < reply.elements; ++index)
+			{
+				result.elements.push_back(reply.element[index] != nullptr ? scalar(*reply.element[index]) : std::nullopt);
+			}
+			break;
+		default:
+			result.value = scalar(reply);
+			break;
+		}
+		return result;
+	}
+
+	auto is_read_only_command(std::string name) -> bool
+	{
+		std::transform(name.begin(), name.end(), name.begin(), [](unsigned char character) { return static_cast<char>(std::toupper(character)); });
+		return name == "GET" || name == "MGET" || name == "EXISTS" || name == "TTL" || name == "PTTL" || name == "STRLEN" || name == "TYPE";
+	}
+
+	// Argument indexes that hold keys; commands not listed here take one key, first
+	auto key_positions(const std::vector<std::string>& arguments) -> std::vector<size_t>
+	{
+		std::vector<size_t> positions;
+		if (arguments.size() < 2)
+		{
+			return positions;
+		}
+
+		auto name = arguments.front();
+		std::transform(name.begin(), name.end(), name.begin(), [](unsigned char character) { return static_cast<char>(std::toupper(character)); });
+		if (name == "MGET" || name == "DEL" || name == "UNLINK" || name == "EXISTS" || name == "TOUCH" || name == "WATCH" ||
+			name == "SINTER" || name == "SUNION" || name == "SDIFF" || name == "SINTERSTORE" || name == "SUNIONSTORE" || name == "SDIFFSTORE" ||
+			name == "PFCOUNT" || name == "PFMERGE")
+		{
+			for (size_t index = 1; index < arguments.size(); ++index)
+			{
+				positions.push_back(index);
+			}
+		}
+		else if (name == "MSET" || name == "MSETNX")
+		{
+			for (size_t index = 1; index < arguments.size(); index += 2)
+			{
+				positions.push_back(index);
+			}
+		}
+		else if (name == "RENAME" || name == "RENAMENX" || name == "COPY" || name == "SMOVE" || name == "RPOPLPUSH" ||
+			name == "BRPOPLPUSH" || name == "LMOVE" || name == "BLMOVE")
+		{
+			positions.push_back(1);
+			if (arguments.size() > 2)
+			{
+				positions.push_back(2);
+			}
+		}
+		else if (name == "BLPOP" || name == "BRPOP")
+		{
+			// The last argument is the timeout
+			for (size_t index = 1; index + 1 < arguments.size(); ++index)
+			{
+				positions.push_back(index);
+			}
+		}
+		else if (name == "EVAL" || name == "EVALSHA" || name == "EVAL_RO" || name == "EVALSHA_RO")
+		{
+			size_t key_count = 0;
+			if (arguments.size() > 2)
+			{
+				const auto& count = arguments[2];
+				std::from_chars(count.data(), count.data() + count.size(), key_count);
+			}
+			for (size_t index = 3; index < arguments.size() && index < 3 + key_count; ++index)
+			{
+				positions.push_back(index);
+			}
+		}
+		else
+		{
+			positions.push_back(1);
+		}
+
+		return positions;
+	}
+
+	auto random_engine() -> std::mt19937_64&
+	{
+		thread_local std::mt19937_64 engine(std::random_device{}());
+		return engine;
+	}
+
+	// Compare-and-delete, so a load that outlived its lock can't release the next holder's
+	constexpr const char* release_lock_script =
+		"if redis.call('GET', KEYS[1]) == ARGV[1] then return redis.call('DEL', KEYS[1]) end return 0";
+
+	struct StreamEntry
+	{
+		std::string id;
+		std::optional<std::string> body;
+	};
+
+	// [[id, [field, value, ...]], ...]; entries deleted while pending come back without fields
+	auto to_stream_entries(const redisReply* list) -> std::vector<StreamEntry>
+	{
+		std::vector<StreamEntry> entries;
+		if (list == nullptr || list->type != REDIS_REPLY_ARRAY)
+		{
+			return entries;
+		}
+
+		entries.reserve(list->elements);
+		for (size_t index = 0; index < list->elements; ++index)
+		{
+			auto* item = list->element[index];
+			if (item == nullptr || item->type != REDIS_REPLY_ARRAY || item->elements < 1 || item->element[0]->type != REDIS_REPLY_STRING)
+			{
+				continue;
+			}
+
+			StreamEntry entry{ std::string(item->element[0]->str, item->element[0]->len), std::nullopt };
+			auto* fields = item->elements > 1 ? item->element[1] : nullptr;
+			for (size_t field = 0; fields != nullptr && fields->type == REDIS_REPLY_ARRAY && field + 1 < fields->elements; field += 2)
+			{
+				auto* name = fields->element[field];
+				auto* value = fields->element[field + 1];
+				if (name->type == REDIS_REPLY_STRING && std::string(name->str, name->len) == "body" && value->type == REDIS_REPLY_STRING)
+				{
+					entry.body = std::string(value->str, value->len);
+				}
+			}
+			entries.push_back(std::move(entry));
+		}
+		return entries;
+	}
+
+	template <typename Queued>
+	auto exec_queued(Queued queued, const RedisCommandBatch& batch) -> std::vector<RedisReply>
+	{
+		for (const auto& arguments : batch.commands())
+		{
+			queued.command(arguments.begin(), arguments.end());
+		}
+
+		auto queued_replies = queued.exec();
+		std::vector<RedisReply> replies;
+		replies.reserve(queued_replies.size());
+		for (size_t index = 0; index < queued_replies.size(); ++index)
+		{
+			replies.push_back(to_reply(queued_replies.get(index)));
+		}
+		return replies;
+	}
+}
+
 CacheDBService::CacheDBService(std::shared_ptr<Configurations> configurations)
     : configurations_(std::move(configurations))
-    , redis_client_(nullptr)
-    , work_queue_emitter_(nullptr)
+	, shard_ring_(nullptr)
+	, value_codec_(nullptr)
+	, near_cache_(nullptr)
+    , publisher_(nullptr)
     , thread_pool_(nullptr)
+	, parse_buffer_(std::make_unique<unsigned char[]>(parse_buffer_bytes))
+	, parse_resource_(parse_buffer_.get(), parse_buffer_bytes)
+	, pending_queue_(nullptr)
+	, pending_bytes_(0)
+	, dropped_operations_(0)
+	, queue_full_policy_(QueueFullPolicy::Reject)
+	, pending_operations_(nullptr)
+	, spool_(nullptr)
+	, write_behind_(nullptr)
+	, flush_stop_requested_(false)
+	, flush_requested_(false)
+	, idle_backoff_(false)
+	, idle_wakeup_(false)
+	, stream_sequence_(0)
+	, collected_stream_sequence_(0)
 {
+	auto policy = configurations_->pending_queue_full_policy();
+	if (policy == "block")
+	{
+		queue_full_policy_ = QueueFullPolicy::Block;
+	}
+	else if (policy == "drop_oldest")
+	{
+		queue_full_policy_ = QueueFullPolicy::DropOldest;
+	}
+
+	if (!configurations_->write_behind().empty())
+	{
+		write_behind_ = std::make_unique<WriteBehindTracker>(configurations_->write_behind());
+	}
+
+	value_codec_ = std::make_unique<ValueCodec>(
+		configurations_->value_encoding() != "raw",
+		static_cast<size_t>(std::max(0, configurations_->value_compression_threshold_bytes())));
 }
 
 CacheDBService::~CacheDBService()
@@ -33,33 +257,91 @@ auto CacheDBService::start() -> std::tuple<bool, std::optional<std::string>>
     stop_promise_ = std::promise<void>();
     stop_future_ = stop_promise_.get_future().share();
 
+	if (!configurations_->spool_enabled() && pending_queue_ == nullptr)
 	{
-		std::lock_guard<std::mutex> lock(pending_mutex_);
-		pending_messages_.clear();
+		pending_queue_ = std::make_unique<BoundedMpmcQueue<QueuedOperation>>(static_cast<size_t>(std::max(1, configurations_->pending_queue_capacity())));
+	}
+	pending_bytes_ = 0;
+	dropped_operations_ = 0;
+	pending_operations_ = std::make_unique<WriteCoalescer>(configurations_->coalesce_writes(), configurations_->coalesce_keys());
+	flush_stop_requested_ = false;
+	flush_requested_ = false;
+	idle_backoff_ = false;
+	idle_wakeup_ = false;
+	unconfirmed_envelopes_.clear();
+	stream_entries_.clear();
+	stream_sequence_ = 0;
+	collected_stream_sequence_ = 0;
+
+	if (configurations_->spool_enabled())
+	{
+		spool_ = std::make_unique<WriteAheadSpool>(
+			configurations_->spool_path(),
+			static_cast<size_t>(std::max(0, configurations_->spool_segment_bytes())),
+			static_cast<size_t>(std::max(0, configurations_->spool_max_segments())),
+			configurations_->spool_sync_interval_ms());
+
+		auto [opened, open_error] = spool_->open();
+		if (!opened)
+		{
+			spool_.reset();
+			return { false, open_error };
+		}
 	}
 
-	if (redis_client_ == nullptr)
+	if (redis_pools_.empty())
 	{
-		redis_client_ = std::make_unique<Redis::RedisClient>(
-			configurations_->redis_host(),
-			configurations_->redis_port(),
-			Redis::TLSOptions(),
-			configurations_->redis_db_index());
+		auto [created, create_error] = create_redis_pools();
+		if (!created)
+		{
+			return { false, create_error };
+		}
 	}
 
-	auto [connected, connect_error] = ensure_redis_connection();
-	if (!connected)
+	for (size_t node = 0; node < redis_pools_.size(); ++node)
 	{
-		return { false, connect_error };
+		auto [connected, connect_error] = redis_pools_[node]->start(configurations_->redis_reconnect_max_retries(), configurations_->redis_reconnect_interval_ms());
+		if (!connected)
+		{
+			return { false, fmt::format("Redis node {}: {}", shard_ring_->node_name(node), connect_error.value_or("unknown error")) };
+		}
+	}
+
+	if (configurations_->near_cache_enabled() && near_cache_ == nullptr)
+	{
+		near_cache_ = std::make_unique<NearCache>(
+			static_cast<size_t>(std::max(1, configurations_->near_cache_capacity())),
+			static_cast<size_t>(std::max(1, configurations_->near_cache_shards())));
+
+		if (configurations_->near_cache_invalidation())
+		{
+			// A node that resubscribes can't tell which of its keys changed, and the cache doesn't track owners
+			for (const auto& pool : redis_pools_)
+			{
+				keyspace_invalidators_.push_back(std::make_unique<KeyspaceInvalidator>(
+					pool->options(),
+					[this](const std::string& key) { near_cache_->invalidate(key); },
+					[this]() { near_cache_->clear(); }));
+			}
+		}
+	}
+	for (auto& invalidator : keyspace_invalidators_)
+	{
+		auto [subscribed, subscribe_error] = invalidator->start(configurations_->near_cache_configure_notifications());
+		if (!subscribed)
+		{
+			return { false, subscribe_error };
+		}
 	}
 
-	if (work_queue_emitter_ == nullptr)
+	if (publisher_ == nullptr)
 	{
-		work_queue_emitter_ = std::make_unique<RabbitMQ::RabbitMQWorkQueueEmitter>(
+		publisher_ = std::make_unique<CommonMessageMQ::RabbitMQConfirmPublisher>(
 			configurations_->rabbit_mq_host(),
 			configurations_->rabbit_mq_port(),
 			configurations_->rabbit_mq_user_name(),
-			configurations_->rabbit_mq_password());
+			configurations_->rabbit_mq_password(),
+			configurations_->rabbit_channel_id());
 	}
 
 	auto [mq_connected, mq_connect_error] = ensure_rabbitmq_connection();
@@ -68,6 +350,12 @@ auto CacheDBService::start() -> std::tuple<bool, std::optional<std::string>>
 		return { false, mq_connect_error };
 	}
 
+	auto [group_ready, group_error] = ensure_stream_group();
+	if (!group_ready)
+	{
+		return { false, group_error };
+	}
+
 	auto [pool_created, pool_error] = create_thread_pool();
 	if (!pool_created)
 	{
@@ -76,6 +364,7 @@ auto CacheDBService::start() -> std::tuple<bool, std::optional<std::string>>
 
 	// Kick first cycle; subsequent cycles re-enqueue themselves via job pool
 	schedule_publish_job();
+	schedule_stream_consumer();
 
 	return { true, std::nullopt };
 }
@@ -93,7 +382,44 @@ auto CacheDBService::wait_stop() -> std::tuple<bool, std::optional<std::string>>
 
 auto CacheDBService::stop() -> std::tuple<bool, std::optional<std::string>>
 {
+	flush_stop_requested_ = true;
+	wake_flush_loop();
+
     destroy_thread_pool();
+	for (auto& invalidator : keyspace_invalidators_)
+	{
+		invalidator->stop();
+	}
+	if (near_cache_ != nullptr)
+	{
+		auto stats = near_cache_->stats();
+		Logger::handle().write(LogTypes::Information, fmt::format("near cache: {} hits, {} misses, {} evictions, {} expirations, {} invalidations, {} entries",
+			stats.hits, stats.misses, stats.evictions, stats.expirations, stats.invalidations, stats.entries));
+	}
+	for (auto& pool : redis_pools_)
+	{
+		pool->stop();
+	}
+	if (spool_ != nullptr)
+	{
+		// Producers racing with stop get "spool is not open" instead of a dangling spool
+		spool_->close();
+	}
+	if (pending_queue_ != nullptr)
+	{
+		// Pushed after the final flush collected; without a spool nothing would carry them into the next start
+		QueuedOperation queued;
+		size_t discarded = 0;
+		while (pending_queue_->try_pop(queued))
+		{
+			++discarded;
+		}
+		if (discarded > 0)
+		{
+			Logger::handle().write(LogTypes::Error, fmt::format("dropping {} operations queued during stop", discarded));
+		}
+		pending_bytes_ = 0;
+	}
     if (stop_future_.valid())
     {
         try
@@ -158,8 +484,8 @@ auto CacheDBService::create_thread_pool() -> std::tuple<bool, std::optional<std:
 		return { false, low_err };
 	}
 
-	// Ensure at least one long-term worker for scheduled jobs
-	auto [long_ok, long_err] = allocate_workers(1, std::vector<JobPriorities>{ JobPriorities::LongTerm });
+	// Ensure at least one long-term worker for scheduled jobs, and one more for the stream consumer
+	auto [long_ok, long_err] = allocate_workers(configurations_->redis_stream_enabled() ? 2 : 1, std::vector<JobPriorities>{ JobPriorities::LongTerm });
 	if (!long_ok)
 	{
 		return { false, long_err };
@@ -186,54 +512,246 @@ auto CacheDBService::destroy_thread_pool() -> void
 
 auto CacheDBService::ensure_stream_group() -> std::tuple<bool, std::optional<std::string>>
 {
-	// No consumption required currently; return success
+	if (!configurations_->redis_stream_enabled() || !configurations_->redis_auto_create_group())
+	{
+		return { true, std::nullopt };
+	}
+
+	// From the start of the stream, so entries added before the group existed are not skipped
+	auto stream_key = configurations_->redis_stream_key();
+	auto error = redis_pools_[node_for(stream_key)]->execute([&](sw::redis::Redis& redis)
+	{
+		redis.command<void>("XGROUP", "CREATE", stream_key, configurations_->redis_group_name(), "0", "MKSTREAM");
+	});
+	if (error.has_value() && error.value().find("BUSYGROUP") == std::string::npos)
+	{
+		return { false, fmt::format("failed to create consumer group {} on {}: {}", configurations_->redis_group_name(), stream_key, error.value()) };
+	}
+
 	return { true, std::nullopt };
 }
 
-auto CacheDBService::ensure_redis_connection() -> std::tuple<bool, std::optional<std::string>>
+void CacheDBService::schedule_stream_consumer()
 {
-	if (redis_client_ == nullptr)
+	if (thread_pool_ == nullptr || !configurations_->redis_stream_enabled())
 	{
-		return { false, std::optional<std::string>("Redis client is null") };
+		return;
 	}
-
-	if (redis_client_->is_connected())
+	auto [queued, queue_error] = thread_pool_->push(std::make_shared<Job>(
+		JobPriorities::LongTerm,
+		std::bind(&CacheDBService::consume_redis_stream, this),
+		"consume_redis_stream"));
+	if (!queued)
 	{
-		return { true, std::nullopt };
+		Logger::handle().write(LogTypes::Error, queue_error.value_or("failed to schedule stream consumer"));
 	}
+}
 
-	int max_retries = configurations_->redis_reconnect_max_retries();
-	int interval_ms = configurations_->redis_reconnect_interval_ms();
+auto CacheDBService::consume_redis_stream() -> std::tuple<bool, std::optional<std::string>>
+{
+	// Runs for the lifetime of the service on its own long-term worker, with its own connection: a blocking
+	// read would hold a pooled one for the whole block and trip its socket timeout
+	const auto stream_key = configurations_->redis_stream_key();
+	const auto group = configurations_->redis_group_name();
+	const auto consumer = configurations_->redis_consumer_name();
+	const auto count = std::to_string(std::max(1, configurations_->redis_count()));
+	const auto block_ms = std::max(1, configurations_->redis_block_ms());
+	const auto claim_idle = std::chrono::milliseconds(std::max(1, configurations_->redis_stream_claim_idle_ms()));
+
+	auto options = redis_pools_[node_for(stream_key)]->options();
+	options.socket_timeout = std::chrono::milliseconds(block_ms + configurations_->redis_socket_timeout_ms());
+
+	std::unique_ptr<sw::redis::Redis> connection;
+	// Our own pending entries from a previous run are read back first ("0"), then new ones (">")
+	std::string read_cursor = "0";
+	std::string last_admitted_id = "0";
+	std::string claim_cursor = "0-0";
+	auto next_claim = std::chrono::steady_clock::now();
+
+	auto pause = [this](std::chrono::milliseconds duration)
+	{
+		auto until = std::chrono::steady_clock::now() + duration;
+		while (!flush_stop_requested_ && std::chrono::steady_clock::now() < until)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		}
+	};
 
-	for (int retry = 0; retry < max_retries; ++retry)
+	// Admits entries in order; returns the number admitted before the pipeline pushed back
+	auto admit = [&](const std::vector<StreamEntry>& entries) -> size_t
 	{
-		auto [connected, connect_error] = redis_client_->connect();
-		if (connected)
+		std::vector<std::string> poison;
+		size_t admitted = 0;
+		for (const auto& entry : entries)
 		{
-			Logger::handle().write(LogTypes::Information,
-				fmt::format("Redis reconnected successfully after {} retries", retry));
-			return { true, std::nullopt };
+			if (stream_entries_.in_flight(entry.id))
+			{
+				// Already in the pipeline, waiting for its publish to be confirmed
+				++admitted;
+				continue;
+			}
+
+			if (!entry.body.has_value() || !std::get<0>(JsonValidator::validate_object(entry.body.value())))
+			{
+				// Acknowledged right away; it would otherwise be claimed and rejected forever
+				Logger::handle().write(LogTypes::Error, fmt::format("dropping stream entry {}: no JSON object in its body field", entry.id));
+				poison.push_back(entry.id);
+				++admitted;
+				continue;
+			}
+
+			uint64_t sequence = 0;
+			auto [accepted, admit_error] = admit_operation(entry.body.value(), &sequence);
+			if (!accepted)
+			{
+				Logger::handle().write(LogTypes::Debug, fmt::format("stream ingest paused at {}: {}", entry.id, admit_error.value_or("unknown error")));
+				break;
+			}
+
+			stream_entries_.admit(entry.id, sequence);
+			++admitted;
 		}
 
-		Logger::handle().write(LogTypes::Error,
-			fmt::format("Redis connection failed (retry {}/{}): {}",
-				retry + 1, max_retries, connect_error.value_or("unknown error")));
+		if (!poison.empty())
+		{
+			std::vector<std::string> command{ "XACK", stream_key, group };
+			command.insert(command.end(), poison.begin(), poison.end());
+			connection->command<long long>(command.begin(), command.end());
+		}
+		return admitted;
+	};
 
-		if (retry < max_retries - 1)
+	while (!flush_stop_requested_)
+	{
+		try
 		{
-			std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+			if (connection == nullptr)
+			{
+				connection = std::make_unique<sw::redis::Redis>(options);
+			}
+
+			// Entries left pending by consumers that went away become ours and are admitted like new ones
+			if (std::chrono::steady_clock::now() >= next_claim)
+			{
+				std::vector<std::string> claim{ "XAUTOCLAIM", stream_key, group, consumer, std::to_string(claim_idle.count()), claim_cursor, "COUNT", count };
+				auto reply = connection->command(claim.begin(), claim.end());
+				if (reply != nullptr && reply->type == REDIS_REPLY_ARRAY && reply->elements >= 2 && reply->element[0]->type == REDIS_REPLY_STRING)
+				{
+					claim_cursor = std::string(reply->element[0]->str, reply->element[0]->len);
+					auto claimed = to_stream_entries(reply->element[1]);
+					if (!claimed.empty())
+					{
+						Logger::handle().write(LogTypes::Information, fmt::format("claimed {} stale entries from {}", claimed.size(), stream_key));
+						if (admit(claimed) < claimed.size())
+						{
+							// The rest now sits in our pending list; replay it once there is room
+							read_cursor = "0";
+							last_admitted_id = "0";
+							pause(std::chrono::milliseconds(configurations_->redis_reconnect_interval_ms()));
+							continue;
+						}
+					}
+				}
+				// A full pass over the pending list waits for the next period; otherwise keep paging
+				if (claim_cursor == "0-0")
+				{
+					next_claim = std::chrono::steady_clock::now() + claim_idle;
+				}
+			}
+
+			std::vector<std::string> read{ "XREADGROUP", "GROUP", group, consumer, "COUNT", count };
+			if (read_cursor == ">")
+			{
+				read.insert(read.end(), { "BLOCK", std::to_string(block_ms) });
+			}
+			read.insert(read.end(), { "STREAMS", stream_key, read_cursor });
+
+			auto reply = connection->command(read.begin(), read.end());
+			// [[key, entries]], or nil when the block ran out
+			std::vector<StreamEntry> entries;
+			if (reply != nullptr && reply->type == REDIS_REPLY_ARRAY && reply->elements > 0 && reply->element[0]->type == REDIS_REPLY_ARRAY && reply->element[0]->elements >= 2)
+			{
+				entries = to_stream_entries(reply->element[0]->element[1]);
+			}
+
+			if (entries.empty())
+			{
+				// Our pending history is replayed; from here on only new entries
+				read_cursor = ">";
+				continue;
+			}
+
+			auto admitted = admit(entries);
+			if (admitted > 0)
+			{
+				last_admitted_id = entries[admitted - 1].id;
+			}
+			if (admitted < entries.size())
+			{
+				// The rest is already delivered to us, so it is read back from our pending list once there is room
+				read_cursor = last_admitted_id;
+				pause(std::chrono::milliseconds(configurations_->redis_reconnect_interval_ms()));
+			}
+			else if (read_cursor != ">")
+			{
+				read_cursor = last_admitted_id;
+			}
+		}
+		catch (const sw::redis::Error& e)
+		{
+			Logger::handle().write(LogTypes::Error, fmt::format("stream consumer error, reconnecting: {}", e.what()));
+			connection.reset();
+			pause(std::chrono::milliseconds(configurations_->redis_reconnect_interval_ms()));
 		}
 	}
 
-	return { false, std::optional<std::string>(
-		fmt::format("Failed to reconnect to Redis after {} retries", max_retries)) };
+	return { true, std::nullopt };
+}
+
+auto CacheDBService::acknowledge_stream_entries(uint64_t delivered_sequence) -> void
+{
+	if (redis_pools_.empty())
+	{
+		return;
+	}
+
+	constexpr size_t ids_per_ack = 1000;
+	auto stream_key = configurations_->redis_stream_key();
+	auto& pool = redis_pools_[node_for(stream_key)];
+	while (true)
+	{
+		auto ids = stream_entries_.delivered(delivered_sequence, ids_per_ack);
+		if (ids.empty())
+		{
+			return;
+		}
+
+		std::vector<std::string> command{ "XACK", stream_key, configurations_->redis_group_name() };
+		command.insert(command.end(), ids.begin(), ids.end());
+
+		auto error = pool->execute([&](sw::redis::Redis& redis)
+		{
+			redis.command<long long>(command.begin(), command.end());
+		});
+		if (error.has_value())
+		{
+			Logger::handle().write(LogTypes::Error, fmt::format("XACK failed, retrying after the next publish: {}", error.value()));
+			return;
+		}
+		stream_entries_.acknowledged(ids.size());
+	}
 }
 
 auto CacheDBService::ensure_rabbitmq_connection() -> std::tuple<bool, std::optional<std::string>>
 {
-	if (work_queue_emitter_ == nullptr)
+	if (publisher_ == nullptr)
+	{
+		return { false, std::optional<std::string>("RabbitMQ publisher is null") };
+	}
+
+	if (publisher_->is_connected())
 	{
-		return { false, std::optional<std::string>("WorkQueueEmitter is null") };
+		return { true, std::nullopt };
 	}
 
 	int max_retries = configurations_->rabbit_mq_reconnect_max_retries();
@@ -241,7 +759,7 @@ auto CacheDBService::ensure_rabbitmq_connection() -> std::tuple<bool, std::optio
 
 	for (int retry = 0; retry < max_retries; ++retry)
 	{
-		auto [started, start_error] = work_queue_emitter_->start();
+		auto [started, start_error] = publisher_->start();
 		if (started)
 		{
 			if (retry > 0)
@@ -266,213 +784,1208 @@ auto CacheDBService::ensure_rabbitmq_connection() -> std::tuple<bool, std::optio
 		fmt::format("Failed to connect to RabbitMQ after {} retries", max_retries)) };
 }
 
-auto CacheDBService::publish_message(const std::string& message_body) -> std::tuple<bool, std::optional<std::string>>
+auto CacheDBService::redis_connection_options(const std::string& node) const -> std::tuple<std::optional<sw::redis::ConnectionOptions>, std::optional<std::string>>
 {
-	if (work_queue_emitter_ == nullptr)
+	auto separator = node.rfind(':');
+	if (separator == std::string::npos || separator == 0 || separator + 1 == node.size() || node.size() - separator - 1 > 5 ||
+		!std::all_of(node.begin() + separator + 1, node.end(), [](unsigned char character) { return std::isdigit(character) != 0; }))
 	{
-		return { false, std::optional<std::string>("WorkQueueEmitter is null") };
+		return { std::nullopt, fmt::format("invalid Redis node \"{}\", expected host:port", node) };
 	}
 
-	auto [success, error_message] = work_queue_emitter_->publish(
-		configurations_->rabbit_channel_id(),
-		configurations_->publish_queue_name(),
-		message_body,
-		configurations_->content_type(),
-		std::nullopt);
+	sw::redis::ConnectionOptions options;
+	options.host = node.substr(0, separator);
+	options.port = std::stoi(node.substr(separator + 1));
+	options.db = configurations_->redis_db_index();
+	options.connect_timeout = std::chrono::milliseconds(configurations_->redis_socket_timeout_ms());
+	options.socket_timeout = std::chrono::milliseconds(configurations_->redis_socket_timeout_ms());
+	return { options, std::nullopt };
+}
 
-	// If operation failed due to connection issue, try to reconnect and retry
-	if (!success && error_message.has_value() &&
-		(error_message.value().find("connection") != std::string::npos ||
-		 error_message.value().find("socket") != std::string::npos ||
-		 error_message.value().find("channel") != std::string::npos))
+auto CacheDBService::create_redis_pools() -> std::tuple<bool, std::optional<std::string>>
+{
+	auto nodes = configurations_->redis_nodes();
+	if (nodes.empty())
 	{
-		Logger::handle().write(LogTypes::Error,
-			fmt::format("RabbitMQ publish failed, attempting reconnection: {}", error_message.value()));
+		nodes.push_back(fmt::format("{}:{}", configurations_->redis_host(), configurations_->redis_port()));
+	}
+
+	auto ring = std::make_unique<ConsistentHashRing>(static_cast<size_t>(std::max(1, configurations_->redis_virtual_nodes())));
+	std::vector<std::unique_ptr<RedisConnectionPool>> pools;
+	for (const auto& node : nodes)
+	{
+		auto [options, options_error] = redis_connection_options(node);
+		if (!options.has_value())
+		{
+			return { false, options_error };
+		}
 
-		auto [reconnected, reconnect_error] = ensure_rabbitmq_connection();
-		if (reconnected)
+		auto [added, add_error] = ring->add_node(node);
+		if (!added)
 		{
-			return work_queue_emitter_->publish(
-				configurations_->rabbit_channel_id(),
-				configurations_->publish_queue_name(),
-				message_body,
-				configurations_->content_type(),
-				std::nullopt);
+			return { false, add_error };
 		}
-		return { false, reconnect_error };
+
+		pools.push_back(std::make_unique<RedisConnectionPool>(
+			options.value(),
+			static_cast<size_t>(std::max(1, configurations_->redis_pool_size())),
+			configurations_->redis_health_check_interval_ms()));
 	}
 
-	return { success, error_message };
+	shard_ring_ = std::move(ring);
+	redis_pools_ = std::move(pools);
+
+	return { true, std::nullopt };
 }
 
-auto CacheDBService::set_key_value(const std::string& key, const std::string& value, long ttl_seconds) -> std::tuple<bool, std::optional<std::string>>
+auto CacheDBService::node_for(const std::string& key) const -> size_t
 {
-	auto [connected, connect_error] = ensure_redis_connection();
-	if (!connected)
-	{
-		return { false, connect_error };
-	}
+	return redis_pools_.size() == 1 ? 0 : shard_ring_->node_for(key);
+}
 
-	auto [success, error_message] = redis_client_->set(key, value, ttl_seconds);
+auto CacheDBService::near_cache_usable(size_t node) const -> bool
+{
+	// Without the node's subscription, writes from other instances would go unnoticed
+	return near_cache_ != nullptr && (keyspace_invalidators_.empty() || keyspace_invalidators_[node]->is_subscribed());
+}
 
-	// If operation failed due to connection issue, try one more time after reconnection
-	if (!success && error_message.has_value() &&
-		(error_message.value().find("connection") != std::string::npos ||
-		 error_message.value().find("timeout") != std::string::npos))
+auto CacheDBService::remember(const std::string& key, const std::string& value, long long ttl_ms, uint64_t version) -> void
+{
+	if (near_cache_ == nullptr || ttl_ms == -2)
 	{
-		Logger::handle().write(LogTypes::Error,
-			fmt::format("Redis SET operation failed, attempting reconnection: {}", error_message.value()));
-
-		auto [reconnected, reconnect_error] = ensure_redis_connection();
-		if (reconnected)
-		{
-			return redis_client_->set(key, value, ttl_seconds);
-		}
-		return { false, reconnect_error };
+		return;
 	}
 
-	return { success, error_message };
+	auto ttl = std::chrono::milliseconds(configurations_->near_cache_max_ttl_ms());
+	if (ttl_ms >= 0)
+	{
+		ttl = std::min(ttl, std::chrono::milliseconds(ttl_ms));
+	}
+	near_cache_->put(key, value, ttl, version);
 }
 
-auto CacheDBService::get_key_value(const std::string& key) -> std::tuple<std::optional<std::string>, std::optional<std::string>>
+auto CacheDBService::pack_envelopes(std::vector<PendingOperation>& messages) const -> std::vector<Envelope>
 {
-	auto [connected, connect_error] = ensure_redis_connection();
-	if (!connected)
+	if (CommonMessageMQ::OperationCodec::is_binary(configurations_->content_type()))
 	{
-		return { std::nullopt, connect_error };
+		return pack_binary_envelopes(messages);
 	}
 
-	auto [value, error_message] = redis_client_->get(key);
+	const auto max_messages = static_cast<size_t>(std::max(1, configurations_->publish_batch_max_messages()));
+	const auto max_bytes = static_cast<size_t>(std::max(0, configurations_->publish_batch_max_bytes()));
 
-	// If operation failed due to connection issue, try one more time after reconnection
-	if (error_message.has_value() &&
-		(error_message.value().find("connection") != std::string::npos ||
-		 error_message.value().find("timeout") != std::string::npos))
+	std::vector<Envelope> envelopes;
+	Envelope current;
+
+	auto close_current = [&]()
 	{
-		Logger::handle().write(LogTypes::Error,
-			fmt::format("Redis GET operation failed, attempting reconnection: {}", error_message.value()));
+		if (current.message_count == 0)
+		{
+			return;
+		}
+		current.body += packed_suffix;
+		envelopes.push_back(std::move(current));
+		current = Envelope();
+	};
+
+	for (auto& message : messages)
+	{
+		// Batches can't be nested in another batch; they travel as their own envelope
+		if (message.batch)
+		{
+			close_current();
+			envelopes.push_back(Envelope{ std::move(message.message_body), 1 });
+			continue;
+		}
 
-		auto [reconnected, reconnect_error] = ensure_redis_connection();
-		if (reconnected)
+		if (current.message_count > 0 &&
+			(current.message_count >= max_messages || current.body.size() + message.message_body.size() + 1 + packed_suffix.size() > max_bytes))
 		{
-			return redis_client_->get(key);
+			close_current();
 		}
-		return { std::nullopt, reconnect_error };
+
+		current.body += current.message_count == 0 ? "{\"batch\":[" : ",";
+		current.body += message.message_body;
+		++current.message_count;
 	}
+	close_current();
 
-	return { value, error_message };
+	return envelopes;
 }
 
-auto CacheDBService::enqueue_database_operation(const std::string& json_body) -> std::tuple<bool, std::optional<std::string>>
+auto CacheDBService::pack_binary_envelopes(std::vector<PendingOperation>& messages) const -> std::vector<Envelope>
 {
-	// Basic JSON validation
-	try
+	const auto max_messages = static_cast<size_t>(std::max(1, configurations_->publish_batch_max_messages()));
+	const auto max_bytes = static_cast<size_t>(std::max(0, configurations_->publish_batch_max_bytes()));
+
+	CommonMessageMQ::OperationCodec codec;
+	std::vector<Envelope> envelopes;
+	Envelope current;
+	// Envelopes are cut where the JSON ones would be, so both formats split a flush the same way
+	size_t json_bytes = 0;
+
+	auto close_current = [&]()
 	{
-			auto json_value = boost::json::parse(json_body);
-			if (!json_value.is_object())
+		if (current.message_count == 0)
 		{
-			return { false, std::optional<std::string>("message is not a JSON object") };
+			return;
 		}
-	}
-	catch (const std::exception& e)
+		envelopes.push_back(std::move(current));
+		current = Envelope();
+		json_bytes = 0;
+	};
+
+	for (auto& message : messages)
 	{
-		return { false, std::optional<std::string>(std::string("invalid JSON: ") + e.what()) };
+		if (message.batch)
+		{
+			close_current();
+			Envelope envelope{ std::string(), 1 };
+			codec.begin(envelope.body, false);
+			codec.append(envelope.body, message.operation);
+			envelopes.push_back(std::move(envelope));
+			continue;
+		}
+
+		if (current.message_count > 0 &&
+			(current.message_count >= max_messages || json_bytes + message.message_body.size() + 1 + packed_suffix.size() > max_bytes))
+		{
+			close_current();
+		}
+
+		if (current.message_count == 0)
+		{
+			codec.begin(current.body, true, true);
+			json_bytes = std::string_view("{\"batch\":[").size();
+		}
+		codec.append(current.body, message.operation);
+		json_bytes += message.message_body.size() + 1;
+		++current.message_count;
+	}
+	close_current();
+
+	return envelopes;
+}
+
+auto CacheDBService::publish_envelopes() -> std::tuple<bool, std::optional<std::string>>
+{
+	if (unconfirmed_envelopes_.empty())
+	{
+		return { true, std::nullopt };
+	}
+
+	auto [connected, connect_error] = ensure_rabbitmq_connection();
+	if (!connected)
+	{
+		return { false, connect_error };
+	}
+
+	std::vector<std::string> bodies;
+	bodies.reserve(unconfirmed_envelopes_.size());
+	for (const auto& envelope : unconfirmed_envelopes_)
+	{
+		bodies.push_back(envelope.body);
+	}
+
+	auto [confirmed, publish_error] = publisher_->publish_batch(
+		configurations_->publish_queue_name(),
+		bodies,
+		configurations_->content_type(),
+		configurations_->publish_confirm_timeout_ms());
+
+	std::vector<Envelope> unconfirmed;
+	size_t published_messages = 0;
+	for (size_t index = 0; index < unconfirmed_envelopes_.size(); ++index)
+	{
+		if (confirmed[index])
+		{
+			published_messages += unconfirmed_envelopes_[index].message_count;
+			continue;
+		}
+		unconfirmed.push_back(std::move(unconfirmed_envelopes_[index]));
 	}
+	unconfirmed_envelopes_.swap(unconfirmed);
 
+	Logger::handle().write(LogTypes::Debug, fmt::format("published {} messages in {} envelopes, {} envelopes pending retry",
+		published_messages, bodies.size() - unconfirmed_envelopes_.size(), unconfirmed_envelopes_.size()));
+
+	if (publish_error.has_value())
+	{
+		return { false, publish_error };
+	}
+	if (!unconfirmed_envelopes_.empty())
 	{
-		std::lock_guard<std::mutex> lock(pending_mutex_);
-		pending_messages_.push_back(PendingMessage{ json_body });
+		return { false, fmt::format("{} envelopes were not confirmed by the broker", unconfirmed_envelopes_.size()) };
 	}
+
 	return { true, std::nullopt };
 }
 
-void CacheDBService::schedule_publish_job()
+auto CacheDBService::set_key_value(const std::string& key, const std::string& value, long ttl_seconds) -> std::tuple<bool, std::optional<std::string>>
 {
-	if (thread_pool_ == nullptr || is_stop_requested())
+	if (redis_pools_.empty())
 	{
-		return;
+		return { false, std::optional<std::string>("Redis pool is null") };
 	}
-	auto [queued, queue_error] = thread_pool_->push(std::make_shared<Job>(
-		JobPriorities::LongTerm,
-		std::bind(&CacheDBService::publish_to_main_db_service, this),
-		"publish_to_main_db_service"));
-	if (!queued)
+
+	auto stored = value_codec_->encode(value);
+	auto error = redis_pools_[node_for(key)]->execute([&](sw::redis::Redis& redis)
 	{
-		Logger::handle().write(LogTypes::Error, queue_error.value_or("failed to schedule publish job"));
+		redis.set(key, stored, std::chrono::seconds(std::max(0L, ttl_seconds)));
+	});
+	// Also on failure: the write may have reached Redis before the connection broke
+	if (near_cache_ != nullptr)
+	{
+		near_cache_->invalidate(key);
 	}
+	mark_written(key);
+	if (error.has_value())
+	{
+		return { false, error };
+	}
+
+	return { true, std::nullopt };
 }
 
-auto CacheDBService::publish_to_main_db_service() -> std::tuple<bool, std::optional<std::string>>
+auto CacheDBService::get_key_value(const std::string& key) -> std::tuple<std::optional<std::string>, std::optional<std::string>>
 {
-	if (thread_pool_ == nullptr)
+	if (redis_pools_.empty())
 	{
-		return { false, std::optional<std::string>("thread_pool is null") };
+		return { std::nullopt, std::optional<std::string>("Redis pool is null") };
 	}
 
-	if (is_stop_requested())
+	auto node = node_for(key);
+	if (!near_cache_usable(node))
 	{
-		return { true, std::nullopt };
+		std::optional<std::string> value;
+		auto error = redis_pools_[node]->execute([&](sw::redis::Redis& redis)
+		{
+			value = redis.get(key);
+		});
+		if (error.has_value())
+		{
+			return { std::nullopt, error };
+		}
+		if (!value.has_value())
+		{
+			return { std::nullopt, std::nullopt };
+		}
+
+		return value_codec_->decode(value.value());
+	}
+
+	if (auto cached = near_cache_->get(key); cached.has_value())
+	{
+		return { cached, std::nullopt };
 	}
 
-	const auto wait_interval = std::chrono::milliseconds(configurations_->publish_to_main_db_service_interval_ms());
-	const auto wake_slice = std::chrono::milliseconds(100);
-	auto deadline = std::chrono::steady_clock::now() + wait_interval;
-	while (!is_stop_requested() && std::chrono::steady_clock::now() < deadline)
+	// Fetch the remaining TTL in the same round trip so the local copy never outlives the Redis one
+	auto version = near_cache_->version(key);
+	std::optional<std::string> value;
+	long long ttl_ms = -2;
+	auto error = redis_pools_[node]->execute([&](sw::redis::Redis& redis)
 	{
-		auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
-		auto sleep_span = remaining > wake_slice ? wake_slice : remaining;
-		if (sleep_span.count() > 0)
+		auto pipeline = redis.pipeline(false);
+		pipeline.get(key).pttl(key);
+		auto replies = pipeline.exec();
+		value = replies.get<sw::redis::OptionalString>(0);
+		ttl_ms = replies.get<long long>(1);
+	});
+	if (error.has_value())
+	{
+		return { std::nullopt, error };
+	}
+	if (!value.has_value())
+	{
+		return { std::nullopt, std::nullopt };
+	}
+
+	auto [decoded, decode_error] = value_codec_->decode(value.value());
+	if (decode_error.has_value())
+	{
+		return { std::nullopt, decode_error };
+	}
+	value = std::move(decoded);
+
+	remember(key, value.value(), ttl_ms, version);
+
+	return { value, std::nullopt };
+}
+
+auto CacheDBService::mget_key_values(const std::vector<std::string>& keys) -> std::tuple<std::vector<std::optional<std::string>>, std::optional<std::string>>
+{
+	std::vector<std::optional<std::string>> values;
+	if (keys.empty())
+	{
+		return { values, std::nullopt };
+	}
+	if (redis_pools_.empty())
+	{
+		return { std::vector<std::optional<std::string>>(keys.size()), std::optional<std::string>("Redis pool is null") };
+	}
+
+	// Serve what the near cache holds and fetch only the rest, one MGET per node; misses aren't filled without their TTLs
+	std::vector<std::vector<std::string>> missing_keys(redis_pools_.size());
+	std::vector<std::vector<size_t>> missing_indexes(redis_pools_.size());
+	values.resize(keys.size());
+	for (size_t index = 0; index < keys.size(); ++index)
+	{
+		auto node = node_for(keys[index]);
+		if (near_cache_usable(node))
 		{
-			std::this_thread::sleep_for(sleep_span);
+			values[index] = near_cache_->get(keys[index]);
+			if (values[index].has_value())
+			{
+				continue;
+			}
 		}
+		missing_keys[node].push_back(keys[index]);
+		missing_indexes[node].push_back(index);
 	}
 
-	if (is_stop_requested())
+	for (size_t node = 0; node < redis_pools_.size(); ++node)
 	{
-		return { true, std::nullopt };
+		if (missing_keys[node].empty())
+		{
+			continue;
+		}
+
+		std::vector<std::optional<std::string>> fetched;
+		fetched.reserve(missing_keys[node].size());
+		auto error = redis_pools_[node]->execute([&](sw::redis::Redis& redis)
+		{
+			redis.mget(missing_keys[node].begin(), missing_keys[node].end(), std::back_inserter(fetched));
+		});
+		if (error.has_value())
+		{
+			return { std::vector<std::optional<std::string>>(keys.size()), error };
+		}
+
+		for (size_t index = 0; index < missing_indexes[node].size() && index < fetched.size(); ++index)
+		{
+			if (!fetched[index].has_value())
+			{
+				continue;
+			}
+
+			// One unreadable value shouldn't fail the others
+			auto [decoded, decode_error] = value_codec_->decode(fetched[index].value());
+			if (decode_error.has_value())
+			{
+				Logger::handle().write(LogTypes::Error, fmt::format("cannot decode cached value of {}: {}", missing_keys[node][index], decode_error.value()));
+				continue;
+			}
+			values[missing_indexes[node][index]] = std::move(decoded);
+		}
+	}
+
+	return { values, std::nullopt };
+}
+
+auto CacheDBService::mset_key_values(const std::vector<CacheEntry>& entries) -> std::tuple<std::vector<std::optional<std::string>>, std::optional<std::string>>
+{
+	// Pipelined SETs rather than MSET, which can't carry a TTL per key
+	RedisCommandBatch batch;
+	for (const auto& entry : entries)
+	{
+		batch.set(entry.key, entry.value, entry.ttl_seconds);
+	}
+
+	auto [replies, batch_error] = execute_batch(batch);
+	if (batch_error.has_value())
+	{
+		return { std::vector<std::optional<std::string>>(entries.size(), batch_error), batch_error };
+	}
+
+	std::vector<std::optional<std::string>> errors;
+	errors.reserve(replies.size());
+	for (auto& reply : replies)
+	{
+		errors.push_back(std::move(reply.error));
+	}
+
+	return { errors, std::nullopt };
+}
+
+auto CacheDBService::execute_batch(const RedisCommandBatch& batch, bool transaction) -> std::tuple<std::vector<RedisReply>, std::optional<std::string>>
+{
+	if (batch.empty())
+	{
+		return { std::vector<RedisReply>(), std::nullopt };
+	}
+	if (redis_pools_.empty())
+	{
+		return { std::vector<RedisReply>(), std::optional<std::string>("Redis pool is null") };
 	}
 
-	std::vector<PendingMessage> messages_to_flush;
+	// Values of set() are stored the way set_key_value() stores them, so both sides can read them back
+	const auto& codings = batch.codings();
+	RedisCommandBatch encoded;
+	const auto* sent = &batch;
+	if (std::find(codings.begin(), codings.end(), RedisCommandBatch::ValueCoding::EncodeValue) != codings.end())
 	{
-		std::lock_guard<std::mutex> lock(pending_mutex_);
-		messages_to_flush.swap(pending_messages_);
+		for (size_t index = 0; index < batch.size(); ++index)
+		{
+			auto arguments = batch.commands()[index];
+			if (codings[index] == RedisCommandBatch::ValueCoding::EncodeValue && arguments.size() > 2)
+			{
+				arguments[2] = value_codec_->encode(arguments[2]);
+			}
+			encoded.command(std::move(arguments));
+		}
+		sent = &encoded;
 	}
 
-	for (const auto& pending_message : messages_to_flush)
+	// Keyless commands go to the first node. A command whose keys live on several nodes has none: like
+	// CROSSSLOT in Redis Cluster it is answered with an error instead of running against the wrong node.
+	std::vector<std::optional<size_t>> nodes;
+	nodes.reserve(sent->size());
+	for (const auto& arguments : sent->commands())
 	{
-		if (is_stop_requested())
+		auto positions = key_positions(arguments);
+		std::optional<size_t> node = positions.empty() ? 0 : node_for(arguments[positions.front()]);
+		for (size_t index = 1; index < positions.size() && node.has_value() && redis_pools_.size() > 1; ++index)
 		{
-			return { true, std::nullopt };
+			if (node_for(arguments[positions[index]]) != node.value())
+			{
+				node = std::nullopt;
+			}
+		}
+		nodes.push_back(node);
+	}
+
+	std::vector<RedisReply> replies;
+	std::optional<std::string> error;
+	if (std::all_of(nodes.begin(), nodes.end(), [&](const std::optional<size_t>& node) { return node.has_value() && node == nodes.front(); }))
+	{
+		std::tie(replies, error) = execute_node_batch(nodes.front().value(), *sent, transaction);
+	}
+	else if (transaction)
+	{
+		return { std::vector<RedisReply>(), std::optional<std::string>("transaction spans several Redis nodes; give its keys a common {hash tag}") };
+	}
+	else
+	{
+		// One pipeline per node, replies put back in the caller's order
+		replies.resize(sent->size());
+		std::vector<RedisCommandBatch> node_batches(redis_pools_.size());
+		std::vector<std::vector<size_t>> node_indexes(redis_pools_.size());
+		for (size_t index = 0; index < nodes.size(); ++index)
+		{
+			if (!nodes[index].has_value())
+			{
+				replies[index].error = fmt::format("keys of {} span several Redis nodes; give them a common {{hash tag}}", sent->commands()[index].front());
+				continue;
+			}
+			node_batches[nodes[index].value()].command(sent->commands()[index]);
+			node_indexes[nodes[index].value()].push_back(index);
+		}
+
+		for (size_t node = 0; node < redis_pools_.size() && !error.has_value(); ++node)
+		{
+			if (node_batches[node].empty())
+			{
+				continue;
+			}
+
+			auto [node_replies, node_error] = execute_node_batch(node, node_batches[node], false);
+			error = node_error;
+			for (size_t index = 0; index < node_replies.size() && index < node_indexes[node].size(); ++index)
+			{
+				replies[node_indexes[node][index]] = std::move(node_replies[index]);
+			}
+		}
+	}
+
+	if (near_cache_ != nullptr)
+	{
+		// Arguments aren't parsed per command; dropping a non-key argument only costs a version bump
+		for (const auto& arguments : batch.commands())
+		{
+			if (arguments.empty() || is_read_only_command(arguments.front()))
+			{
+				continue;
+			}
+			for (size_t index = 1; index < arguments.size(); ++index)
+			{
+				near_cache_->invalidate(arguments[index]);
+			}
+		}
+	}
+	// Every set() reaches the write-behind tables like set_key_value(), also on failure for the same reason
+	for (size_t index = 0; index < codings.size(); ++index)
+	{
+		if (codings[index] == RedisCommandBatch::ValueCoding::EncodeValue && batch.commands()[index].size() > 1)
+		{
+			mark_written(batch.commands()[index][1]);
+		}
+	}
+	if (error.has_value())
+	{
+		return { std::vector<RedisReply>(), error };
+	}
+
+	for (size_t index = 0; index < replies.size() && index < codings.size(); ++index)
+	{
+		auto& reply = replies[index];
+		if (codings[index] != RedisCommandBatch::ValueCoding::DecodeReply || !reply.value.has_value())
+		{
+			continue;
+		}
+
+		// One unreadable value shouldn't fail the others
+		auto [decoded, decode_error] = value_codec_->decode(reply.value.value());
+		reply.value = std::move(decoded);
+		if (decode_error.has_value())
+		{
+			reply.error = decode_error;
+		}
+	}
+
+	return { replies, std::nullopt };
+}
+
+auto CacheDBService::execute_node_batch(size_t node, const RedisCommandBatch& batch, bool transaction) -> std::tuple<std::vector<RedisReply>, std::optional<std::string>>
+{
+	std::vector<RedisReply> replies;
+	auto error = redis_pools_[node]->execute([&](sw::redis::Redis& redis)
+	{
+		replies = transaction ? exec_queued(redis.transaction(true, false), batch) : exec_queued(redis.pipeline(false), batch);
+	});
+	if (error.has_value())
+	{
+		return { std::vector<RedisReply>(), error };
+	}
+
+	return { replies, std::nullopt };
+}
+
+auto CacheDBService::get_or_load(const std::string& key, const CacheLoader& loader, long ttl_seconds) -> std::tuple<std::optional<std::string>, std::optional<std::string>>
+{
+	if (redis_pools_.empty())
+	{
+		return { std::nullopt, std::optional<std::string>("Redis pool is null") };
+	}
+
+	if (near_cache_usable(node_for(key)))
+	{
+		if (auto cached = near_cache_->get(key); cached.has_value())
+		{
+			return { cached, std::nullopt };
+		}
+	}
+
+	return load_flight_.run(key, [&]() { return read_through(key, loader, ttl_seconds); });
+}
+
+auto CacheDBService::read_through(const std::string& key, const CacheLoader& loader, long ttl_seconds) -> std::tuple<std::optional<std::string>, std::optional<std::string>>
+{
+	auto node = node_for(key);
+	auto version = near_cache_ != nullptr ? near_cache_->version(key) : 0;
+
+	std::optional<std::string> stored;
+	long long ttl_ms = -2;
+	auto error = redis_pools_[node]->execute([&](sw::redis::Redis& redis)
+	{
+		auto pipeline = redis.pipeline(false);
+		pipeline.get(key).pttl(key);
+		auto replies = pipeline.exec();
+		stored = replies.get<sw::redis::OptionalString>(0);
+		ttl_ms = replies.get<long long>(1);
+	});
+	if (error.has_value())
+	{
+		// Still one load per key in this process; nothing is stored while Redis is unreachable
+		Logger::handle().write(LogTypes::Error, fmt::format("read-through of {} bypasses Redis: {}", key, error.value()));
+		try
+		{
+			return loader();
+		}
+		catch (const std::exception& e)
+		{
+			return { std::nullopt, fmt::format("loader failed: {}", e.what()) };
+		}
+	}
+
+	if (stored.has_value())
+	{
+		auto [value, decode_error] = value_codec_->decode(stored.value());
+		if (decode_error.has_value())
+		{
+			return { std::nullopt, decode_error };
 		}
 
-		auto [publish_success, publish_error] = publish_message(pending_message.message_body);
-		if (!publish_success)
+		if (!should_refresh_early(stored.value(), ttl_ms))
 		{
-			Logger::handle().write(LogTypes::Error, fmt::format("Failed to publish message: {}", publish_error.value_or("unknown error")));
-			std::lock_guard<std::mutex> lock(pending_mutex_);
-			pending_messages_.push_back(pending_message);
+			if (near_cache_usable(node))
+			{
+				remember(key, value.value(), ttl_ms, version);
+			}
+			return { value, std::nullopt };
+		}
+
+		// Whoever wins the lock refreshes; everyone else keeps serving the current value
+		auto token = try_load_lock(key);
+		if (!token.has_value())
+		{
+			return { value, std::nullopt };
+		}
+
+		auto result = load_and_store(key, loader, ttl_seconds);
+		release_load_lock(key, token.value());
+		if (std::get<1>(result).has_value())
+		{
+			Logger::handle().write(LogTypes::Error, fmt::format("early refresh of {} failed: {}", key, std::get<1>(result).value()));
+			return { value, std::nullopt };
 		}
+		return result;
+	}
+
+	if (auto token = try_load_lock(key); token.has_value())
+	{
+		auto result = load_and_store(key, loader, ttl_seconds);
+		release_load_lock(key, token.value());
+		return result;
+	}
+
+	// Another instance is loading: wait for its value rather than loading the same thing
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(configurations_->read_through_lock_wait_ms());
+	auto delay = std::chrono::milliseconds(5);
+	while (std::chrono::steady_clock::now() < deadline)
+	{
+		std::this_thread::sleep_for(delay);
+		delay = std::min(delay * 2, std::chrono::milliseconds(100));
+
+		std::optional<std::string> loaded;
+		if (redis_pools_[node]->execute([&](sw::redis::Redis& redis) { loaded = redis.get(key); }).has_value())
+		{
+			break;
+		}
+		if (loaded.has_value())
+		{
+			return value_codec_->decode(loaded.value());
+		}
+	}
+
+	Logger::handle().write(LogTypes::Debug, fmt::format("gave up waiting for another instance to load {}", key));
+	return load_and_store(key, loader, ttl_seconds);
+}
+
+auto CacheDBService::load_and_store(const std::string& key, const CacheLoader& loader, long ttl_seconds) -> std::tuple<std::optional<std::string>, std::optional<std::string>>
+{
+	auto started = std::chrono::steady_clock::now();
+	std::tuple<std::optional<std::string>, std::optional<std::string>> result;
+	try
+	{
+		result = loader();
+	}
+	catch (const std::exception& e)
+	{
+		return { std::nullopt, fmt::format("loader failed: {}", e.what()) };
 	}
 
-	auto job_pool = thread_pool_->job_pool();
-	if (job_pool == nullptr || job_pool->lock())
+	auto& [value, load_error] = result;
+	if (load_error.has_value() || !value.has_value())
 	{
-		return { false, std::optional<std::string>("job_pool is null or locked") };
+		return result;
 	}
 
-	if (!is_stop_requested())
+	// The load time drives how early the next refresh may start
+	auto recompute_time = std::max(std::chrono::milliseconds(1),
+		std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started));
+	auto stored = value_codec_->encode(value.value(), recompute_time);
+	auto error = redis_pools_[node_for(key)]->execute([&](sw::redis::Redis& redis)
 	{
-		auto [queued, queue_error] = job_pool->push(
-			std::make_shared<Job>(JobPriorities::LongTerm, std::bind(&CacheDBService::publish_to_main_db_service, this), "publish_to_main_db_service"));
-		if (!queued)
+		redis.set(key, stored, std::chrono::seconds(std::max(0L, ttl_seconds)));
+	});
+	if (near_cache_ != nullptr)
+	{
+		near_cache_->invalidate(key);
+	}
+	if (error.has_value())
+	{
+		Logger::handle().write(LogTypes::Error, fmt::format("failed to cache loaded value of {}: {}", key, error.value()));
+	}
+
+	return result;
+}
+
+auto CacheDBService::should_refresh_early(const std::string& stored, long long ttl_ms) const -> bool
+{
+	auto beta = configurations_->read_through_early_refresh_beta_percent() / 100.0;
+	auto recompute_time = value_codec_->recompute_time(stored);
+	if (beta <= 0 || recompute_time.count() <= 0 || ttl_ms < 0)
+	{
+		return false;
+	}
+
+	// XFetch: refresh when recompute_time * beta * -ln(U) reaches the remaining TTL, U uniform in (0, 1]
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+	auto draw = 1.0 - uniform(random_engine());
+	return -static_cast<double>(recompute_time.count()) * beta * std::log(draw) >= static_cast<double>(ttl_ms);
+}
+
+auto CacheDBService::try_load_lock(const std::string& key) -> std::optional<std::string>
+{
+	auto lock_key = key + ":load-lock";
+	auto token = fmt::format("{:016x}{:016x}", random_engine()(), random_engine()());
+
+	bool acquired = false;
+	auto error = redis_pools_[node_for(lock_key)]->execute([&](sw::redis::Redis& redis)
+	{
+		acquired = redis.set(lock_key, token, std::chrono::milliseconds(std::max(1, configurations_->read_through_lock_ttl_ms())), sw::redis::UpdateType::NOT_EXIST);
+	});
+	if (error.has_value())
+	{
+		// Without the lock service, loading beats waiting on a lock nobody can take
+		Logger::handle().write(LogTypes::Error, fmt::format("load lock for {} unavailable: {}", key, error.value()));
+		return token;
+	}
+
+	return acquired ? std::optional<std::string>(token) : std::nullopt;
+}
+
+auto CacheDBService::release_load_lock(const std::string& key, const std::string& token) -> void
+{
+	auto lock_key = key + ":load-lock";
+	auto error = redis_pools_[node_for(lock_key)]->execute([&](sw::redis::Redis& redis)
+	{
+		redis.eval<long long>(release_lock_script, { lock_key }, { token });
+	});
+	if (error.has_value())
+	{
+		// The lock expires on its own
+		Logger::handle().write(LogTypes::Debug, fmt::format("failed to release load lock for {}: {}", key, error.value()));
+	}
+}
+
+auto CacheDBService::value_codec() const -> const ValueCodec&
+{
+	return *value_codec_;
+}
+
+auto CacheDBService::near_cache_stats() const -> std::optional<NearCacheStats>
+{
+	if (near_cache_ == nullptr)
+	{
+		return std::nullopt;
+	}
+	return near_cache_->stats();
+}
+
+auto CacheDBService::enqueue_database_operation(const std::string& json_body) -> std::tuple<bool, std::optional<std::string>>
+{
+	// Validated without building a DOM; the flush loop parses it once it takes it off the queue
+	auto [valid, invalid_reason] = JsonValidator::validate_object(json_body);
+	if (!valid)
+	{
+		return { false, invalid_reason };
+	}
+
+	return admit_operation(json_body);
+}
+
+auto CacheDBService::admit_operation(const std::string& json_body, uint64_t* stream_sequence) -> std::tuple<bool, std::optional<std::string>>
+{
+	if (spool_ != nullptr)
+	{
+		uint64_t sequence = 0;
+		auto [appended, append_error] = spool_->append(json_body, sequence);
+		if (!appended)
 		{
-			return { false, queue_error };
+			return { false, append_error };
+		}
+		if (stream_sequence != nullptr)
+		{
+			*stream_sequence = sequence;
+		}
+	}
+	else
+	{
+		// Only the stream consumer numbers its operations, so their queue order matches their numbers
+		uint64_t sequence = stream_sequence != nullptr ? ++stream_sequence_ : 0;
+		auto [pushed, push_error] = push_pending(QueuedOperation{ json_body, sequence });
+		if (!pushed)
+		{
+			return { false, push_error };
+		}
+		if (stream_sequence != nullptr)
+		{
+			*stream_sequence = sequence;
 		}
 	}
 
+	if (flush_watermark_reached() && !flush_requested_.exchange(true))
+	{
+		wake_flush_loop();
+	}
+	else if (idle_backoff_.exchange(false))
+	{
+		idle_wakeup_ = true;
+		wake_flush_loop();
+	}
 	return { true, std::nullopt };
 }
 
+auto CacheDBService::push_pending(QueuedOperation&& operation) -> std::tuple<bool, std::optional<std::string>>
+{
+	if (pending_queue_ == nullptr || flush_stop_requested_)
+	{
+		return { false, std::optional<std::string>("service is not running") };
+	}
+
+	// Count the bytes before the push so the flush loop never subtracts more than was added
+	auto bytes = operation.message_body.size();
+	pending_bytes_ += bytes;
+	if (pending_queue_->try_push(std::move(operation)))
+	{
+		return { true, std::nullopt };
+	}
+
+	switch (queue_full_policy_)
+	{
+	case QueueFullPolicy::DropOldest:
+		for (int attempt = 0; attempt < 8; ++attempt)
+		{
+			QueuedOperation dropped;
+			if (pending_queue_->try_pop(dropped))
+			{
+				pending_bytes_ -= dropped.message_body.size();
+				++dropped_operations_;
+			}
+			if (pending_queue_->try_push(std::move(operation)))
+			{
+				return { true, std::nullopt };
+			}
+		}
+		break;
+	case QueueFullPolicy::Block:
+	{
+		if (!flush_requested_.exchange(true))
+		{
+			wake_flush_loop();
+		}
+
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(configurations_->pending_queue_block_timeout_ms());
+		for (int spin = 0; !flush_stop_requested_ && std::chrono::steady_clock::now() < deadline; ++spin)
+		{
+			if (spin < 64)
+			{
+				std::this_thread::yield();
+			}
+			else
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+			if (pending_queue_->try_push(std::move(operation)))
+			{
+				return { true, std::nullopt };
+			}
+		}
+		break;
+	}
+	case QueueFullPolicy::Reject:
+		break;
+	}
+
+	pending_bytes_ -= bytes;
+	return { false, std::optional<std::string>(fmt::format("pending queue is full ({} operations)", pending_queue_->capacity())) };
+}
+
+auto CacheDBService::collect_pending() -> void
+{
+	// Everything parsed into the arena last cycle was drained from the coalescer with it
+	parse_resource_.release();
+
+	if (spool_ != nullptr)
+	{
+		// Only read past what the broker has confirmed; during an outage records wait on disk, not in memory
+		if (!unconfirmed_envelopes_.empty())
+		{
+			return;
+		}
+
+		std::vector<std::string> records;
+		if (auto error = spool_->read(static_cast<size_t>(std::max(1, configurations_->pending_queue_capacity())), records); error.has_value())
+		{
+			Logger::handle().write(LogTypes::Error, error.value());
+		}
+		for (auto& record : records)
+		{
+			auto operation = parse_operation(record);
+			if (!operation.has_value())
+			{
+				Logger::handle().write(LogTypes::Error, "skipping unreadable spooled operation");
+				continue;
+			}
+			pending_operations_->add(std::move(record), std::move(operation.value()));
+		}
+		return;
+	}
+
+	QueuedOperation queued;
+	while (pending_queue_->try_pop(queued))
+	{
+		pending_bytes_ -= queued.message_body.size();
+		collected_stream_sequence_ = std::max(collected_stream_sequence_, queued.stream_sequence);
+		auto operation = parse_operation(queued.message_body);
+		if (!operation.has_value())
+		{
+			continue;
+		}
+		pending_operations_->add(std::move(queued.message_body), std::move(operation.value()));
+	}
+
+	if (auto dropped = dropped_operations_.exchange(0); dropped > 0)
+	{
+		Logger::handle().write(LogTypes::Error, fmt::format("pending queue full: dropped {} oldest operations", dropped));
+	}
+}
+
+auto CacheDBService::parse_operation(const std::string& json_body) -> std::optional<boost::json::object>
+{
+	parser_.reset(boost::json::storage_ptr(&parse_resource_));
+
+	boost::json::error_code ec;
+	parser_.write(json_body.data(), json_body.size(), ec);
+	if (ec)
+	{
+		return std::nullopt;
+	}
+
+	auto json_value = parser_.release();
+	if (!json_value.is_object())
+	{
+		return std::nullopt;
+	}
+	return std::move(json_value.as_object());
+}
+
+auto CacheDBService::collect_write_behind() -> void
+{
+	if (write_behind_ == nullptr || redis_pools_.empty())
+	{
+		return;
+	}
+
+	// Read back in slices so one busy interval doesn't turn into one huge MGET
+	constexpr size_t keys_per_read = 1000;
+	auto keys = write_behind_->take();
+	for (size_t offset = 0; offset < keys.size(); offset += keys_per_read)
+	{
+		std::vector<std::string> slice(keys.begin() + offset, keys.begin() + std::min(keys.size(), offset + keys_per_read));
+		auto [values, read_error] = mget_key_values(slice);
+		if (read_error.has_value())
+		{
+			Logger::handle().write(LogTypes::Error, fmt::format("write-behind read failed, retrying next flush: {}", read_error.value()));
+			write_behind_->restore(std::vector<std::string>(keys.begin() + offset, keys.end()));
+			return;
+		}
+
+		for (size_t index = 0; index < slice.size(); ++index)
+		{
+			// Gone by now (expired or deleted); there is nothing left to write
+			if (!values[index].has_value())
+			{
+				continue;
+			}
+
+			auto [operation, convert_error] = write_behind_->to_operation(slice[index], values[index].value());
+			if (!operation.has_value())
+			{
+				Logger::handle().write(LogTypes::Error, fmt::format("skipping write-behind of {}: {}", slice[index], convert_error.value_or("unknown error")));
+				continue;
+			}
+
+			auto body = boost::json::serialize(operation.value());
+			if (spool_ == nullptr)
+			{
+				pending_operations_->add(std::move(body), std::move(operation.value()));
+				continue;
+			}
+
+			// Through the spool like any other operation, so it survives a restart from here on
+			if (auto [appended, append_error] = spool_->append(body); !appended)
+			{
+				Logger::handle().write(LogTypes::Error, fmt::format("write-behind of {} deferred: {}", slice[index], append_error.value_or("unknown error")));
+				write_behind_->restore({ slice[index] });
+			}
+		}
+	}
+}
+
+auto CacheDBService::mark_written(const std::string& key) -> void
+{
+	if (write_behind_ == nullptr || !write_behind_->tracked(key))
+	{
+		return;
+	}
+
+	// Only the first change since the last flush can find the loop backed off
+	if (write_behind_->mark(key) && idle_backoff_.exchange(false))
+	{
+		idle_wakeup_ = true;
+		wake_flush_loop();
+	}
+}
+
+auto CacheDBService::pending_count() const -> size_t
+{
+	auto dirty = write_behind_ != nullptr ? write_behind_->dirty_count() : 0;
+	if (spool_ != nullptr)
+	{
+		return spool_->pending_records() + dirty;
+	}
+	if (pending_queue_ != nullptr)
+	{
+		return pending_queue_->size_approx() + dirty;
+	}
+	return dirty;
+}
+
+auto CacheDBService::wake_flush_loop() -> void
+{
+	// The flag was set before taking the mutex, so the loop either sees it in its predicate or is already waiting
+	{
+		std::lock_guard<std::mutex> lock(flush_mutex_);
+	}
+	flush_condition_.notify_all();
+}
+
+void CacheDBService::schedule_publish_job()
+{
+	if (thread_pool_ == nullptr || is_stop_requested())
+	{
+		return;
+	}
+	auto [queued, queue_error] = thread_pool_->push(std::make_shared<Job>(
+		JobPriorities::LongTerm,
+		std::bind(&CacheDBService::publish_to_main_db_service, this),
+		"publish_to_main_db_service"));
+	if (!queued)
+	{
+		Logger::handle().write(LogTypes::Error, queue_error.value_or("failed to schedule publish job"));
+	}
+}
+
+auto CacheDBService::publish_to_main_db_service() -> std::tuple<bool, std::optional<std::string>>
+{
+	// Runs for the lifetime of the service on the long-term worker
+	const auto base_interval = std::chrono::milliseconds(std::max(1, configurations_->publish_to_main_db_service_interval_ms()));
+	const auto max_interval = std::max(base_interval, std::chrono::milliseconds(configurations_->flush_idle_max_interval_ms()));
+
+	auto interval = base_interval;
+	auto deadline = std::chrono::steady_clock::now() + interval;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(flush_mutex_);
+			idle_backoff_ = interval > base_interval;
+			if (idle_backoff_ && pending_count() > 0)
+			{
+				// Something arrived before the flag was visible to producers
+				idle_backoff_ = false;
+				interval = base_interval;
+				deadline = std::min(deadline, std::chrono::steady_clock::now() + interval);
+			}
+			flush_condition_.wait_until(lock, deadline, [this]()
+			{
+				return flush_stop_requested_.load() || flush_requested_.load() || idle_wakeup_.load();
+			});
+			idle_backoff_ = false;
+		}
+
+		auto stopping = flush_stop_requested_.load();
+		auto requested = flush_requested_.exchange(false);
+		auto idle_wakeup = idle_wakeup_.exchange(false);
+		if (!stopping && !requested && idle_wakeup && std::chrono::steady_clock::now() < deadline)
+		{
+			// First write after an idle stretch: flush it within the normal interval, not the backed-off one
+			interval = base_interval;
+			deadline = std::chrono::steady_clock::now() + interval;
+			continue;
+		}
+
+		collect_write_behind();
+		collect_pending();
+		auto buffered = pending_operations_->buffered_count();
+		auto messages_to_flush = pending_operations_->drain();
+		if (!messages_to_flush.empty())
+		{
+			Logger::handle().write(LogTypes::Debug, fmt::format("coalesced {} operations into {}", buffered, messages_to_flush.size()));
+		}
+
+		// Unconfirmed envelopes from the previous flush are retried ahead of the new ones
+		auto envelopes = pack_envelopes(messages_to_flush);
+		unconfirmed_envelopes_.insert(unconfirmed_envelopes_.end(), std::make_move_iterator(envelopes.begin()), std::make_move_iterator(envelopes.end()));
+
+		if (stopping && (publisher_ == nullptr || !publisher_->is_connected()))
+		{
+			if (!unconfirmed_envelopes_.empty() && spool_ != nullptr)
+			{
+				Logger::handle().write(LogTypes::Information, fmt::format("{} unpublished envelopes stay in the spool for the next start", unconfirmed_envelopes_.size()));
+			}
+			else if (!unconfirmed_envelopes_.empty())
+			{
+				Logger::handle().write(LogTypes::Error, fmt::format("dropping {} unpublished envelopes on stop", unconfirmed_envelopes_.size()));
+			}
+			return { true, std::nullopt };
+		}
+
+		auto [published, publish_error] = publish_envelopes();
+		if (!published)
+		{
+			Logger::handle().write(LogTypes::Error, fmt::format("Failed to publish envelopes: {}", publish_error.value_or("unknown error")));
+		}
+		else
+		{
+			// Everything collected so far is confirmed; with the spool, only what its checkpoint now covers counts
+			auto delivered_sequence = collected_stream_sequence_;
+			if (spool_ != nullptr)
+			{
+				auto [acknowledged, acknowledge_error] = spool_->acknowledge();
+				if (!acknowledged)
+				{
+					Logger::handle().write(LogTypes::Error, fmt::format("Failed to acknowledge spooled operations: {}", acknowledge_error.value_or("unknown error")));
+				}
+				delivered_sequence = spool_->acknowledged_sequence();
+			}
+			acknowledge_stream_entries(delivered_sequence);
+		}
+
+		if (stopping)
+		{
+			return { true, std::nullopt };
+		}
+
+		// Back off while there is nothing to send; anything pending keeps the base interval
+		if (messages_to_flush.empty() && unconfirmed_envelopes_.empty())
+		{
+			interval = std::min(interval * 2, max_interval);
+		}
+		else
+		{
+			interval = base_interval;
+		}
+		deadline = std::chrono::steady_clock::now() + interval;
+	}
+}
+
+auto CacheDBService::flush_watermark_reached() const -> bool
+{
+	if (pending_queue_ == nullptr && spool_ == nullptr)
+	{
+		return false;
+	}
+
+	// Measured before coalescing: the queue is what has to stay below capacity
+	auto count = configurations_->flush_watermark_count();
+	auto bytes = configurations_->flush_watermark_bytes();
+	auto pending_bytes = spool_ != nullptr ? spool_->pending_bytes() : pending_bytes_.load();
+	return (count > 0 && pending_count() >= static_cast<size_t>(count)) ||
+		(bytes > 0 && pending_bytes >= static_cast<size_t>(bytes));
+}
+
 auto CacheDBService::is_stop_requested() const -> bool
 {
     if (!stop_future_.valid())
@@ -1,13 +1,28 @@
 #pragma once
 
 #include "Configurations.h"
-#include "RedisClient.h"
-#include "RabbitMQWorkQueueEmitter.h"
+#include "ConsistentHashRing.h"
+#include "RedisCommandBatch.h"
+#include "RedisConnectionPool.h"
+#include "ValueCodec.h"
+#include "NearCache.h"
+#include "KeyspaceInvalidator.h"
+#include "BoundedMpmcQueue.h"
+#include "RabbitMQConfirmPublisher.h"
+#include "WriteCoalescer.h"
+#include "WriteBehindTracker.h"
+#include "WriteAheadSpool.h"
+#include "SingleFlight.h"
+#include "StreamEntryTracker.h"
 #include "ThreadPool.h"
 #include "ThreadWorker.h"
 #include "Job.h"
 #include "JobPriorities.h"
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
 #include <future>
 #include <memory>
 #include <mutex>
@@ -18,8 +33,13 @@
 
 using namespace Thread;
 
+// Produces the value for a key on a cache miss; an empty value means there is nothing to cache
+using CacheLoader = std::function<std::tuple<std::optional<std::string>, std::optional<std::string>>()>;
+
 class CacheDBService
 {
+	friend class CacheDBServiceBenchmark;
+
 public:
 	CacheDBService(std::shared_ptr<Configurations> configurations);
 	virtual ~CacheDBService();
@@ -28,37 +48,147 @@ public:
 	auto wait_stop() -> std::tuple<bool, std::optional<std::string>>;
 	auto stop() -> std::tuple<bool, std::optional<std::string>>;
 
-	// Direct cache access API
+	// Direct cache access API. Keys under a write-behind prefix are also upserted into their table on the next flush,
+	// whether written by set_key_value(), mset_key_values() or a set() in execute_batch().
 	auto set_key_value(const std::string& key, const std::string& value, long ttl_seconds = 0) -> std::tuple<bool, std::optional<std::string>>;
 	auto get_key_value(const std::string& key) -> std::tuple<std::optional<std::string>, std::optional<std::string>>;
 	auto enqueue_database_operation(const std::string& json_body) -> std::tuple<bool, std::optional<std::string>>;
 
+	// Read-through: concurrent misses on a key share one load in this process, and a short Redis lock makes other
+	// instances wait for it instead of loading too. A value close to expiry is refreshed early by one caller, more
+	// likely the closer it gets (XFetch), so a hot key doesn't expire for everyone at once.
+	// Callers arriving while a load runs get its result, whatever loader and TTL they passed.
+	auto get_or_load(const std::string& key, const CacheLoader& loader, long ttl_seconds) -> std::tuple<std::optional<std::string>, std::optional<std::string>>;
+
+	// Batched cache access: one round trip per Redis node holding any of the keys
+	auto mget_key_values(const std::vector<std::string>& keys) -> std::tuple<std::vector<std::optional<std::string>>, std::optional<std::string>>;
+	// Returns one error slot per entry, empty where the SET succeeded
+	auto mset_key_values(const std::vector<CacheEntry>& entries) -> std::tuple<std::vector<std::optional<std::string>>, std::optional<std::string>>;
+	// Commands are routed by their keys. One whose keys (MGET, MSET, DEL k1 k2, RENAME, ...) fall on several nodes
+	// gets an error reply; so does a transaction across nodes. Keys that must go together need a common {tag}.
+	// Values of set() are encoded and replies of get() decoded like the key/value calls, and a set() on a write-behind key
+	// is flushed to its table like set_key_value(); command() passes through untouched.
+	auto execute_batch(const RedisCommandBatch& batch, bool transaction = false) -> std::tuple<std::vector<RedisReply>, std::optional<std::string>>;
+
+	auto value_codec() const -> const ValueCodec&;
+
+	// Empty when the near cache is disabled
+	auto near_cache_stats() const -> std::optional<NearCacheStats>;
+
 protected:
 	auto create_thread_pool() -> std::tuple<bool, std::optional<std::string>>;
 	auto destroy_thread_pool() -> void;
 	auto ensure_stream_group() -> std::tuple<bool, std::optional<std::string>>;
-	auto publish_message(const std::string& message_body) -> std::tuple<bool, std::optional<std::string>>;
-	auto ensure_redis_connection() -> std::tuple<bool, std::optional<std::string>>;
+	auto consume_redis_stream() -> std::tuple<bool, std::optional<std::string>>;
+	auto acknowledge_stream_entries(uint64_t delivered_sequence) -> void;
+	auto publish_envelopes() -> std::tuple<bool, std::optional<std::string>>;
 	auto ensure_rabbitmq_connection() -> std::tuple<bool, std::optional<std::string>>;
+	auto redis_connection_options(const std::string& node) const -> std::tuple<std::optional<sw::redis::ConnectionOptions>, std::optional<std::string>>;
+	auto create_redis_pools() -> std::tuple<bool, std::optional<std::string>>;
+	auto node_for(const std::string& key) const -> size_t;
+	auto execute_node_batch(size_t node, const RedisCommandBatch& batch, bool transaction) -> std::tuple<std::vector<RedisReply>, std::optional<std::string>>;
+	auto near_cache_usable(size_t node) const -> bool;
+	// Keeps a decoded value in the near cache for no longer than Redis keeps it (ttl_ms as from PTTL)
+	auto remember(const std::string& key, const std::string& value, long long ttl_ms, uint64_t version) -> void;
+	auto read_through(const std::string& key, const CacheLoader& loader, long ttl_seconds) -> std::tuple<std::optional<std::string>, std::optional<std::string>>;
+	auto load_and_store(const std::string& key, const CacheLoader& loader, long ttl_seconds) -> std::tuple<std::optional<std::string>, std::optional<std::string>>;
+	auto should_refresh_early(const std::string& stored, long long ttl_ms) const -> bool;
+	auto try_load_lock(const std::string& key) -> std::optional<std::string>;
+	auto release_load_lock(const std::string& key, const std::string& token) -> void;
 
 private:
 	std::shared_ptr<Configurations> configurations_;
-    std::unique_ptr<Redis::RedisClient> redis_client_;
-    std::unique_ptr<RabbitMQ::RabbitMQWorkQueueEmitter> work_queue_emitter_;
+	// One pool per Redis node, indexed like the nodes on the ring
+	std::unique_ptr<ConsistentHashRing> shard_ring_;
+	std::vector<std::unique_ptr<RedisConnectionPool>> redis_pools_;
+	std::unique_ptr<ValueCodec> value_codec_;
+	// Optional L1 in front of Redis, holding decoded values; a node's keys are only served from it while that node's subscription is live
+	std::unique_ptr<NearCache> near_cache_;
+	std::vector<std::unique_ptr<KeyspaceInvalidator>> keyspace_invalidators_;
+	SingleFlight<std::tuple<std::optional<std::string>, std::optional<std::string>>> load_flight_;
+    std::unique_ptr<CommonMessageMQ::RabbitMQConfirmPublisher> publisher_;
     std::shared_ptr<ThreadPool> thread_pool_;
 
     std::promise<void> stop_promise_;
     std::shared_future<void> stop_future_;
 
-	struct PendingMessage
+	// Pending messages packed into one {"batch":[...]} body; kept as a unit until the broker confirms it
+	struct Envelope
+	{
+		std::string body;
+		size_t message_count = 0;
+	};
+
+	// Validated operation on its way from enqueue_database_operation to the flush loop; parsed once it gets there
+	struct QueuedOperation
 	{
 		std::string message_body;
+		// Set for operations read from the Redis stream, which are the only ones numbered
+		uint64_t stream_sequence = 0;
 	};
 
-	std::mutex pending_mutex_;
-	std::vector<PendingMessage> pending_messages_;
+	enum class QueueFullPolicy
+	{
+		Block,
+		DropOldest,
+		Reject,
+	};
+
+	// Operations are parsed on the flush loop into this arena. The coalescer is drained every cycle, so
+	// nothing parsed in one cycle outlives it and the arena is released wholesale at the next collect.
+	// Declared ahead of the coalescer so it is destroyed after it.
+	std::unique_ptr<unsigned char[]> parse_buffer_;
+	boost::json::monotonic_resource parse_resource_;
+	boost::json::parser parser_;
+
+	// Only used with spool_enabled false; with the spool on (the default) producers append to it instead,
+	// under its lock. Producers push without taking a lock and the flush loop pops, as do producers dropping
+	// the oldest operation. Created once and emptied by stop(), so a late producer never sees it replaced.
+	std::unique_ptr<BoundedMpmcQueue<QueuedOperation>> pending_queue_;
+	std::atomic<size_t> pending_bytes_;
+	std::atomic<uint64_t> dropped_operations_;
+	QueueFullPolicy queue_full_policy_;
+	std::unique_ptr<WriteCoalescer> pending_operations_;
+	// When enabled, operations are appended here instead of the queue and acknowledged once confirmed
+	std::unique_ptr<WriteAheadSpool> spool_;
+	// Null without write-behind mappings
+	std::unique_ptr<WriteBehindTracker> write_behind_;
+
+	// Wakes the flush loop on stop, on crossing a watermark, or on the first write while it is backing off.
+	// Producers only touch the mutex when they actually have to wake the loop.
+	std::mutex flush_mutex_;
+	std::condition_variable flush_condition_;
+	std::atomic<bool> flush_stop_requested_;
+	std::atomic<bool> flush_requested_;
+	std::atomic<bool> idle_backoff_;
+	std::atomic<bool> idle_wakeup_;
+
+	// Envelopes not yet confirmed by the broker, republished unchanged until they are; owned by the publish job
+	std::vector<Envelope> unconfirmed_envelopes_;
+
+	// Stream entries admitted to the pipeline by the consumer. With the spool they carry the sequence of their
+	// record and are XACKed once spool_->acknowledge() has moved past it; without it they carry a queue number
+	// of their own, and are XACKed once a collect has popped them and a publish after it is fully confirmed.
+	StreamEntryTracker stream_entries_;
+	// Queue numbering: the consumer's last number, and the highest one the publish job has collected
+	uint64_t stream_sequence_;
+	uint64_t collected_stream_sequence_;
+
+	auto pack_envelopes(std::vector<PendingOperation>& messages) const -> std::vector<Envelope>;
+	auto pack_binary_envelopes(std::vector<PendingOperation>& messages) const -> std::vector<Envelope>;
 
 	void schedule_publish_job();
 	auto publish_to_main_db_service() -> std::tuple<bool, std::optional<std::string>>;
+	auto flush_watermark_reached() const -> bool;
+	auto push_pending(QueuedOperation&& operation) -> std::tuple<bool, std::optional<std::string>>;
+	// stream_sequence is set for operations read from the Redis stream
+	auto admit_operation(const std::string& json_body, uint64_t* stream_sequence = nullptr) -> std::tuple<bool, std::optional<std::string>>;
+	auto parse_operation(const std::string& json_body) -> std::optional<boost::json::object>;
+	void schedule_stream_consumer();
+	auto collect_pending() -> void;
+	auto collect_write_behind() -> void;
+	auto mark_written(const std::string& key) -> void;
+	auto pending_count() const -> size_t;
+	auto wake_flush_loop() -> void;
 	auto is_stop_requested() const -> bool;
 };
@@ -35,8 +35,15 @@ Configurations::Configurations(ArgumentParser&& arguments)
 	, redis_block_ms_(1000)
 	, redis_count_(50)
 	, redis_auto_create_group_(true)
+	, redis_stream_enabled_(false)
+	, redis_stream_claim_idle_ms_(30000)
 	, redis_reconnect_max_retries_(10)
 	, redis_reconnect_interval_ms_(1000)
+	, redis_pool_size_(8)
+	, redis_socket_timeout_ms_(1000)
+	, redis_health_check_interval_ms_(1000)
+	, redis_nodes_()
+	, redis_virtual_nodes_(160)
 	, rabbit_mq_host_("127.0.0.1")
 	, rabbit_mq_port_(5672)
 	, rabbit_mq_user_name_("guest")
@@ -46,7 +53,33 @@ Configurations::Configurations(ArgumentParser&& arguments)
 	, content_type_("application/json")
 	, rabbit_mq_reconnect_max_retries_(10)
 	, rabbit_mq_reconnect_interval_ms_(1000)
+	, publish_batch_max_messages_(500)
+	, publish_batch_max_bytes_(256 * 1024)
+	, publish_confirm_timeout_ms_(5000)
+	, pending_queue_capacity_(65536)
+	, pending_queue_full_policy_("reject")
+	, pending_queue_block_timeout_ms_(1000)
+	, coalesce_writes_(true)
+	, near_cache_enabled_(false)
+	, near_cache_capacity_(100000)
+	, near_cache_shards_(16)
+	, near_cache_max_ttl_ms_(30000)
+	, near_cache_invalidation_(true)
+	, near_cache_configure_notifications_(false)
+	, spool_enabled_(true)
+	, spool_path_("./spool/")
+	, spool_segment_bytes_(64 * 1024 * 1024)
+	, spool_max_segments_(16)
+	, spool_sync_interval_ms_(10)
+	, value_encoding_("binary")
+	, value_compression_threshold_bytes_(1024)
+	, read_through_lock_ttl_ms_(5000)
+	, read_through_lock_wait_ms_(3000)
+	, read_through_early_refresh_beta_percent_(100)
 	, publish_to_main_db_service_interval_ms_(1000)
+	, flush_watermark_count_(1000)
+	, flush_watermark_bytes_(1024 * 1024)
+	, flush_idle_max_interval_ms_(5000)
 {
 	root_path_ = arguments.program_folder();
 	load();
@@ -116,11 +149,36 @@ auto Configurations::redis_auto_create_group() const -> bool
 	return redis_auto_create_group_;
 }
 
+auto Configurations::redis_stream_enabled() const -> bool
+{
+	return redis_stream_enabled_;
+}
+
+auto Configurations::redis_stream_claim_idle_ms() const -> int
+{
+	return redis_stream_claim_idle_ms_;
+}
+
 auto Configurations::publish_to_main_db_service_interval_ms() const -> int
 {
 	return publish_to_main_db_service_interval_ms_;
 }
 
+auto Configurations::flush_watermark_count() const -> int
+{
+	return flush_watermark_count_;
+}
+
+auto Configurations::flush_watermark_bytes() const -> int
+{
+	return flush_watermark_bytes_;
+}
+
+auto Configurations::flush_idle_max_interval_ms() const -> int
+{
+	return flush_idle_max_interval_ms_;
+}
+
 auto Configurations::redis_reconnect_max_retries() const -> int
 {
 	return redis_reconnect_max_retries_;
@@ -131,6 +189,31 @@ auto Configurations::redis_reconnect_interval_ms() const -> int
 	return redis_reconnect_interval_ms_;
 }
 
+auto Configurations::redis_pool_size() const -> int
+{
+	return redis_pool_size_;
+}
+
+auto Configurations::redis_socket_timeout_ms() const -> int
+{
+	return redis_socket_timeout_ms_;
+}
+
+auto Configurations::redis_health_check_interval_ms() const -> int
+{
+	return redis_health_check_interval_ms_;
+}
+
+auto Configurations::redis_nodes() const -> std::vector<std::string>
+{
+	return redis_nodes_;
+}
+
+auto Configurations::redis_virtual_nodes() const -> int
+{
+	return redis_virtual_nodes_;
+}
+
 auto Configurations::rabbit_mq_host() const -> std::string
 {
 	return rabbit_mq_host_;
@@ -176,6 +259,131 @@ auto Configurations::rabbit_mq_reconnect_interval_ms() const -> int
 	return rabbit_mq_reconnect_interval_ms_;
 }
 
+auto Configurations::publish_batch_max_messages() const -> int
+{
+	return publish_batch_max_messages_;
+}
+
+auto Configurations::publish_batch_max_bytes() const -> int
+{
+	return publish_batch_max_bytes_;
+}
+
+auto Configurations::publish_confirm_timeout_ms() const -> int
+{
+	return publish_confirm_timeout_ms_;
+}
+
+auto Configurations::pending_queue_capacity() const -> int
+{
+	return pending_queue_capacity_;
+}
+
+auto Configurations::pending_queue_full_policy() const -> std::string
+{
+	return pending_queue_full_policy_;
+}
+
+auto Configurations::pending_queue_block_timeout_ms() const -> int
+{
+	return pending_queue_block_timeout_ms_;
+}
+
+auto Configurations::coalesce_writes() const -> bool
+{
+	return coalesce_writes_;
+}
+
+auto Configurations::coalesce_keys() const -> const std::unordered_map<std::string, std::vector<std::string>>&
+{
+	return coalesce_keys_;
+}
+
+auto Configurations::near_cache_enabled() const -> bool
+{
+	return near_cache_enabled_;
+}
+
+auto Configurations::near_cache_capacity() const -> int
+{
+	return near_cache_capacity_;
+}
+
+auto Configurations::near_cache_shards() const -> int
+{
+	return near_cache_shards_;
+}
+
+auto Configurations::near_cache_max_ttl_ms() const -> int
+{
+	return near_cache_max_ttl_ms_;
+}
+
+auto Configurations::near_cache_invalidation() const -> bool
+{
+	return near_cache_invalidation_;
+}
+
+auto Configurations::near_cache_configure_notifications() const -> bool
+{
+	return near_cache_configure_notifications_;
+}
+
+auto Configurations::spool_enabled() const -> bool
+{
+	return spool_enabled_;
+}
+
+auto Configurations::spool_path() const -> std::string
+{
+	return spool_path_;
+}
+
+auto Configurations::spool_segment_bytes() const -> int
+{
+	return spool_segment_bytes_;
+}
+
+auto Configurations::spool_max_segments() const -> int
+{
+	return spool_max_segments_;
+}
+
+auto Configurations::spool_sync_interval_ms() const -> int
+{
+	return spool_sync_interval_ms_;
+}
+
+auto Configurations::value_encoding() const -> std::string
+{
+	return value_encoding_;
+}
+
+auto Configurations::value_compression_threshold_bytes() const -> int
+{
+	return value_compression_threshold_bytes_;
+}
+
+auto Configurations::read_through_lock_ttl_ms() const -> int
+{
+	return read_through_lock_ttl_ms_;
+}
+
+auto Configurations::read_through_lock_wait_ms() const -> int
+{
+	return read_through_lock_wait_ms_;
+}
+
+auto Configurations::read_through_early_refresh_beta_percent() const -> int
+{
+	return read_through_early_refresh_beta_percent_;
+}
+
+auto Configurations::write_behind() const -> const std::unordered_map<std::string, WriteBehindMapping>&
+{
+	return write_behind_;
+}
+
 auto Configurations::load() -> void
 {
 	std::filesystem::path path = root_path_ + "cache_db_service_cfg.json";
@@ -269,10 +477,30 @@ auto Configurations::load() -> void
 	{
 		redis_auto_create_group_ = obj.at("redis_auto_create_group").as_bool();
 	}
+	if (obj.contains("redis_stream_enabled"))
+	{
+		redis_stream_enabled_ = obj.at("redis_stream_enabled").as_bool();
+	}
+	if (obj.contains("redis_stream_claim_idle_ms"))
+	{
+		redis_stream_claim_idle_ms_ = static_cast<int>(obj.at("redis_stream_claim_idle_ms").as_int64());
+	}
 	if (obj.contains("publish_to_main_db_service_interval_ms"))
 	{
 		publish_to_main_db_service_interval_ms_ = static_cast<int>(obj.at("publish_to_main_db_service_interval_ms").as_int64());
 	}
+	if (obj.contains("flush_watermark_count"))
+	{
+		flush_watermark_count_ = static_cast<int>(obj.at("flush_watermark_count").as_int64());
+	}
+	if (obj.contains("flush_watermark_bytes"))
+	{
+		flush_watermark_bytes_ = static_cast<int>(obj.at("flush_watermark_bytes").as_int64());
+	}
+	if (obj.contains("flush_idle_max_interval_ms"))
+	{
+		flush_idle_max_interval_ms_ = static_cast<int>(obj.at("flush_idle_max_interval_ms").as_int64());
+	}
 	if (obj.contains("redis_reconnect_max_retries"))
 	{
 		redis_reconnect_max_retries_ = static_cast<int>(obj.at("redis_reconnect_max_retries").as_int64());
@@ -281,6 +509,30 @@ auto Configurations::load() -> void
 	{
 		redis_reconnect_interval_ms_ = static_cast<int>(obj.at("redis_reconnect_interval_ms").as_int64());
 	}
+	if (obj.contains("redis_pool_size"))
+	{
+		redis_pool_size_ = static_cast<int>(obj.at("redis_pool_size").as_int64());
+	}
+	if (obj.contains("redis_socket_timeout_ms"))
+	{
+		redis_socket_timeout_ms_ = static_cast<int>(obj.at("redis_socket_timeout_ms").as_int64());
+	}
+	if (obj.contains("redis_health_check_interval_ms"))
+	{
+		redis_health_check_interval_ms_ = static_cast<int>(obj.at("redis_health_check_interval_ms").as_int64());
+	}
+	if (obj.contains("redis_nodes") && obj.at("redis_nodes").is_array())
+	{
+		redis_nodes_.clear();
+		for (auto& v : obj.at("redis_nodes").as_array())
+		{
+			redis_nodes_.push_back(boost::json::value_to<std::string>(v));
+		}
+	}
+	if (obj.contains("redis_virtual_nodes"))
+	{
+		redis_virtual_nodes_ = static_cast<int>(obj.at("redis_virtual_nodes").as_int64());
+	}
 
 	// MQ
 	if (obj.contains("rabbit_mq_host"))
@@ -319,6 +571,159 @@ auto Configurations::load() -> void
 	{
 		rabbit_mq_reconnect_interval_ms_ = static_cast<int>(obj.at("rabbit_mq_reconnect_interval_ms").as_int64());
 	}
+	if (obj.contains("publish_batch_max_messages"))
+	{
+		publish_batch_max_messages_ = static_cast<int>(obj.at("publish_batch_max_messages").as_int64());
+	}
+	if (obj.contains("publish_batch_max_bytes"))
+	{
+		publish_batch_max_bytes_ = static_cast<int>(obj.at("publish_batch_max_bytes").as_int64());
+	}
+	if (obj.contains("publish_confirm_timeout_ms"))
+	{
+		publish_confirm_timeout_ms_ = static_cast<int>(obj.at("publish_confirm_timeout_ms").as_int64());
+	}
+
+	// Pending queue
+	if (obj.contains("pending_queue_capacity"))
+	{
+		pending_queue_capacity_ = static_cast<int>(obj.at("pending_queue_capacity").as_int64());
+	}
+	if (obj.contains("pending_queue_full_policy"))
+	{
+		pending_queue_full_policy_ = obj.at("pending_queue_full_policy").as_string().data();
+	}
+	if (obj.contains("pending_queue_block_timeout_ms"))
+	{
+		pending_queue_block_timeout_ms_ = static_cast<int>(obj.at("pending_queue_block_timeout_ms").as_int64());
+	}
+
+	// Write coalescing
+	if (obj.contains("coalesce_writes"))
+	{
+		coalesce_writes_ = obj.at("coalesce_writes").as_bool();
+	}
+	if (obj.contains("coalesce_keys") && obj.at("coalesce_keys").is_object())
+	{
+		coalesce_keys_.clear();
+		for (auto& kv : obj.at("coalesce_keys").as_object())
+		{
+			if (!kv.value().is_array())
+			{
+				continue;
+			}
+			auto& columns = coalesce_keys_[std::string(kv.key().data(), kv.key().size())];
+			for (auto& v : kv.value().as_array())
+			{
+				columns.push_back(boost::json::value_to<std::string>(v));
+			}
+		}
+	}
+
+	// Near cache
+	if (obj.contains("near_cache_enabled"))
+	{
+		near_cache_enabled_ = obj.at("near_cache_enabled").as_bool();
+	}
+	if (obj.contains("near_cache_capacity"))
+	{
+		near_cache_capacity_ = static_cast<int>(obj.at("near_cache_capacity").as_int64());
+	}
+	if (obj.contains("near_cache_shards"))
+	{
+		near_cache_shards_ = static_cast<int>(obj.at("near_cache_shards").as_int64());
+	}
+	if (obj.contains("near_cache_max_ttl_ms"))
+	{
+		near_cache_max_ttl_ms_ = static_cast<int>(obj.at("near_cache_max_ttl_ms").as_int64());
+	}
+	if (obj.contains("near_cache_invalidation"))
+	{
+		near_cache_invalidation_ = obj.at("near_cache_invalidation").as_bool();
+	}
+	if (obj.contains("near_cache_configure_notifications"))
+	{
+		near_cache_configure_notifications_ = obj.at("near_cache_configure_notifications").as_bool();
+	}
+
+	// Write-ahead spool
+	if (obj.contains("spool_enabled"))
+	{
+		spool_enabled_ = obj.at("spool_enabled").as_bool();
+	}
+	if (obj.contains("spool_path"))
+	{
+		spool_path_ = obj.at("spool_path").as_string().data();
+	}
+	if (obj.contains("spool_segment_bytes"))
+	{
+		spool_segment_bytes_ = static_cast<int>(obj.at("spool_segment_bytes").as_int64());
+	}
+	if (obj.contains("spool_max_segments"))
+	{
+		spool_max_segments_ = static_cast<int>(obj.at("spool_max_segments").as_int64());
+	}
+	if (obj.contains("spool_sync_interval_ms"))
+	{
+		spool_sync_interval_ms_ = static_cast<int>(obj.at("spool_sync_interval_ms").as_int64());
+	}
+
+	// Value codec
+	if (obj.contains("value_encoding"))
+	{
+		value_encoding_ = obj.at("value_encoding").as_string().data();
+	}
+	if (obj.contains("value_compression_threshold_bytes"))
+	{
+		value_compression_threshold_bytes_ = static_cast<int>(obj.at("value_compression_threshold_bytes").as_int64());
+	}
+
+	// Read-through loading
+	if (obj.contains("read_through_lock_ttl_ms"))
+	{
+		read_through_lock_ttl_ms_ = static_cast<int>(obj.at("read_through_lock_ttl_ms").as_int64());
+	}
+	if (obj.contains("read_through_lock_wait_ms"))
+	{
+		read_through_lock_wait_ms_ = static_cast<int>(obj.at("read_through_lock_wait_ms").as_int64());
+	}
+	if (obj.contains("read_through_early_refresh_beta_percent"))
+	{
+		read_through_early_refresh_beta_percent_ = static_cast<int>(obj.at("read_through_early_refresh_beta_percent").as_int64());
+	}
+
+	// Write-behind
+	if (obj.contains("write_behind") && obj.at("write_behind").is_object())
+	{
+		write_behind_.clear();
+		for (auto& kv : obj.at("write_behind").as_object())
+		{
+			if (!kv.value().is_object() || !kv.value().as_object().contains("table") || !kv.value().as_object().contains("key_columns"))
+			{
+				continue;
+			}
+
+			const auto& entry = kv.value().as_object();
+			WriteBehindMapping mapping;
+			mapping.table = boost::json::value_to<std::string>(entry.at("table"));
+			for (auto& v : entry.at("key_columns").as_array())
+			{
+				mapping.key_columns.push_back(boost::json::value_to<std::string>(v));
+			}
+			if (entry.contains("value_column"))
+			{
+				mapping.value_column = boost::json::value_to<std::string>(entry.at("value_column"));
+			}
+			if (entry.contains("key_types") && entry.at("key_types").is_object())
+			{
+				for (auto& type : entry.at("key_types").as_object())
+				{
+					mapping.key_types[std::string(type.key().data(), type.key().size())] = boost::json::value_to<std::string>(type.value());
+				}
+			}
+			write_behind_[std::string(kv.key().data(), kv.key().size())] = std::move(mapping);
+		}
+	}
 }
 
 auto Configurations::parse(ArgumentParser& arguments) -> void
@@ -396,10 +801,30 @@ auto Configurations::parse(ArgumentParser& arguments) -> void
 	{
 		redis_auto_create_group_ = v.value();
 	}
+	if (auto v = arguments.to_bool("--redis_stream_enabled"); v != std::nullopt)
+	{
+		redis_stream_enabled_ = v.value();
+	}
+	if (auto v = arguments.to_int("--redis_stream_claim_idle_ms"); v != std::nullopt)
+	{
+		redis_stream_claim_idle_ms_ = v.value();
+	}
 	if (auto v = arguments.to_int("--publish_to_main_db_service_interval_ms"); v != std::nullopt)
 	{
 		publish_to_main_db_service_interval_ms_ = v.value();
 	}
+	if (auto v = arguments.to_int("--flush_watermark_count"); v != std::nullopt)
+	{
+		flush_watermark_count_ = v.value();
+	}
+	if (auto v = arguments.to_int("--flush_watermark_bytes"); v != std::nullopt)
+	{
+		flush_watermark_bytes_ = v.value();
+	}
+	if (auto v = arguments.to_int("--flush_idle_max_interval_ms"); v != std::nullopt)
+	{
+		flush_idle_max_interval_ms_ = v.value();
+	}
 	if (auto v = arguments.to_int("--redis_reconnect_max_retries"); v != std::nullopt)
 	{
 		redis_reconnect_max_retries_ = v.value();
@@ -408,6 +833,41 @@ auto Configurations::parse(ArgumentParser& arguments) -> void
 	{
 		redis_reconnect_interval_ms_ = v.value();
 	}
+	if (auto v = arguments.to_int("--redis_pool_size"); v != std::nullopt)
+	{
+		redis_pool_size_ = v.value();
+	}
+	if (auto v = arguments.to_int("--redis_socket_timeout_ms"); v != std::nullopt)
+	{
+		redis_socket_timeout_ms_ = v.value();
+	}
+	if (auto v = arguments.to_int("--redis_health_check_interval_ms"); v != std::nullopt)
+	{
+		redis_health_check_interval_ms_ = v.value();
+	}
+	if (auto v = arguments.to_string("--redis_nodes"); v != std::nullopt)
+	{
+		// Comma separated on the command line
+		redis_nodes_.clear();
+		size_t start = 0;
+		while (start <= v.value().size())
+		{
+			auto end = v.value().find(',', start);
+			if (end == std::string::npos)
+			{
+				end = v.value().size();
+			}
+			if (end > start)
+			{
+				redis_nodes_.push_back(v.value().substr(start, end - start));
+			}
+			start = end + 1;
+		}
+	}
+	if (auto v = arguments.to_int("--redis_virtual_nodes"); v != std::nullopt)
+	{
+		redis_virtual_nodes_ = v.value();
+	}
 
 	// MQ
 	if (auto v = arguments.to_string("--rabbit_mq_host"); v != std::nullopt)
@@ -446,6 +906,102 @@ auto Configurations::parse(ArgumentParser& arguments) -> void
 	{
 		rabbit_mq_reconnect_interval_ms_ = v.value();
 	}
+	if (auto v = arguments.to_int("--publish_batch_max_messages"); v != std::nullopt)
+	{
+		publish_batch_max_messages_ = v.value();
+	}
+	if (auto v = arguments.to_int("--publish_batch_max_bytes"); v != std::nullopt)
+	{
+		publish_batch_max_bytes_ = v.value();
+	}
+	if (auto v = arguments.to_int("--publish_confirm_timeout_ms"); v != std::nullopt)
+	{
+		publish_confirm_timeout_ms_ = v.value();
+	}
+	if (auto v = arguments.to_int("--pending_queue_capacity"); v != std::nullopt)
+	{
+		pending_queue_capacity_ = v.value();
+	}
+	if (auto v = arguments.to_string("--pending_queue_full_policy"); v != std::nullopt)
+	{
+		pending_queue_full_policy_ = v.value();
+	}
+	if (auto v = arguments.to_int("--pending_queue_block_timeout_ms"); v != std::nullopt)
+	{
+		pending_queue_block_timeout_ms_ = v.value();
+	}
+	if (auto v = arguments.to_bool("--coalesce_writes"); v != std::nullopt)
+	{
+		coalesce_writes_ = v.value();
+	}
+	if (auto v = arguments.to_bool("--near_cache_enabled"); v != std::nullopt)
+	{
+		near_cache_enabled_ = v.value();
+	}
+	if (auto v = arguments.to_int("--near_cache_capacity"); v != std::nullopt)
+	{
+		near_cache_capacity_ = v.value();
+	}
+	if (auto v = arguments.to_int("--near_cache_shards"); v != std::nullopt)
+	{
+		near_cache_shards_ = v.value();
+	}
+	if (auto v = arguments.to_int("--near_cache_max_ttl_ms"); v != std::nullopt)
+	{
+		near_cache_max_ttl_ms_ = v.value();
+	}
+	if (auto v = arguments.to_bool("--near_cache_invalidation"); v != std::nullopt)
+	{
+		near_cache_invalidation_ = v.value();
+	}
+	if (auto v = arguments.to_bool("--near_cache_configure_notifications"); v != std::nullopt)
+	{
+		near_cache_configure_notifications_ = v.value();
+	}
+	if (auto v = arguments.to_bool("--spool_enabled"); v != std::nullopt)
+	{
+		spool_enabled_ = v.value();
+	}
+	if (auto v = arguments.to_string("--spool_path"); v != std::nullopt)
+	{
+		spool_path_ = v.value();
+	}
+	if (auto v = arguments.to_int("--spool_segment_bytes"); v != std::nullopt)
+	{
+		spool_segment_bytes_ = v.value();
+	}
+	if (auto v = arguments.to_int("--spool_max_segments"); v != std::nullopt)
+	{
+		spool_max_segments_ = v.value();
+	}
+	if (auto v = arguments.to_int("--spool_sync_interval_ms"); v != std::nullopt)
+	{
+		spool_sync_interval_ms_ = v.value();
+	}
+
+	// Value codec
+	if (auto v = arguments.to_string("--value_encoding"); v != std::nullopt)
+	{
+		value_encoding_ = v.value();
+	}
+	if (auto v = arguments.to_int("--value_compression_threshold_bytes"); v != std::nullopt)
+	{
+		value_compression_threshold_bytes_ = v.value();
+	}
+
+	// Read-through loading
+	if (auto v = arguments.to_int("--read_through_lock_ttl_ms"); v != std::nullopt)
+	{
+		read_through_lock_ttl_ms_ = v.value();
+	}
+	if (auto v = arguments.to_int("--read_through_lock_wait_ms"); v != std::nullopt)
+	{
+		read_through_lock_wait_ms_ = v.value();
+	}
+	if (auto v = arguments.to_int("--read_through_early_refresh_beta_percent"); v != std::nullopt)
+	{
+		read_through_early_refresh_beta_percent_ = v.value();
+	}
 }
 // Thread pool getters
 auto Configurations::high_priority_worker_count() const -> int { return high_priority_worker_count_; }
@@ -6,11 +6,24 @@
 #include <optional>
 #include <string>
 #include <tuple>
+#include <unordered_map>
 #include <vector>
 
 
 using namespace Utilities;
 
+// Keys starting with a write-behind prefix map to one row of table. The rest of the key, split on ':', gives the
+// key_columns values. The cached value goes into value_column, or, when that is empty, is a JSON object of columns.
+// key_types gives a key column's database type (e.g. "int8", "text"); without one, a key that is a plain integer
+// is sent as a number and anything else as a string.
+struct WriteBehindMapping
+{
+	std::string table;
+	std::vector<std::string> key_columns;
+	std::string value_column;
+	std::unordered_map<std::string, std::string> key_types;
+};
+
 class Configurations
 {
 public:
@@ -46,9 +59,20 @@ public:
 	auto redis_block_ms() const -> int;
 	auto redis_count() const -> int;
 	auto redis_auto_create_group() const -> bool;
+	auto redis_stream_enabled() const -> bool;
+	auto redis_stream_claim_idle_ms() const -> int;
 	auto publish_to_main_db_service_interval_ms() const -> int;
+	auto flush_watermark_count() const -> int;
+	auto flush_watermark_bytes() const -> int;
+	auto flush_idle_max_interval_ms() const -> int;
 	auto redis_reconnect_max_retries() const -> int;
 	auto redis_reconnect_interval_ms() const -> int;
+	auto redis_pool_size() const -> int;
+	auto redis_socket_timeout_ms() const -> int;
+	auto redis_health_check_interval_ms() const -> int;
+	// "host:port" per shard; empty means the single redis_host/redis_port node
+	auto redis_nodes() const -> std::vector<std::string>;
+	auto redis_virtual_nodes() const -> int;
 
 	// MQ publisher
 	auto rabbit_mq_host() const -> std::string;
@@ -60,6 +84,46 @@ public:
 	auto content_type() const -> std::string;
 	auto rabbit_mq_reconnect_max_retries() const -> int;
 	auto rabbit_mq_reconnect_interval_ms() const -> int;
+	auto publish_batch_max_messages() const -> int;
+	auto publish_batch_max_bytes() const -> int;
+	auto publish_confirm_timeout_ms() const -> int;
+
+	// Pending queue, the lock-free producer path; only used with spool_enabled false
+	auto pending_queue_capacity() const -> int;
+	auto pending_queue_full_policy() const -> std::string;
+	auto pending_queue_block_timeout_ms() const -> int;
+
+	// Write coalescing
+	auto coalesce_writes() const -> bool;
+	auto coalesce_keys() const -> const std::unordered_map<std::string, std::vector<std::string>>&;
+
+	// Near cache
+	auto near_cache_enabled() const -> bool;
+	auto near_cache_capacity() const -> int;
+	auto near_cache_shards() const -> int;
+	auto near_cache_max_ttl_ms() const -> int;
+	auto near_cache_invalidation() const -> bool;
+	auto near_cache_configure_notifications() const -> bool;
+
+	// Write-ahead spool
+	auto spool_enabled() const -> bool;
+	auto spool_path() const -> std::string;
+	auto spool_segment_bytes() const -> int;
+	auto spool_max_segments() const -> int;
+	auto spool_sync_interval_ms() const -> int;
+
+	// Value codec
+	auto value_encoding() const -> std::string;
+	auto value_compression_threshold_bytes() const -> int;
+
+	// Read-through loading
+	auto read_through_lock_ttl_ms() const -> int;
+	auto read_through_lock_wait_ms() const -> int;
+	// XFetch beta in percent; 0 turns early refresh off
+	auto read_through_early_refresh_beta_percent() const -> int;
+
+	// Write-behind, keyed by key prefix
+	auto write_behind() const -> const std::unordered_map<std::string, WriteBehindMapping>&;
 
 protected:
 	auto load() -> void;
@@ -89,9 +153,19 @@ private:
 	int redis_block_ms_;
 	int redis_count_;
 	bool redis_auto_create_group_;
+	bool redis_stream_enabled_;
+	int redis_stream_claim_idle_ms_;
 	int publish_to_main_db_service_interval_ms_;
+	int flush_watermark_count_;
+	int flush_watermark_bytes_;
+	int flush_idle_max_interval_ms_;
 	int redis_reconnect_max_retries_;
 	int redis_reconnect_interval_ms_;
+	int redis_pool_size_;
+	int redis_socket_timeout_ms_;
+	int redis_health_check_interval_ms_;
+	std::vector<std::string> redis_nodes_;
+	int redis_virtual_nodes_;
 
 	// MQ
 	std::string rabbit_mq_host_;
@@ -103,4 +177,43 @@ private:
 	std::string content_type_;
 	int rabbit_mq_reconnect_max_retries_;
 	int rabbit_mq_reconnect_interval_ms_;
+	int publish_batch_max_messages_;
+	int publish_batch_max_bytes_;
+	int publish_confirm_timeout_ms_;
+
+	// Pending queue
+	int pending_queue_capacity_;
+	std::string pending_queue_full_policy_;
+	int pending_queue_block_timeout_ms_;
+
+	// Write coalescing
+	bool coalesce_writes_;
+	std::unordered_map<std::string, std::vector<std::string>> coalesce_keys_;
+
+	// Near cache
+	bool near_cache_enabled_;
+	int near_cache_capacity_;
+	int near_cache_shards_;
+	int near_cache_max_ttl_ms_;
+	bool near_cache_invalidation_;
+	bool near_cache_configure_notifications_;
+
+	// Write-ahead spool
+	bool spool_enabled_;
+	std::string spool_path_;
+	int spool_segment_bytes_;
+	int spool_max_segments_;
+	int spool_sync_interval_ms_;
+
+	// Value codec
+	std::string value_encoding_;
+	int value_compression_threshold_bytes_;
+
+	// Read-through loading
+	int read_through_lock_ttl_ms_;
+	int read_through_lock_wait_ms_;
+	int read_through_early_refresh_beta_percent_;
+
+	// Write-behind
+	std::unordered_map<std::string, WriteBehindMapping> write_behind_;
 };
@@ -0,0 +1,96 @@
+#include "ConsistentHashRing.h"
+
+#include "fmt/format.h"
+
+#include <algorithm>
+
+ConsistentHashRing::ConsistentHashRing(size_t virtual_nodes)
+	: virtual_nodes_(std::max<size_t>(virtual_nodes, 1))
+{
+}
+
+ConsistentHashRing::~ConsistentHashRing(void)
+{
+}
+
+auto ConsistentHashRing::add_node(const std::string& name) -> std::tuple<bool, std::optional<std::string>>
+{
+	if (std::find(nodes_.begin(), nodes_.end(), name) != nodes_.end())
+	{
+		return { false, fmt::format("node {} is already on the ring", name) };
+	}
+
+	auto index = nodes_.size();
+	nodes_.push_back(name);
+
+	points_.reserve(points_.size() + virtual_nodes_);
+	for (size_t point = 0; point < virtual_nodes_; ++point)
+	{
+		points_.emplace_back(hash(fmt::format("{}#{}", name, point)), index);
+	}
+	std::sort(points_.begin(), points_.end());
+
+	return { true, std::nullopt };
+}
+
+auto ConsistentHashRing::node_for(std::string_view key) const -> size_t
+{
+	if (points_.empty())
+	{
+		return 0;
+	}
+
+	auto position = hash(hash_tag(key));
+	auto found = std::lower_bound(points_.begin(), points_.end(), std::make_pair(position, size_t(0)));
+	if (found == points_.end())
+	{
+		found = points_.begin();
+	}
+	return found->second;
+}
+
+auto ConsistentHashRing::node_count() const -> size_t
+{
+	return nodes_.size();
+}
+
+auto ConsistentHashRing::node_name(size_t index) const -> const std::string&
+{
+	return nodes_.at(index);
+}
+
+auto ConsistentHashRing::hash_tag(std::string_view key) -> std::string_view
+{
+	auto open = key.find('{');
+	if (open == std::string_view::npos)
+	{
+		return key;
+	}
+
+	auto close = key.find('}', open + 1);
+	if (close == std::string_view::npos || close == open + 1)
+	{
+		return key;
+	}
+
+	return key.substr(open + 1, close - open - 1);
+}
+
+auto ConsistentHashRing::hash(std::string_view data) -> uint64_t
+{
+	// FNV-1a is stable across builds and platforms, unlike std::hash; the finalizer spreads
+	// names that differ only in their last characters, such as the point suffixes
+	uint64_t value = 14695981039346656037ull;
+	for (auto character : data)
+	{
+		value ^= static_cast<uint8_t>(character);
+		value *= 1099511628211ull;
+	}
+
+	value ^= value >> 33;
+	value *= 0xff51afd7ed558ccdull;
+	value ^= value >> 33;
+	value *= 0xc4ceb9fe1a85ec53ull;
+	value ^= value >> 33;
+	return value;
+}
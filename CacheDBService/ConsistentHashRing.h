@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// Maps keys onto Redis nodes. Every node owns virtual_nodes points on a 64-bit ring, placed by hashing its name,
+// and a key belongs to the node of the first point at or after the key's hash. Adding a node only moves the keys
+// that fall on its new points, about 1/N of them, and the list order doesn't matter since points depend on names
+// alone. As in Redis Cluster, a key with a non-empty {tag} is hashed on the tag only, so keys sharing a tag share
+// a node. Nodes are added before the ring is shared; lookups are read-only.
+class ConsistentHashRing
+{
+public:
+	ConsistentHashRing(size_t virtual_nodes);
+	virtual ~ConsistentHashRing(void);
+
+	// The node's index is node_count() - 1 once added
+	auto add_node(const std::string& name) -> std::tuple<bool, std::optional<std::string>>;
+	auto node_for(std::string_view key) const -> size_t;
+	auto node_count() const -> size_t;
+	auto node_name(size_t index) const -> const std::string&;
+
+	static auto hash_tag(std::string_view key) -> std::string_view;
+	static auto hash(std::string_view data) -> uint64_t;
+
+private:
+	size_t virtual_nodes_;
+	std::vector<std::string> nodes_;
+	// Sorted by position; ties are broken by node index so the order never depends on insertion
+	std::vector<std::pair<uint64_t, size_t>> points_;
+};
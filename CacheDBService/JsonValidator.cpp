@@ -0,0 +1,116 @@
+#include "JsonValidator.h"
+
+#include "boost/json/basic_parser_impl.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+namespace
+{
+	// Records whether the top-level value is an object; everything below it is only counted
+	class ObjectShapeHandler
+	{
+	public:
+		static constexpr std::size_t max_object_size = std::numeric_limits<std::size_t>::max();
+		static constexpr std::size_t max_array_size = std::numeric_limits<std::size_t>::max();
+		static constexpr std::size_t max_key_size = std::numeric_limits<std::size_t>::max();
+		static constexpr std::size_t max_string_size = std::numeric_limits<std::size_t>::max();
+
+		auto reset() -> void
+		{
+			depth_ = 0;
+			top_level_seen_ = false;
+			top_level_object_ = false;
+		}
+
+		auto top_level_object() const -> bool
+		{
+			return top_level_object_;
+		}
+
+		bool on_document_begin(boost::json::error_code&) { return true; }
+		bool on_document_end(boost::json::error_code&) { return true; }
+
+		bool on_object_begin(boost::json::error_code&)
+		{
+			value_begins(true);
+			++depth_;
+			return true;
+		}
+
+		bool on_object_end(std::size_t, boost::json::error_code&)
+		{
+			--depth_;
+			return true;
+		}
+
+		bool on_array_begin(boost::json::error_code&)
+		{
+			value_begins(false);
+			++depth_;
+			return true;
+		}
+
+		bool on_array_end(std::size_t, boost::json::error_code&)
+		{
+			--depth_;
+			return true;
+		}
+
+		bool on_key_part(boost::json::string_view, std::size_t, boost::json::error_code&) { return true; }
+		bool on_key(boost::json::string_view, std::size_t, boost::json::error_code&) { return true; }
+		bool on_string_part(boost::json::string_view, std::size_t, boost::json::error_code&) { return true; }
+		bool on_number_part(boost::json::string_view, boost::json::error_code&) { return true; }
+		bool on_comment_part(boost::json::string_view, boost::json::error_code&) { return true; }
+		bool on_comment(boost::json::string_view, boost::json::error_code&) { return true; }
+
+		bool on_string(boost::json::string_view, std::size_t, boost::json::error_code&) { return value_begins(false); }
+		bool on_int64(std::int64_t, boost::json::string_view, boost::json::error_code&) { return value_begins(false); }
+		bool on_uint64(std::uint64_t, boost::json::string_view, boost::json::error_code&) { return value_begins(false); }
+		bool on_double(double, boost::json::string_view, boost::json::error_code&) { return value_begins(false); }
+		bool on_bool(bool, boost::json::error_code&) { return value_begins(false); }
+		bool on_null(boost::json::error_code&) { return value_begins(false); }
+
+	private:
+		auto value_begins(bool object) -> bool
+		{
+			if (depth_ == 0 && !top_level_seen_)
+			{
+				top_level_seen_ = true;
+				top_level_object_ = object;
+			}
+			return true;
+		}
+
+		std::size_t depth_ = 0;
+		bool top_level_seen_ = false;
+		bool top_level_object_ = false;
+	};
+}
+
+auto JsonValidator::validate_object(std::string_view json_body) -> std::tuple<bool, std::optional<std::string>>
+{
+	// The parser keeps its state stack between calls, so it is only allocated once per thread
+	thread_local boost::json::basic_parser<ObjectShapeHandler> parser{ boost::json::parse_options() };
+	parser.reset();
+	parser.handler().reset();
+
+	boost::json::error_code ec;
+	auto consumed = parser.write_some(false, json_body.data(), json_body.size(), ec);
+	if (ec)
+	{
+		return { false, std::optional<std::string>("invalid JSON: " + ec.message()) };
+	}
+	if (consumed < json_body.size())
+	{
+		return { false, std::optional<std::string>("invalid JSON: extra data after the object") };
+	}
+
+	if (!parser.handler().top_level_object())
+	{
+		return { false, std::optional<std::string>("message is not a JSON object") };
+	}
+
+	return { true, std::nullopt };
+}
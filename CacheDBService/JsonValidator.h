@@ -0,0 +1,15 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+
+// Checks that a message body is one well-formed JSON object without building a DOM for it.
+// Runs boost::json's SAX parser with handlers that only track nesting, on a parser kept per thread,
+// so validating a body on the enqueue path costs no allocations once the thread has warmed up.
+class JsonValidator
+{
+public:
+	static auto validate_object(std::string_view json_body) -> std::tuple<bool, std::optional<std::string>>;
+};
@@ -0,0 +1,139 @@
+#include "KeyspaceInvalidator.h"
+
+#include "Logger.h"
+
+#include "fmt/format.h"
+
+#include <chrono>
+#include <vector>
+
+using namespace Utilities;
+
+KeyspaceInvalidator::KeyspaceInvalidator(const sw::redis::ConnectionOptions& options,
+										 std::function<void(const std::string&)> on_invalidate,
+										 std::function<void()> on_reset)
+	: options_(options)
+	, on_invalidate_(std::move(on_invalidate))
+	, on_reset_(std::move(on_reset))
+	, channel_prefix_(fmt::format("__keyspace@{}__:", options.db))
+	, stop_requested_(false)
+	, subscribed_(false)
+{
+	// consume() has to return now and then to notice stop()
+	if (options_.socket_timeout.count() <= 0)
+	{
+		options_.socket_timeout = std::chrono::milliseconds(1000);
+	}
+}
+
+KeyspaceInvalidator::~KeyspaceInvalidator(void)
+{
+	stop();
+}
+
+auto KeyspaceInvalidator::start(bool configure_server) -> std::tuple<bool, std::optional<std::string>>
+{
+	stop();
+
+	if (configure_server)
+	{
+		try
+		{
+			sw::redis::Redis redis(options_);
+			enable_notifications(redis);
+		}
+		catch (const sw::redis::Error& e)
+		{
+			return { false, fmt::format("failed to enable keyspace notifications: {}", e.what()) };
+		}
+	}
+
+	stop_requested_ = false;
+	listen_thread_ = std::thread(&KeyspaceInvalidator::listen_loop, this);
+
+	return { true, std::nullopt };
+}
+
+auto KeyspaceInvalidator::stop() -> void
+{
+	stop_requested_ = true;
+	if (listen_thread_.joinable())
+	{
+		listen_thread_.join();
+	}
+	subscribed_ = false;
+}
+
+auto KeyspaceInvalidator::is_subscribed() const -> bool
+{
+	return subscribed_.load(std::memory_order_acquire);
+}
+
+auto KeyspaceInvalidator::enable_notifications(sw::redis::Redis& redis) -> void
+{
+	auto current = redis.command<std::vector<std::string>>("CONFIG", "GET", "notify-keyspace-events");
+	auto flags = current.size() == 2 ? current[1] : std::string();
+
+	// Keyspace channel, plus string writes, generic commands (DEL, RENAME, ...), expiry and eviction; 'A' covers all but K
+	std::string required = flags.find('A') != std::string::npos ? "K" : "K$gxe";
+	auto merged = flags;
+	for (auto flag : required)
+	{
+		if (merged.find(flag) == std::string::npos)
+		{
+			merged += flag;
+		}
+	}
+	if (merged == flags)
+	{
+		return;
+	}
+
+	redis.command<void>("CONFIG", "SET", "notify-keyspace-events", merged);
+	Logger::handle().write(LogTypes::Information, fmt::format("notify-keyspace-events changed from \"{}\" to \"{}\"", flags, merged));
+}
+
+auto KeyspaceInvalidator::listen_loop() -> void
+{
+	while (!stop_requested_)
+	{
+		try
+		{
+			sw::redis::Redis redis(options_);
+			auto subscriber = redis.subscriber();
+			subscriber.on_pmessage([this](std::string, std::string channel, std::string)
+			{
+				if (channel.compare(0, channel_prefix_.size(), channel_prefix_) == 0)
+				{
+					on_invalidate_(channel.substr(channel_prefix_.size()));
+				}
+			});
+			subscriber.psubscribe(channel_prefix_ + "*");
+			subscriber.consume();
+
+			// Whatever changed before this point went unreported
+			on_reset_();
+			subscribed_ = true;
+
+			while (!stop_requested_)
+			{
+				try
+				{
+					subscriber.consume();
+				}
+				catch (const sw::redis::TimeoutError&)
+				{
+				}
+			}
+		}
+		catch (const sw::redis::Error& e)
+		{
+			subscribed_ = false;
+			Logger::handle().write(LogTypes::Error, fmt::format("keyspace subscription lost, retrying: {}", e.what()));
+			for (int wait = 0; wait < 10 && !stop_requested_; ++wait)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			}
+		}
+	}
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <sw/redis++/redis++.h>
+
+#include <atomic>
+#include <functional>
+#include <optional>
+#include <string>
+#include <thread>
+#include <tuple>
+
+// Listens to Redis keyspace notifications (__keyspace@<db>__:<key>) and reports every key another client
+// touched. While the subscription is down nothing is reported, so on each (re)subscribe it calls on_reset
+// first and the caller must treat everything it cached as stale.
+class KeyspaceInvalidator
+{
+public:
+	KeyspaceInvalidator(const sw::redis::ConnectionOptions& options,
+						std::function<void(const std::string&)> on_invalidate,
+						std::function<void()> on_reset);
+	virtual ~KeyspaceInvalidator(void);
+
+	// With configure_server, missing notification classes are added to notify-keyspace-events
+	auto start(bool configure_server) -> std::tuple<bool, std::optional<std::string>>;
+	auto stop() -> void;
+	// False until the first subscription is confirmed and again while it is being re-established
+	auto is_subscribed() const -> bool;
+
+protected:
+	auto enable_notifications(sw::redis::Redis& redis) -> void;
+	auto listen_loop() -> void;
+
+private:
+	sw::redis::ConnectionOptions options_;
+	std::function<void(const std::string&)> on_invalidate_;
+	std::function<void()> on_reset_;
+	std::string channel_prefix_;
+
+	std::atomic<bool> stop_requested_;
+	std::atomic<bool> subscribed_;
+	std::thread listen_thread_;
+};
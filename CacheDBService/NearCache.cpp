@@ -0,0 +1,183 @@
+#include "NearCache.h"
+
+#include <algorithm>
+#include <functional>
+
+NearCache::NearCache(size_t capacity, size_t shard_count)
+	: hits_(0)
+	, misses_(0)
+	, evictions_(0)
+	, expirations_(0)
+	, invalidations_(0)
+{
+	shard_count = std::max<size_t>(shard_count, 1);
+	auto slots_per_shard = std::max<size_t>((capacity + shard_count - 1) / shard_count, 1);
+
+	shards_.reserve(shard_count);
+	for (size_t index = 0; index < shard_count; ++index)
+	{
+		auto shard = std::make_unique<Shard>();
+		shard->slots.resize(slots_per_shard);
+		shard->index.reserve(slots_per_shard);
+		shards_.push_back(std::move(shard));
+	}
+}
+
+NearCache::~NearCache(void)
+{
+}
+
+auto NearCache::get(const std::string& key) -> std::optional<std::string>
+{
+	auto& shard = shard_for(key);
+	std::lock_guard<std::mutex> lock(shard.mutex);
+
+	auto found = shard.index.find(key);
+	if (found == shard.index.end())
+	{
+		++misses_;
+		return std::nullopt;
+	}
+
+	auto& entry = shard.slots[found->second];
+	if (entry.expires_at <= std::chrono::steady_clock::now())
+	{
+		remove(shard, found->second);
+		++expirations_;
+		++misses_;
+		return std::nullopt;
+	}
+
+	entry.referenced = true;
+	++hits_;
+	return entry.value;
+}
+
+auto NearCache::version(const std::string& key) const -> uint64_t
+{
+	return shard_for(key).version.load(std::memory_order_acquire);
+}
+
+auto NearCache::put(const std::string& key, const std::string& value, std::chrono::milliseconds ttl, uint64_t version) -> void
+{
+	if (ttl.count() <= 0)
+	{
+		return;
+	}
+
+	auto& shard = shard_for(key);
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	if (shard.version.load(std::memory_order_relaxed) != version)
+	{
+		return;
+	}
+
+	auto now = std::chrono::steady_clock::now();
+	auto found = shard.index.find(key);
+	if (found != shard.index.end())
+	{
+		auto& entry = shard.slots[found->second];
+		entry.value = value;
+		entry.expires_at = now + ttl;
+		return;
+	}
+
+	// Sweep for a free, expired or unreferenced slot; two turns are enough since the first clears every bit
+	size_t victim = shard.slots.size();
+	for (size_t step = 0; step < shard.slots.size() * 2; ++step)
+	{
+		auto slot = shard.hand;
+		shard.hand = (shard.hand + 1) % shard.slots.size();
+
+		auto& entry = shard.slots[slot];
+		if (!entry.occupied)
+		{
+			victim = slot;
+			break;
+		}
+		if (entry.expires_at <= now)
+		{
+			remove(shard, slot);
+			++expirations_;
+			victim = slot;
+			break;
+		}
+		if (entry.referenced)
+		{
+			entry.referenced = false;
+			continue;
+		}
+
+		remove(shard, slot);
+		++evictions_;
+		victim = slot;
+		break;
+	}
+
+	auto& entry = shard.slots[victim];
+	entry.key = key;
+	entry.value = value;
+	entry.expires_at = now + ttl;
+	entry.occupied = true;
+	entry.referenced = false;
+	shard.index.emplace(key, victim);
+}
+
+auto NearCache::invalidate(const std::string& key) -> void
+{
+	auto& shard = shard_for(key);
+	std::lock_guard<std::mutex> lock(shard.mutex);
+
+	shard.version.fetch_add(1, std::memory_order_release);
+	auto found = shard.index.find(key);
+	if (found == shard.index.end())
+	{
+		return;
+	}
+
+	remove(shard, found->second);
+	++invalidations_;
+}
+
+auto NearCache::clear() -> void
+{
+	for (auto& shard : shards_)
+	{
+		std::lock_guard<std::mutex> lock(shard->mutex);
+		shard->version.fetch_add(1, std::memory_order_release);
+		for (auto& entry : shard->slots)
+		{
+			entry = Entry();
+		}
+		shard->index.clear();
+		shard->hand = 0;
+	}
+}
+
+auto NearCache::stats() const -> NearCacheStats
+{
+	NearCacheStats stats;
+	stats.hits = hits_.load();
+	stats.misses = misses_.load();
+	stats.evictions = evictions_.load();
+	stats.expirations = expirations_.load();
+	stats.invalidations = invalidations_.load();
+	for (const auto& shard : shards_)
+	{
+		std::lock_guard<std::mutex> lock(shard->mutex);
+		stats.entries += shard->index.size();
+	}
+	return stats;
+}
+
+auto NearCache::shard_for(const std::string& key) const -> Shard&
+{
+	return *shards_[std::hash<std::string>{}(key) % shards_.size()];
+}
+
+auto NearCache::remove(Shard& shard, size_t slot) -> void
+{
+	auto& entry = shard.slots[slot];
+	shard.index.erase(entry.key);
+	entry = Entry();
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct NearCacheStats
+{
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	uint64_t evictions = 0;
+	uint64_t expirations = 0;
+	uint64_t invalidations = 0;
+	size_t entries = 0;
+};
+
+// In-process copy of hot Redis values. Keys are spread over shards, each a fixed ring of slots with its own
+// lock, and a full shard evicts with CLOCK: the hand skips (and clears) entries read since its last pass.
+// Entries never outlive the TTL they were stored with. A fill races with invalidations of the same key, so
+// callers take version() before reading Redis and pass it to put(), which drops the value if the shard
+// saw an invalidation in between.
+class NearCache
+{
+public:
+	NearCache(size_t capacity, size_t shard_count);
+	virtual ~NearCache(void);
+
+	auto get(const std::string& key) -> std::optional<std::string>;
+	auto version(const std::string& key) const -> uint64_t;
+	auto put(const std::string& key, const std::string& value, std::chrono::milliseconds ttl, uint64_t version) -> void;
+	auto invalidate(const std::string& key) -> void;
+	auto clear() -> void;
+
+	auto stats() const -> NearCacheStats;
+
+protected:
+	struct Entry
+	{
+		std::string key;
+		std::string value;
+		std::chrono::steady_clock::time_point expires_at;
+		bool occupied = false;
+		bool referenced = false;
+	};
+
+	struct Shard
+	{
+		mutable std::mutex mutex;
+		std::vector<Entry> slots;
+		std::unordered_map<std::string, size_t> index;
+		size_t hand = 0;
+		std::atomic<uint64_t> version{ 0 };
+	};
+
+	auto shard_for(const std::string& key) const -> Shard&;
+	auto remove(Shard& shard, size_t slot) -> void;
+
+private:
+	std::vector<std::unique_ptr<Shard>> shards_;
+
+	std::atomic<uint64_t> hits_;
+	std::atomic<uint64_t> misses_;
+	std::atomic<uint64_t> evictions_;
+	std::atomic<uint64_t> expirations_;
+	std::atomic<uint64_t> invalidations_;
+};
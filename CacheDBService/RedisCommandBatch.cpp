@@ -0,0 +1,85 @@
+#include "RedisCommandBatch.h"
+
+#include <utility>
+
+RedisCommandBatch::RedisCommandBatch(void)
+{
+}
+
+RedisCommandBatch::~RedisCommandBatch(void)
+{
+}
+
+auto RedisCommandBatch::set(const std::string& key, const std::string& value, long ttl_seconds) -> RedisCommandBatch&
+{
+	codings_.push_back(ValueCoding::EncodeValue);
+	if (ttl_seconds > 0)
+	{
+		commands_.push_back({ "SET", key, value, "EX", std::to_string(ttl_seconds) });
+		return *this;
+	}
+
+	commands_.push_back({ "SET", key, value });
+	return *this;
+}
+
+auto RedisCommandBatch::get(const std::string& key) -> RedisCommandBatch&
+{
+	codings_.push_back(ValueCoding::DecodeReply);
+	commands_.push_back({ "GET", key });
+	return *this;
+}
+
+auto RedisCommandBatch::del(const std::string& key) -> RedisCommandBatch&
+{
+	codings_.push_back(ValueCoding::None);
+	commands_.push_back({ "DEL", key });
+	return *this;
+}
+
+auto RedisCommandBatch::expire(const std::string& key, long ttl_seconds) -> RedisCommandBatch&
+{
+	codings_.push_back(ValueCoding::None);
+	commands_.push_back({ "EXPIRE", key, std::to_string(ttl_seconds) });
+	return *this;
+}
+
+auto RedisCommandBatch::incr_by(const std::string& key, long long delta) -> RedisCommandBatch&
+{
+	codings_.push_back(ValueCoding::None);
+	commands_.push_back({ "INCRBY", key, std::to_string(delta) });
+	return *this;
+}
+
+auto RedisCommandBatch::command(std::vector<std::string> arguments) -> RedisCommandBatch&
+{
+	codings_.push_back(ValueCoding::None);
+	commands_.push_back(std::move(arguments));
+	return *this;
+}
+
+auto RedisCommandBatch::commands() const -> const std::vector<std::vector<std::string>>&
+{
+	return commands_;
+}
+
+auto RedisCommandBatch::codings() const -> const std::vector<ValueCoding>&
+{
+	return codings_;
+}
+
+auto RedisCommandBatch::size() const -> size_t
+{
+	return commands_.size();
+}
+
+auto RedisCommandBatch::empty() const -> bool
+{
+	return commands_.empty();
+}
+
+auto RedisCommandBatch::clear() -> void
+{
+	commands_.clear();
+	codings_.clear();
+}
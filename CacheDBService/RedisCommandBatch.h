@@ -0,0 +1,58 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <vector>
+
+struct CacheEntry
+{
+	std::string key;
+	std::string value;
+	long ttl_seconds = 0;
+};
+
+// One reply per queued command. Scalars land in value (nil stays empty, integers are formatted),
+// array replies in elements; a command the server rejected only sets error.
+struct RedisReply
+{
+	std::optional<std::string> value;
+	std::vector<std::optional<std::string>> elements;
+	std::optional<std::string> error;
+};
+
+// Commands collected on the caller's side and sent in one round trip by CacheDBService::execute_batch(),
+// either pipelined or wrapped in MULTI/EXEC. The values of set() and the replies of get() go through the
+// service's ValueCodec like the key/value calls; command() is sent and answered exactly as given.
+class RedisCommandBatch
+{
+public:
+	enum class ValueCoding
+	{
+		None,
+		// The third argument is a cached value to encode
+		EncodeValue,
+		// The reply is a cached value to decode
+		DecodeReply,
+	};
+
+	RedisCommandBatch(void);
+	virtual ~RedisCommandBatch(void);
+
+	auto set(const std::string& key, const std::string& value, long ttl_seconds = 0) -> RedisCommandBatch&;
+	auto get(const std::string& key) -> RedisCommandBatch&;
+	auto del(const std::string& key) -> RedisCommandBatch&;
+	auto expire(const std::string& key, long ttl_seconds) -> RedisCommandBatch&;
+	auto incr_by(const std::string& key, long long delta) -> RedisCommandBatch&;
+	auto command(std::vector<std::string> arguments) -> RedisCommandBatch&;
+
+	auto commands() const -> const std::vector<std::vector<std::string>>&;
+	// One per command
+	auto codings() const -> const std::vector<ValueCoding>&;
+	auto size() const -> size_t;
+	auto empty() const -> bool;
+	auto clear() -> void;
+
+private:
+	std::vector<std::vector<std::string>> commands_;
+	std::vector<ValueCoding> codings_;
+};
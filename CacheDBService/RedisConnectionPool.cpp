@@ -0,0 +1,225 @@
+#include "RedisConnectionPool.h"
+
+#include "Logger.h"
+
+#include "fmt/format.h"
+
+#include <algorithm>
+
+using namespace Utilities;
+
+RedisConnectionPool::RedisConnectionPool(const sw::redis::ConnectionOptions& options, size_t size, int health_check_interval_ms)
+	: options_(options)
+	, health_check_interval_(std::max(1, health_check_interval_ms))
+	, health_stop_requested_(false)
+	, rebuild_requested_(false)
+{
+	size = std::max<size_t>(size, 1);
+	slots_.reserve(size);
+	for (size_t index = 0; index < size; ++index)
+	{
+		slots_.push_back(std::make_unique<Slot>());
+	}
+}
+
+RedisConnectionPool::~RedisConnectionPool(void)
+{
+	stop();
+}
+
+auto RedisConnectionPool::start(int max_retries, int retry_interval_ms) -> std::tuple<bool, std::optional<std::string>>
+{
+	stop();
+
+	std::optional<std::string> last_error;
+	for (int retry = 0; retry < std::max(1, max_retries); ++retry)
+	{
+		for (size_t slot = 0; slot < slots_.size(); ++slot)
+		{
+			if (slots_[slot]->healthy)
+			{
+				continue;
+			}
+			if (auto error = connect(slot); error.has_value())
+			{
+				last_error = error;
+			}
+		}
+
+		if (healthy_count() > 0)
+		{
+			break;
+		}
+
+		Logger::handle().write(LogTypes::Error,
+			fmt::format("Redis connection failed (retry {}/{}): {}", retry + 1, max_retries, last_error.value_or("unknown error")));
+
+		if (retry < max_retries - 1)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(retry_interval_ms));
+		}
+	}
+
+	if (healthy_count() == 0)
+	{
+		return { false, fmt::format("Failed to connect to Redis after {} retries", max_retries) };
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(health_mutex_);
+		health_stop_requested_ = false;
+		rebuild_requested_ = false;
+	}
+	health_thread_ = std::thread(&RedisConnectionPool::health_loop, this);
+
+	Logger::handle().write(LogTypes::Information,
+		fmt::format("Redis pool connected {}/{} connections to {}:{}", healthy_count(), slots_.size(), options_.host, options_.port));
+
+	return { true, std::nullopt };
+}
+
+auto RedisConnectionPool::stop() -> void
+{
+	if (health_thread_.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(health_mutex_);
+			health_stop_requested_ = true;
+		}
+		health_condition_.notify_all();
+		health_thread_.join();
+	}
+}
+
+auto RedisConnectionPool::options() const -> const sw::redis::ConnectionOptions&
+{
+	return options_;
+}
+
+auto RedisConnectionPool::size() const -> size_t
+{
+	return slots_.size();
+}
+
+auto RedisConnectionPool::healthy_count() const -> size_t
+{
+	return static_cast<size_t>(std::count_if(slots_.begin(), slots_.end(), [](const std::unique_ptr<Slot>& slot) { return slot->healthy.load(); }));
+}
+
+auto RedisConnectionPool::acquire() -> std::tuple<size_t, std::shared_ptr<sw::redis::Redis>>
+{
+	// Threads are numbered on first use and keep their slot; pools share the numbering, which is fine for spreading
+	static std::atomic<size_t> next_thread_index{ 0 };
+	thread_local size_t thread_index = next_thread_index.fetch_add(1);
+
+	auto home = thread_index % slots_.size();
+	for (size_t step = 0; step < slots_.size(); ++step)
+	{
+		auto slot = (home + step) % slots_.size();
+		if (!slots_[slot]->healthy.load(std::memory_order_acquire))
+		{
+			continue;
+		}
+
+		std::lock_guard<std::mutex> lock(slots_[slot]->mutex);
+		if (slots_[slot]->connection != nullptr)
+		{
+			return { slot, slots_[slot]->connection };
+		}
+	}
+
+	return { 0, nullptr };
+}
+
+auto RedisConnectionPool::mark_unhealthy(size_t slot, const std::shared_ptr<sw::redis::Redis>& connection) -> void
+{
+	{
+		std::lock_guard<std::mutex> lock(slots_[slot]->mutex);
+		// The health thread may already have replaced the connection that failed
+		if (slots_[slot]->connection != connection)
+		{
+			return;
+		}
+		slots_[slot]->healthy = false;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(health_mutex_);
+		rebuild_requested_ = true;
+	}
+	health_condition_.notify_all();
+}
+
+auto RedisConnectionPool::connect(size_t slot) -> std::optional<std::string>
+{
+	sw::redis::ConnectionPoolOptions pool_options;
+	pool_options.size = 1;
+
+	std::shared_ptr<sw::redis::Redis> connection;
+	try
+	{
+		connection = std::make_shared<sw::redis::Redis>(options_, pool_options);
+		connection->ping();
+	}
+	catch (const sw::redis::Error& e)
+	{
+		return std::optional<std::string>(e.what());
+	}
+
+	std::lock_guard<std::mutex> lock(slots_[slot]->mutex);
+	slots_[slot]->connection = connection;
+	slots_[slot]->healthy = true;
+
+	return std::nullopt;
+}
+
+auto RedisConnectionPool::health_check() -> void
+{
+	for (size_t slot = 0; slot < slots_.size(); ++slot)
+	{
+		if (slots_[slot]->healthy)
+		{
+			std::shared_ptr<sw::redis::Redis> connection;
+			{
+				std::lock_guard<std::mutex> lock(slots_[slot]->mutex);
+				connection = slots_[slot]->connection;
+			}
+
+			try
+			{
+				connection->ping();
+				continue;
+			}
+			catch (const sw::redis::Error& e)
+			{
+				Logger::handle().write(LogTypes::Error, fmt::format("Redis connection {} failed its health check: {}", slot, e.what()));
+				mark_unhealthy(slot, connection);
+			}
+		}
+
+		if (auto error = connect(slot); error.has_value())
+		{
+			Logger::handle().write(LogTypes::Debug, fmt::format("Redis connection {} is still down: {}", slot, error.value()));
+			continue;
+		}
+		Logger::handle().write(LogTypes::Information, fmt::format("Redis connection {} rebuilt", slot));
+	}
+}
+
+auto RedisConnectionPool::health_loop() -> void
+{
+	std::unique_lock<std::mutex> lock(health_mutex_);
+	while (!health_stop_requested_)
+	{
+		health_condition_.wait_for(lock, health_check_interval_, [this]() { return health_stop_requested_ || rebuild_requested_; });
+		if (health_stop_requested_)
+		{
+			break;
+		}
+		rebuild_requested_ = false;
+
+		lock.unlock();
+		health_check();
+		lock.lock();
+	}
+}
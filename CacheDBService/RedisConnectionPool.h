@@ -0,0 +1,90 @@
+#pragma once
+
+#include <sw/redis++/redis++.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+// Fixed set of single-connection Redis clients. Each calling thread is pinned to one slot, so threads don't queue
+// behind each other on a shared socket. A slot that fails with a connection error is taken out of rotation and its
+// callers move to the next healthy slot; the health thread pings every slot on an interval and rebuilds the dead
+// ones, so no request thread ever waits for a reconnect.
+class RedisConnectionPool
+{
+public:
+	RedisConnectionPool(const sw::redis::ConnectionOptions& options, size_t size, int health_check_interval_ms);
+	virtual ~RedisConnectionPool(void);
+
+	// Retries until at least one connection is up; the rest are left to the health thread
+	auto start(int max_retries, int retry_interval_ms) -> std::tuple<bool, std::optional<std::string>>;
+	auto stop() -> void;
+
+	template <typename Action>
+	auto execute(Action&& action) -> std::optional<std::string>
+	{
+		auto [slot, connection] = acquire();
+		if (connection == nullptr)
+		{
+			return std::optional<std::string>("no healthy Redis connection");
+		}
+
+		try
+		{
+			action(*connection);
+		}
+		catch (const sw::redis::IoError& e)
+		{
+			mark_unhealthy(slot, connection);
+			return std::string("Redis connection error: ") + e.what();
+		}
+		catch (const sw::redis::ClosedError& e)
+		{
+			mark_unhealthy(slot, connection);
+			return std::string("Redis connection closed: ") + e.what();
+		}
+		catch (const sw::redis::Error& e)
+		{
+			return std::string("Redis error: ") + e.what();
+		}
+
+		return std::nullopt;
+	}
+
+	auto options() const -> const sw::redis::ConnectionOptions&;
+	auto size() const -> size_t;
+	auto healthy_count() const -> size_t;
+
+protected:
+	auto acquire() -> std::tuple<size_t, std::shared_ptr<sw::redis::Redis>>;
+	auto mark_unhealthy(size_t slot, const std::shared_ptr<sw::redis::Redis>& connection) -> void;
+	auto connect(size_t slot) -> std::optional<std::string>;
+	auto health_check() -> void;
+	auto health_loop() -> void;
+
+private:
+	struct Slot
+	{
+		std::mutex mutex;
+		std::shared_ptr<sw::redis::Redis> connection;
+		std::atomic<bool> healthy{ false };
+	};
+
+	sw::redis::ConnectionOptions options_;
+	std::vector<std::unique_ptr<Slot>> slots_;
+	std::chrono::milliseconds health_check_interval_;
+
+	std::mutex health_mutex_;
+	std::condition_variable health_condition_;
+	bool health_stop_requested_;
+	bool rebuild_requested_;
+	std::thread health_thread_;
+};
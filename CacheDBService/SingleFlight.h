@@ -0,0 +1,68 @@
+#pragma once
+
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Collapses concurrent calls for the same key into one: the first caller runs the function, everyone who
+// arrives while it is running waits for and shares its result. The key is released as soon as the call
+// finishes, so later callers start a fresh one. Exceptions from the function reach every waiter.
+template <typename Result>
+class SingleFlight
+{
+public:
+	SingleFlight(void) = default;
+
+	SingleFlight(const SingleFlight&) = delete;
+	SingleFlight& operator=(const SingleFlight&) = delete;
+
+	auto run(const std::string& key, const std::function<Result()>& function) -> Result
+	{
+		std::promise<Result> promise;
+		std::shared_future<Result> running;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			auto found = calls_.find(key);
+			if (found != calls_.end())
+			{
+				running = found->second;
+			}
+			else
+			{
+				calls_.emplace(key, promise.get_future().share());
+			}
+		}
+		if (running.valid())
+		{
+			return running.get();
+		}
+
+		try
+		{
+			auto result = function();
+			promise.set_value(result);
+			finish(key);
+			return result;
+		}
+		catch (...)
+		{
+			promise.set_exception(std::current_exception());
+			finish(key);
+			throw;
+		}
+	}
+
+protected:
+	auto finish(const std::string& key) -> void
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		calls_.erase(key);
+	}
+
+private:
+	std::mutex mutex_;
+	std::unordered_map<std::string, std::shared_future<Result>> calls_;
+};
@@ -0,0 +1,65 @@
+#include "StreamEntryTracker.h"
+
+#include <algorithm>
+
+StreamEntryTracker::StreamEntryTracker(void)
+{
+}
+
+StreamEntryTracker::~StreamEntryTracker(void)
+{
+}
+
+auto StreamEntryTracker::admit(const std::string& id, uint64_t sequence) -> void
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (in_flight_.insert(id).second)
+	{
+		admitted_.emplace_back(id, sequence);
+	}
+}
+
+auto StreamEntryTracker::in_flight(const std::string& id) const -> bool
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return in_flight_.contains(id);
+}
+
+auto StreamEntryTracker::delivered(uint64_t sequence, size_t max_ids) const -> std::vector<std::string>
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	std::vector<std::string> ids;
+	for (const auto& [id, admitted_at] : admitted_)
+	{
+		if (admitted_at > sequence || ids.size() >= max_ids)
+		{
+			break;
+		}
+		ids.push_back(id);
+	}
+	return ids;
+}
+
+auto StreamEntryTracker::acknowledged(size_t count) -> void
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	count = std::min(count, admitted_.size());
+	for (auto entry = admitted_.begin(); entry != admitted_.begin() + count; ++entry)
+	{
+		in_flight_.erase(std::get<0>(*entry));
+	}
+	admitted_.erase(admitted_.begin(), admitted_.begin() + count);
+}
+
+auto StreamEntryTracker::size() const -> size_t
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return admitted_.size();
+}
+
+auto StreamEntryTracker::clear() -> void
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	admitted_.clear();
+	in_flight_.clear();
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <unordered_set>
+#include <vector>
+
+// Stream entries admitted to the pipeline and not yet XACKed, each tagged with the sequence its operation got
+// on the way in (its spool record, or its place in the pending queue). The flush loop only XACKs an entry once
+// everything up to that sequence has been delivered, however many collects and publishes that took.
+class StreamEntryTracker
+{
+public:
+	StreamEntryTracker(void);
+	virtual ~StreamEntryTracker(void);
+
+	// Stream consumer; sequences only grow
+	auto admit(const std::string& id, uint64_t sequence) -> void;
+	// Admitted ids stay in our pending list until XACKed, so XAUTOCLAIM and the pending-list replay hand them
+	// back; those must not be admitted a second time
+	auto in_flight(const std::string& id) const -> bool;
+
+	// Flush loop: the oldest ids, at most max_ids, admitted at or before the delivered sequence
+	auto delivered(uint64_t sequence, size_t max_ids) const -> std::vector<std::string>;
+	// Flush loop: the first count ids returned by delivered() have been XACKed
+	auto acknowledged(size_t count) -> void;
+
+	auto size() const -> size_t;
+	auto clear() -> void;
+
+private:
+	mutable std::mutex mutex_;
+	// In admission order, so by sequence too
+	std::deque<std::tuple<std::string, uint64_t>> admitted_;
+	std::unordered_set<std::string> in_flight_;
+};
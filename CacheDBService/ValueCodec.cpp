@@ -0,0 +1,178 @@
+#include "ValueCodec.h"
+
+#include "fmt/format.h"
+
+#include <lz4.h>
+
+namespace
+{
+	constexpr char magic[2] = { '\x00', '\xC7' };
+	constexpr size_t header_size = 4;
+	// Guards the allocation against a corrupt size field; far above anything worth caching
+	constexpr uint64_t max_decoded_size = 512ull * 1024 * 1024;
+
+	auto append_varint(std::string& target, uint64_t value) -> void
+	{
+		while (value >= 0x80)
+		{
+			target.push_back(static_cast<char>((value & 0x7F) | 0x80));
+			value >>= 7;
+		}
+		target.push_back(static_cast<char>(value));
+	}
+
+	auto read_varint(const std::string& source, size_t& offset) -> std::optional<uint64_t>
+	{
+		uint64_t value = 0;
+		for (int shift = 0; shift < 64 && offset < source.size(); shift += 7)
+		{
+			auto byte = static_cast<uint8_t>(source[offset++]);
+			value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+			if ((byte & 0x80) == 0)
+			{
+				return value;
+			}
+		}
+		return std::nullopt;
+	}
+}
+
+ValueCodec::ValueCodec(bool binary, size_t compression_threshold)
+	: binary_(binary)
+	, compression_threshold_(compression_threshold)
+{
+}
+
+ValueCodec::~ValueCodec(void)
+{
+}
+
+auto ValueCodec::encode(const std::string& value, std::chrono::milliseconds recompute_time) const -> std::string
+{
+	// Raw values are stored as they are, unless they would read back as a frame
+	if (!binary_ && !is_framed(value))
+	{
+		return value;
+	}
+
+	uint8_t flags = recompute_time.count() > 0 ? Flags::RecomputeTime : 0;
+	std::string stored;
+	stored.append(magic, sizeof(magic));
+	stored.push_back(static_cast<char>(format_version));
+
+	if (binary_ && compression_threshold_ > 0 && value.size() >= compression_threshold_ && value.size() <= LZ4_MAX_INPUT_SIZE)
+	{
+		stored.push_back(static_cast<char>(flags | Flags::Lz4));
+		append_varint(stored, value.size());
+		if ((flags & Flags::RecomputeTime) != 0)
+		{
+			append_varint(stored, static_cast<uint64_t>(recompute_time.count()));
+		}
+
+		// Compress straight into the output and keep it only if it actually saved space
+		auto offset = stored.size();
+		auto bound = LZ4_compressBound(static_cast<int>(value.size()));
+		stored.resize(offset + static_cast<size_t>(bound));
+		auto written = LZ4_compress_default(value.data(), stored.data() + offset, static_cast<int>(value.size()), bound);
+		if (written > 0 && static_cast<size_t>(written) < value.size())
+		{
+			stored.resize(offset + static_cast<size_t>(written));
+			return stored;
+		}
+
+		stored.resize(header_size - 1);
+	}
+
+	stored.push_back(static_cast<char>(flags));
+	if ((flags & Flags::RecomputeTime) != 0)
+	{
+		append_varint(stored, static_cast<uint64_t>(recompute_time.count()));
+	}
+	stored.append(value);
+	return stored;
+}
+
+auto ValueCodec::decode(const std::string& stored) const -> std::tuple<std::optional<std::string>, std::optional<std::string>>
+{
+	if (!is_framed(stored))
+	{
+		return { stored, std::nullopt };
+	}
+	if (stored.size() < header_size)
+	{
+		return { std::nullopt, std::optional<std::string>("truncated cached value header") };
+	}
+
+	auto version = static_cast<uint8_t>(stored[2]);
+	if (version != format_version)
+	{
+		return { std::nullopt, fmt::format("unsupported cached value format version {}", version) };
+	}
+
+	auto flags = static_cast<uint8_t>(stored[3]);
+	if ((flags & ~(Flags::Lz4 | Flags::RecomputeTime)) != 0)
+	{
+		return { std::nullopt, fmt::format("unknown cached value flags 0x{:02x}", flags) };
+	}
+
+	size_t offset = header_size;
+	std::optional<uint64_t> raw_size;
+	if ((flags & Flags::Lz4) != 0)
+	{
+		raw_size = read_varint(stored, offset);
+		if (!raw_size.has_value() || raw_size.value() > max_decoded_size)
+		{
+			return { std::nullopt, std::optional<std::string>("corrupt compressed value size") };
+		}
+	}
+	if ((flags & Flags::RecomputeTime) != 0 && !read_varint(stored, offset).has_value())
+	{
+		return { std::nullopt, std::optional<std::string>("truncated cached value header") };
+	}
+
+	if (!raw_size.has_value())
+	{
+		return { stored.substr(offset), std::nullopt };
+	}
+	if (stored.size() - offset > LZ4_MAX_INPUT_SIZE)
+	{
+		return { std::nullopt, std::optional<std::string>("corrupt compressed value size") };
+	}
+
+	std::string value(static_cast<size_t>(raw_size.value()), '\0');
+	auto read = LZ4_decompress_safe(stored.data() + offset, value.data(), static_cast<int>(stored.size() - offset), static_cast<int>(value.size()));
+	if (read < 0 || static_cast<uint64_t>(read) != raw_size.value())
+	{
+		return { std::nullopt, std::optional<std::string>("corrupt compressed value") };
+	}
+
+	return { value, std::nullopt };
+}
+
+auto ValueCodec::recompute_time(const std::string& stored) const -> std::chrono::milliseconds
+{
+	if (!is_framed(stored) || stored.size() < header_size || static_cast<uint8_t>(stored[2]) != format_version)
+	{
+		return std::chrono::milliseconds(0);
+	}
+
+	auto flags = static_cast<uint8_t>(stored[3]);
+	if ((flags & Flags::RecomputeTime) == 0)
+	{
+		return std::chrono::milliseconds(0);
+	}
+
+	size_t offset = header_size;
+	if ((flags & Flags::Lz4) != 0 && !read_varint(stored, offset).has_value())
+	{
+		return std::chrono::milliseconds(0);
+	}
+
+	auto recompute_ms = read_varint(stored, offset);
+	return std::chrono::milliseconds(static_cast<std::chrono::milliseconds::rep>(recompute_ms.value_or(0)));
+}
+
+auto ValueCodec::is_framed(const std::string& stored) const -> bool
+{
+	return stored.size() >= sizeof(magic) && stored[0] == magic[0] && stored[1] == magic[1];
+}
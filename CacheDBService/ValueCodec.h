@@ -0,0 +1,44 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <tuple>
+
+// Turns cached values into what is stored in Redis and back. With binary enabled a value is framed as
+//   0x00 0xC7 | version | flags | [raw size, varint, if compressed] | [recompute ms, varint, if given] | payload
+// and compressed with LZ4 once it reaches compression_threshold bytes, if that makes it smaller (0 never
+// compresses). Text and JSON never start with 0x00, so anything without the two magic bytes is a value
+// written before the codec existed, or with binary disabled, and decodes unchanged. With binary disabled a
+// value that does start with the magic bytes is framed anyway, uncompressed, so it reads back as written;
+// only such a value stored before the codec existed is ambiguous. Decoding always understands both forms,
+// which keeps switching between them safe. Override encode/decode for another format.
+// The recompute time is what the value took to load; read-through callers use it to refresh ahead of expiry.
+class ValueCodec
+{
+public:
+	ValueCodec(bool binary, size_t compression_threshold);
+	virtual ~ValueCodec(void);
+
+	virtual auto encode(const std::string& value, std::chrono::milliseconds recompute_time = std::chrono::milliseconds(0)) const -> std::string;
+	virtual auto decode(const std::string& stored) const -> std::tuple<std::optional<std::string>, std::optional<std::string>>;
+	// Zero when the value carries none
+	virtual auto recompute_time(const std::string& stored) const -> std::chrono::milliseconds;
+
+	static constexpr uint8_t format_version = 1;
+
+protected:
+	enum Flags : uint8_t
+	{
+		Lz4 = 0x01,
+		RecomputeTime = 0x02,
+	};
+
+	auto is_framed(const std::string& stored) const -> bool;
+
+private:
+	bool binary_;
+	size_t compression_threshold_;
+};
@@ -0,0 +1,880 @@
+#include "WriteAheadSpool.h"
+
+#include "Logger.h"
+
+#include "fmt/format.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace Utilities;
+
+namespace
+{
+	// Segment file: 16-byte header, then records of { uint32 length word, uint32 checksum, payload } padded to 8 bytes.
+	// The length word is claimed under the append lock and gets COMMITTED once the payload is in place; a zero
+	// word is the end of what has been claimed.
+	constexpr char SEGMENT_MAGIC[8] = { 'C', 'D', 'B', 'S', 'P', 'O', 'O', 'L' };
+	constexpr uint32_t SEGMENT_VERSION = 1;
+	constexpr size_t SEGMENT_HEADER_SIZE = 16;
+	constexpr size_t RECORD_HEADER_SIZE = 8;
+	constexpr uint32_t COMMITTED = 0x80000000u;
+	// Set by recovery on records that were claimed but never finished, failed their checksum, or ran past the segment
+	constexpr uint32_t DISCARDED = 0x40000000u;
+	constexpr uint32_t LENGTH_MASK = 0x3FFFFFFFu;
+	constexpr size_t NOT_SEALED = static_cast<size_t>(-1);
+
+	auto record_size(size_t length) -> size_t
+	{
+		return (RECORD_HEADER_SIZE + length + 7) & ~static_cast<size_t>(7);
+	}
+
+	auto checksum(std::string_view payload) -> uint32_t
+	{
+		// FNV-1a; catches torn pages after a power loss, which is all it has to do
+		uint32_t hash = 2166136261u;
+		for (auto character : payload)
+		{
+			hash ^= static_cast<uint8_t>(character);
+			hash *= 16777619u;
+		}
+		return hash;
+	}
+
+	auto last_error_message() -> std::string
+	{
+#ifdef _WIN32
+		return fmt::format("error {}", GetLastError());
+#else
+		return std::strerror(errno);
+#endif
+	}
+}
+
+struct WriteAheadSpool::Segment
+{
+	uint64_t id = 0;
+	std::filesystem::path path;
+	char* data = nullptr;
+	size_t capacity = 0;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#else
+	int file = -1;
+#endif
+
+	// Guarded by append_mutex_
+	size_t reserved = SEGMENT_HEADER_SIZE;
+	// Where appends stopped once the next segment took over
+	std::atomic<size_t> sealed_at{ NOT_SEALED };
+	// Sync thread only; everything before synced is committed and on disk
+	size_t synced = 0;
+	bool directory_synced = false;
+	// Found by open(); its records predate the current sequence numbering
+	bool recovered = false;
+	// Every record is acknowledged; the file is deleted with the last reference
+	std::atomic<bool> retired{ false };
+
+	auto length_word(size_t offset) -> std::atomic_ref<uint32_t>
+	{
+		return std::atomic_ref<uint32_t>(*reinterpret_cast<uint32_t*>(data + offset));
+	}
+
+	auto flush(size_t from, size_t to) -> std::optional<std::string>
+	{
+		if (to <= from)
+		{
+			return std::nullopt;
+		}
+#ifdef _WIN32
+		if (!FlushViewOfFile(data + from, to - from) || !FlushFileBuffers(file))
+		{
+			return fmt::format("failed to sync spool segment {}: {}", path.string(), last_error_message());
+		}
+#else
+		static const auto page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+		auto aligned = from - from % page_size;
+		if (msync(data + aligned, to - aligned, MS_SYNC) != 0)
+		{
+			return fmt::format("failed to sync spool segment {}: {}", path.string(), last_error_message());
+		}
+#endif
+		return std::nullopt;
+	}
+
+	~Segment()
+	{
+#ifdef _WIN32
+		if (data != nullptr)
+		{
+			UnmapViewOfFile(data);
+		}
+		if (mapping != nullptr)
+		{
+			CloseHandle(mapping);
+		}
+		if (file != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(file);
+		}
+#else
+		if (data != nullptr)
+		{
+			munmap(data, capacity);
+		}
+		if (file >= 0)
+		{
+			::close(file);
+		}
+#endif
+		if (retired)
+		{
+			std::error_code error;
+			std::filesystem::remove(path, error);
+		}
+	}
+};
+
+WriteAheadSpool::WriteAheadSpool(const std::string& directory, size_t segment_bytes, size_t max_segments, int sync_interval_ms)
+	: directory_(directory)
+	, segment_bytes_(std::max(segment_bytes, SEGMENT_HEADER_SIZE + record_size(4096)))
+	, max_segments_(std::max<size_t>(max_segments, 2))
+	, sync_interval_(std::max(1, sync_interval_ms))
+	, next_segment_id_(1)
+	, appended_sequence_(0)
+	, accepting_(false)
+	, writers_(0)
+	, read_segment_(nullptr)
+	, read_offset_(SEGMENT_HEADER_SIZE)
+	, acknowledged_segment_id_(0)
+	, acknowledged_offset_(0)
+	, read_sequence_(0)
+	, acknowledged_sequence_(0)
+	, appended_records_(0)
+	, appended_bytes_(0)
+	, read_records_(0)
+	, read_bytes_(0)
+	, sync_stop_requested_(false)
+	, spare_requested_(false)
+{
+}
+
+WriteAheadSpool::~WriteAheadSpool(void)
+{
+	close();
+}
+
+auto WriteAheadSpool::open() -> std::tuple<bool, std::optional<std::string>>
+{
+	close();
+
+	std::error_code error;
+	std::filesystem::create_directories(directory_, error);
+	if (error)
+	{
+		return { false, fmt::format("failed to create spool directory {}: {}", directory_.string(), error.message()) };
+	}
+	std::filesystem::remove(directory_ / "checkpoint.tmp", error);
+
+	std::vector<uint64_t> ids;
+	for (const auto& entry : std::filesystem::directory_iterator(directory_, error))
+	{
+		auto stem = entry.path().stem().string();
+		if (entry.path().extension() != ".seg" || stem.empty() || !std::all_of(stem.begin(), stem.end(), [](unsigned char character) { return std::isdigit(character) != 0; }))
+		{
+			continue;
+		}
+		ids.push_back(std::stoull(stem));
+	}
+	std::sort(ids.begin(), ids.end());
+
+	uint64_t checkpoint_segment = 0;
+	size_t checkpoint_offset = SEGMENT_HEADER_SIZE;
+	if (auto checkpoint = load_checkpoint(); checkpoint.has_value())
+	{
+		std::tie(checkpoint_segment, checkpoint_offset) = checkpoint.value();
+	}
+
+	std::lock_guard<std::mutex> lock(append_mutex_);
+	segments_.clear();
+	read_segment_.reset();
+	read_offset_ = SEGMENT_HEADER_SIZE;
+	appended_sequence_ = 0;
+	read_sequence_ = 0;
+	acknowledged_sequence_ = 0;
+	appended_records_ = 0;
+	appended_bytes_ = 0;
+	read_records_ = 0;
+	read_bytes_ = 0;
+
+	for (auto id : ids)
+	{
+		next_segment_id_ = id + 1;
+
+		auto [segment, open_error] = open_segment(id, false);
+		if (segment == nullptr)
+		{
+			return { false, open_error };
+		}
+		if (id < checkpoint_segment || segment->capacity < SEGMENT_HEADER_SIZE ||
+			std::memcmp(segment->data, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC)) != 0)
+		{
+			// Fully acknowledged, or created right before a crash and never written
+			segment->retired = true;
+			continue;
+		}
+
+		if (read_segment_ == nullptr)
+		{
+			read_segment_ = segment;
+			read_offset_ = id == checkpoint_segment ? std::max(checkpoint_offset, SEGMENT_HEADER_SIZE) : SEGMENT_HEADER_SIZE;
+		}
+		segment->recovered = true;
+		recover_segment(*segment, true);
+		segments_.push_back(segment);
+	}
+
+	// Recovered segments are only read from; appends go to a fresh segment
+	auto [segment, create_error] = open_segment(next_segment_id_, true);
+	if (segment == nullptr)
+	{
+		segments_.clear();
+		read_segment_.reset();
+		return { false, create_error };
+	}
+	++next_segment_id_;
+	if (!segments_.empty())
+	{
+		segments_.back()->sealed_at = segments_.back()->reserved;
+	}
+	segments_.push_back(segment);
+	if (read_segment_ == nullptr)
+	{
+		read_segment_ = segment;
+		read_offset_ = SEGMENT_HEADER_SIZE;
+	}
+	acknowledged_segment_id_ = read_segment_->id;
+	acknowledged_offset_ = read_offset_;
+
+	accepting_ = true;
+	sync_stop_requested_ = false;
+	spare_requested_ = true;
+	sync_thread_ = std::thread(&WriteAheadSpool::sync_loop, this);
+
+	if (appended_records_ > 0)
+	{
+		Logger::handle().write(LogTypes::Information, fmt::format("spool recovered {} unacknowledged records ({} bytes) from {}",
+			appended_records_.load(), appended_bytes_.load(), directory_.string()));
+	}
+
+	return { true, std::nullopt };
+}
+
+auto WriteAheadSpool::close() -> void
+{
+	// No new claims, then let the writers holding one finish their copy before anything is unmapped
+	{
+		std::lock_guard<std::mutex> lock(append_mutex_);
+		accepting_ = false;
+	}
+	for (auto writers = writers_.load(); writers != 0; writers = writers_.load())
+	{
+		writers_.wait(writers);
+	}
+
+	if (sync_thread_.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(sync_wait_mutex_);
+			sync_stop_requested_ = true;
+		}
+		sync_condition_.notify_all();
+		sync_thread_.join();
+	}
+
+	if (auto error = sync(); error.has_value())
+	{
+		Logger::handle().write(LogTypes::Error, error.value());
+	}
+
+	std::lock_guard<std::mutex> lock(append_mutex_);
+	read_segment_.reset();
+	segments_.clear();
+	if (spare_segment_ != nullptr)
+	{
+		// Never written to, so nothing to keep
+		spare_segment_->retired = true;
+		spare_segment_.reset();
+	}
+}
+
+auto WriteAheadSpool::append(std::string_view record) -> std::tuple<bool, std::optional<std::string>>
+{
+	uint64_t sequence = 0;
+	return append(record, sequence);
+}
+
+auto WriteAheadSpool::append(std::string_view record, uint64_t& sequence) -> std::tuple<bool, std::optional<std::string>>
+{
+	// A zero length word marks the end of the log
+	if (record.empty())
+	{
+		return { false, std::optional<std::string>("empty records can't be spooled") };
+	}
+	auto size = record_size(record.size());
+	if (record.size() > LENGTH_MASK || size > segment_bytes_ - SEGMENT_HEADER_SIZE)
+	{
+		return { false, fmt::format("record of {} bytes does not fit in a spool segment", record.size()) };
+	}
+
+	std::shared_ptr<Segment> segment;
+	size_t offset = 0;
+	{
+		std::lock_guard<std::mutex> lock(append_mutex_);
+		if (!accepting_ || segments_.empty())
+		{
+			return { false, std::optional<std::string>("spool is not open") };
+		}
+		if (segments_.back()->reserved + size > segments_.back()->capacity)
+		{
+			auto [rolled, roll_error] = roll_segment();
+			if (!rolled)
+			{
+				return { false, roll_error };
+			}
+		}
+
+		segment = segments_.back();
+		offset = segment->reserved;
+		segment->reserved += size;
+		sequence = ++appended_sequence_;
+		segment->length_word(offset).store(static_cast<uint32_t>(record.size()), std::memory_order_release);
+		writers_.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	auto sum = checksum(record);
+	std::memcpy(segment->data + offset + sizeof(uint32_t), &sum, sizeof(sum));
+	std::memcpy(segment->data + offset + RECORD_HEADER_SIZE, record.data(), record.size());
+	segment->length_word(offset).store(static_cast<uint32_t>(record.size()) | COMMITTED, std::memory_order_release);
+
+	appended_bytes_ += record.size();
+	++appended_records_;
+
+	if (writers_.fetch_sub(1, std::memory_order_release) == 1)
+	{
+		writers_.notify_all();
+	}
+
+	return { true, std::nullopt };
+}
+
+auto WriteAheadSpool::read(size_t max_records, std::vector<std::string>& records) -> std::optional<std::string>
+{
+	if (read_segment_ == nullptr)
+	{
+		return std::optional<std::string>("spool is not open");
+	}
+
+	size_t skipped = 0;
+	size_t count = 0;
+	while (count < max_records)
+	{
+		auto& segment = *read_segment_;
+		// Records of a sealed segment end where appends stopped; recovery seals at the first word it can't trust
+		auto limit = std::min(segment.capacity, segment.sealed_at.load(std::memory_order_acquire));
+		if (read_offset_ + RECORD_HEADER_SIZE <= limit)
+		{
+			auto word = segment.length_word(read_offset_).load(std::memory_order_acquire);
+			auto length = static_cast<size_t>(word & LENGTH_MASK);
+			if (word != 0 && read_offset_ + record_size(length) > limit)
+			{
+				// Only a damaged file gets here; nothing past this word can be located
+				Logger::handle().write(LogTypes::Error, fmt::format("spool segment {} has a record running past its end at offset {}", segment.path.string(), read_offset_));
+				read_offset_ = limit;
+				continue;
+			}
+			if ((word & COMMITTED) != 0 && (word & DISCARDED) == 0)
+			{
+				std::string_view payload(segment.data + read_offset_ + RECORD_HEADER_SIZE, length);
+				uint32_t stored = 0;
+				std::memcpy(&stored, segment.data + read_offset_ + sizeof(uint32_t), sizeof(stored));
+				if (stored == checksum(payload))
+				{
+					records.emplace_back(payload);
+					++count;
+				}
+				else
+				{
+					++skipped;
+				}
+				read_offset_ += record_size(length);
+				if (!segment.recovered)
+				{
+					++read_sequence_;
+				}
+				++read_records_;
+				read_bytes_ += length;
+				continue;
+			}
+			if ((word & DISCARDED) != 0)
+			{
+				read_offset_ += record_size(length);
+				continue;
+			}
+			if (word != 0)
+			{
+				// Claimed, still being copied in
+				break;
+			}
+		}
+
+		// Nothing more at the cursor: move on only if this segment stopped taking appends at this point
+		std::shared_ptr<Segment> next;
+		{
+			std::lock_guard<std::mutex> lock(append_mutex_);
+			auto current = std::find(segments_.begin(), segments_.end(), read_segment_);
+			if (current != segments_.end() && std::next(current) != segments_.end())
+			{
+				next = *std::next(current);
+			}
+		}
+		if (next == nullptr || read_offset_ < segment.sealed_at.load(std::memory_order_acquire))
+		{
+			break;
+		}
+		read_segment_ = next;
+		read_offset_ = SEGMENT_HEADER_SIZE;
+	}
+
+	if (skipped > 0)
+	{
+		return fmt::format("skipped {} spooled records with a bad checksum", skipped);
+	}
+	return std::nullopt;
+}
+
+auto WriteAheadSpool::acknowledge() -> std::tuple<bool, std::optional<std::string>>
+{
+	if (read_segment_ == nullptr)
+	{
+		return { false, std::optional<std::string>("spool is not open") };
+	}
+	if (read_segment_->id == acknowledged_segment_id_ && read_offset_ == acknowledged_offset_)
+	{
+		return { true, std::nullopt };
+	}
+
+	// Persist the position before dropping segments; a crash in between only replays what was delivered
+	if (auto error = save_checkpoint(read_segment_->id, read_offset_); error.has_value())
+	{
+		return { false, error };
+	}
+	acknowledged_segment_id_ = read_segment_->id;
+	acknowledged_offset_ = read_offset_;
+	acknowledged_sequence_ = read_sequence_;
+
+	std::lock_guard<std::mutex> lock(append_mutex_);
+	while (segments_.size() > 1 && segments_.front() != read_segment_)
+	{
+		segments_.front()->retired = true;
+		segments_.pop_front();
+	}
+
+	return { true, std::nullopt };
+}
+
+auto WriteAheadSpool::acknowledged_sequence() const -> uint64_t
+{
+	return acknowledged_sequence_;
+}
+
+auto WriteAheadSpool::sync() -> std::optional<std::string>
+{
+	std::lock_guard<std::mutex> sync_lock(sync_mutex_);
+
+	std::vector<std::tuple<std::shared_ptr<Segment>, size_t>> targets;
+	{
+		std::lock_guard<std::mutex> lock(append_mutex_);
+		for (const auto& segment : segments_)
+		{
+			if (segment->synced < segment->reserved || !segment->directory_synced)
+			{
+				targets.emplace_back(segment, segment->reserved);
+			}
+		}
+	}
+
+	bool directory_dirty = false;
+	for (auto& [segment, reserved] : targets)
+	{
+		// Only up to the first record still being copied: a later pass starts from the page it is on,
+		// so its COMMITTED word is flushed once it lands
+		auto committed = std::max(segment->synced, SEGMENT_HEADER_SIZE);
+		while (committed + RECORD_HEADER_SIZE <= reserved)
+		{
+			auto word = segment->length_word(committed).load(std::memory_order_acquire);
+			if ((word & (COMMITTED | DISCARDED)) == 0)
+			{
+				break;
+			}
+			committed += record_size(word & LENGTH_MASK);
+		}
+
+		if (auto error = segment->flush(segment->synced, committed); error.has_value())
+		{
+			return error;
+		}
+		segment->synced = committed;
+		directory_dirty = directory_dirty || !segment->directory_synced;
+		segment->directory_synced = true;
+	}
+
+	// New segment files must survive a power loss too, not only their contents
+	if (directory_dirty)
+	{
+		return sync_directory();
+	}
+
+	return std::nullopt;
+}
+
+auto WriteAheadSpool::pending_records() const -> size_t
+{
+	auto appended = appended_records_.load();
+	auto read = read_records_.load();
+	return appended > read ? appended - read : 0;
+}
+
+auto WriteAheadSpool::pending_bytes() const -> size_t
+{
+	auto appended = appended_bytes_.load();
+	auto read = read_bytes_.load();
+	return appended > read ? appended - read : 0;
+}
+
+auto WriteAheadSpool::open_segment(uint64_t id, bool create) -> std::tuple<std::shared_ptr<Segment>, std::optional<std::string>>
+{
+	auto segment = std::make_shared<Segment>();
+	segment->id = id;
+	segment->path = segment_path(id);
+
+#ifdef _WIN32
+	segment->file = CreateFileW(segment->path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+		create ? CREATE_NEW : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (segment->file == INVALID_HANDLE_VALUE)
+	{
+		return { nullptr, fmt::format("failed to open spool segment {}: {}", segment->path.string(), last_error_message()) };
+	}
+
+	if (create)
+	{
+		segment->capacity = segment_bytes_;
+	}
+	else
+	{
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(segment->file, &size))
+		{
+			return { nullptr, fmt::format("failed to stat spool segment {}: {}", segment->path.string(), last_error_message()) };
+		}
+		segment->capacity = static_cast<size_t>(size.QuadPart);
+	}
+	if (segment->capacity == 0)
+	{
+		return { segment, std::nullopt };
+	}
+
+	// Mapping a new file at full size extends it, so no separate allocation step
+	auto capacity = static_cast<uint64_t>(segment->capacity);
+	segment->mapping = CreateFileMappingW(segment->file, nullptr, PAGE_READWRITE,
+		static_cast<DWORD>(capacity >> 32), static_cast<DWORD>(capacity & 0xFFFFFFFFu), nullptr);
+	if (segment->mapping == nullptr)
+	{
+		return { nullptr, fmt::format("failed to map spool segment {}: {}", segment->path.string(), last_error_message()) };
+	}
+	segment->data = static_cast<char*>(MapViewOfFile(segment->mapping, FILE_MAP_ALL_ACCESS, 0, 0, segment->capacity));
+	if (segment->data == nullptr)
+	{
+		return { nullptr, fmt::format("failed to map spool segment {}: {}", segment->path.string(), last_error_message()) };
+	}
+#else
+	segment->file = ::open(segment->path.c_str(), O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_EXCL : 0), 0644);
+	if (segment->file < 0)
+	{
+		return { nullptr, fmt::format("failed to open spool segment {}: {}", segment->path.string(), last_error_message()) };
+	}
+
+	if (create)
+	{
+		// Allocate the blocks up front: running out of disk under a mapping is a SIGBUS, not an error code
+#ifdef __APPLE__
+		if (ftruncate(segment->file, static_cast<off_t>(segment_bytes_)) != 0)
+		{
+			return { nullptr, fmt::format("failed to allocate spool segment {}: {}", segment->path.string(), last_error_message()) };
+		}
+#else
+		if (auto result = posix_fallocate(segment->file, 0, static_cast<off_t>(segment_bytes_)); result != 0)
+		{
+			return { nullptr, fmt::format("failed to allocate spool segment {}: {}", segment->path.string(), std::strerror(result)) };
+		}
+#endif
+		segment->capacity = segment_bytes_;
+	}
+	else
+	{
+		struct stat status;
+		if (fstat(segment->file, &status) != 0)
+		{
+			return { nullptr, fmt::format("failed to stat spool segment {}: {}", segment->path.string(), last_error_message()) };
+		}
+		segment->capacity = static_cast<size_t>(status.st_size);
+	}
+	if (segment->capacity == 0)
+	{
+		return { segment, std::nullopt };
+	}
+
+	auto* address = mmap(nullptr, segment->capacity, PROT_READ | PROT_WRITE, MAP_SHARED, segment->file, 0);
+	if (address == MAP_FAILED)
+	{
+		return { nullptr, fmt::format("failed to map spool segment {}: {}", segment->path.string(), last_error_message()) };
+	}
+	segment->data = static_cast<char*>(address);
+#endif
+
+	if (create)
+	{
+		std::memcpy(segment->data, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC));
+		std::memcpy(segment->data + sizeof(SEGMENT_MAGIC), &SEGMENT_VERSION, sizeof(SEGMENT_VERSION));
+	}
+
+	return { segment, std::nullopt };
+}
+
+auto WriteAheadSpool::roll_segment() -> std::tuple<bool, std::optional<std::string>>
+{
+	if (segments_.size() >= max_segments_)
+	{
+		return { false, fmt::format("spool is full ({} segments of {} bytes)", segments_.size(), segment_bytes_) };
+	}
+
+	// The sync thread keeps a spare ready, so this is normally a swap; creating one here only happens when
+	// appends outrun it, and holds up every producer while the file is allocated and mapped
+	auto segment = std::move(spare_segment_);
+	if (segment == nullptr)
+	{
+		std::optional<std::string> create_error;
+		std::tie(segment, create_error) = open_segment(next_segment_id_, true);
+		if (segment == nullptr)
+		{
+			return { false, create_error };
+		}
+		++next_segment_id_;
+	}
+
+	segments_.back()->sealed_at.store(segments_.back()->reserved, std::memory_order_release);
+	segments_.push_back(segment);
+
+	{
+		std::lock_guard<std::mutex> lock(sync_wait_mutex_);
+		spare_requested_ = true;
+	}
+	sync_condition_.notify_all();
+
+	return { true, std::nullopt };
+}
+
+auto WriteAheadSpool::prepare_segment() -> std::optional<std::string>
+{
+	uint64_t id = 0;
+	{
+		std::lock_guard<std::mutex> lock(append_mutex_);
+		if (!accepting_ || spare_segment_ != nullptr)
+		{
+			return std::nullopt;
+		}
+		id = next_segment_id_++;
+	}
+
+	auto [segment, create_error] = open_segment(id, true);
+	if (segment == nullptr)
+	{
+		return create_error;
+	}
+
+	std::lock_guard<std::mutex> lock(append_mutex_);
+	if (!accepting_ || segments_.empty() || segments_.back()->id > id)
+	{
+		// Closed meanwhile, or a roll could not wait and took a later id; segments must stay in id order
+		segment->retired = true;
+		return std::nullopt;
+	}
+	spare_segment_ = segment;
+
+	return std::nullopt;
+}
+
+auto WriteAheadSpool::recover_segment(Segment& segment, bool count_records) -> void
+{
+	// Walk the claimed records; anything claimed but not committed, or torn, is marked so read() steps over it
+	auto offset = SEGMENT_HEADER_SIZE;
+	while (offset + RECORD_HEADER_SIZE <= segment.capacity)
+	{
+		auto word = segment.length_word(offset).load(std::memory_order_relaxed);
+		auto length = static_cast<size_t>(word & LENGTH_MASK);
+		if (word == 0)
+		{
+			break;
+		}
+		if (length == 0 || offset + record_size(length) > segment.capacity)
+		{
+			// A torn length word; the records behind it can't be located, so the segment ends here
+			segment.length_word(offset).store(static_cast<uint32_t>(length) | DISCARDED, std::memory_order_relaxed);
+			break;
+		}
+
+		if ((word & DISCARDED) == 0)
+		{
+			uint32_t stored = 0;
+			std::memcpy(&stored, segment.data + offset + sizeof(uint32_t), sizeof(stored));
+			auto valid = (word & COMMITTED) != 0 &&
+				stored == checksum(std::string_view(segment.data + offset + RECORD_HEADER_SIZE, length));
+			if (!valid)
+			{
+				segment.length_word(offset).store(static_cast<uint32_t>(length) | DISCARDED, std::memory_order_relaxed);
+			}
+			else if (count_records && (read_segment_.get() != &segment || offset >= read_offset_))
+			{
+				++appended_records_;
+				appended_bytes_ += length;
+			}
+		}
+		offset += record_size(length);
+	}
+
+	segment.reserved = offset;
+	segment.sealed_at = offset;
+}
+
+auto WriteAheadSpool::segment_path(uint64_t id) const -> std::filesystem::path
+{
+	return directory_ / fmt::format("{:020}.seg", id);
+}
+
+auto WriteAheadSpool::load_checkpoint() const -> std::optional<std::tuple<uint64_t, size_t>>
+{
+	std::ifstream source(directory_ / "checkpoint");
+	uint64_t segment_id = 0;
+	size_t offset = 0;
+	if (!(source >> segment_id >> offset))
+	{
+		return std::nullopt;
+	}
+	return std::make_tuple(segment_id, offset);
+}
+
+auto WriteAheadSpool::save_checkpoint(uint64_t segment_id, size_t offset) const -> std::optional<std::string>
+{
+	// The new position has to be on disk before the rename publishes it, and the rename before segments go
+	auto temporary = directory_ / "checkpoint.tmp";
+	auto contents = fmt::format("{} {}\n", segment_id, offset);
+
+#ifdef _WIN32
+	auto file = CreateFileW(temporary.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return fmt::format("failed to write spool checkpoint {}: {}", temporary.string(), last_error_message());
+	}
+	DWORD written = 0;
+	auto stored = WriteFile(file, contents.data(), static_cast<DWORD>(contents.size()), &written, nullptr) && written == contents.size() &&
+		FlushFileBuffers(file);
+	CloseHandle(file);
+	if (!stored)
+	{
+		return fmt::format("failed to write spool checkpoint {}: {}", temporary.string(), last_error_message());
+	}
+	if (!MoveFileExW(temporary.c_str(), (directory_ / "checkpoint").c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+	{
+		return fmt::format("failed to replace spool checkpoint: {}", last_error_message());
+	}
+	return std::nullopt;
+#else
+	auto file = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (file < 0)
+	{
+		return fmt::format("failed to write spool checkpoint {}: {}", temporary.string(), last_error_message());
+	}
+	auto stored = ::write(file, contents.data(), contents.size()) == static_cast<ssize_t>(contents.size()) && fsync(file) == 0;
+	auto write_error = last_error_message();
+	::close(file);
+	if (!stored)
+	{
+		return fmt::format("failed to write spool checkpoint {}: {}", temporary.string(), write_error);
+	}
+
+	std::error_code error;
+	std::filesystem::rename(temporary, directory_ / "checkpoint", error);
+	if (error)
+	{
+		return fmt::format("failed to replace spool checkpoint: {}", error.message());
+	}
+	return sync_directory();
+#endif
+}
+
+auto WriteAheadSpool::sync_directory() const -> std::optional<std::string>
+{
+#ifndef _WIN32
+	auto directory = ::open(directory_.c_str(), O_RDONLY | O_CLOEXEC);
+	if (directory < 0)
+	{
+		return fmt::format("failed to open spool directory {}: {}", directory_.string(), last_error_message());
+	}
+	auto synced = fsync(directory) == 0;
+	auto sync_error = last_error_message();
+	::close(directory);
+	if (!synced)
+	{
+		return fmt::format("failed to sync spool directory {}: {}", directory_.string(), sync_error);
+	}
+#endif
+	return std::nullopt;
+}
+
+auto WriteAheadSpool::sync_loop() -> void
+{
+	std::unique_lock<std::mutex> lock(sync_wait_mutex_);
+	while (!sync_stop_requested_)
+	{
+		sync_condition_.wait_for(lock, sync_interval_, [this]() { return sync_stop_requested_ || spare_requested_; });
+		spare_requested_ = false;
+
+		lock.unlock();
+		// Every pass, so a spare that failed to allocate is retried
+		if (auto error = prepare_segment(); error.has_value())
+		{
+			Logger::handle().write(LogTypes::Error, error.value());
+		}
+		if (auto error = sync(); error.has_value())
+		{
+			Logger::handle().write(LogTypes::Error, error.value());
+		}
+		lock.lock();
+	}
+}
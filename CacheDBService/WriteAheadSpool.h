@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+// Append-only log of memory-mapped segment files that sits between enqueue_database_operation and the broker.
+// append() claims space under a short lock and copies the record into the mapping outside it, so a write costs
+// a memcpy; a background thread msyncs what was written every sync interval (group commit) and keeps the next
+// segment allocated, so filling one doesn't stall producers on creating the file. A process crash
+// loses nothing because the mapping is shared with the page cache; a power failure loses at most one interval.
+// The flush loop read()s records in append order and acknowledge()s them once the broker has confirmed them,
+// which persists the read position and deletes the segments behind it. Anything not acknowledged is read
+// again after a restart.
+class WriteAheadSpool
+{
+public:
+	WriteAheadSpool(const std::string& directory, size_t segment_bytes, size_t max_segments, int sync_interval_ms);
+	virtual ~WriteAheadSpool(void);
+
+	auto open() -> std::tuple<bool, std::optional<std::string>>;
+	auto close() -> void;
+
+	auto append(std::string_view record) -> std::tuple<bool, std::optional<std::string>>;
+	// Records appended since open() are numbered from 1 in the order read() returns them
+	auto append(std::string_view record, uint64_t& sequence) -> std::tuple<bool, std::optional<std::string>>;
+	// Flush loop only. Stops at the first record still being written; the error reports records it had to skip.
+	auto read(size_t max_records, std::vector<std::string>& records) -> std::optional<std::string>;
+	// Flush loop only. Everything returned by read() so far has been delivered.
+	auto acknowledge() -> std::tuple<bool, std::optional<std::string>>;
+	// Flush loop only. Every record appended since open() up to this sequence is behind the persisted position.
+	auto acknowledged_sequence() const -> uint64_t;
+	auto sync() -> std::optional<std::string>;
+
+	// Records appended but not read yet
+	auto pending_records() const -> size_t;
+	auto pending_bytes() const -> size_t;
+
+protected:
+	struct Segment;
+
+	auto open_segment(uint64_t id, bool create) -> std::tuple<std::shared_ptr<Segment>, std::optional<std::string>>;
+	auto roll_segment() -> std::tuple<bool, std::optional<std::string>>;
+	auto prepare_segment() -> std::optional<std::string>;
+	auto recover_segment(Segment& segment, bool count_records) -> void;
+	auto segment_path(uint64_t id) const -> std::filesystem::path;
+	auto load_checkpoint() const -> std::optional<std::tuple<uint64_t, size_t>>;
+	auto save_checkpoint(uint64_t segment_id, size_t offset) const -> std::optional<std::string>;
+	auto sync_directory() const -> std::optional<std::string>;
+	auto sync_loop() -> void;
+
+private:
+	std::filesystem::path directory_;
+	size_t segment_bytes_;
+	size_t max_segments_;
+	std::chrono::milliseconds sync_interval_;
+
+	// Oldest first; the last one takes appends. Guarded by append_mutex_.
+	std::mutex append_mutex_;
+	std::deque<std::shared_ptr<Segment>> segments_;
+	uint64_t next_segment_id_;
+	uint64_t appended_sequence_;
+	// Created, allocated and mapped by the sync thread ahead of the next roll; not counted against max_segments
+	std::shared_ptr<Segment> spare_segment_;
+	// Cleared by close() under append_mutex_ before it waits for writers_ to finish their copies
+	bool accepting_;
+	std::atomic<size_t> writers_;
+
+	// Read position, owned by the flush loop
+	std::shared_ptr<Segment> read_segment_;
+	size_t read_offset_;
+	uint64_t acknowledged_segment_id_;
+	size_t acknowledged_offset_;
+	uint64_t read_sequence_;
+	uint64_t acknowledged_sequence_;
+
+	std::atomic<size_t> appended_records_;
+	std::atomic<size_t> appended_bytes_;
+	std::atomic<size_t> read_records_;
+	std::atomic<size_t> read_bytes_;
+
+	std::mutex sync_mutex_;
+	std::mutex sync_wait_mutex_;
+	std::condition_variable sync_condition_;
+	bool sync_stop_requested_;
+	// Set by a roll to have the sync thread prepare the next spare right away
+	bool spare_requested_;
+	std::thread sync_thread_;
+};
@@ -0,0 +1,204 @@
+#include "WriteBehindTracker.h"
+
+#include "fmt/format.h"
+
+#include "boost/json/parse.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+
+namespace
+{
+	auto parse_integer(const std::string& text) -> std::optional<int64_t>
+	{
+		int64_t number = 0;
+		auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), number);
+		if (error != std::errc() || end != text.data() + text.size())
+		{
+			return std::nullopt;
+		}
+		return number;
+	}
+
+	// Key parts are text; the column decides what the database is sent, so an int8 key isn't compared as a string
+	auto key_value(const std::string& text, const std::string& type) -> std::tuple<std::optional<boost::json::value>, std::optional<std::string>>
+	{
+		std::string lowered(type);
+		std::transform(lowered.begin(), lowered.end(), lowered.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+		if (lowered.empty())
+		{
+			// Only the canonical spelling becomes a number, so "007" or "+7" keep meaning what they say
+			auto number = parse_integer(text);
+			if (number.has_value() && std::to_string(number.value()) == text)
+			{
+				return { boost::json::value(number.value()), std::nullopt };
+			}
+			return { boost::json::value(text), std::nullopt };
+		}
+		if (lowered == "int2" || lowered == "int4" || lowered == "int8" || lowered == "smallint" || lowered == "integer" || lowered == "bigint")
+		{
+			auto number = parse_integer(text);
+			if (!number.has_value())
+			{
+				return { std::nullopt, fmt::format("{} is not an integer", text) };
+			}
+			return { boost::json::value(number.value()), std::nullopt };
+		}
+		if (lowered == "bool" || lowered == "boolean")
+		{
+			if (text == "true" || text == "1")
+			{
+				return { boost::json::value(true), std::nullopt };
+			}
+			if (text == "false" || text == "0")
+			{
+				return { boost::json::value(false), std::nullopt };
+			}
+			return { std::nullopt, fmt::format("{} is not a boolean", text) };
+		}
+		// Numeric, text and anything else are sent as written and converted by the database
+		return { boost::json::value(text), std::nullopt };
+	}
+}
+
+WriteBehindTracker::WriteBehindTracker(const std::unordered_map<std::string, WriteBehindMapping>& mappings)
+	: mappings_(mappings)
+{
+}
+
+WriteBehindTracker::~WriteBehindTracker(void)
+{
+}
+
+auto WriteBehindTracker::mark(const std::string& key) -> bool
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return dirty_.insert(key).second;
+}
+
+auto WriteBehindTracker::take() -> std::vector<std::string>
+{
+	std::unordered_set<std::string> dirty;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		dirty.swap(dirty_);
+	}
+
+	return std::vector<std::string>(dirty.begin(), dirty.end());
+}
+
+auto WriteBehindTracker::restore(const std::vector<std::string>& keys) -> void
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	dirty_.insert(keys.begin(), keys.end());
+}
+
+auto WriteBehindTracker::dirty_count() const -> size_t
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return dirty_.size();
+}
+
+auto WriteBehindTracker::tracked(const std::string& key) const -> bool
+{
+	return mapping_for(key).has_value();
+}
+
+auto WriteBehindTracker::to_operation(const std::string& key, const std::string& value) const -> std::tuple<std::optional<boost::json::object>, std::optional<std::string>>
+{
+	auto found = mapping_for(key);
+	if (!found.has_value())
+	{
+		return { std::nullopt, fmt::format("{} has no write-behind mapping", key) };
+	}
+	auto [prefix, mapping] = found.value();
+
+	std::vector<std::string> key_values;
+	auto rest = key.substr(prefix.size());
+	size_t start = 0;
+	while (true)
+	{
+		auto end = rest.find(':', start);
+		key_values.push_back(rest.substr(start, end == std::string::npos ? std::string::npos : end - start));
+		if (end == std::string::npos)
+		{
+			break;
+		}
+		start = end + 1;
+	}
+	if (key_values.size() != mapping->key_columns.size())
+	{
+		return { std::nullopt, fmt::format("{} does not carry the {} key columns of {}", key, mapping->key_columns.size(), mapping->table) };
+	}
+
+	boost::json::object values;
+	if (!mapping->value_column.empty())
+	{
+		values[mapping->value_column] = value;
+	}
+	else
+	{
+		boost::json::value parsed;
+		try
+		{
+			parsed = boost::json::parse(value);
+		}
+		catch (const std::exception& e)
+		{
+			return { std::nullopt, fmt::format("value of {} is not JSON: {}", key, e.what()) };
+		}
+		if (!parsed.is_object())
+		{
+			return { std::nullopt, fmt::format("value of {} is not a JSON object", key) };
+		}
+		values = std::move(parsed.as_object());
+	}
+
+	boost::json::array conflict;
+	for (size_t index = 0; index < key_values.size(); ++index)
+	{
+		const auto& column = mapping->key_columns[index];
+		auto type = mapping->key_types.find(column);
+		auto [typed, type_error] = key_value(key_values[index], type == mapping->key_types.end() ? std::string() : type->second);
+		if (!typed.has_value())
+		{
+			return { std::nullopt, fmt::format("key column {} of {}: {}", column, key, type_error.value_or("invalid value")) };
+		}
+
+		// The key decides the row, whatever the value claims
+		values[column] = std::move(typed.value());
+		conflict.emplace_back(column);
+	}
+
+	boost::json::object operation;
+	operation["op"] = "upsert";
+	operation["table"] = mapping->table;
+	operation["values"] = std::move(values);
+	operation["conflict"] = std::move(conflict);
+
+	return { operation, std::nullopt };
+}
+
+auto WriteBehindTracker::mapping_for(const std::string& key) const -> std::optional<std::tuple<std::string, const WriteBehindMapping*>>
+{
+	// Longest prefix wins, so "player:stats:" can be mapped apart from "player:"
+	const std::string* best_prefix = nullptr;
+	const WriteBehindMapping* best = nullptr;
+	for (const auto& [prefix, mapping] : mappings_)
+	{
+		if (key.size() > prefix.size() && key.compare(0, prefix.size(), prefix) == 0 &&
+			(best_prefix == nullptr || prefix.size() > best_prefix->size()))
+		{
+			best_prefix = &prefix;
+			best = &mapping;
+		}
+	}
+
+	if (best == nullptr)
+	{
+		return std::nullopt;
+	}
+	return std::make_tuple(*best_prefix, best);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "Configurations.h"
+
+#include <boost/json.hpp>
+
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Remembers which cached keys belong to a write-behind table and changed since the last flush. A key that is set
+// again before the flush stays a single entry, so each row is written at most once per flush whatever its churn;
+// the flush reads the current value back from Redis and turns it into one upsert.
+class WriteBehindTracker
+{
+public:
+	WriteBehindTracker(const std::unordered_map<std::string, WriteBehindMapping>& mappings);
+	virtual ~WriteBehindTracker(void);
+
+	// True when the key was clean until now
+	auto mark(const std::string& key) -> bool;
+	auto take() -> std::vector<std::string>;
+	// Puts back keys a flush couldn't handle, e.g. while Redis was unreachable
+	auto restore(const std::vector<std::string>& keys) -> void;
+	auto dirty_count() const -> size_t;
+
+	auto tracked(const std::string& key) const -> bool;
+	auto to_operation(const std::string& key, const std::string& value) const -> std::tuple<std::optional<boost::json::object>, std::optional<std::string>>;
+
+protected:
+	auto mapping_for(const std::string& key) const -> std::optional<std::tuple<std::string, const WriteBehindMapping*>>;
+
+private:
+	std::unordered_map<std::string, WriteBehindMapping> mappings_;
+
+	mutable std::mutex mutex_;
+	std::unordered_set<std::string> dirty_;
+};
@@ -0,0 +1,267 @@
+#include "WriteCoalescer.h"
+
+WriteCoalescer::WriteCoalescer(bool enabled, const std::unordered_map<std::string, std::vector<std::string>>& primary_keys)
+	: enabled_(enabled)
+	, primary_keys_(primary_keys)
+	, live_count_(0)
+	, buffered_count_(0)
+	, buffered_bytes_(0)
+	, received_count_(0)
+	, emitted_count_(0)
+{
+}
+
+WriteCoalescer::~WriteCoalescer(void)
+{
+}
+
+auto WriteCoalescer::add(std::string message_body, boost::json::object operation) -> void
+{
+	++received_count_;
+	++buffered_count_;
+	buffered_bytes_ += message_body.size();
+
+	if (!enabled_ || operation.contains("batch"))
+	{
+		auto batch = operation.contains("batch");
+		append(std::move(message_body), "", std::move(operation), batch);
+		barrier();
+		return;
+	}
+
+	std::string op;
+	if (auto* op_value = operation.if_contains("op"); op_value != nullptr && op_value->is_string())
+	{
+		op = op_value->as_string().c_str();
+	}
+
+	auto key = row_key(op, operation);
+	if (!key.has_value())
+	{
+		append(std::move(message_body), op, std::move(operation), false);
+		barrier();
+		return;
+	}
+
+	// A merged row moves to its last write, so it must not move across another table's writes, which may depend on it
+	std::string table(operation.at("table").as_string());
+	if (table != table_)
+	{
+		barrier();
+		table_ = std::move(table);
+	}
+
+	auto row = rows_.find(key.value());
+	if (row == rows_.end())
+	{
+		rows_[key.value()] = append(std::move(message_body), op, std::move(operation), false);
+		return;
+	}
+
+	auto& entry = entries_[row->second];
+	if (entry.op == "insert" && op == "delete")
+	{
+		// The row never reached the database, so neither statement has to
+		entry.removed = true;
+		--live_count_;
+		rows_.erase(row);
+		return;
+	}
+	if ((entry.op == "update" || entry.op == "upsert") && op == "delete")
+	{
+		entry.removed = true;
+		--live_count_;
+		row->second = append(std::move(message_body), op, std::move(operation), false);
+		return;
+	}
+	if (entry.op == "delete" && op == "delete")
+	{
+		return;
+	}
+	if (merge(row->second, op, operation))
+	{
+		row->second = move_to_end(row->second);
+		return;
+	}
+
+	row->second = append(std::move(message_body), op, std::move(operation), false);
+}
+
+auto WriteCoalescer::drain() -> std::vector<PendingOperation>
+{
+	std::vector<PendingOperation> operations;
+	operations.reserve(live_count_);
+	for (auto& entry : entries_)
+	{
+		if (entry.removed)
+		{
+			continue;
+		}
+
+		if (entry.dirty)
+		{
+			entry.message_body = boost::json::serialize(entry.operation);
+		}
+		operations.push_back(PendingOperation{ std::move(entry.message_body), entry.batch, std::move(entry.operation) });
+	}
+
+	emitted_count_ += operations.size();
+	entries_.clear();
+	barrier();
+	live_count_ = 0;
+	buffered_count_ = 0;
+	buffered_bytes_ = 0;
+
+	return operations;
+}
+
+auto WriteCoalescer::empty() const -> bool
+{
+	return live_count_ == 0;
+}
+
+auto WriteCoalescer::buffered_count() const -> size_t
+{
+	return buffered_count_;
+}
+
+auto WriteCoalescer::buffered_bytes() const -> size_t
+{
+	return buffered_bytes_;
+}
+
+auto WriteCoalescer::size() const -> size_t
+{
+	return live_count_;
+}
+
+auto WriteCoalescer::received_count() const -> size_t
+{
+	return received_count_;
+}
+
+auto WriteCoalescer::emitted_count() const -> size_t
+{
+	return emitted_count_;
+}
+
+auto WriteCoalescer::row_key(const std::string& op, const boost::json::object& operation) const -> std::optional<std::string>
+{
+	if (op != "insert" && op != "update" && op != "upsert" && op != "delete")
+	{
+		return std::nullopt;
+	}
+	if (operation.contains("sql") || !operation.contains("table") || !operation.at("table").is_string())
+	{
+		return std::nullopt;
+	}
+
+	std::string table(operation.at("table").as_string());
+	const auto* values = operation.if_contains("values");
+	const auto* where = operation.if_contains("where");
+	if (op != "delete" && (values == nullptr || !values->is_object()))
+	{
+		return std::nullopt;
+	}
+
+	// Only a configured primary key is known to name one row; any other column set may match several
+	auto configured = primary_keys_.find(table);
+	if (configured == primary_keys_.end() || configured->second.empty())
+	{
+		return std::nullopt;
+	}
+	const auto& columns = configured->second;
+
+	const boost::json::object* source = nullptr;
+	if (op == "insert" || op == "upsert")
+	{
+		source = &values->as_object();
+	}
+	else
+	{
+		if (where == nullptr || !where->is_object())
+		{
+			return std::nullopt;
+		}
+		source = &where->as_object();
+
+		if (source->size() != columns.size())
+		{
+			// A where clause wider or narrower than the key may match a different set of rows
+			return std::nullopt;
+		}
+	}
+
+	std::string key = table;
+	for (const auto& column : columns)
+	{
+		const auto* value = source->if_contains(column);
+		if (value == nullptr || value->is_null() || value->is_object() || value->is_array())
+		{
+			return std::nullopt;
+		}
+
+		// An update that rewrites its own key columns moves the row; later writes would address another key
+		if (op == "update" && values->as_object().contains(column))
+		{
+			return std::nullopt;
+		}
+
+		key += '\x1f';
+		key += column;
+		key += '=';
+		key += boost::json::serialize(*value);
+	}
+
+	return key;
+}
+
+auto WriteCoalescer::merge(size_t index, const std::string& op, const boost::json::object& operation) -> bool
+{
+	auto& entry = entries_[index];
+	auto mergeable = (op == "update" && (entry.op == "update" || entry.op == "insert" || entry.op == "upsert")) ||
+		(op == "upsert" && entry.op == "upsert");
+	if (!mergeable)
+	{
+		return false;
+	}
+
+	auto& merged = entry.operation["values"].as_object();
+	for (const auto& item : operation.at("values").as_object())
+	{
+		merged[item.key()] = item.value();
+	}
+	entry.dirty = true;
+
+	return true;
+}
+
+auto WriteCoalescer::append(std::string&& message_body, const std::string& op, boost::json::object&& operation, bool batch) -> size_t
+{
+	// Move-constructed so the parsed operation keeps its storage; assigning it would copy it into the default one
+	entries_.push_back(Entry{ op, std::move(message_body), std::move(operation), false, false, batch });
+	++live_count_;
+
+	return entries_.size() - 1;
+}
+
+auto WriteCoalescer::move_to_end(size_t index) -> size_t
+{
+	if (index + 1 == entries_.size())
+	{
+		return index;
+	}
+
+	// Moved out first: pushing an element of the vector into itself could reallocate under it
+	auto entry = std::move(entries_[index]);
+	entries_[index].removed = true;
+	entries_.push_back(std::move(entry));
+
+	return entries_.size() - 1;
+}
+
+auto WriteCoalescer::barrier() -> void
+{
+	rows_.clear();
+	table_.clear();
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <boost/json.hpp>
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct PendingOperation
+{
+	std::string message_body;
+	bool batch = false;
+	// The parsed operation message_body was produced from, so it can be re-encoded without parsing it again
+	boost::json::object operation;
+};
+
+// Last-writer-wins buffer for DB operations between two flushes.
+// Operations on the same row, keyed by (table, configured primary key values), collapse into their net effect:
+// update+update and upsert+upsert merge their values, insert+update and upsert+update become one insert or
+// upsert, update+delete and upsert+delete become the delete, and insert+delete cancels out. A merged row takes
+// the position of its last write, so it never runs ahead of a write it followed.
+// Anything that can't be keyed (tables without a configured key, raw sql, exec, batches, updates that change
+// key columns) is a barrier: it keeps its place and nothing merges across it. So is a write to another table,
+// which may reference the row through a foreign key; only consecutive writes to one table coalesce.
+class WriteCoalescer
+{
+public:
+	WriteCoalescer(bool enabled, const std::unordered_map<std::string, std::vector<std::string>>& primary_keys);
+	virtual ~WriteCoalescer(void);
+
+	auto add(std::string message_body, boost::json::object operation) -> void;
+	auto drain() -> std::vector<PendingOperation>;
+
+	auto empty() const -> bool;
+	// Operations added since the last drain, before coalescing
+	auto buffered_count() const -> size_t;
+	auto buffered_bytes() const -> size_t;
+	// Operations that would be emitted if drained now
+	auto size() const -> size_t;
+	auto received_count() const -> size_t;
+	auto emitted_count() const -> size_t;
+
+protected:
+	auto row_key(const std::string& op, const boost::json::object& operation) const -> std::optional<std::string>;
+	auto merge(size_t index, const std::string& op, const boost::json::object& operation) -> bool;
+	auto append(std::string&& message_body, const std::string& op, boost::json::object&& operation, bool batch) -> size_t;
+	// Returns the entry's new index
+	auto move_to_end(size_t index) -> size_t;
+	auto barrier() -> void;
+
+private:
+	struct Entry
+	{
+		std::string op;
+		std::string message_body;
+		// Parsed form; keyed rows merge later writes into it
+		boost::json::object operation;
+		bool dirty = false;
+		bool removed = false;
+		bool batch = false;
+	};
+
+	bool enabled_;
+	std::unordered_map<std::string, std::vector<std::string>> primary_keys_;
+
+	std::vector<Entry> entries_;
+	// Row key -> entry index, only for entries after the last barrier
+	std::unordered_map<std::string, size_t> rows_;
+	// Table of the keyed writes since the last barrier
+	std::string table_;
+
+	size_t live_count_;
+	size_t buffered_count_;
+	size_t buffered_bytes_;
+	size_t received_count_;
+	size_t emitted_count_;
+};
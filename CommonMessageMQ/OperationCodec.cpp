@@ -0,0 +1,452 @@
+#include "OperationCodec.h"
+
+#include <cstring>
+#include <vector>
+
+namespace CommonMessageMQ
+{
+	namespace
+	{
+		enum class ValueTag : uint8_t
+		{
+			Null = 0,
+			False = 1,
+			True = 2,
+			Int64 = 3,
+			UInt64 = 4,
+			Double = 5,
+			String = 6,
+			Name = 7,
+			Array = 8,
+			Object = 9,
+		};
+
+		constexpr size_t header_size = 4;
+		constexpr uint8_t batch_flag = 0x01;
+		constexpr uint8_t packed_flag = 0x02;
+		constexpr size_t max_depth = 64;
+
+		auto write_tag(std::string& out, ValueTag tag) -> void
+		{
+			out.push_back(static_cast<char>(tag));
+		}
+
+		auto write_varint(std::string& out, uint64_t value) -> void
+		{
+			while (value >= 0x80)
+			{
+				out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+				value >>= 7;
+			}
+			out.push_back(static_cast<char>(value));
+		}
+
+		auto write_text(std::string& out, std::string_view text) -> void
+		{
+			write_varint(out, text.size());
+			out.append(text.data(), text.size());
+		}
+
+		// Reads one envelope body into values that allocate from their parent's storage.
+		// Names refer back into data, which outlives the reader.
+		class Reader
+		{
+		public:
+			Reader(std::string_view data)
+				: data_(data)
+				, position_(0)
+			{
+			}
+
+			auto at_end() const -> bool
+			{
+				return position_ == data_.size();
+			}
+
+			auto error() const -> std::string
+			{
+				return error_.value_or("malformed binary message");
+			}
+
+			auto read_value(size_t depth, boost::json::value& value) -> bool
+			{
+				if (depth > max_depth)
+				{
+					return fail("binary message nested too deeply");
+				}
+
+				uint8_t tag = 0;
+				if (!read_byte(tag))
+				{
+					return false;
+				}
+
+				switch (static_cast<ValueTag>(tag))
+				{
+				case ValueTag::Null:
+					value.emplace_null();
+					return true;
+				case ValueTag::False:
+				case ValueTag::True:
+					value.emplace_bool() = static_cast<ValueTag>(tag) == ValueTag::True;
+					return true;
+				case ValueTag::Int64:
+				{
+					uint64_t encoded = 0;
+					if (!read_varint(encoded))
+					{
+						return false;
+					}
+					value.emplace_int64() = static_cast<int64_t>(encoded >> 1) ^ -static_cast<int64_t>(encoded & 1);
+					return true;
+				}
+				case ValueTag::UInt64:
+					return read_varint(value.emplace_uint64());
+				case ValueTag::Double:
+				{
+					if (data_.size() - position_ < 8)
+					{
+						return fail("binary message truncated");
+					}
+					uint64_t bits = 0;
+					for (size_t index = 0; index < 8; ++index)
+					{
+						bits |= static_cast<uint64_t>(static_cast<uint8_t>(data_[position_ + index])) << (8 * index);
+					}
+					position_ += 8;
+					std::memcpy(&value.emplace_double(), &bits, sizeof(bits));
+					return true;
+				}
+				case ValueTag::String:
+				{
+					std::string_view text;
+					if (!read_text(text))
+					{
+						return false;
+					}
+					value.emplace_string().assign(text.data(), text.size());
+					return true;
+				}
+				case ValueTag::Name:
+				{
+					std::string_view name;
+					if (!read_name(name))
+					{
+						return false;
+					}
+					value.emplace_string().assign(name.data(), name.size());
+					return true;
+				}
+				case ValueTag::Array:
+				{
+					uint64_t count = 0;
+					if (!read_count(count))
+					{
+						return false;
+					}
+					auto& array = value.emplace_array();
+					array.reserve(static_cast<size_t>(count));
+					for (uint64_t index = 0; index < count; ++index)
+					{
+						if (!read_value(depth + 1, array.emplace_back(nullptr)))
+						{
+							return false;
+						}
+					}
+					return true;
+				}
+				case ValueTag::Object:
+				{
+					uint64_t count = 0;
+					if (!read_count(count))
+					{
+						return false;
+					}
+					auto& object = value.emplace_object();
+					object.reserve(static_cast<size_t>(count));
+					for (uint64_t index = 0; index < count; ++index)
+					{
+						std::string_view key;
+						if (!read_name(key))
+						{
+							return false;
+						}
+						if (!read_value(depth + 1, object[key]))
+						{
+							return false;
+						}
+					}
+					return true;
+				}
+				}
+
+				return fail("unknown value tag " + std::to_string(tag) + " in binary message");
+			}
+
+		private:
+			auto fail(const std::string& message) -> bool
+			{
+				if (!error_.has_value())
+				{
+					error_ = message;
+				}
+				return false;
+			}
+
+			auto read_byte(uint8_t& byte) -> bool
+			{
+				if (at_end())
+				{
+					return fail("binary message truncated");
+				}
+				byte = static_cast<uint8_t>(data_[position_++]);
+				return true;
+			}
+
+			auto read_varint(uint64_t& value) -> bool
+			{
+				value = 0;
+				for (int shift = 0; shift < 64; shift += 7)
+				{
+					uint8_t byte = 0;
+					if (!read_byte(byte))
+					{
+						return false;
+					}
+					value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+					if ((byte & 0x80) == 0)
+					{
+						return true;
+					}
+				}
+				return fail("varint too long in binary message");
+			}
+
+			// Every element takes at least one byte, so a count beyond what is left is corrupt, not a huge reserve
+			auto read_count(uint64_t& count) -> bool
+			{
+				if (!read_varint(count))
+				{
+					return false;
+				}
+				if (count > data_.size() - position_)
+				{
+					return fail("element count exceeds binary message size");
+				}
+				return true;
+			}
+
+			auto read_text(std::string_view& text) -> bool
+			{
+				uint64_t size = 0;
+				if (!read_varint(size))
+				{
+					return false;
+				}
+				if (size > data_.size() - position_)
+				{
+					return fail("binary message truncated");
+				}
+				text = data_.substr(position_, static_cast<size_t>(size));
+				position_ += static_cast<size_t>(size);
+				return true;
+			}
+
+			auto read_name(std::string_view& name) -> bool
+			{
+				uint64_t id = 0;
+				if (!read_varint(id))
+				{
+					return false;
+				}
+				if (id < names_.size())
+				{
+					name = names_[static_cast<size_t>(id)];
+					return true;
+				}
+				if (id != names_.size())
+				{
+					return fail("unknown name id " + std::to_string(id) + " in binary message");
+				}
+				if (!read_text(name))
+				{
+					return false;
+				}
+				names_.push_back(name);
+				return true;
+			}
+
+		private:
+			std::string_view data_;
+			size_t position_;
+			std::vector<std::string_view> names_;
+			std::optional<std::string> error_;
+		};
+	}
+
+	OperationCodec::OperationCodec(void)
+	{
+	}
+
+	OperationCodec::~OperationCodec(void)
+	{
+	}
+
+	auto OperationCodec::is_binary(std::string_view type) -> bool
+	{
+		return type.substr(0, content_type.size()) == content_type;
+	}
+
+	auto OperationCodec::begin(std::string& out, bool batch, bool packed) -> void
+	{
+		names_.clear();
+		out.clear();
+		out.push_back('D');
+		out.push_back('B');
+		out.push_back(static_cast<char>(version));
+		out.push_back(static_cast<char>((batch ? batch_flag : 0) | (batch && packed ? packed_flag : 0)));
+	}
+
+	auto OperationCodec::append(std::string& out, const boost::json::value& value) -> void
+	{
+		write_value(out, value);
+	}
+
+	auto OperationCodec::append(std::string& out, const boost::json::object& operation) -> void
+	{
+		write_object(out, operation);
+	}
+
+	auto OperationCodec::decode(std::string_view data, boost::json::storage_ptr storage) -> std::tuple<std::optional<boost::json::value>, std::optional<std::string>>
+	{
+		if (data.size() < header_size || data[0] != 'D' || data[1] != 'B')
+		{
+			return { std::nullopt, "not a binary DB operation message" };
+		}
+		if (static_cast<uint8_t>(data[2]) != version)
+		{
+			return { std::nullopt, "unsupported binary message version " + std::to_string(static_cast<uint8_t>(data[2])) };
+		}
+
+		auto batch = (static_cast<uint8_t>(data[3]) & batch_flag) != 0;
+		Reader reader(data.substr(header_size));
+		boost::json::value message(storage);
+		if (!batch)
+		{
+			if (!reader.read_value(0, message))
+			{
+				return { std::nullopt, reader.error() };
+			}
+			if (!reader.at_end())
+			{
+				return { std::nullopt, "trailing bytes after binary message" };
+			}
+			return { std::move(message), std::nullopt };
+		}
+
+		auto& envelope = message.emplace_object();
+		auto& items = envelope["batch"].emplace_array();
+		if ((static_cast<uint8_t>(data[3]) & packed_flag) != 0)
+		{
+			envelope["packed"] = true;
+		}
+		while (!reader.at_end())
+		{
+			if (!reader.read_value(0, items.emplace_back(nullptr)))
+			{
+				return { std::nullopt, reader.error() };
+			}
+		}
+		return { std::move(message), std::nullopt };
+	}
+
+	auto OperationCodec::write_value(std::string& out, const boost::json::value& value) -> void
+	{
+		switch (value.kind())
+		{
+		case boost::json::kind::null:
+			write_tag(out, ValueTag::Null);
+			break;
+		case boost::json::kind::bool_:
+			write_tag(out, value.get_bool() ? ValueTag::True : ValueTag::False);
+			break;
+		case boost::json::kind::int64:
+		{
+			auto number = value.get_int64();
+			write_tag(out, ValueTag::Int64);
+			write_varint(out, (static_cast<uint64_t>(number) << 1) ^ static_cast<uint64_t>(number >> 63));
+			break;
+		}
+		case boost::json::kind::uint64:
+			write_tag(out, ValueTag::UInt64);
+			write_varint(out, value.get_uint64());
+			break;
+		case boost::json::kind::double_:
+		{
+			uint64_t bits = 0;
+			auto number = value.get_double();
+			std::memcpy(&bits, &number, sizeof(bits));
+			write_tag(out, ValueTag::Double);
+			for (size_t index = 0; index < 8; ++index)
+			{
+				out.push_back(static_cast<char>((bits >> (8 * index)) & 0xff));
+			}
+			break;
+		}
+		case boost::json::kind::string:
+		{
+			const auto& text = value.get_string();
+			write_tag(out, ValueTag::String);
+			write_text(out, std::string_view(text.data(), text.size()));
+			break;
+		}
+		case boost::json::kind::array:
+			write_tag(out, ValueTag::Array);
+			write_varint(out, value.get_array().size());
+			for (const auto& item : value.get_array())
+			{
+				write_value(out, item);
+			}
+			break;
+		case boost::json::kind::object:
+			write_object(out, value.get_object());
+			break;
+		}
+	}
+
+	auto OperationCodec::write_object(std::string& out, const boost::json::object& object) -> void
+	{
+		write_tag(out, ValueTag::Object);
+		write_varint(out, object.size());
+		for (const auto& item : object)
+		{
+			std::string_view key(item.key().data(), item.key().size());
+			write_name(out, key);
+
+			// The op code and table recur in every operation of a batch, so they are sent as names too
+			if ((key == "op" || key == "table") && item.value().is_string())
+			{
+				const auto& text = item.value().get_string();
+				write_tag(out, ValueTag::Name);
+				write_name(out, std::string_view(text.data(), text.size()));
+				continue;
+			}
+			write_value(out, item.value());
+		}
+	}
+
+	auto OperationCodec::write_name(std::string& out, std::string_view name) -> void
+	{
+		name_key_.assign(name.data(), name.size());
+		if (auto found = names_.find(name_key_); found != names_.end())
+		{
+			write_varint(out, found->second);
+			return;
+		}
+
+		auto id = static_cast<uint32_t>(names_.size());
+		names_.emplace(name_key_, id);
+		write_varint(out, id);
+		write_text(out, name);
+	}
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <boost/json.hpp>
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
+
+namespace CommonMessageMQ
+{
+	// Binary form of the DB operation messages CacheDBService publishes to MainDBService, negotiated through
+	// the message content_type; application/json stays accepted everywhere for debugging.
+	//
+	// An envelope is a 4 byte header ('D', 'B', version, flags) followed by tagged values. With the batch flag
+	// set every value is one operation of a {"batch":[...]} message, otherwise exactly one value follows; the
+	// packed flag marks a batch of unrelated operations and decodes as {"batch":[...],"packed":true}.
+	// Numbers are written as varints or raw doubles, so nothing is formatted or parsed as text. Object keys
+	// and the values of "op" and "table" are names: the first use in an envelope carries the text and
+	// assigns the next id, later uses carry only the id, so a batch pays for each column name once.
+	class OperationCodec
+	{
+	public:
+		static constexpr std::string_view content_type = "application/x-db-operations";
+		static constexpr uint8_t version = 1;
+
+		OperationCodec(void);
+		virtual ~OperationCodec(void);
+
+		static auto is_binary(std::string_view type) -> bool;
+
+		// Writes the header of a new envelope into out, replacing its contents and forgetting the names of the last one
+		auto begin(std::string& out, bool batch, bool packed = false) -> void;
+		// Appends one value to the envelope started by begin()
+		auto append(std::string& out, const boost::json::value& value) -> void;
+		auto append(std::string& out, const boost::json::object& operation) -> void;
+
+		// Builds the message straight into storage; a batch envelope comes back as {"batch":[...]}
+		static auto decode(std::string_view data, boost::json::storage_ptr storage = {}) -> std::tuple<std::optional<boost::json::value>, std::optional<std::string>>;
+
+	private:
+		auto write_value(std::string& out, const boost::json::value& value) -> void;
+		auto write_object(std::string& out, const boost::json::object& object) -> void;
+		auto write_name(std::string& out, std::string_view name) -> void;
+
+	private:
+		std::unordered_map<std::string, uint32_t> names_;
+		std::string name_key_;
+	};
+}
@@ -0,0 +1,211 @@
+#include "RabbitMQConfirmPublisher.h"
+
+#include <algorithm>
+#include <chrono>
+#include <set>
+
+namespace CommonMessageMQ
+{
+	RabbitMQConfirmPublisher::RabbitMQConfirmPublisher(const std::string& host,
+													   int port,
+													   const std::string& user_name,
+													   const std::string& password,
+													   int channel_id,
+													   int heartbeat)
+		: connection_(std::make_unique<RabbitMQConnection>(host, port, user_name, password, channel_id, heartbeat))
+		, next_delivery_tag_(1)
+	{
+	}
+
+	RabbitMQConfirmPublisher::~RabbitMQConfirmPublisher()
+	{
+		stop();
+	}
+
+	auto RabbitMQConfirmPublisher::start() -> std::tuple<bool, std::optional<std::string>>
+	{
+		auto [connected, connect_error] = connection_->connect();
+		if (!connected)
+		{
+			return { false, connect_error };
+		}
+
+		amqp_confirm_select(connection_->state(), connection_->channel_id());
+		if (auto error = connection_->check_reply("confirm select"); error.has_value())
+		{
+			connection_->disconnect();
+			return { false, error };
+		}
+
+		// Delivery tags restart at 1 on every channel put into confirm mode
+		next_delivery_tag_ = 1;
+
+		return { true, std::nullopt };
+	}
+
+	auto RabbitMQConfirmPublisher::stop() -> void
+	{
+		connection_->disconnect();
+	}
+
+	auto RabbitMQConfirmPublisher::is_connected() const -> bool
+	{
+		return connection_->is_connected();
+	}
+
+	auto RabbitMQConfirmPublisher::publish_batch(const std::string& routing_key,
+												 const std::vector<std::string>& bodies,
+												 const std::string& content_type,
+												 int timeout_ms) -> std::tuple<std::vector<bool>, std::optional<std::string>>
+	{
+		std::vector<bool> confirmed(bodies.size(), false);
+		if (bodies.empty())
+		{
+			return { confirmed, std::nullopt };
+		}
+		if (!connection_->is_connected())
+		{
+			return { confirmed, std::optional<std::string>("RabbitMQ connection is not established") };
+		}
+
+		auto first_tag = next_delivery_tag_;
+		for (const auto& body : bodies)
+		{
+			auto message_id = std::to_string(next_delivery_tag_);
+
+			amqp_basic_properties_t properties;
+			properties._flags = AMQP_BASIC_CONTENT_TYPE_FLAG | AMQP_BASIC_DELIVERY_MODE_FLAG | AMQP_BASIC_MESSAGE_ID_FLAG;
+			properties.content_type = amqp_cstring_bytes(content_type.c_str());
+			properties.delivery_mode = 2;
+			properties.message_id = amqp_cstring_bytes(message_id.c_str());
+
+			amqp_bytes_t payload;
+			payload.len = body.size();
+			payload.bytes = const_cast<char*>(body.data());
+
+			auto status = amqp_basic_publish(connection_->state(), connection_->channel_id(), amqp_empty_bytes,
+											 amqp_cstring_bytes(routing_key.c_str()), 1, 0, &properties, payload);
+			if (auto error = connection_->check_status(status, "basic publish"); error.has_value())
+			{
+				connection_->disconnect();
+				return { confirmed, error };
+			}
+			++next_delivery_tag_;
+		}
+
+		auto error = wait_confirms(first_tag, confirmed, timeout_ms);
+		if (error.has_value())
+		{
+			// Late confirms would be attributed to the wrong batch, so start over on a fresh channel
+			connection_->disconnect();
+		}
+		else
+		{
+			amqp_maybe_release_buffers(connection_->state());
+		}
+
+		return { confirmed, error };
+	}
+
+	auto RabbitMQConfirmPublisher::wait_confirms(uint64_t first_tag, std::vector<bool>& confirmed, int timeout_ms) -> std::optional<std::string>
+	{
+		auto state = connection_->state();
+		auto last_tag = first_tag + confirmed.size() - 1;
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+		std::vector<bool> settled(confirmed.size(), false);
+		std::set<uint64_t> returned;
+		size_t pending = confirmed.size();
+
+		auto settle = [&](uint64_t delivery_tag, bool multiple, bool acked)
+		{
+			auto from = multiple ? first_tag : delivery_tag;
+			for (auto tag = std::max(from, first_tag); tag <= std::min(delivery_tag, last_tag); ++tag)
+			{
+				auto index = static_cast<size_t>(tag - first_tag);
+				if (settled[index])
+				{
+					continue;
+				}
+				settled[index] = true;
+				confirmed[index] = acked && returned.find(tag) == returned.end();
+				--pending;
+			}
+		};
+
+		while (pending > 0)
+		{
+			auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now());
+			if (remaining.count() <= 0)
+			{
+				return std::optional<std::string>("publisher confirms timed out");
+			}
+
+			timeval timeout;
+			timeout.tv_sec = static_cast<decltype(timeout.tv_sec)>(remaining.count() / 1000000);
+			timeout.tv_usec = static_cast<decltype(timeout.tv_usec)>(remaining.count() % 1000000);
+
+			amqp_frame_t frame;
+			auto status = amqp_simple_wait_frame_noblock(state, &frame, &timeout);
+			if (status == AMQP_STATUS_TIMEOUT)
+			{
+				return std::optional<std::string>("publisher confirms timed out");
+			}
+			if (auto error = connection_->check_status(status, "wait confirm"); error.has_value())
+			{
+				return error;
+			}
+			if (frame.frame_type != AMQP_FRAME_METHOD)
+			{
+				continue;
+			}
+
+			switch (frame.payload.method.id)
+			{
+			case AMQP_BASIC_ACK_METHOD:
+			{
+				auto* ack = static_cast<amqp_basic_ack_t*>(frame.payload.method.decoded);
+				settle(ack->delivery_tag, ack->multiple != 0, true);
+				break;
+			}
+			case AMQP_BASIC_NACK_METHOD:
+			{
+				auto* nack = static_cast<amqp_basic_nack_t*>(frame.payload.method.decoded);
+				settle(nack->delivery_tag, nack->multiple != 0, false);
+				break;
+			}
+			case AMQP_BASIC_RETURN_METHOD:
+			{
+				// An unroutable message is still acked afterwards; remember it through the message id set at publish
+				amqp_message_t message;
+				auto reply = amqp_read_message(state, frame.channel, &message, 0);
+				if (auto error = connection_->check_reply(reply, "read returned message"); error.has_value())
+				{
+					return error;
+				}
+				if (message.properties._flags & AMQP_BASIC_MESSAGE_ID_FLAG)
+				{
+					std::string message_id(static_cast<char*>(message.properties.message_id.bytes), message.properties.message_id.len);
+					try
+					{
+						returned.insert(std::stoull(message_id));
+					}
+					catch (const std::exception&)
+					{
+					}
+				}
+				amqp_destroy_message(&message);
+				break;
+			}
+			case AMQP_CHANNEL_CLOSE_METHOD:
+				return std::optional<std::string>("channel closed by server while waiting for confirms");
+			case AMQP_CONNECTION_CLOSE_METHOD:
+				return std::optional<std::string>("connection closed by server while waiting for confirms");
+			default:
+				break;
+			}
+		}
+
+		return std::nullopt;
+	}
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "RabbitMQConnection.h"
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace CommonMessageMQ
+{
+	// Publisher on a channel in confirm mode. publish_batch() writes every body back to back and only
+	// then collects the broker's basic.ack/basic.nack frames, so a batch costs one round trip instead
+	// of one per message. Messages are published persistent and mandatory; a basic.return counts as a
+	// failed publish.
+	class RabbitMQConfirmPublisher
+	{
+	public:
+		RabbitMQConfirmPublisher(const std::string& host,
+								 int port,
+								 const std::string& user_name,
+								 const std::string& password,
+								 int channel_id = 1,
+								 int heartbeat = 60);
+		virtual ~RabbitMQConfirmPublisher();
+
+		auto start() -> std::tuple<bool, std::optional<std::string>>;
+		auto stop() -> void;
+		auto is_connected() const -> bool;
+
+		// Returns one flag per body, true when the broker confirmed it. The error is set when the
+		// connection failed or the confirms did not arrive within timeout_ms.
+		auto publish_batch(const std::string& routing_key,
+						   const std::vector<std::string>& bodies,
+						   const std::string& content_type,
+						   int timeout_ms) -> std::tuple<std::vector<bool>, std::optional<std::string>>;
+
+	private:
+		auto wait_confirms(uint64_t first_tag, std::vector<bool>& confirmed, int timeout_ms) -> std::optional<std::string>;
+
+	private:
+		std::unique_ptr<RabbitMQConnection> connection_;
+		uint64_t next_delivery_tag_;
+	};
+}
@@ -0,0 +1,141 @@
+#include "RabbitMQConnection.h"
+
+namespace CommonMessageMQ
+{
+	RabbitMQConnection::RabbitMQConnection(const std::string& host,
+										   int port,
+										   const std::string& user_name,
+										   const std::string& password,
+										   int channel_id,
+										   int heartbeat)
+		: host_(host)
+		, port_(port)
+		, user_name_(user_name)
+		, password_(password)
+		, channel_id_(static_cast<amqp_channel_t>(channel_id))
+		, heartbeat_(heartbeat)
+		, state_(nullptr)
+		, channel_opened_(false)
+	{
+	}
+
+	RabbitMQConnection::~RabbitMQConnection()
+	{
+		disconnect();
+	}
+
+	auto RabbitMQConnection::connect() -> std::tuple<bool, std::optional<std::string>>
+	{
+		disconnect();
+
+		state_ = amqp_new_connection();
+		if (state_ == nullptr)
+		{
+			return { false, std::optional<std::string>("failed to allocate RabbitMQ connection") };
+		}
+
+		amqp_socket_t* socket = amqp_tcp_socket_new(state_);
+		if (socket == nullptr)
+		{
+			disconnect();
+			return { false, std::optional<std::string>("failed to create RabbitMQ socket") };
+		}
+
+		if (auto error = check_status(amqp_socket_open(socket, host_.c_str(), port_), "socket open"); error.has_value())
+		{
+			disconnect();
+			return { false, error };
+		}
+
+		auto login = amqp_login(state_, "/", 0, AMQP_DEFAULT_FRAME_SIZE, heartbeat_, AMQP_SASL_METHOD_PLAIN, user_name_.c_str(), password_.c_str());
+		if (auto error = check_reply(login, "login"); error.has_value())
+		{
+			disconnect();
+			return { false, error };
+		}
+
+		amqp_channel_open(state_, channel_id_);
+		if (auto error = check_reply("channel open"); error.has_value())
+		{
+			disconnect();
+			return { false, error };
+		}
+		channel_opened_ = true;
+
+		return { true, std::nullopt };
+	}
+
+	auto RabbitMQConnection::disconnect() -> void
+	{
+		if (state_ == nullptr)
+		{
+			return;
+		}
+
+		if (channel_opened_)
+		{
+			amqp_channel_close(state_, channel_id_, AMQP_REPLY_SUCCESS);
+			channel_opened_ = false;
+		}
+		amqp_connection_close(state_, AMQP_REPLY_SUCCESS);
+		amqp_destroy_connection(state_);
+		state_ = nullptr;
+	}
+
+	auto RabbitMQConnection::is_connected() const -> bool
+	{
+		return state_ != nullptr && channel_opened_;
+	}
+
+	auto RabbitMQConnection::state() const -> amqp_connection_state_t
+	{
+		return state_;
+	}
+
+	auto RabbitMQConnection::channel_id() const -> amqp_channel_t
+	{
+		return channel_id_;
+	}
+
+	auto RabbitMQConnection::check_reply(const std::string& context) const -> std::optional<std::string>
+	{
+		return check_reply(amqp_get_rpc_reply(state_), context);
+	}
+
+	auto RabbitMQConnection::check_reply(const amqp_rpc_reply_t& reply, const std::string& context) const -> std::optional<std::string>
+	{
+		switch (reply.reply_type)
+		{
+		case AMQP_RESPONSE_NORMAL:
+			return std::nullopt;
+		case AMQP_RESPONSE_NONE:
+			return context + ": missing RPC reply";
+		case AMQP_RESPONSE_LIBRARY_EXCEPTION:
+			return context + ": " + amqp_error_string2(reply.library_error);
+		case AMQP_RESPONSE_SERVER_EXCEPTION:
+			if (reply.reply.id == AMQP_CONNECTION_CLOSE_METHOD)
+			{
+				auto* close = static_cast<amqp_connection_close_t*>(reply.reply.decoded);
+				return context + ": connection closed by server: " + std::string(static_cast<char*>(close->reply_text.bytes), close->reply_text.len);
+			}
+			if (reply.reply.id == AMQP_CHANNEL_CLOSE_METHOD)
+			{
+				auto* close = static_cast<amqp_channel_close_t*>(reply.reply.decoded);
+				return context + ": channel closed by server: " + std::string(static_cast<char*>(close->reply_text.bytes), close->reply_text.len);
+			}
+			return context + ": server exception";
+		}
+
+		return context + ": unknown reply";
+	}
+
+	auto RabbitMQConnection::check_status(int status, const std::string& context) const -> std::optional<std::string>
+	{
+		if (status == AMQP_STATUS_OK)
+		{
+			return std::nullopt;
+		}
+
+		return context + ": " + amqp_error_string2(status);
+	}
+}
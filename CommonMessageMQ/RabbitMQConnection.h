@@ -0,0 +1,54 @@
+#pragma once
+
+#if __has_include(<rabbitmq-c/amqp.h>)
+#include <rabbitmq-c/amqp.h>
+#include <rabbitmq-c/tcp_socket.h>
+#else
+#include <amqp.h>
+#include <amqp_tcp_socket.h>
+#endif
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <tuple>
+
+namespace CommonMessageMQ
+{
+	// Raw rabbitmq-c connection with one open channel. Used where the CppToolkit
+	// RabbitMQ wrappers do not expose the needed protocol methods (basic.qos,
+	// manual basic.ack/nack, publisher confirms).
+	class RabbitMQConnection
+	{
+	public:
+		RabbitMQConnection(const std::string& host,
+						   int port,
+						   const std::string& user_name,
+						   const std::string& password,
+						   int channel_id = 1,
+						   int heartbeat = 60);
+		virtual ~RabbitMQConnection();
+
+		auto connect() -> std::tuple<bool, std::optional<std::string>>;
+		auto disconnect() -> void;
+		auto is_connected() const -> bool;
+
+		auto state() const -> amqp_connection_state_t;
+		auto channel_id() const -> amqp_channel_t;
+
+		auto check_reply(const std::string& context) const -> std::optional<std::string>;
+		auto check_reply(const amqp_rpc_reply_t& reply, const std::string& context) const -> std::optional<std::string>;
+		auto check_status(int status, const std::string& context) const -> std::optional<std::string>;
+
+	private:
+		std::string host_;
+		int port_;
+		std::string user_name_;
+		std::string password_;
+		amqp_channel_t channel_id_;
+		int heartbeat_;
+
+		amqp_connection_state_t state_;
+		bool channel_opened_;
+	};
+}
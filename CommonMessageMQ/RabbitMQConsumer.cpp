@@ -1,7 +1,16 @@
 #include "RabbitMQConsumer.h"
 
+#include <algorithm>
+#include <iterator>
+
 namespace CommonMessageMQ
 {
+	namespace
+	{
+		constexpr auto POLL_INTERVAL = std::chrono::milliseconds(100);
+		constexpr auto DRAIN_TIMEOUT = std::chrono::seconds(10);
+	}
+
 	RabbitMQConsumer::RabbitMQConsumer(const std::string& host,
 									   int port,
 									   const std::string& user_name,
@@ -9,56 +18,131 @@ namespace CommonMessageMQ
 									   const SSLOptions& ssl_options,
 									   int channel_id,
 									   int heartbeat)
-		: channel_id_(channel_id)
+		: connection_(nullptr)
+		, worker_(std::make_unique<RabbitMQWorkQueueConsume>(host, port, user_name, password, ssl_options))
+		, channel_id_(channel_id)
 		, heartbeat_(heartbeat)
+		, prefetch_count_(1)
+		, ack_count_(1)
+		, ack_interval_(0)
+		, requeue_on_failure_(false)
+		, dlx_exchange_(std::nullopt)
+		, dlx_routing_key_(std::nullopt)
+		, message_ttl_ms_(std::nullopt)
+		, delivery_callback_(nullptr)
+		, stop_requested_(false)
+		, consume_error_(std::nullopt)
+	{
+	}
+
+	RabbitMQConsumer::RabbitMQConsumer(const std::string& host,
+									   int port,
+									   const std::string& user_name,
+									   const std::string& password,
+									   int channel_id,
+									   int heartbeat)
+		: connection_(std::make_unique<RabbitMQConnection>(host, port, user_name, password, channel_id, heartbeat))
 		, worker_(nullptr)
+		, channel_id_(channel_id)
+		, heartbeat_(heartbeat)
+		, prefetch_count_(1)
+		, ack_count_(1)
+		, ack_interval_(0)
+		, requeue_on_failure_(false)
+		, dlx_exchange_(std::nullopt)
+		, dlx_routing_key_(std::nullopt)
+		, message_ttl_ms_(std::nullopt)
+		, delivery_callback_(nullptr)
+		, stop_requested_(false)
+		, consume_error_(std::nullopt)
 	{
-		worker_ = std::make_unique<RabbitMQWorkQueueConsume>(host, port, user_name, password, ssl_options);
 	}
 
 	RabbitMQConsumer::~RabbitMQConsumer()
 	{
-		if (worker_ != nullptr)
-		{
-			worker_.reset();
-		}
+		stop();
 	}
 
 	auto RabbitMQConsumer::start() -> std::tuple<bool, std::optional<std::string>>
 	{
-		if (worker_ == nullptr)
+		if (worker_ != nullptr)
 		{
-			return { false, std::optional<std::string>("RabbitMQ worker is nullptr") };
+			return worker_->connect(heartbeat_);
+		}
+		if (connection_ == nullptr)
+		{
+			return { false, std::optional<std::string>("RabbitMQ connection is nullptr") };
 		}
 
-		return worker_->connect(heartbeat_);
+		stop_requested_ = false;
+		return connection_->connect();
 	}
 
 	auto RabbitMQConsumer::wait_stop() -> std::tuple<bool, std::optional<std::string>>
 	{
-		if (worker_ == nullptr)
+		if (consume_thread_.joinable())
 		{
-			return { false, std::optional<std::string>("RabbitMQ worker is nullptr") };
+			consume_thread_.join();
 		}
 
-		// CppToolkit RabbitMQBase doesn't have wait_stop, just return success
+		if (consume_error_.has_value())
+		{
+			return { false, consume_error_ };
+		}
 		return { true, std::nullopt };
 	}
 
 	auto RabbitMQConsumer::stop() -> std::tuple<bool, std::optional<std::string>>
 	{
-		if (worker_ == nullptr)
+		if (worker_ != nullptr)
+		{
+			worker_->stop_consume();
+			worker_->channel_close();
+			worker_->disconnect();
+			return { true, std::nullopt };
+		}
+
+		stop_requested_ = true;
+		completion_condition_.notify_all();
+
+		if (consume_thread_.joinable() && consume_thread_.get_id() != std::this_thread::get_id())
 		{
-			return { false, std::optional<std::string>("RabbitMQ worker is nullptr") };
+			consume_thread_.join();
 		}
 
-		worker_->stop_consume();
-		worker_->channel_close();
-		worker_->disconnect();
+		if (connection_ != nullptr)
+		{
+			connection_->disconnect();
+		}
 
 		return { true, std::nullopt };
 	}
 
+	auto RabbitMQConsumer::set_prefetch_count(uint16_t prefetch_count) -> void
+	{
+		prefetch_count_ = prefetch_count;
+	}
+
+	auto RabbitMQConsumer::set_ack_batch(size_t ack_count, int ack_interval_ms) -> void
+	{
+		ack_count_ = std::max<size_t>(1, ack_count);
+		ack_interval_ = std::chrono::milliseconds(std::max(0, ack_interval_ms));
+	}
+
+	auto RabbitMQConsumer::set_queue_policies(const std::optional<std::string>& dlx_exchange,
+											  const std::optional<std::string>& dlx_routing_key,
+											  const std::optional<uint32_t>& message_ttl_ms) -> void
+	{
+		dlx_exchange_ = dlx_exchange;
+		dlx_routing_key_ = dlx_routing_key;
+		message_ttl_ms_ = message_ttl_ms;
+	}
+
+	auto RabbitMQConsumer::set_requeue_on_failure(bool requeue_on_failure) -> void
+	{
+		requeue_on_failure_ = requeue_on_failure;
+	}
+
 	auto RabbitMQConsumer::subscribe(const std::string& queue_name,
 									 const std::string& consumer_group,
 									 const std::function<std::tuple<bool, std::optional<std::string>>(
@@ -67,32 +151,302 @@ namespace CommonMessageMQ
 										 const std::string&, const std::string&, const std::string&)>& expired_callback)
 		-> std::tuple<bool, std::optional<std::string>>
 	{
-		if (worker_ == nullptr)
+		// RabbitMQ doesn't use consumer_group in the same way as Redis
+		// The queue_name itself acts as the consumer group mechanism
+
+		if (worker_ != nullptr)
 		{
-			return { false, std::optional<std::string>("RabbitMQ worker is nullptr") };
+			auto [declared_name, error] = worker_->channel_open(channel_id_, queue_name);
+			if (error.has_value())
+			{
+				return { false, error };
+			}
+
+			auto [prepared, prepare_error] = worker_->prepare_consume();
+			if (!prepared)
+			{
+				return { false, prepare_error };
+			}
+
+			auto [registered, register_error] = worker_->register_consume(channel_id_, declared_name.value(), task_callback);
+			if (!registered)
+			{
+				return { false, register_error };
+			}
+
+			return worker_->start_consume();
 		}
 
-		// RabbitMQ doesn't use consumer_group in the same way as Redis
-		// The queue_name itself acts as the consumer group mechanism
+		return subscribe_deferred(queue_name, [this, queue_name, task_callback](uint64_t delivery_tag, const std::string& body, const std::string& content_type)
+		{
+			auto [success, error] = task_callback(queue_name, body, content_type);
+			complete(delivery_tag, success);
+		});
+	}
 
-		auto [declred_name, error] = worker_->channel_open(channel_id_, queue_name);
-		if (error.has_value())
+	auto RabbitMQConsumer::subscribe_deferred(const std::string& queue_name,
+											  const std::function<void(uint64_t, const std::string&, const std::string&)>& delivery_callback)
+		-> std::tuple<bool, std::optional<std::string>>
+	{
+		if (worker_ != nullptr)
+		{
+			return { false, std::optional<std::string>("deferred acknowledgements are not available on the SSLOptions consumer; use subscribe()") };
+		}
+		if (connection_ == nullptr || !connection_->is_connected())
+		{
+			return { false, std::optional<std::string>("RabbitMQ connection is not established") };
+		}
+		if (consume_thread_.joinable())
+		{
+			return { false, std::optional<std::string>("consumer is already running") };
+		}
+
+		auto [consuming, consume_error] = declare_and_consume(queue_name);
+		if (!consuming)
+		{
+			return { false, consume_error };
+		}
+
+		delivery_callback_ = delivery_callback;
+		consume_error_ = std::nullopt;
+		outstanding_.clear();
+		completed_.clear();
+		last_ack_time_ = std::chrono::steady_clock::now();
+		consume_thread_ = std::thread(&RabbitMQConsumer::consume_loop, this);
+
+		return { true, std::nullopt };
+	}
+
+	auto RabbitMQConsumer::complete(uint64_t delivery_tag, bool success, std::vector<std::string> dead_letters) -> void
+	{
+		{
+			std::lock_guard<std::mutex> lock(completion_mutex_);
+			completions_.push_back(Completion{ delivery_tag, success, std::move(dead_letters) });
+		}
+		completion_condition_.notify_one();
+	}
+
+	auto RabbitMQConsumer::declare_and_consume(const std::string& queue_name) -> std::tuple<bool, std::optional<std::string>>
+	{
+		auto state = connection_->state();
+		auto channel = connection_->channel_id();
+		queue_name_ = queue_name;
+
+		if (dlx_exchange_.has_value())
+		{
+			amqp_exchange_declare(state, channel, amqp_cstring_bytes(dlx_exchange_->c_str()), amqp_cstring_bytes("direct"), 0, 1, 0, 0, amqp_empty_table);
+			if (auto error = connection_->check_reply("dead letter exchange declare"); error.has_value())
+			{
+				return { false, error };
+			}
+		}
+
+		std::vector<amqp_table_entry_t> entries;
+		if (dlx_exchange_.has_value())
+		{
+			amqp_table_entry_t entry;
+			entry.key = amqp_cstring_bytes("x-dead-letter-exchange");
+			entry.value.kind = AMQP_FIELD_KIND_UTF8;
+			entry.value.value.bytes = amqp_cstring_bytes(dlx_exchange_->c_str());
+			entries.push_back(entry);
+		}
+		if (dlx_routing_key_.has_value())
+		{
+			amqp_table_entry_t entry;
+			entry.key = amqp_cstring_bytes("x-dead-letter-routing-key");
+			entry.value.kind = AMQP_FIELD_KIND_UTF8;
+			entry.value.value.bytes = amqp_cstring_bytes(dlx_routing_key_->c_str());
+			entries.push_back(entry);
+		}
+		if (message_ttl_ms_.has_value())
+		{
+			amqp_table_entry_t entry;
+			entry.key = amqp_cstring_bytes("x-message-ttl");
+			entry.value.kind = AMQP_FIELD_KIND_I32;
+			entry.value.value.i32 = static_cast<int32_t>(message_ttl_ms_.value());
+			entries.push_back(entry);
+		}
+		amqp_table_t arguments{ static_cast<int>(entries.size()), entries.data() };
+
+		amqp_queue_declare(state, channel, amqp_cstring_bytes(queue_name.c_str()), 0, 1, 0, 0, arguments);
+		if (auto error = connection_->check_reply("queue declare"); error.has_value())
 		{
 			return { false, error };
 		}
 
-		auto [success1, error1] = worker_->prepare_consume();
-		if (!success1)
+		amqp_basic_qos(state, channel, 0, prefetch_count_, 0);
+		if (auto error = connection_->check_reply("basic qos"); error.has_value())
+		{
+			return { false, error };
+		}
+
+		amqp_basic_consume(state, channel, amqp_cstring_bytes(queue_name.c_str()), amqp_empty_bytes, 0, 0, 0, amqp_empty_table);
+		if (auto error = connection_->check_reply("basic consume"); error.has_value())
+		{
+			return { false, error };
+		}
+
+		return { true, std::nullopt };
+	}
+
+	auto RabbitMQConsumer::consume_loop() -> void
+	{
+		auto state = connection_->state();
+		auto poll_interval = ack_interval_.count() > 0 ? std::min(ack_interval_, std::chrono::milliseconds(POLL_INTERVAL)) : POLL_INTERVAL;
+
+		while (!stop_requested_)
+		{
+			amqp_maybe_release_buffers(state);
+
+			timeval timeout;
+			timeout.tv_sec = 0;
+			timeout.tv_usec = static_cast<decltype(timeout.tv_usec)>(poll_interval.count() * 1000);
+
+			amqp_envelope_t envelope;
+			auto reply = amqp_consume_message(state, &envelope, &timeout, 0);
+			if (reply.reply_type == AMQP_RESPONSE_NORMAL)
+			{
+				std::string body(static_cast<char*>(envelope.message.body.bytes), envelope.message.body.len);
+				std::string content_type;
+				if (envelope.message.properties._flags & AMQP_BASIC_CONTENT_TYPE_FLAG)
+				{
+					content_type.assign(static_cast<char*>(envelope.message.properties.content_type.bytes), envelope.message.properties.content_type.len);
+				}
+				auto delivery_tag = envelope.delivery_tag;
+				amqp_destroy_envelope(&envelope);
+
+				outstanding_.insert(delivery_tag);
+				delivery_callback_(delivery_tag, body, content_type);
+			}
+			else if (reply.reply_type != AMQP_RESPONSE_LIBRARY_EXCEPTION || reply.library_error != AMQP_STATUS_TIMEOUT)
+			{
+				consume_error_ = connection_->check_reply(reply, "consume message");
+				break;
+			}
+
+			collect_completions();
+			flush_acks(false);
+		}
+
+		// Give in-flight deliveries a chance to finish so their acks are not lost to a redelivery
+		auto deadline = std::chrono::steady_clock::now() + DRAIN_TIMEOUT;
+		while (!consume_error_.has_value() && !outstanding_.empty() && std::chrono::steady_clock::now() < deadline)
 		{
-			return { false, error1 };
+			{
+				std::unique_lock<std::mutex> lock(completion_mutex_);
+				completion_condition_.wait_for(lock, POLL_INTERVAL, [this]() { return !completions_.empty(); });
+			}
+			collect_completions();
 		}
 
-		auto [success2, error2] = worker_->register_consume(channel_id_, declred_name.value(), task_callback);
-		if (!success2)
+		if (!consume_error_.has_value())
+		{
+			collect_completions();
+			flush_acks(true);
+		}
+	}
+
+	auto RabbitMQConsumer::collect_completions() -> void
+	{
+		std::vector<Completion> completions;
+		{
+			std::lock_guard<std::mutex> lock(completion_mutex_);
+			completions.swap(completions_);
+		}
+
+		auto state = connection_->state();
+		for (const auto& [delivery_tag, success, dead_letters] : completions)
+		{
+			if (outstanding_.erase(delivery_tag) == 0)
+			{
+				continue;
+			}
+
+			if (success && !dead_letters.empty())
+			{
+				if (auto error = publish_dead_letters(dead_letters); error.has_value())
+				{
+					// Left unsettled so the broker redelivers it: the committed parts repeat, but the failed ones are not lost
+					outstanding_.insert(delivery_tag);
+					consume_error_ = error;
+					stop_requested_ = true;
+					return;
+				}
+			}
+
+			if (success)
+			{
+				completed_.insert(delivery_tag);
+				continue;
+			}
+
+			amqp_basic_nack(state, connection_->channel_id(), delivery_tag, 0, requeue_on_failure_ ? 1 : 0);
+		}
+	}
+
+	auto RabbitMQConsumer::publish_dead_letters(const std::vector<std::string>& dead_letters) -> std::optional<std::string>
+	{
+		std::string exchange;
+		std::string routing_key = queue_name_;
+		if (!requeue_on_failure_)
+		{
+			if (!dlx_exchange_.has_value())
+			{
+				return std::nullopt;
+			}
+			exchange = dlx_exchange_.value();
+			routing_key = dlx_routing_key_.value_or(queue_name_);
+		}
+
+		amqp_basic_properties_t properties;
+		properties._flags = AMQP_BASIC_CONTENT_TYPE_FLAG | AMQP_BASIC_DELIVERY_MODE_FLAG;
+		properties.content_type = amqp_cstring_bytes("application/json");
+		properties.delivery_mode = 2;
+
+		for (const auto& body : dead_letters)
+		{
+			amqp_bytes_t payload;
+			payload.len = body.size();
+			payload.bytes = const_cast<char*>(body.data());
+
+			auto status = amqp_basic_publish(connection_->state(), connection_->channel_id(), amqp_cstring_bytes(exchange.c_str()),
+											 amqp_cstring_bytes(routing_key.c_str()), 0, 0, &properties, payload);
+			if (auto error = connection_->check_status(status, "dead letter publish"); error.has_value())
+			{
+				return error;
+			}
+		}
+
+		return std::nullopt;
+	}
+
+	auto RabbitMQConsumer::flush_acks(bool force) -> void
+	{
+		if (completed_.empty())
+		{
+			return;
+		}
+
+		auto now = std::chrono::steady_clock::now();
+		if (!force && completed_.size() < ack_count_ && now - last_ack_time_ < ack_interval_)
+		{
+			return;
+		}
+
+		// multiple=true settles every delivery up to the tag, so stop below the oldest one still in flight
+		auto limit = completed_.end();
+		if (!outstanding_.empty())
+		{
+			limit = completed_.lower_bound(*outstanding_.begin());
+		}
+		if (limit == completed_.begin())
 		{
-			return { false, error2 };
+			return;
 		}
 
-		return worker_->start_consume();
+		auto last = std::prev(limit);
+		amqp_basic_ack(connection_->state(), connection_->channel_id(), *last, 1);
+		completed_.erase(completed_.begin(), limit);
+		last_ack_time_ = now;
 	}
 }
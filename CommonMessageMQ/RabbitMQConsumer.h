@@ -1,14 +1,29 @@
 #pragma once
 
 #include "MessageQueueConsumer.h"
+#include "RabbitMQConnection.h"
 #include "RabbitMQWorkQueueConsume.h"
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
 
 using namespace RabbitMQ;
 
 namespace CommonMessageMQ
 {
+	// Work queue consumer with a basic.qos prefetch window and batched acknowledgements.
+	// Successful deliveries are acked with multiple=true once every N completions or every
+	// T ms (only up to the lowest delivery still in flight); failures are nacked one by one
+	// so the broker routes them to the queue's dead letter exchange.
+	// Constructed with SSLOptions it consumes through the CppToolkit work queue instead, as it always has:
+	// TLS, but one synchronous ack per delivery and no subscribe_deferred().
 	class RabbitMQConsumer : public MessageQueueConsumer
 	{
 	public:
@@ -19,12 +34,25 @@ namespace CommonMessageMQ
 						 const SSLOptions& ssl_options = SSLOptions(),
 						 int channel_id = 1,
 						 int heartbeat = 60);
+		RabbitMQConsumer(const std::string& host,
+						 int port,
+						 const std::string& user_name,
+						 const std::string& password,
+						 int channel_id,
+						 int heartbeat = 60);
 		virtual ~RabbitMQConsumer();
 
 		auto start() -> std::tuple<bool, std::optional<std::string>> override;
 		auto wait_stop() -> std::tuple<bool, std::optional<std::string>> override;
 		auto stop() -> std::tuple<bool, std::optional<std::string>> override;
 
+		auto set_prefetch_count(uint16_t prefetch_count) -> void;
+		auto set_ack_batch(size_t ack_count, int ack_interval_ms) -> void;
+		auto set_queue_policies(const std::optional<std::string>& dlx_exchange,
+								const std::optional<std::string>& dlx_routing_key,
+								const std::optional<uint32_t>& message_ttl_ms) -> void;
+		auto set_requeue_on_failure(bool requeue_on_failure) -> void;
+
 		auto subscribe(const std::string& queue_name,
 					   const std::string& consumer_group,
 					   const std::function<std::tuple<bool, std::optional<std::string>>(
@@ -33,9 +61,58 @@ namespace CommonMessageMQ
 						   const std::string&, const std::string&, const std::string&)>& expired_callback = nullptr)
 			-> std::tuple<bool, std::optional<std::string>> override;
 
+		// Deliveries are handed over with their delivery tag and settled later through complete(),
+		// which may be called from any thread.
+		auto subscribe_deferred(const std::string& queue_name,
+								const std::function<void(uint64_t, const std::string&, const std::string&)>& delivery_callback)
+			-> std::tuple<bool, std::optional<std::string>>;
+		// dead_letters are parts of a successful delivery (application/json) that failed on their own. They are
+		// settled the way a nack would settle them: republished to the queue with requeue_on_failure, else to the
+		// dead letter exchange, else dropped; the delivery is acked once they are out.
+		auto complete(uint64_t delivery_tag, bool success, std::vector<std::string> dead_letters = {}) -> void;
+
+	private:
+		auto declare_and_consume(const std::string& queue_name) -> std::tuple<bool, std::optional<std::string>>;
+		auto consume_loop() -> void;
+		auto collect_completions() -> void;
+		auto publish_dead_letters(const std::vector<std::string>& dead_letters) -> std::optional<std::string>;
+		auto flush_acks(bool force) -> void;
+
+		struct Completion
+		{
+			uint64_t delivery_tag;
+			bool success;
+			std::vector<std::string> dead_letters;
+		};
+
 	private:
+		std::unique_ptr<RabbitMQConnection> connection_;
+		// Set instead of connection_ by the SSLOptions constructor
+		std::unique_ptr<RabbitMQWorkQueueConsume> worker_;
 		int channel_id_;
 		int heartbeat_;
-		std::unique_ptr<RabbitMQWorkQueueConsume> worker_;
+
+		uint16_t prefetch_count_;
+		size_t ack_count_;
+		std::chrono::milliseconds ack_interval_;
+		bool requeue_on_failure_;
+		std::optional<std::string> dlx_exchange_;
+		std::optional<std::string> dlx_routing_key_;
+		std::optional<uint32_t> message_ttl_ms_;
+		std::string queue_name_;
+
+		std::function<void(uint64_t, const std::string&, const std::string&)> delivery_callback_;
+		std::thread consume_thread_;
+		std::atomic<bool> stop_requested_;
+		std::optional<std::string> consume_error_;
+
+		// Owned by the consume thread
+		std::set<uint64_t> outstanding_;
+		std::set<uint64_t> completed_;
+		std::chrono::steady_clock::time_point last_ack_time_;
+
+		std::mutex completion_mutex_;
+		std::condition_variable completion_condition_;
+		std::vector<Completion> completions_;
 	};
 }
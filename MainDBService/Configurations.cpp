@@ -35,7 +35,19 @@ Configurations::Configurations(ArgumentParser&& arguments)
 	, dlx_exchange_(std::nullopt)
 	, dlx_routing_key_(std::nullopt)
 	, message_ttl_ms_(std::nullopt)
+	, prefetch_count_(64)
+	, ack_batch_count_(16)
+	, ack_batch_interval_ms_(50)
 	, postgres_conn_("host=127.0.0.1 port=5432 dbname=game user=postgres password=postgres")
+	, schema_source_("none")
+	, insert_coalesce_max_rows_(500)
+	, insert_coalesce_max_bytes_(1024 * 1024)
+	, copy_max_rows_(50000)
+	, copy_max_bytes_(16 * 1024 * 1024)
+	, statement_cache_size_(256)
+	, db_worker_count_(4)
+	, micro_batch_size_(32)
+	, micro_batch_wait_ms_(5)
 {
 	root_path_ = arguments.program_folder();
 	load();
@@ -126,6 +138,21 @@ auto Configurations::message_ttl_ms() const -> std::optional<int>
 	return message_ttl_ms_;
 }
 
+auto Configurations::prefetch_count() const -> int
+{
+	return prefetch_count_;
+}
+
+auto Configurations::ack_batch_count() const -> int
+{
+	return ack_batch_count_;
+}
+
+auto Configurations::ack_batch_interval_ms() const -> int
+{
+	return ack_batch_interval_ms_;
+}
+
 auto Configurations::postgres_conn() const -> std::string
 {
 	return postgres_conn_;
@@ -141,6 +168,66 @@ auto Configurations::allowed_tables() const -> const std::vector<std::string>&
 	return allowed_tables_;
 }
 
+auto Configurations::schema_source() const -> std::string
+{
+	return schema_source_;
+}
+
+auto Configurations::schema() const -> const boost::json::object&
+{
+	return schema_;
+}
+
+auto Configurations::insert_coalesce_max_rows() const -> int
+{
+	return insert_coalesce_max_rows_;
+}
+
+auto Configurations::insert_coalesce_max_bytes() const -> int
+{
+	return insert_coalesce_max_bytes_;
+}
+
+auto Configurations::copy_tables() const -> const std::vector<std::string>&
+{
+	return copy_tables_;
+}
+
+auto Configurations::copy_max_rows() const -> int
+{
+	return copy_max_rows_;
+}
+
+auto Configurations::copy_max_bytes() const -> int
+{
+	return copy_max_bytes_;
+}
+
+auto Configurations::statement_cache_size() const -> int
+{
+	return statement_cache_size_;
+}
+
+auto Configurations::db_worker_count() const -> int
+{
+	return db_worker_count_;
+}
+
+auto Configurations::micro_batch_size() const -> int
+{
+	return micro_batch_size_;
+}
+
+auto Configurations::micro_batch_wait_ms() const -> int
+{
+	return micro_batch_wait_ms_;
+}
+
+auto Configurations::partition_keys() const -> const std::unordered_map<std::string, std::vector<std::string>>&
+{
+	return partition_keys_;
+}
+
 auto Configurations::load() -> void
 {
 	std::filesystem::path path = root_path_ + "main_db_service_cfg.json";
@@ -276,6 +363,19 @@ auto Configurations::load() -> void
 		}
 	}
 
+	if (message.contains("prefetch_count"))
+	{
+		prefetch_count_ = static_cast<int>(message.at("prefetch_count").as_int64());
+	}
+	if (message.contains("ack_batch_count"))
+	{
+		ack_batch_count_ = static_cast<int>(message.at("ack_batch_count").as_int64());
+	}
+	if (message.contains("ack_batch_interval_ms"))
+	{
+		ack_batch_interval_ms_ = static_cast<int>(message.at("ack_batch_interval_ms").as_int64());
+	}
+
 	if (message.contains("allowed_ops") && message.at("allowed_ops").is_array())
 	{
 		allowed_ops_.clear();
@@ -292,6 +392,72 @@ auto Configurations::load() -> void
 			allowed_tables_.push_back(boost::json::value_to<std::string>(v));
 		}
 	}
+	if (message.contains("schema_source"))
+	{
+		schema_source_ = message.at("schema_source").as_string().data();
+	}
+	if (message.contains("schema") && message.at("schema").is_object())
+	{
+		schema_ = message.at("schema").as_object();
+	}
+
+	if (message.contains("insert_coalesce_max_rows"))
+	{
+		insert_coalesce_max_rows_ = static_cast<int>(message.at("insert_coalesce_max_rows").as_int64());
+	}
+	if (message.contains("insert_coalesce_max_bytes"))
+	{
+		insert_coalesce_max_bytes_ = static_cast<int>(message.at("insert_coalesce_max_bytes").as_int64());
+	}
+	if (message.contains("copy_tables") && message.at("copy_tables").is_array())
+	{
+		copy_tables_.clear();
+		for (auto& v : message.at("copy_tables").as_array())
+		{
+			copy_tables_.push_back(boost::json::value_to<std::string>(v));
+		}
+	}
+	if (message.contains("copy_max_rows"))
+	{
+		copy_max_rows_ = static_cast<int>(message.at("copy_max_rows").as_int64());
+	}
+	if (message.contains("copy_max_bytes"))
+	{
+		copy_max_bytes_ = static_cast<int>(message.at("copy_max_bytes").as_int64());
+	}
+	if (message.contains("statement_cache_size"))
+	{
+		statement_cache_size_ = static_cast<int>(message.at("statement_cache_size").as_int64());
+	}
+
+	if (message.contains("db_worker_count"))
+	{
+		db_worker_count_ = static_cast<int>(message.at("db_worker_count").as_int64());
+	}
+	if (message.contains("micro_batch_size"))
+	{
+		micro_batch_size_ = static_cast<int>(message.at("micro_batch_size").as_int64());
+	}
+	if (message.contains("micro_batch_wait_ms"))
+	{
+		micro_batch_wait_ms_ = static_cast<int>(message.at("micro_batch_wait_ms").as_int64());
+	}
+	if (message.contains("partition_keys") && message.at("partition_keys").is_object())
+	{
+		partition_keys_.clear();
+		for (auto& kv : message.at("partition_keys").as_object())
+		{
+			if (!kv.value().is_array())
+			{
+				continue;
+			}
+			auto& columns = partition_keys_[std::string(kv.key().data(), kv.key().size())];
+			for (auto& v : kv.value().as_array())
+			{
+				columns.push_back(boost::json::value_to<std::string>(v));
+			}
+		}
+	}
 }
 
 auto Configurations::parse(ArgumentParser& arguments) -> void
@@ -345,4 +511,52 @@ auto Configurations::parse(ArgumentParser& arguments) -> void
 	{
 		message_ttl_ms_ = v.value();
 	}
+	if (auto v = arguments.to_int("--prefetch_count"); v != std::nullopt)
+	{
+		prefetch_count_ = v.value();
+	}
+	if (auto v = arguments.to_int("--ack_batch_count"); v != std::nullopt)
+	{
+		ack_batch_count_ = v.value();
+	}
+	if (auto v = arguments.to_int("--ack_batch_interval_ms"); v != std::nullopt)
+	{
+		ack_batch_interval_ms_ = v.value();
+	}
+	if (auto v = arguments.to_string("--schema_source"); v != std::nullopt)
+	{
+		schema_source_ = v.value();
+	}
+	if (auto v = arguments.to_int("--insert_coalesce_max_rows"); v != std::nullopt)
+	{
+		insert_coalesce_max_rows_ = v.value();
+	}
+	if (auto v = arguments.to_int("--insert_coalesce_max_bytes"); v != std::nullopt)
+	{
+		insert_coalesce_max_bytes_ = v.value();
+	}
+	if (auto v = arguments.to_int("--copy_max_rows"); v != std::nullopt)
+	{
+		copy_max_rows_ = v.value();
+	}
+	if (auto v = arguments.to_int("--copy_max_bytes"); v != std::nullopt)
+	{
+		copy_max_bytes_ = v.value();
+	}
+	if (auto v = arguments.to_int("--statement_cache_size"); v != std::nullopt)
+	{
+		statement_cache_size_ = v.value();
+	}
+	if (auto v = arguments.to_int("--db_worker_count"); v != std::nullopt)
+	{
+		db_worker_count_ = v.value();
+	}
+	if (auto v = arguments.to_int("--micro_batch_size"); v != std::nullopt)
+	{
+		micro_batch_size_ = v.value();
+	}
+	if (auto v = arguments.to_int("--micro_batch_wait_ms"); v != std::nullopt)
+	{
+		micro_batch_wait_ms_ = v.value();
+	}
 }
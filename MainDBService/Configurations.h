@@ -3,7 +3,11 @@
 #include "LogTypes.h"
 #include "ArgumentParser.h"
 
+#include <boost/json.hpp>
+
+#include <optional>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 using namespace Utilities;
@@ -32,10 +36,29 @@ public:
 	auto dlx_exchange() const -> std::optional<std::string>;
 	auto dlx_routing_key() const -> std::optional<std::string>;
 	auto message_ttl_ms() const -> std::optional<int>;
+	auto prefetch_count() const -> int;
+	auto ack_batch_count() const -> int;
+	auto ack_batch_interval_ms() const -> int;
 
 	auto postgres_conn() const -> std::string;
 	auto allowed_ops() const -> const std::vector<std::string>&;
 	auto allowed_tables() const -> const std::vector<std::string>&;
+	// "none", "database" (introspected at startup) or "config" (the schema object below)
+	auto schema_source() const -> std::string;
+	auto schema() const -> const boost::json::object&;
+
+	auto insert_coalesce_max_rows() const -> int;
+	auto insert_coalesce_max_bytes() const -> int;
+	auto copy_tables() const -> const std::vector<std::string>&;
+	// A COPY stream is sent in chunks of at most this many rows / bytes (0 = no byte limit)
+	auto copy_max_rows() const -> int;
+	auto copy_max_bytes() const -> int;
+	auto statement_cache_size() const -> int;
+
+	auto db_worker_count() const -> int;
+	auto micro_batch_size() const -> int;
+	auto micro_batch_wait_ms() const -> int;
+	auto partition_keys() const -> const std::unordered_map<std::string, std::vector<std::string>>&;
 
 protected:
 	auto load() -> void;
@@ -62,6 +85,9 @@ private:
 	std::optional<std::string> dlx_exchange_;
 	std::optional<std::string> dlx_routing_key_;
 	std::optional<int> message_ttl_ms_;
+	int prefetch_count_;
+	int ack_batch_count_;
+	int ack_batch_interval_ms_;
 
 	// DB
 	std::string postgres_conn_;
@@ -69,4 +95,20 @@ private:
 	// Policy
 	std::vector<std::string> allowed_ops_;
 	std::vector<std::string> allowed_tables_;
+	std::string schema_source_;
+	boost::json::object schema_;
+
+	// Batch
+	int insert_coalesce_max_rows_;
+	int insert_coalesce_max_bytes_;
+	std::vector<std::string> copy_tables_;
+	int copy_max_rows_;
+	int copy_max_bytes_;
+	int statement_cache_size_;
+
+	// Workers
+	int db_worker_count_;
+	int micro_batch_size_;
+	int micro_batch_wait_ms_;
+	std::unordered_map<std::string, std::vector<std::string>> partition_keys_;
 };
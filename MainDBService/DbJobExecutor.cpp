@@ -1,16 +1,85 @@
 #include "DbJobExecutor.h"
 
+#include "fmt/format.h"
+
+#include <algorithm>
+#include <iterator>
+
 using namespace Database;
 
-DbJobExecutor::DbJobExecutor(PostgresDB& db,
-							   const std::vector<std::string>& allowed_ops,
-							   const std::vector<std::string>& allowed_tables)
+namespace
+{
+	// Pooled statements holding more than this are released instead, so one huge COPY doesn't pin its buffer
+	constexpr size_t max_pooled_statement_bytes = 4 * 1024 * 1024;
+	constexpr size_t max_pooled_statements = 256;
+
+	auto string_view_of(const boost::json::value& v) -> std::string_view
+	{
+		const auto& s = v.get_string();
+		return std::string_view(s.data(), s.size());
+	}
+
+	auto key_of(const boost::json::key_value_pair& kv) -> std::string_view
+	{
+		return std::string_view(kv.key().data(), kv.key().size());
+	}
+
+	// Serialises an object or array through a stack buffer instead of into a temporary string
+	template <typename Sink>
+	auto serialize_chunks(const boost::json::value& v, Sink&& sink) -> void
+	{
+		boost::json::serializer serializer;
+		serializer.reset(&v);
+		char buffer[512];
+		while (!serializer.done())
+		{
+			sink(serializer.read(buffer, sizeof(buffer)));
+		}
+	}
+
+	auto append_copy_text(std::string& data, std::string_view text) -> void
+	{
+		// COPY text format: backslash, tab, newline and carriage return must be escaped
+		for (auto c : text)
+		{
+			switch (c)
+			{
+			case '\\': data += "\\\\"; break;
+			case '\t': data += "\\t"; break;
+			case '\n': data += "\\n"; break;
+			case '\r': data += "\\r"; break;
+			default: data += c; break;
+			}
+		}
+	}
+
+	template <typename Number>
+	auto append_number(std::string& out, Number value) -> void
+	{
+		fmt::format_to(std::back_inserter(out), "{}", value);
+	}
+}
+
+DbJobExecutor::DbJobExecutor(PostgresDB& db, std::shared_ptr<Configurations> configurations, std::shared_ptr<const SchemaRegistry> schema)
 	: db_(db)
-	, allowed_ops_(allowed_ops)
-	, allowed_tables_(allowed_tables)
-{}
+	, allowed_ops_(configurations->allowed_ops())
+	, allowed_tables_(configurations->allowed_tables())
+	, insert_coalesce_max_rows_(static_cast<size_t>(std::max(1, configurations->insert_coalesce_max_rows())))
+	, insert_coalesce_max_bytes_(static_cast<size_t>(std::max(0, configurations->insert_coalesce_max_bytes())))
+	, copy_tables_(configurations->copy_tables())
+	, copy_max_rows_(static_cast<size_t>(std::max(1, configurations->copy_max_rows())))
+	, copy_max_bytes_(static_cast<size_t>(std::max(0, configurations->copy_max_bytes())))
+	, statement_cache_size_(static_cast<size_t>(std::max(0, configurations->statement_cache_size())))
+	, session_(nullptr)
+	, schema_(std::move(schema))
+{
+	if (!copy_tables_.empty() || statement_cache_size_ > 0)
+	{
+		session_ = std::make_unique<PostgresConnection>(configurations->postgres_conn(), statement_cache_size_);
+	}
+}
 
-auto DbJobExecutor::is_safe_identifier(const std::string& ident) const -> bool
+auto DbJobExecutor::is_safe_identifier(std::string_view ident) const -> bool
 {
     if (ident.empty())
     {
@@ -37,154 +106,656 @@ auto DbJobExecutor::is_safe_identifier(const std::string& ident) const -> bool
 
 auto DbJobExecutor::handle_message(const std::string& message) -> std::tuple<bool, std::optional<std::string>>
 {
-	auto v = boost::json::parse(message);
-    if (!v.is_object())
-    {
-        return { false, "invalid message: not a JSON object" };
-    }
-	auto obj = v.as_object();
+	parser_.reset(boost::json::storage_ptr(&parse_resource_));
+
+	boost::json::error_code ec;
+	parser_.write(message.data(), message.size(), ec);
+	if (ec)
+	{
+		return { false, "invalid JSON: " + ec.message() };
+	}
+
+	std::tuple<bool, std::optional<std::string>> result{ false, "invalid message: not a JSON object" };
+	{
+		auto v = parser_.release();
+		if (v.is_object())
+		{
+			result = handle_operation(v.as_object());
+		}
+	}
+	parse_resource_.release();
+	return result;
+}
+
+auto DbJobExecutor::handle_operation(const boost::json::object& obj) -> std::tuple<bool, std::optional<std::string>>
+{
+	auto [ok, err] = operation_to_statements(obj, statements_);
+	if (!ok)
+	{
+		recycle_statements(statements_);
+		return { false, err };
+	}
+
+	auto result = execute_statements(statements_);
+	recycle_statements(statements_);
+	return result;
+}
+
+auto DbJobExecutor::handle_operations(const std::vector<boost::json::object>& operations) -> std::vector<std::tuple<bool, std::optional<std::string>>>
+{
+	std::vector<std::tuple<bool, std::optional<std::string>>> results(operations.size(), { false, std::nullopt });
+	if (operations.size() == 1)
+	{
+		results.front() = handle_operation(operations.front());
+		return results;
+	}
+
+	if (operation_statements_.size() < operations.size())
+	{
+		operation_statements_.resize(operations.size());
+	}
+	operation_ready_.assign(operations.size(), false);
+
+	auto release_all = [&]()
+	{
+		for (size_t index = 0; index < operations.size(); ++index)
+		{
+			recycle_statements(operation_statements_[index]);
+		}
+	};
 
-	if (obj.if_contains("batch") && obj["batch"].is_array())
+	bool any_valid = false;
+	for (size_t index = 0; index < operations.size(); ++index)
 	{
-		std::vector<std::string> sqls;
-		for (auto& item : obj["batch"].as_array())
+		auto [ok, err] = operation_to_statements(operations[index], operation_statements_[index]);
+		if (!ok)
+		{
+			results[index] = { false, err };
+			continue;
+		}
+		operation_ready_[index] = true;
+		any_valid = true;
+	}
+
+	if (!any_valid)
+	{
+		release_all();
+		return results;
+	}
+
+	auto fail_all = [&](const std::optional<std::string>& err)
+	{
+		for (size_t index = 0; index < operations.size(); ++index)
+		{
+			if (operation_ready_[index])
+			{
+				results[index] = { false, err };
+			}
+		}
+		release_all();
+	};
+
+	auto [ok_begin, err_begin] = execute_command("BEGIN;");
+	if (!ok_begin)
+	{
+		fail_all(err_begin);
+		return results;
+	}
+
+	for (size_t index = 0; index < operations.size(); ++index)
+	{
+		if (!operation_ready_[index])
 		{
-            if (!item.is_object())
-            {
-                return { false, "batch item must be object" };
-            }
-			auto io = item.as_object();
-			auto [ok, err, sql] = to_sql(io);
+			continue;
+		}
+
+		auto [ok_savepoint, err_savepoint] = execute_command("SAVEPOINT message_savepoint;");
+		if (!ok_savepoint)
+		{
+			execute_command("ROLLBACK;");
+			fail_all(err_savepoint);
+			return results;
+		}
+
+		std::optional<std::string> error = std::nullopt;
+		for (const auto& statement : operation_statements_[index])
+		{
+			auto [ok, err] = execute_statement(statement);
 			if (!ok)
 			{
-				return { false, err };
+				error = err.value_or("unknown error");
+				break;
 			}
-			sqls.push_back(sql);
 		}
-		return execute_batch(sqls);
+
+		if (!error.has_value())
+		{
+			execute_command("RELEASE SAVEPOINT message_savepoint;");
+			results[index] = { true, std::nullopt };
+			continue;
+		}
+
+		results[index] = { false, error };
+		operation_ready_[index] = false;
+
+		// Undo only this message; the transaction stays usable for the rest of the group
+		auto [ok_rollback, err_rollback] = execute_command("ROLLBACK TO SAVEPOINT message_savepoint;");
+		if (!ok_rollback)
+		{
+			execute_command("ROLLBACK;");
+			fail_all(err_rollback);
+			return results;
+		}
+		execute_command("RELEASE SAVEPOINT message_savepoint;");
 	}
 
-	auto [ok, err, sql] = to_sql(obj);
-	if (!ok)
+	auto [ok_commit, err_commit] = execute_command("COMMIT;");
+	if (!ok_commit)
 	{
-		return { false, err };
+		fail_all(err_commit);
+		return results;
 	}
-	return db_.execute_command(sql);
+
+	release_all();
+	return results;
 }
 
-auto DbJobExecutor::to_sql(const boost::json::object& obj) -> std::tuple<bool, std::string, std::string>
+auto DbJobExecutor::statement_cache_stats() const -> std::optional<StatementCache::Stats>
+{
+	if (!prepared_statements_enabled())
+	{
+		return std::nullopt;
+	}
+	return session_->statement_cache_stats();
+}
+
+auto DbJobExecutor::write_sql(std::string& sql, const boost::json::object& obj) const -> void
 {
 	if (obj.if_contains("sql"))
 	{
-        if (!op_allowed("exec"))
-        {
-            return { false, "op not allowed: exec", "" };
-        }
-        return { true, "", boost::json::value_to<std::string>(obj.at("sql")) };
+		sql += string_view_of(obj.at("sql"));
+		return;
 	}
-	if (obj.if_contains("op") && obj.if_contains("table"))
+
+	auto op = string_view_of(obj.at("op"));
+	auto table = string_view_of(obj.at("table"));
+	if (op == "insert")
+	{
+		write_insert_sql(sql, table, obj.at("values").as_object());
+		return;
+	}
+	if (op == "update")
+	{
+		write_update_sql(sql, table, obj.at("values").as_object(), obj.at("where").as_object());
+		return;
+	}
+	if (op == "upsert")
 	{
-		auto op = boost::json::value_to<std::string>(obj.at("op"));
-		auto table = boost::json::value_to<std::string>(obj.at("table"));
-        // Policy checks
-        if (!op_allowed(op))
+		write_upsert_sql(sql, table, obj.at("values").as_object(), *conflict_of(obj));
+		return;
+	}
+	write_delete_sql(sql, table, obj.at("where").as_object());
+}
+
+auto DbJobExecutor::batch_to_statements(const boost::json::array& batch, std::vector<Statement>& statements) -> std::tuple<bool, std::string>
+{
+	for (auto& item : batch)
+	{
+        if (!item.is_object())
         {
-            return { false, std::string("op not allowed: ") + op, "" };
+			insert_group_.rows = 0;
+            return { false, "batch item must be object" };
         }
-        if (!table_allowed(table))
+
+		auto [ok, err] = append_statement(item.as_object(), statements);
+		if (!ok)
+		{
+			insert_group_.rows = 0;
+			return { false, err };
+		}
+	}
+	flush_insert_group(statements);
+
+	return { true, "" };
+}
+
+auto DbJobExecutor::operation_to_statements(const boost::json::object& obj, std::vector<Statement>& statements) -> std::tuple<bool, std::string>
+{
+	if (obj.if_contains("batch") && obj.at("batch").is_array())
+	{
+		return batch_to_statements(obj.at("batch").as_array(), statements);
+	}
+
+	auto [ok, err] = append_statement(obj, statements);
+	if (!ok)
+	{
+		insert_group_.rows = 0;
+		return { false, err };
+	}
+	flush_insert_group(statements);
+
+	return { true, "" };
+}
+
+auto DbJobExecutor::append_statement(const boost::json::object& obj, std::vector<Statement>& statements) -> std::tuple<bool, std::string>
+{
+	auto [valid, error] = validate_operation(obj);
+	if (!valid)
+	{
+		return { false, error };
+	}
+
+	if (!obj.if_contains("sql") && obj.at("op").as_string() == "insert")
+	{
+		auto table = string_view_of(obj.at("table"));
+		if (copy_table(table))
+		{
+			append_copy_row(table, obj.at("values").as_object(), statements);
+		}
+		else
+		{
+			append_insert_row(table, obj.at("values").as_object(), nullptr, statements);
+		}
+		return { true, "" };
+	}
+	if (!obj.if_contains("sql") && obj.at("op").as_string() == "upsert")
+	{
+		append_insert_row(string_view_of(obj.at("table")), obj.at("values").as_object(), conflict_of(obj), statements);
+		return { true, "" };
+	}
+
+	flush_insert_group(statements);
+	auto statement = take_statement();
+	if (!obj.if_contains("sql") && prepared_statements_enabled())
+	{
+		write_prepared_statement(statement, obj);
+	}
+	else
+	{
+		write_sql(statement.sql, obj);
+	}
+	statements.push_back(std::move(statement));
+
+	return { true, "" };
+}
+
+auto DbJobExecutor::validate_operation(const boost::json::object& obj) const -> std::tuple<bool, std::string>
+{
+	if (obj.if_contains("sql"))
+	{
+        if (!op_allowed("exec"))
         {
-            return { false, std::string("table not allowed: ") + table, "" };
+            return { false, "op not allowed: exec" };
         }
-        if (!is_safe_identifier(table))
+        if (!obj.at("sql").is_string())
         {
-            return { false, std::string("invalid table name: ") + table, "" };
+            return { false, "'sql' must be a string" };
         }
-		if (op == "insert")
-		{
-			auto values = obj.if_contains("values") && obj.at("values").is_object() ? obj.at("values").as_object() : boost::json::object{};
-            if (values.empty())
-            {
-                return { false, "insert requires non-empty 'values'", "" };
-            }
-            for (auto& kv : values)
-            {
-                auto key = std::string(kv.key().data(), kv.key().size());
-                if (!is_safe_identifier(key))
-                {
-                    return { false, std::string("invalid column name: ") + key, "" };
-                }
-            }
-            return { true, "", build_insert_sql(table, values) };
-		}
-		if (op == "update")
-		{
-			auto values = obj.if_contains("values") && obj.at("values").is_object() ? obj.at("values").as_object() : boost::json::object{};
-			auto where = obj.if_contains("where") && obj.at("where").is_object() ? obj.at("where").as_object() : boost::json::object{};
-            if (values.empty())
-            {
-                return { false, "update requires non-empty 'values'", "" };
-            }
-            if (where.empty())
-            {
-                return { false, "update requires non-empty 'where'", "" };
-            }
-            for (auto& kv : values)
-            {
-                auto key = std::string(kv.key().data(), kv.key().size());
-                if (!is_safe_identifier(key))
-                {
-                    return { false, std::string("invalid column name: ") + key, "" };
-                }
-            }
-            for (auto& kv : where)
-            {
-                auto key = std::string(kv.key().data(), kv.key().size());
-                if (!is_safe_identifier(key))
-                {
-                    return { false, std::string("invalid column name in where: ") + key, "" };
-                }
-            }
-            return { true, "", build_update_sql(table, values, where) };
-		}
-		if (op == "delete")
-		{
-			auto where = obj.if_contains("where") && obj.at("where").is_object() ? obj.at("where").as_object() : boost::json::object{};
-            if (where.empty())
-            {
-                return { false, "delete requires non-empty 'where'", "" };
-            }
-            for (auto& kv : where)
-            {
-                auto key = std::string(kv.key().data(), kv.key().size());
-                if (!is_safe_identifier(key))
-                {
-                    return { false, std::string("invalid column name in where: ") + key, "" };
-                }
-            }
-            return { true, "", build_delete_sql(table, where) };
-		}
-        return { false, std::string("unsupported op: ") + op, "" };
-	}
-    return { false, "unsupported message format", "" };
-}
-
-auto DbJobExecutor::execute_batch(const std::vector<std::string>& sqls) -> std::tuple<bool, std::optional<std::string>>
-{
-	auto [ok_begin, err_begin] = db_.execute_command("BEGIN;");
+        return { true, "" };
+	}
+	if (!obj.if_contains("op") || !obj.if_contains("table") || !obj.at("op").is_string() || !obj.at("table").is_string())
+	{
+		return { false, "unsupported message format" };
+	}
+
+	auto op = string_view_of(obj.at("op"));
+	auto table = string_view_of(obj.at("table"));
+    // Policy checks
+    if (!op_allowed(op))
+    {
+        return { false, std::string("op not allowed: ").append(op) };
+    }
+    if (!table_allowed(table))
+    {
+        return { false, std::string("table not allowed: ").append(table) };
+    }
+
+	const SchemaRegistry::Table* schema_table = nullptr;
+	if (schema_ != nullptr)
+	{
+		schema_table = schema_->table(table);
+		if (schema_table == nullptr)
+		{
+			return { false, std::string("unknown table: ").append(table) };
+		}
+	}
+	else if (!is_safe_identifier(table))
+	{
+		return { false, std::string("invalid table name: ").append(table) };
+	}
+
+	auto has_values = obj.if_contains("values") && obj.at("values").is_object() && !obj.at("values").as_object().empty();
+	auto has_where = obj.if_contains("where") && obj.at("where").is_object() && !obj.at("where").as_object().empty();
+	if (op == "insert" && !has_values)
+	{
+		return { false, "insert requires non-empty 'values'" };
+	}
+	if (op == "update" && !has_values)
+	{
+		return { false, "update requires non-empty 'values'" };
+	}
+	if (op == "upsert" && !has_values)
+	{
+		return { false, "upsert requires non-empty 'values'" };
+	}
+	if ((op == "update" || op == "delete") && !has_where)
+	{
+		return { false, std::string(op).append(" requires non-empty 'where'") };
+	}
+	if (op != "insert" && op != "update" && op != "upsert" && op != "delete")
+	{
+        return { false, std::string("unsupported op: ").append(op) };
+	}
+	if (op == "upsert")
+	{
+		// The conflict target has to be a set of columns the row supplies, e.g. its primary key
+		const auto* conflict = conflict_of(obj);
+		if (conflict == nullptr || conflict->empty())
+		{
+			return { false, "upsert requires non-empty 'conflict'" };
+		}
+		for (auto& column : *conflict)
+		{
+			if (!column.is_string() || !obj.at("values").as_object().contains(column.as_string()))
+			{
+				return { false, "upsert 'conflict' columns must be present in 'values'" };
+			}
+		}
+	}
+
+	if (schema_table != nullptr)
+	{
+		// Names found in the schema are known identifiers, so a hash probe replaces the character checks
+		if (op != "delete")
+		{
+			auto usage = op == "update" ? SchemaRegistry::Usage::Update : SchemaRegistry::Usage::Insert;
+			if (auto error = SchemaRegistry::check_columns(*schema_table, obj.at("values").as_object(), usage); error.has_value())
+			{
+				return { false, error.value() };
+			}
+		}
+		if (op == "update" || op == "delete")
+		{
+			if (auto error = SchemaRegistry::check_columns(*schema_table, obj.at("where").as_object(), SchemaRegistry::Usage::Where); error.has_value())
+			{
+				return { false, error.value() };
+			}
+		}
+		return { true, "" };
+	}
+
+	if (op != "delete")
+	{
+		for (auto& kv : obj.at("values").as_object())
+		{
+			if (!is_safe_identifier(key_of(kv)))
+			{
+				return { false, std::string("invalid column name: ").append(key_of(kv)) };
+			}
+		}
+	}
+	if (op == "update" || op == "delete")
+	{
+		for (auto& kv : obj.at("where").as_object())
+		{
+			if (!is_safe_identifier(key_of(kv)))
+			{
+				return { false, std::string("invalid column name in where: ").append(key_of(kv)) };
+			}
+		}
+	}
+
+	return { true, "" };
+}
+
+auto DbJobExecutor::conflict_of(const boost::json::object& obj) const -> const boost::json::array*
+{
+	if (const auto* conflict = obj.if_contains("conflict"); conflict != nullptr)
+	{
+		return conflict->if_array();
+	}
+	if (schema_ == nullptr)
+	{
+		return nullptr;
+	}
+
+	const auto* table = schema_->table(string_view_of(obj.at("table")));
+	return table != nullptr && !table->primary_key.empty() ? &table->primary_key : nullptr;
+}
+
+auto DbJobExecutor::append_insert_row(std::string_view table, const boost::json::object& values, const boost::json::array* conflict, std::vector<Statement>& statements) -> void
+{
+	auto& group = insert_group_;
+	auto same_shape = group.rows > 0 && !group.copy && group.table == table && group.shape->size() == values.size() &&
+		(group.conflict == conflict || (group.conflict != nullptr && conflict != nullptr && *group.conflict == *conflict));
+	if (same_shape)
+	{
+		for (const auto& kv : *group.shape)
+		{
+			if (!values.contains(kv.key()))
+			{
+				same_shape = false;
+				break;
+			}
+		}
+	}
+
+	size_t key_hash = 0;
+	if (conflict != nullptr)
+	{
+		key_hash = conflict_key_hash(values, *conflict);
+		same_shape = same_shape && !group.keys.contains(key_hash);
+	}
+
+	if (!same_shape || group.rows >= insert_coalesce_max_rows_)
+	{
+		flush_insert_group(statements);
+	}
+
+	// The first row stays unrendered so that a group of one can still go out as a prepared statement
+	if (group.rows == 0)
+	{
+		group.table = table;
+		group.copy = false;
+		group.shape = &values;
+		group.conflict = conflict;
+		group.keys.clear();
+		if (conflict != nullptr)
+		{
+			group.keys.insert(key_hash);
+		}
+		group.statement = take_statement();
+		write_insert_head(group.statement.sql, table, values);
+		group.first_values = &values;
+		group.rows = 1;
+		return;
+	}
+
+	auto& sql = group.statement.sql;
+	if (group.first_values != nullptr)
+	{
+		write_insert_row(sql, *group.shape, *group.first_values);
+		group.first_values = nullptr;
+	}
+
+	auto row_start = sql.size();
+	sql += ",";
+	write_insert_row(sql, *group.shape, values);
+	if (insert_coalesce_max_bytes_ > 0 && sql.size() + 1 > insert_coalesce_max_bytes_)
+	{
+		// The row doesn't fit; it starts the next statement instead
+		auto next = take_statement();
+		write_insert_head(next.sql, table, *group.shape);
+		next.sql.append(sql, row_start + 1, std::string::npos);
+		sql.resize(row_start);
+		write_insert_tail(sql, *group.shape, group.conflict);
+		statements.push_back(std::move(group.statement));
+		group.statement = std::move(next);
+		group.rows = 1;
+		group.keys.clear();
+		if (conflict != nullptr)
+		{
+			group.keys.insert(key_hash);
+		}
+		return;
+	}
+
+	if (conflict != nullptr)
+	{
+		group.keys.insert(key_hash);
+	}
+	group.rows++;
+}
+
+auto DbJobExecutor::append_copy_row(std::string_view table, const boost::json::object& values, std::vector<Statement>& statements) -> void
+{
+	auto& group = insert_group_;
+	auto same_shape = group.rows > 0 && group.copy && group.table == table && group.shape->size() == values.size();
+	if (same_shape)
+	{
+		for (const auto& kv : *group.shape)
+		{
+			if (!values.contains(kv.key()))
+			{
+				same_shape = false;
+				break;
+			}
+		}
+	}
+
+	// A full chunk goes out as its own COPY, so one large flush doesn't buffer its whole payload
+	if (same_shape && (group.rows >= copy_max_rows_ || (copy_max_bytes_ > 0 && group.statement.copy_data.size() >= copy_max_bytes_)))
+	{
+		same_shape = false;
+	}
+
+	if (!same_shape)
+	{
+		flush_insert_group(statements);
+		group.table = table;
+		group.copy = true;
+		group.shape = &values;
+		group.statement = take_statement();
+		group.statement.copy = true;
+		write_copy_sql(group.statement.sql, table, values);
+	}
+
+	auto& data = group.statement.copy_data;
+	bool first = true;
+	for (const auto& kv : *group.shape)
+	{
+		if (!first)
+		{
+			data += '\t';
+		}
+		first = false;
+		write_copy_field(data, group.shape == &values ? kv.value() : values.at(kv.key()));
+	}
+	data += '\n';
+	group.rows++;
+}
+
+auto DbJobExecutor::flush_insert_group(std::vector<Statement>& statements) -> void
+{
+	auto& group = insert_group_;
+	if (group.rows == 0)
+	{
+		return;
+	}
+
+	if (!group.copy && group.first_values != nullptr && prepared_statements_enabled())
+	{
+		group.statement.sql.clear();
+		if (group.conflict != nullptr)
+		{
+			write_prepared_upsert(group.statement, group.table, *group.first_values, *group.conflict);
+		}
+		else
+		{
+			write_prepared_insert(group.statement, group.table, *group.shape, *group.first_values);
+		}
+	}
+	else if (!group.copy)
+	{
+		if (group.first_values != nullptr)
+		{
+			write_insert_row(group.statement.sql, *group.shape, *group.first_values);
+		}
+		write_insert_tail(group.statement.sql, *group.shape, group.conflict);
+	}
+	statements.push_back(std::move(group.statement));
+
+	group.shape = nullptr;
+	group.first_values = nullptr;
+	group.conflict = nullptr;
+	group.rows = 0;
+}
+
+auto DbJobExecutor::conflict_key_hash(const boost::json::object& values, const boost::json::array& conflict) -> size_t
+{
+	// Rendered as literals, so equal keys hash alike; a collision only splits the statement early
+	auto& key = insert_group_.key;
+	key.clear();
+	for (const auto& column : conflict)
+	{
+		write_sql_literal(key, values.at(string_view_of(column)));
+		key += ',';
+	}
+	return std::hash<std::string_view>()(key);
+}
+
+auto DbJobExecutor::take_statement() -> Statement
+{
+	if (statement_pool_.empty())
+	{
+		return Statement();
+	}
+
+	auto statement = std::move(statement_pool_.back());
+	statement_pool_.pop_back();
+	statement.sql.clear();
+	statement.copy = false;
+	statement.copy_data.clear();
+	statement.cache_key.clear();
+	// params keeps its slots; the writer overwrites them and trims the rest
+	return statement;
+}
+
+auto DbJobExecutor::recycle_statements(std::vector<Statement>& statements) -> void
+{
+	for (auto& statement : statements)
+	{
+		if (statement_pool_.size() < max_pooled_statements &&
+			statement.sql.capacity() + statement.copy_data.capacity() <= std::max(max_pooled_statement_bytes, insert_coalesce_max_bytes_))
+		{
+			statement_pool_.push_back(std::move(statement));
+		}
+	}
+	statements.clear();
+}
+
+auto DbJobExecutor::execute_statements(const std::vector<Statement>& statements) -> std::tuple<bool, std::optional<std::string>>
+{
+	if (statements.size() == 1)
+	{
+		return execute_statement(statements.front());
+	}
+
+	auto [ok_begin, err_begin] = execute_command("BEGIN;");
 	if (!ok_begin)
 	{
 		return { false, err_begin };
 	}
-	for (const auto& s : sqls)
+	for (const auto& statement : statements)
 	{
-		auto [ok, err] = db_.execute_command(s);
+		auto [ok, err] = execute_statement(statement);
 		if (!ok)
 		{
-			db_.execute_command("ROLLBACK;");
+			execute_command("ROLLBACK;");
 			return { false, err };
 		}
 	}
-	auto [ok_commit, err_commit] = db_.execute_command("COMMIT;");
+	auto [ok_commit, err_commit] = execute_command("COMMIT;");
 	if (!ok_commit)
 	{
 		return { false, err_commit };
@@ -192,7 +763,34 @@ auto DbJobExecutor::execute_batch(const std::vector<std::string>& sqls) -> std::
 	return { true, std::nullopt };
 }
 
-auto DbJobExecutor::op_allowed(const std::string& op) const -> bool
+auto DbJobExecutor::execute_statement(const Statement& statement) -> std::tuple<bool, std::optional<std::string>>
+{
+	if (!statement.copy && statement.cache_key.empty())
+	{
+		return execute_command(statement.sql);
+	}
+
+	if (session_ == nullptr)
+	{
+		return { false, "COPY and prepared statements require a postgres session" };
+	}
+	if (statement.copy)
+	{
+		return session_->copy_from_stdin(statement.sql, statement.copy_data);
+	}
+	return session_->execute_prepared(statement.cache_key, statement.sql, statement.params);
+}
+
+auto DbJobExecutor::execute_command(const std::string& sql) -> std::tuple<bool, std::optional<std::string>>
+{
+	if (session_ != nullptr)
+	{
+		return session_->execute_command(sql);
+	}
+	return db_.execute_command(sql);
+}
+
+auto DbJobExecutor::op_allowed(std::string_view op) const -> bool
 {
     if (allowed_ops_.empty())
 	{
@@ -208,7 +806,7 @@ auto DbJobExecutor::op_allowed(const std::string& op) const -> bool
 	return false;
 }
 
-auto DbJobExecutor::table_allowed(const std::string& table) const -> bool
+auto DbJobExecutor::table_allowed(std::string_view table) const -> bool
 {
     if (allowed_tables_.empty())
 	{
@@ -224,105 +822,151 @@ auto DbJobExecutor::table_allowed(const std::string& table) const -> bool
 	return false;
 }
 
-auto DbJobExecutor::quote_identifier(const std::string& ident) const -> std::string
+auto DbJobExecutor::prepared_statements_enabled() const -> bool
 {
-	return "\"" + ident + "\"";
+	return session_ != nullptr && statement_cache_size_ > 0;
 }
 
-auto DbJobExecutor::json_value_to_sql_literal(const boost::json::value& v) const -> std::string
+auto DbJobExecutor::copy_table(std::string_view table) const -> bool
 {
-	if (v.is_null())
-	{
-		return "NULL";
-	}
-	if (v.is_bool())
-	{
-		return v.as_bool() ? "TRUE" : "FALSE";
-	}
-	if (v.is_int64())
+    for (const auto& t : copy_tables_)
 	{
-		return std::to_string(v.as_int64());
-	}
-	if (v.is_uint64())
-	{
-		return std::to_string(v.as_uint64());
+		if (t == table)
+		{
+			return true;
+		}
 	}
-	if (v.is_double())
+	return false;
+}
+
+auto DbJobExecutor::write_identifier(std::string& sql, std::string_view ident) const -> void
+{
+	sql += '"';
+	sql += ident;
+	sql += '"';
+}
+
+auto DbJobExecutor::write_sql_literal(std::string& sql, const boost::json::value& v) const -> void
+{
+	switch (v.kind())
 	{
-		return std::to_string(v.as_double());
+	case boost::json::kind::null:
+		sql += "NULL";
+		return;
+	case boost::json::kind::bool_:
+		sql += v.get_bool() ? "TRUE" : "FALSE";
+		return;
+	case boost::json::kind::int64:
+		append_number(sql, v.get_int64());
+		return;
+	case boost::json::kind::uint64:
+		append_number(sql, v.get_uint64());
+		return;
+	case boost::json::kind::double_:
+		append_number(sql, v.get_double());
+		return;
+	case boost::json::kind::string:
+		sql += '\'';
+		write_escaped_text(sql, string_view_of(v));
+		sql += '\'';
+		return;
+	default:
+		// Escaped as a whole, so no multibyte character is split between two chunks
+		literal_scratch_.clear();
+		serialize_chunks(v, [this](std::string_view chunk) { literal_scratch_ += chunk; });
+		sql += '\'';
+		write_escaped_text(sql, literal_scratch_);
+		sql += '\'';
+		return;
 	}
-	if (v.is_string())
+}
+
+auto DbJobExecutor::write_escaped_text(std::string& sql, std::string_view text) const -> void
+{
+	// Always through a connection: escaping by hand misreads multibyte client encodings such as SJIS, BIG5 or GBK.
+	// Like PQescapeStringConn, stop at an embedded NUL; text columns can't hold one.
+	text = text.substr(0, text.find('\0'));
+	if (session_ != nullptr && session_->escape_string(sql, text))
 	{
-		auto s = boost::json::value_to<std::string>(v);
-		return "'" + db_.escape_string(s) + "'";
+		return;
 	}
-	auto s = boost::json::serialize(v);
-	return "'" + db_.escape_string(s) + "'";
+	// The wrapper escapes on its own connection to the same server, but only into a new string
+	sql += db_.escape_string(std::string(text));
 }
 
-auto DbJobExecutor::build_where_clause(const boost::json::object& where) const -> std::string
+auto DbJobExecutor::write_where_clause(std::string& sql, const boost::json::object& where) const -> void
 {
 	if (where.empty())
 	{
-		return "";
+		return;
 	}
-	std::string clause = " WHERE ";
+	sql += " WHERE ";
 	bool first = true;
 	for (auto& kv : where)
 	{
 		if (!first)
 		{
-			clause += " AND ";
+			sql += " AND ";
 		}
 		first = false;
-        clause += quote_identifier(std::string(kv.key().data(), kv.key().size()));
+		write_identifier(sql, key_of(kv));
 		if (kv.value().is_null())
 		{
-			clause += " IS NULL";
+			sql += " IS NULL";
 		}
 		else
 		{
-			clause += " = ";
-			clause += json_value_to_sql_literal(kv.value());
+			sql += " = ";
+			write_sql_literal(sql, kv.value());
 		}
 	}
-	return clause;
 }
 
-auto DbJobExecutor::build_insert_sql(const std::string& table, const boost::json::object& values) const -> std::string
+auto DbJobExecutor::write_insert_sql(std::string& sql, std::string_view table, const boost::json::object& values) const -> void
+{
+	write_insert_head(sql, table, values);
+	write_insert_row(sql, values, values);
+	sql += ";";
+}
+
+auto DbJobExecutor::write_insert_head(std::string& sql, std::string_view table, const boost::json::object& shape) const -> void
 {
-	std::string sql = "INSERT INTO ";
-	sql += quote_identifier(table);
+	sql += "INSERT INTO ";
+	write_identifier(sql, table);
 	sql += " (";
 	bool first = true;
-	for (auto& kv : values)
+	for (const auto& kv : shape)
 	{
 		if (!first)
 		{
 			sql += ",";
 		}
 		first = false;
-        sql += quote_identifier(std::string(kv.key().data(), kv.key().size()));
+		write_identifier(sql, key_of(kv));
 	}
-	sql += ") VALUES (";
-	first = true;
-	for (auto& kv : values)
+	sql += ") VALUES ";
+}
+
+auto DbJobExecutor::write_insert_row(std::string& sql, const boost::json::object& shape, const boost::json::object& values) const -> void
+{
+	sql += "(";
+	bool first = true;
+	for (const auto& kv : shape)
 	{
 		if (!first)
 		{
 			sql += ",";
 		}
 		first = false;
-		sql += json_value_to_sql_literal(kv.value());
+		write_sql_literal(sql, &shape == &values ? kv.value() : values.at(kv.key()));
 	}
-	sql += ");";
-	return sql;
+	sql += ")";
 }
 
-auto DbJobExecutor::build_update_sql(const std::string& table, const boost::json::object& values, const boost::json::object& where) const -> std::string
+auto DbJobExecutor::write_update_sql(std::string& sql, std::string_view table, const boost::json::object& values, const boost::json::object& where) const -> void
 {
-	std::string sql = "UPDATE ";
-	sql += quote_identifier(table);
+	sql += "UPDATE ";
+	write_identifier(sql, table);
 	sql += " SET ";
 	bool first = true;
 	for (auto& kv : values)
@@ -332,20 +976,282 @@ auto DbJobExecutor::build_update_sql(const std::string& table, const boost::json
 			sql += ",";
 		}
 		first = false;
-        sql += quote_identifier(std::string(kv.key().data(), kv.key().size()));
+		write_identifier(sql, key_of(kv));
 		sql += " = ";
-		sql += json_value_to_sql_literal(kv.value());
+		write_sql_literal(sql, kv.value());
+	}
+	write_where_clause(sql, where);
+	sql += ";";
+}
+
+auto DbJobExecutor::write_upsert_sql(std::string& sql, std::string_view table, const boost::json::object& values, const boost::json::array& conflict) const -> void
+{
+	write_insert_head(sql, table, values);
+	write_insert_row(sql, values, values);
+	write_insert_tail(sql, values, &conflict);
+}
+
+auto DbJobExecutor::write_insert_tail(std::string& sql, const boost::json::object& shape, const boost::json::array* conflict) const -> void
+{
+	if (conflict != nullptr)
+	{
+		write_conflict_clause(sql, shape, *conflict);
 	}
-	sql += build_where_clause(where);
 	sql += ";";
-	return sql;
 }
 
-auto DbJobExecutor::build_delete_sql(const std::string& table, const boost::json::object& where) const -> std::string
+auto DbJobExecutor::write_conflict_clause(std::string& sql, const boost::json::object& values, const boost::json::array& conflict) const -> void
+{
+	sql += " ON CONFLICT (";
+	bool first = true;
+	for (const auto& column : conflict)
+	{
+		if (!first)
+		{
+			sql += ",";
+		}
+		first = false;
+		write_identifier(sql, string_view_of(column));
+	}
+	sql += ")";
+
+	auto is_conflict_column = [&conflict](std::string_view column)
+	{
+		return std::any_of(conflict.begin(), conflict.end(), [column](const boost::json::value& c) { return string_view_of(c) == column; });
+	};
+
+	// A row made of key columns only has nothing to update
+	first = true;
+	for (const auto& kv : values)
+	{
+		if (is_conflict_column(key_of(kv)))
+		{
+			continue;
+		}
+		sql += first ? " DO UPDATE SET " : ",";
+		first = false;
+		write_identifier(sql, key_of(kv));
+		sql += " = EXCLUDED.";
+		write_identifier(sql, key_of(kv));
+	}
+	if (first)
+	{
+		sql += " DO NOTHING";
+	}
+}
+
+auto DbJobExecutor::write_delete_sql(std::string& sql, std::string_view table, const boost::json::object& where) const -> void
 {
-	std::string sql = "DELETE FROM ";
-	sql += quote_identifier(table);
-	sql += build_where_clause(where);
+	sql += "DELETE FROM ";
+	write_identifier(sql, table);
+	write_where_clause(sql, where);
 	sql += ";";
-	return sql;
+}
+
+auto DbJobExecutor::write_copy_sql(std::string& sql, std::string_view table, const boost::json::object& shape) const -> void
+{
+	sql += "COPY ";
+	write_identifier(sql, table);
+	sql += " (";
+	bool first = true;
+	for (const auto& kv : shape)
+	{
+		if (!first)
+		{
+			sql += ",";
+		}
+		first = false;
+		write_identifier(sql, key_of(kv));
+	}
+	sql += ") FROM STDIN";
+}
+
+auto DbJobExecutor::write_copy_field(std::string& data, const boost::json::value& v) const -> void
+{
+	switch (v.kind())
+	{
+	case boost::json::kind::null:
+		data += "\\N";
+		return;
+	case boost::json::kind::bool_:
+		data += v.get_bool() ? "t" : "f";
+		return;
+	case boost::json::kind::int64:
+		append_number(data, v.get_int64());
+		return;
+	case boost::json::kind::uint64:
+		append_number(data, v.get_uint64());
+		return;
+	case boost::json::kind::double_:
+		append_number(data, v.get_double());
+		return;
+	case boost::json::kind::string:
+		append_copy_text(data, string_view_of(v));
+		return;
+	default:
+		serialize_chunks(v, [&data](std::string_view chunk) { append_copy_text(data, chunk); });
+		return;
+	}
+}
+
+auto DbJobExecutor::write_prepared_statement(Statement& statement, const boost::json::object& obj) const -> void
+{
+	auto op = string_view_of(obj.at("op"));
+	auto table = string_view_of(obj.at("table"));
+	if (op == "insert")
+	{
+		write_prepared_insert(statement, table, obj.at("values").as_object(), obj.at("values").as_object());
+		return;
+	}
+	if (op == "upsert")
+	{
+		write_prepared_upsert(statement, table, obj.at("values").as_object(), *conflict_of(obj));
+		return;
+	}
+
+	statement.cache_key += op;
+	statement.cache_key += "|";
+	statement.cache_key += table;
+
+	size_t param_count = 0;
+	if (op == "update")
+	{
+		statement.sql += "UPDATE ";
+		write_identifier(statement.sql, table);
+		statement.sql += " SET ";
+		bool first = true;
+		for (auto& kv : obj.at("values").as_object())
+		{
+			statement.sql += first ? "" : ",";
+			statement.cache_key += first ? "|" : ",";
+			first = false;
+			write_param(statement, param_count++, kv.value());
+			write_identifier(statement.sql, key_of(kv));
+			statement.sql += " = $";
+			append_number(statement.sql, param_count);
+			statement.cache_key += key_of(kv);
+		}
+	}
+	else
+	{
+		statement.sql += "DELETE FROM ";
+		write_identifier(statement.sql, table);
+	}
+
+	// NULL comparisons become IS NULL, which changes the statement shape and therefore the key
+	statement.sql += " WHERE ";
+	statement.cache_key += "|";
+	bool first = true;
+	for (auto& kv : obj.at("where").as_object())
+	{
+		if (!first)
+		{
+			statement.sql += " AND ";
+			statement.cache_key += ",";
+		}
+		first = false;
+		write_identifier(statement.sql, key_of(kv));
+		statement.cache_key += key_of(kv);
+		if (kv.value().is_null())
+		{
+			statement.sql += " IS NULL";
+			statement.cache_key += " IS NULL";
+			continue;
+		}
+		write_param(statement, param_count++, kv.value());
+		statement.sql += " = $";
+		append_number(statement.sql, param_count);
+	}
+	statement.sql += ";";
+	statement.params.resize(param_count);
+}
+
+auto DbJobExecutor::write_prepared_insert(Statement& statement, std::string_view table, const boost::json::object& shape, const boost::json::object& values) const -> void
+{
+	write_insert_head(statement.sql, table, shape);
+	statement.cache_key += "insert|";
+	statement.cache_key += table;
+	statement.cache_key += "|";
+
+	statement.sql += "(";
+	size_t param_count = 0;
+	for (const auto& kv : shape)
+	{
+		if (param_count > 0)
+		{
+			statement.sql += ",";
+			statement.cache_key += ",";
+		}
+		write_param(statement, param_count++, &shape == &values ? kv.value() : values.at(kv.key()));
+		statement.sql += "$";
+		append_number(statement.sql, param_count);
+		statement.cache_key += key_of(kv);
+	}
+	statement.sql += ");";
+	statement.params.resize(param_count);
+}
+
+auto DbJobExecutor::write_prepared_upsert(Statement& statement, std::string_view table, const boost::json::object& values, const boost::json::array& conflict) const -> void
+{
+	write_prepared_insert(statement, table, values, values);
+	statement.sql.pop_back();
+	write_conflict_clause(statement.sql, values, conflict);
+	statement.sql += ";";
+
+	statement.cache_key.replace(0, std::string_view("insert").size(), "upsert");
+	statement.cache_key += "|";
+	bool first = true;
+	for (const auto& column : conflict)
+	{
+		if (!first)
+		{
+			statement.cache_key += ",";
+		}
+		first = false;
+		statement.cache_key += string_view_of(column);
+	}
+}
+
+auto DbJobExecutor::write_param(Statement& statement, size_t index, const boost::json::value& v) const -> void
+{
+	if (index == statement.params.size())
+	{
+		statement.params.emplace_back();
+	}
+
+	// Reuses the slot's buffer from the statement's previous life when there is one
+	auto& param = statement.params[index];
+	if (v.is_null())
+	{
+		param.reset();
+		return;
+	}
+	if (!param.has_value())
+	{
+		param.emplace();
+	}
+	auto& text = param.value();
+	text.clear();
+
+	switch (v.kind())
+	{
+	case boost::json::kind::bool_:
+		text += v.get_bool() ? "true" : "false";
+		return;
+	case boost::json::kind::int64:
+		append_number(text, v.get_int64());
+		return;
+	case boost::json::kind::uint64:
+		append_number(text, v.get_uint64());
+		return;
+	case boost::json::kind::double_:
+		append_number(text, v.get_double());
+		return;
+	case boost::json::kind::string:
+		text += string_view_of(v);
+		return;
+	default:
+		serialize_chunks(v, [&text](std::string_view chunk) { text += chunk; });
+		return;
+	}
 }
@@ -1,40 +1,135 @@
 #pragma once
 
+#include "Configurations.h"
+#include "PostgresConnection.h"
 #include "PostgresDB.h"
+#include "SchemaRegistry.h"
 #include <boost/json.hpp>
 
+#include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <tuple>
+#include <unordered_set>
+#include <vector>
 
 class DbJobExecutor
 {
+	friend class DbJobExecutorBenchmark;
+
 public:
-	DbJobExecutor(Database::PostgresDB& db,
-				  const std::vector<std::string>& allowed_ops,
-				  const std::vector<std::string>& allowed_tables);
+	DbJobExecutor(Database::PostgresDB& db, std::shared_ptr<Configurations> configurations, std::shared_ptr<const SchemaRegistry> schema = nullptr);
 
 	auto handle_message(const std::string& message) -> std::tuple<bool, std::optional<std::string>>;
+	auto handle_operation(const boost::json::object& obj) -> std::tuple<bool, std::optional<std::string>>;
+	// Runs several operations in one transaction, each under its own savepoint, and returns one result per operation
+	auto handle_operations(const std::vector<boost::json::object>& operations) -> std::vector<std::tuple<bool, std::optional<std::string>>>;
+	auto statement_cache_stats() const -> std::optional<StatementCache::Stats>;
 
 private:
-	auto to_sql(const boost::json::object& obj) -> std::tuple<bool, std::string, std::string>;
-	auto execute_batch(const std::vector<std::string>& sqls) -> std::tuple<bool, std::optional<std::string>>;
-	
-	auto op_allowed(const std::string& op) const -> bool;
-	auto table_allowed(const std::string& table) const -> bool;
+	// A plain SQL statement, a COPY ... FROM STDIN statement with its text-format payload,
+	// or a parameterised statement executed through the prepared statement cache under cache_key.
+	// Executed statements go back to a pool, so their buffers are reused rather than reallocated.
+	struct Statement
+	{
+		std::string sql;
+		bool copy = false;
+		std::string copy_data;
+		std::string cache_key;
+		std::vector<std::optional<std::string>> params;
+	};
+
+	// Consecutive inserts into the same table with the same column set are merged into one
+	// multi-row INSERT, or into one COPY stream when the table is listed in copy_tables.
+	// Upserts with the same conflict columns are merged the same way under one ON CONFLICT clause.
+	// The column order is that of the first row; table and shape point into the operations being converted.
+	struct InsertGroup
+	{
+		std::string_view table;
+		const boost::json::object* shape = nullptr;
+		const boost::json::object* first_values = nullptr;
+		const boost::json::array* conflict = nullptr;
+		Statement statement;
+		bool copy = false;
+		size_t rows = 0;
+		// Hashes of the conflict keys in the statement; PostgreSQL refuses to update a row twice in one
+		// statement, so a repeated key starts the next one and the later row still wins
+		std::unordered_set<size_t> keys;
+		std::string key;
+	};
+
+	auto batch_to_statements(const boost::json::array& batch, std::vector<Statement>& statements) -> std::tuple<bool, std::string>;
+	auto operation_to_statements(const boost::json::object& obj, std::vector<Statement>& statements) -> std::tuple<bool, std::string>;
+	auto append_statement(const boost::json::object& obj, std::vector<Statement>& statements) -> std::tuple<bool, std::string>;
+	auto validate_operation(const boost::json::object& obj) const -> std::tuple<bool, std::string>;
+	// The message's conflict columns, or the table's primary key from the schema when it names none
+	auto conflict_of(const boost::json::object& obj) const -> const boost::json::array*;
+	auto append_insert_row(std::string_view table, const boost::json::object& values, const boost::json::array* conflict, std::vector<Statement>& statements) -> void;
+	auto append_copy_row(std::string_view table, const boost::json::object& values, std::vector<Statement>& statements) -> void;
+	auto flush_insert_group(std::vector<Statement>& statements) -> void;
+	auto conflict_key_hash(const boost::json::object& values, const boost::json::array& conflict) -> size_t;
+	auto take_statement() -> Statement;
+	auto recycle_statements(std::vector<Statement>& statements) -> void;
+	auto execute_statements(const std::vector<Statement>& statements) -> std::tuple<bool, std::optional<std::string>>;
+	auto execute_statement(const Statement& statement) -> std::tuple<bool, std::optional<std::string>>;
+	auto execute_command(const std::string& sql) -> std::tuple<bool, std::optional<std::string>>;
 	
-	auto quote_identifier(const std::string& ident) const -> std::string;
-	auto json_value_to_sql_literal(const boost::json::value& v) const -> std::string;
-	auto build_where_clause(const boost::json::object& where) const -> std::string;
-	auto build_insert_sql(const std::string& table, const boost::json::object& values) const -> std::string;
-	auto build_update_sql(const std::string& table, const boost::json::object& values, const boost::json::object& where) const -> std::string;
-	auto build_delete_sql(const std::string& table, const boost::json::object& where) const -> std::string;
+	auto op_allowed(std::string_view op) const -> bool;
+	auto table_allowed(std::string_view table) const -> bool;
+	auto copy_table(std::string_view table) const -> bool;
+	auto prepared_statements_enabled() const -> bool;
+
+	// SQL is rendered by appending to the caller's buffer; nothing here builds temporary strings
+	auto write_sql(std::string& sql, const boost::json::object& obj) const -> void;
+	auto write_identifier(std::string& sql, std::string_view ident) const -> void;
+	auto write_sql_literal(std::string& sql, const boost::json::value& v) const -> void;
+	auto write_escaped_text(std::string& sql, std::string_view text) const -> void;
+	auto write_where_clause(std::string& sql, const boost::json::object& where) const -> void;
+	auto write_insert_sql(std::string& sql, std::string_view table, const boost::json::object& values) const -> void;
+	auto write_insert_head(std::string& sql, std::string_view table, const boost::json::object& shape) const -> void;
+	auto write_insert_row(std::string& sql, const boost::json::object& shape, const boost::json::object& values) const -> void;
+	auto write_insert_tail(std::string& sql, const boost::json::object& shape, const boost::json::array* conflict) const -> void;
+	auto write_update_sql(std::string& sql, std::string_view table, const boost::json::object& values, const boost::json::object& where) const -> void;
+	auto write_upsert_sql(std::string& sql, std::string_view table, const boost::json::object& values, const boost::json::array& conflict) const -> void;
+	auto write_conflict_clause(std::string& sql, const boost::json::object& values, const boost::json::array& conflict) const -> void;
+	auto write_delete_sql(std::string& sql, std::string_view table, const boost::json::object& where) const -> void;
+	auto write_copy_sql(std::string& sql, std::string_view table, const boost::json::object& shape) const -> void;
+	auto write_copy_field(std::string& data, const boost::json::value& v) const -> void;
+	auto write_prepared_statement(Statement& statement, const boost::json::object& obj) const -> void;
+	auto write_prepared_insert(Statement& statement, std::string_view table, const boost::json::object& shape, const boost::json::object& values) const -> void;
+	auto write_prepared_upsert(Statement& statement, std::string_view table, const boost::json::object& values, const boost::json::array& conflict) const -> void;
+	auto write_param(Statement& statement, size_t index, const boost::json::value& v) const -> void;
 
 private:
 	Database::PostgresDB& db_;
 	std::vector<std::string> allowed_ops_;
 	std::vector<std::string> allowed_tables_;
+	size_t insert_coalesce_max_rows_;
+	size_t insert_coalesce_max_bytes_;
+	std::vector<std::string> copy_tables_;
+	size_t copy_max_rows_;
+	size_t copy_max_bytes_;
+	size_t statement_cache_size_;
+
+	// Dedicated libpq session, created when COPY ingest or the statement cache is enabled; all statements then run on it
+	std::unique_ptr<PostgresConnection> session_;
+
+	// Null without a schema; otherwise tables and columns are checked against it instead of by name
+	std::shared_ptr<const SchemaRegistry> schema_;
+
+	// Scratch kept across calls so that converting an operation allocates nothing once the buffers have grown
+	InsertGroup insert_group_;
+	std::vector<Statement> statement_pool_;
+	std::vector<Statement> statements_;
+	std::vector<std::vector<Statement>> operation_statements_;
+	std::vector<bool> operation_ready_;
+	// Nested values are serialised here before they are escaped
+	mutable std::string literal_scratch_;
+	// handle_message parses into this arena and releases it once the operation has run
+	boost::json::monotonic_resource parse_resource_;
+	boost::json::parser parser_;
 
 	// Identifier safety: only allow [A-Za-z_][A-Za-z0-9_]*
-	auto is_safe_identifier(const std::string& ident) const -> bool;
+	auto is_safe_identifier(std::string_view ident) const -> bool;
 };
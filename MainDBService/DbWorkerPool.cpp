@@ -0,0 +1,587 @@
+#include "DbWorkerPool.h"
+
+#include "Job.h"
+#include "JobPriorities.h"
+#include "Logger.h"
+#include "OperationCodec.h"
+#include "ThreadWorker.h"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <functional>
+
+using namespace Database;
+using namespace Utilities;
+
+DbWorkerPool::DbWorkerPool(std::shared_ptr<Configurations> configurations)
+	: configurations_(configurations)
+	, partition_keys_(configurations->partition_keys())
+	, micro_batch_size_(static_cast<size_t>(std::max(1, configurations->micro_batch_size())))
+	, micro_batch_wait_(std::max(0, configurations->micro_batch_wait_ms()))
+	, thread_pool_(nullptr)
+{
+}
+
+DbWorkerPool::~DbWorkerPool(void)
+{
+	stop();
+}
+
+auto DbWorkerPool::start() -> std::tuple<bool, std::optional<std::string>>
+{
+	stop();
+
+	auto [schema, schema_error] = load_schema();
+	if (schema_error.has_value())
+	{
+		return { false, schema_error };
+	}
+
+	auto worker_count = std::max(1, configurations_->db_worker_count());
+	for (int index = 0; index < worker_count; ++index)
+	{
+		auto lane = std::make_unique<Lane>();
+		lane->db = std::make_unique<PostgresDB>(configurations_->postgres_conn());
+
+		auto [db_result, db_msg] = lane->db->execute_query_and_get_result("SELECT 1;");
+		if (!db_result.has_value())
+		{
+			lanes_.clear();
+			return { false, fmt::format("database connection {} failed: {}", index, db_msg.value_or("unknown")) };
+		}
+
+		lane->executor = std::make_shared<DbJobExecutor>(*lane->db, configurations_, schema);
+		lanes_.push_back(std::move(lane));
+	}
+
+	try
+	{
+		thread_pool_ = std::make_shared<ThreadPool>();
+		for (int index = 0; index < worker_count; ++index)
+		{
+			thread_pool_->push(std::make_shared<ThreadWorker>(std::vector<JobPriorities>{ JobPriorities::High }));
+		}
+	}
+	catch (const std::bad_alloc& e)
+	{
+		return { false, fmt::format("Memory allocation failed to ThreadPool: {}", e.what()) };
+	}
+
+	auto [started, start_error] = thread_pool_->start();
+	if (!started)
+	{
+		return { false, start_error };
+	}
+
+	Logger::handle().write(LogTypes::Information, fmt::format("DbWorkerPool started with {} lanes", lanes_.size()));
+
+	return { true, std::nullopt };
+}
+
+auto DbWorkerPool::stop() -> void
+{
+	if (thread_pool_ != nullptr)
+	{
+		thread_pool_->stop();
+		thread_pool_.reset();
+	}
+
+	for (size_t index = 0; index < lanes_.size(); ++index)
+	{
+		if (auto stats = lanes_[index]->executor->statement_cache_stats(); stats.has_value())
+		{
+			Logger::handle().write(LogTypes::Information, fmt::format("lane {} statement cache: hits={}, misses={}, evictions={}, size={}",
+				index, stats->hits, stats->misses, stats->evictions, stats->size));
+		}
+	}
+	lanes_.clear();
+}
+
+auto DbWorkerPool::handle_message(const std::string& message, const std::string& content_type) -> std::tuple<bool, std::optional<std::string>>
+{
+	if (lanes_.empty())
+	{
+		return { false, "DbWorkerPool is not started" };
+	}
+
+	auto result = std::make_shared<std::promise<std::tuple<bool, std::optional<std::string>>>>();
+	auto future = result->get_future();
+	dispatch_message(message, content_type, [result](bool ok, const std::optional<std::string>& err)
+	{
+		result->set_value({ ok, err });
+	});
+
+	return future.get();
+}
+
+auto DbWorkerPool::dispatch_message(const std::string& message, const std::string& content_type, const std::function<void(bool, const std::optional<std::string>&)>& completion,
+	const std::function<void(std::vector<std::string>)>& rejected) -> void
+{
+	if (lanes_.empty())
+	{
+		completion(false, "DbWorkerPool is not started");
+		return;
+	}
+
+	auto [parsed, parse_error] = parse_message(message, content_type);
+	if (!parsed.has_value())
+	{
+		completion(false, parse_error);
+		return;
+	}
+
+	auto& obj = parsed.value();
+	if (rejected != nullptr && obj.if_contains("batch") && obj.at("batch").is_array() &&
+		obj.if_contains("packed") && obj.at("packed").is_bool() && obj.at("packed").get_bool())
+	{
+		dispatch_packed(std::move(obj), completion, rejected);
+		return;
+	}
+
+	if (!obj.if_contains("batch") || !obj.at("batch").is_array())
+	{
+		if (auto lane_index = partition_lane(obj); lane_index.has_value())
+		{
+			submit(lane_index.value(), std::move(obj), completion);
+			return;
+		}
+
+		// Without a partition key it may touch any row, so it waits for every lane
+		submit_all(std::move(obj), completion);
+		return;
+	}
+
+	// The lanes the batch touches, in lane order; the batch itself is never split
+	std::vector<bool> touched(lanes_.size(), false);
+	for (const auto& item : obj.at("batch").as_array())
+	{
+		auto lane_index = item.is_object() ? partition_lane(item.as_object()) : std::nullopt;
+		if (!lane_index.has_value())
+		{
+			// Unkeyed or malformed items may touch any row, so the batch waits for every lane
+			submit_all(std::move(obj), completion);
+			return;
+		}
+		touched[lane_index.value()] = true;
+	}
+
+	std::vector<size_t> lane_indexes;
+	for (size_t index = 0; index < touched.size(); ++index)
+	{
+		if (touched[index])
+		{
+			lane_indexes.push_back(index);
+		}
+	}
+
+	if (lane_indexes.empty())
+	{
+		completion(true, std::nullopt);
+		return;
+	}
+	if (lane_indexes.size() == 1)
+	{
+		submit(lane_indexes.front(), std::move(obj), completion);
+		return;
+	}
+	submit_gate(lane_indexes, std::move(obj), completion);
+}
+
+auto DbWorkerPool::dispatch_packed(boost::json::object message, const std::function<void(bool, const std::optional<std::string>&)>& completion,
+	const std::function<void(std::vector<std::string>)>& rejected) -> void
+{
+	auto& items = message.at("batch").as_array();
+	if (items.empty())
+	{
+		completion(true, std::nullopt);
+		return;
+	}
+
+	auto packed = std::make_shared<PackedMessage>();
+	packed->completion = completion;
+	packed->rejected = rejected;
+	packed->remaining = items.size();
+	const auto count = items.size();
+
+	auto reject = [packed](const boost::json::object& operation)
+	{
+		auto body = boost::json::serialize(operation);
+		std::lock_guard<std::mutex> lock(packed->mutex);
+		packed->dead_letters.push_back(std::move(body));
+	};
+
+	auto complete = [packed, count](bool ok, const std::optional<std::string>& err)
+	{
+		if (!ok)
+		{
+			Logger::handle().write(LogTypes::Error, fmt::format("packed operation failed: {}", err.value_or("unknown error")));
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(packed->mutex);
+			if (!ok && !packed->error.has_value())
+			{
+				packed->error = err;
+			}
+			if (--packed->remaining > 0)
+			{
+				return;
+			}
+		}
+
+		// Nothing committed, so the message can be settled as a whole
+		if (packed->dead_letters.size() == count)
+		{
+			packed->completion(false, packed->error);
+			return;
+		}
+		if (!packed->dead_letters.empty())
+		{
+			packed->rejected(std::move(packed->dead_letters));
+		}
+		packed->completion(true, std::nullopt);
+	};
+
+	// Items sharing a partition key land on the same lane in envelope order, so they stay ordered
+	for (auto& item : items)
+	{
+		if (!item.is_object())
+		{
+			{
+				std::lock_guard<std::mutex> lock(packed->mutex);
+				packed->dead_letters.push_back(boost::json::serialize(item));
+			}
+			complete(false, "invalid operation: not a JSON object");
+			continue;
+		}
+
+		auto& operation = item.as_object();
+		if (auto lane_index = partition_lane(operation); lane_index.has_value())
+		{
+			submit(lane_index.value(), std::move(operation), complete, reject);
+			continue;
+		}
+		submit_all(std::move(operation), complete, reject);
+	}
+}
+
+auto DbWorkerPool::submit_all(boost::json::object operation, const std::function<void(bool, const std::optional<std::string>&)>& completion,
+	const std::function<void(const boost::json::object&)>& rejected) -> void
+{
+	if (lanes_.size() == 1)
+	{
+		submit(0, std::move(operation), completion, rejected);
+		return;
+	}
+
+	std::vector<size_t> lane_indexes(lanes_.size());
+	for (size_t index = 0; index < lane_indexes.size(); ++index)
+	{
+		lane_indexes[index] = index;
+	}
+	submit_gate(lane_indexes, std::move(operation), completion, rejected);
+}
+
+auto DbWorkerPool::parse_message(const std::string& message, const std::string& content_type) -> std::tuple<std::optional<boost::json::object>, std::optional<std::string>>
+{
+	// One arena per message, shared by reference count: lane tasks hold its values past this call and the
+	// arena goes away with the last of them. Only this thread allocates from it; lanes just read and move.
+	auto storage = boost::json::make_shared_resource<boost::json::monotonic_resource>(message.size() * 2);
+
+	boost::json::value parsed(storage);
+	if (CommonMessageMQ::OperationCodec::is_binary(content_type))
+	{
+		auto [decoded, decode_error] = CommonMessageMQ::OperationCodec::decode(message, storage);
+		if (!decoded.has_value())
+		{
+			return { std::nullopt, decode_error };
+		}
+		parsed = std::move(decoded.value());
+	}
+	else if (content_type.rfind("application/json", 0) == 0)
+	{
+		thread_local boost::json::parser parser;
+		parser.reset(storage);
+
+		boost::json::error_code ec;
+		parser.write(message.data(), message.size(), ec);
+		if (ec)
+		{
+			return { std::nullopt, "invalid JSON: " + ec.message() };
+		}
+		parsed = parser.release();
+	}
+	else
+	{
+		return { std::nullopt, "unsupported content-type: " + content_type };
+	}
+
+	if (!parsed.is_object())
+	{
+		return { std::nullopt, "invalid message: not a JSON object" };
+	}
+
+	return { std::move(parsed.as_object()), std::nullopt };
+}
+
+auto DbWorkerPool::partition_lane(const boost::json::object& obj) const -> std::optional<size_t>
+{
+	if (obj.if_contains("sql") || !obj.if_contains("table") || !obj.at("table").is_string())
+	{
+		return std::nullopt;
+	}
+
+	std::string key(obj.at("table").as_string());
+	auto columns = partition_keys_.find(key);
+	if (columns != partition_keys_.end())
+	{
+		const auto* where = obj.if_contains("where") && obj.at("where").is_object() ? &obj.at("where").as_object() : nullptr;
+		const auto* values = obj.if_contains("values") && obj.at("values").is_object() ? &obj.at("values").as_object() : nullptr;
+		for (const auto& column : columns->second)
+		{
+			const boost::json::value* part = nullptr;
+			if (where != nullptr)
+			{
+				part = where->if_contains(column);
+			}
+			if (part == nullptr && values != nullptr)
+			{
+				part = values->if_contains(column);
+			}
+			if (part == nullptr)
+			{
+				return std::nullopt;
+			}
+			key += '|';
+			key += boost::json::serialize(*part);
+		}
+	}
+
+	return std::hash<std::string>{}(key) % lanes_.size();
+}
+
+auto DbWorkerPool::submit(size_t lane_index, boost::json::object operation, const std::function<void(bool, const std::optional<std::string>&)>& completion,
+	const std::function<void(const boost::json::object&)>& rejected) -> void
+{
+	auto& lane = *lanes_[lane_index];
+	bool schedule = false;
+	{
+		std::lock_guard<std::mutex> lock(lane.mutex);
+		lane.tasks.push_back(LaneTask{ std::move(operation), completion, rejected, nullptr });
+		if (!lane.draining)
+		{
+			lane.draining = true;
+			schedule = true;
+		}
+	}
+
+	if (!schedule)
+	{
+		lane.condition.notify_one();
+		return;
+	}
+	schedule_drain(lane_index);
+}
+
+auto DbWorkerPool::submit_gate(const std::vector<size_t>& lane_indexes, boost::json::object operation, const std::function<void(bool, const std::optional<std::string>&)>& completion,
+	const std::function<void(const boost::json::object&)>& rejected) -> void
+{
+	auto gate = std::make_shared<Gate>(std::move(operation), completion, rejected, lane_indexes.size());
+
+	std::vector<size_t> idle_lanes;
+	{
+		std::lock_guard<std::mutex> gate_lock(gate_mutex_);
+		for (auto lane_index : lane_indexes)
+		{
+			auto& lane = *lanes_[lane_index];
+			std::lock_guard<std::mutex> lock(lane.mutex);
+			lane.tasks.push_back(LaneTask{ boost::json::object(), nullptr, nullptr, gate });
+			if (!lane.draining)
+			{
+				lane.draining = true;
+				idle_lanes.push_back(lane_index);
+			}
+		}
+	}
+
+	for (auto lane_index : lane_indexes)
+	{
+		if (std::find(idle_lanes.begin(), idle_lanes.end(), lane_index) == idle_lanes.end())
+		{
+			lanes_[lane_index]->condition.notify_one();
+		}
+	}
+	for (auto lane_index : idle_lanes)
+	{
+		schedule_drain(lane_index);
+	}
+}
+
+auto DbWorkerPool::schedule_drain(size_t lane_index) -> void
+{
+	auto [queued, queue_error] = thread_pool_->push(std::make_shared<Job>(
+		JobPriorities::High,
+		std::bind(&DbWorkerPool::drain_lane, this, lane_index),
+		"drain_lane"));
+	if (!queued)
+	{
+		Logger::handle().write(LogTypes::Error, queue_error.value_or("failed to schedule drain_lane"));
+		drain_lane(lane_index);
+	}
+}
+
+auto DbWorkerPool::pass_gate(size_t lane_index, const std::shared_ptr<Gate>& gate) -> bool
+{
+	{
+		std::lock_guard<std::mutex> lock(gate->mutex);
+		if (--gate->waiting > 0)
+		{
+			// The lane stays marked as draining, so what is queued behind the gate waits for the resume
+			gate->parked.push_back(lane_index);
+			return false;
+		}
+	}
+
+	std::vector<boost::json::object> operations;
+	operations.push_back(std::move(gate->operation));
+	std::vector<std::tuple<bool, std::optional<std::string>>> results;
+	try
+	{
+		results = lanes_[lane_index]->executor->handle_operations(operations);
+	}
+	catch (const std::exception& e)
+	{
+		results.assign(1, { false, std::string("operation failed: ") + e.what() });
+	}
+
+	auto& [ok, err] = results.front();
+	if (!ok && gate->rejected != nullptr)
+	{
+		gate->rejected(operations.front());
+	}
+	gate->completion(ok, err);
+
+	for (auto parked : gate->parked)
+	{
+		schedule_drain(parked);
+	}
+	return true;
+}
+
+auto DbWorkerPool::drain_lane(size_t lane_index) -> std::tuple<bool, std::optional<std::string>>
+{
+	auto& lane = *lanes_[lane_index];
+	while (true)
+	{
+		std::vector<LaneTask> tasks;
+		std::shared_ptr<Gate> gate;
+		{
+			std::unique_lock<std::mutex> lock(lane.mutex);
+			if (lane.tasks.empty())
+			{
+				lane.draining = false;
+				return { true, std::nullopt };
+			}
+
+			if (lane.tasks.front().gate != nullptr)
+			{
+				gate = std::move(lane.tasks.front().gate);
+				lane.tasks.pop_front();
+			}
+			else
+			{
+				// Trade a few milliseconds of latency for one commit (and one fsync) per group
+				if (lane.tasks.size() < micro_batch_size_ && micro_batch_wait_.count() > 0)
+				{
+					lane.condition.wait_for(lock, micro_batch_wait_, [this, &lane]() { return lane.tasks.size() >= micro_batch_size_; });
+				}
+
+				// A group ends at a gate; it runs on its own once this group has committed
+				while (tasks.size() < micro_batch_size_ && !lane.tasks.empty() && lane.tasks.front().gate == nullptr)
+				{
+					tasks.push_back(std::move(lane.tasks.front()));
+					lane.tasks.pop_front();
+				}
+			}
+		}
+
+		if (gate != nullptr)
+		{
+			if (!pass_gate(lane_index, gate))
+			{
+				return { true, std::nullopt };
+			}
+			continue;
+		}
+
+		std::vector<boost::json::object> operations;
+		operations.reserve(tasks.size());
+		for (auto& task : tasks)
+		{
+			operations.push_back(std::move(task.operation));
+		}
+
+		std::vector<std::tuple<bool, std::optional<std::string>>> results;
+		try
+		{
+			results = lane.executor->handle_operations(operations);
+		}
+		catch (const std::exception& e)
+		{
+			results.assign(tasks.size(), { false, std::string("operation failed: ") + e.what() });
+		}
+
+		for (size_t index = 0; index < tasks.size(); ++index)
+		{
+			auto& [ok, err] = results[index];
+			if (!ok && tasks[index].rejected != nullptr)
+			{
+				tasks[index].rejected(operations[index]);
+			}
+			tasks[index].completion(ok, err);
+		}
+	}
+}
+
+auto DbWorkerPool::load_schema() -> std::tuple<std::shared_ptr<const SchemaRegistry>, std::optional<std::string>>
+{
+	auto source = configurations_->schema_source();
+	if (source == "none")
+	{
+		return { nullptr, std::nullopt };
+	}
+
+	auto schema = std::make_shared<SchemaRegistry>();
+	if (source == "database")
+	{
+		PostgresConnection connection(configurations_->postgres_conn());
+		auto [loaded, load_error] = schema->introspect(connection, configurations_->allowed_tables());
+		if (!loaded)
+		{
+			return { nullptr, load_error };
+		}
+	}
+	else if (source == "config")
+	{
+		auto [loaded, load_error] = schema->load(configurations_->schema());
+		if (!loaded)
+		{
+			return { nullptr, load_error };
+		}
+	}
+	else
+	{
+		return { nullptr, fmt::format("unknown schema_source: {}", source) };
+	}
+
+	// An empty catalog would reject every operation as an unknown table
+	if (schema->size() == 0)
+	{
+		return { nullptr, fmt::format("schema_source {} provided no tables", source) };
+	}
+
+	Logger::handle().write(LogTypes::Information, fmt::format("schema registry loaded {} tables from {}", schema->size(), source));
+
+	return { schema, std::nullopt };
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "Configurations.h"
+#include "DbJobExecutor.h"
+#include "PostgresDB.h"
+#include "SchemaRegistry.h"
+#include "ThreadPool.h"
+
+#include <boost/json.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+using namespace Thread;
+
+// Runs DB operations on N lanes, each owning its own PostgresDB connection and DbJobExecutor.
+// Operations are routed to a lane by partition key (table + configured key columns), so work on
+// the same row stays ordered while different rows are written in parallel on the shared ThreadPool.
+// dispatch_message() returns as soon as the work is queued so several deliveries can be in flight.
+// A batch runs whole in one transaction: when its items fall on several lanes, it is queued on each
+// of them as a gate and runs once all of them reached it, so no part commits without the rest.
+// Operations without a partition key are gates on every lane. Nothing here blocks the caller
+// except handle_message(), which waits for its own result.
+// A packed batch ({"batch":[...],"packed":true}) holds unrelated operations, so when the caller takes
+// rejections each of them is queued on its own and the ones that fail are handed back to be dead-lettered
+// one by one while the rest commit. Only when all of them fail does the message fail as a whole.
+// A lane drains up to micro_batch_size queued messages (waiting at most micro_batch_wait_ms for
+// more) and commits them as one transaction with a savepoint per message.
+class DbWorkerPool
+{
+public:
+	DbWorkerPool(std::shared_ptr<Configurations> configurations);
+	virtual ~DbWorkerPool(void);
+
+	auto start() -> std::tuple<bool, std::optional<std::string>>;
+	auto stop() -> void;
+
+	// content_type selects the decoder: application/json or CommonMessageMQ::OperationCodec::content_type
+	auto handle_message(const std::string& message, const std::string& content_type) -> std::tuple<bool, std::optional<std::string>>;
+	// rejected receives the failed operations of a packed batch as JSON, before completion(true, ...)
+	auto dispatch_message(const std::string& message, const std::string& content_type, const std::function<void(bool, const std::optional<std::string>&)>& completion,
+		const std::function<void(std::vector<std::string>)>& rejected = nullptr) -> void;
+
+protected:
+	auto parse_message(const std::string& message, const std::string& content_type) -> std::tuple<std::optional<boost::json::object>, std::optional<std::string>>;
+	auto partition_lane(const boost::json::object& obj) const -> std::optional<size_t>;
+	auto dispatch_packed(boost::json::object message, const std::function<void(bool, const std::optional<std::string>&)>& completion,
+		const std::function<void(std::vector<std::string>)>& rejected) -> void;
+	// rejected, when set, sees the operation before a failed completion
+	auto submit(size_t lane_index, boost::json::object operation, const std::function<void(bool, const std::optional<std::string>&)>& completion,
+		const std::function<void(const boost::json::object&)>& rejected = nullptr) -> void;
+	auto submit_gate(const std::vector<size_t>& lane_indexes, boost::json::object operation, const std::function<void(bool, const std::optional<std::string>&)>& completion,
+		const std::function<void(const boost::json::object&)>& rejected = nullptr) -> void;
+	auto submit_all(boost::json::object operation, const std::function<void(bool, const std::optional<std::string>&)>& completion,
+		const std::function<void(const boost::json::object&)>& rejected = nullptr) -> void;
+	auto schedule_drain(size_t lane_index) -> void;
+	auto drain_lane(size_t lane_index) -> std::tuple<bool, std::optional<std::string>>;
+	// Null when schema_source is "none"
+	auto load_schema() -> std::tuple<std::shared_ptr<const SchemaRegistry>, std::optional<std::string>>;
+
+private:
+	// An operation that spans several lanes. Each lane parks when it reaches the gate; the last one to
+	// arrive runs the operation, when everything queued before it on every lane has committed, and
+	// resumes the parked lanes afterwards.
+	struct Gate
+	{
+		// Moved in, so the operation keeps allocating from its message's arena
+		Gate(boost::json::object&& gate_operation, const std::function<void(bool, const std::optional<std::string>&)>& gate_completion,
+			const std::function<void(const boost::json::object&)>& gate_rejected, size_t lanes)
+			: operation(std::move(gate_operation))
+			, completion(gate_completion)
+			, rejected(gate_rejected)
+			, waiting(lanes)
+		{
+		}
+
+		boost::json::object operation;
+		std::function<void(bool, const std::optional<std::string>&)> completion;
+		std::function<void(const boost::json::object&)> rejected;
+
+		std::mutex mutex;
+		size_t waiting = 0;
+		std::vector<size_t> parked;
+	};
+
+	struct LaneTask
+	{
+		boost::json::object operation;
+		std::function<void(bool, const std::optional<std::string>&)> completion;
+		std::function<void(const boost::json::object&)> rejected;
+		std::shared_ptr<Gate> gate;
+	};
+
+	// Settles a packed batch once every one of its operations has completed
+	struct PackedMessage
+	{
+		std::function<void(bool, const std::optional<std::string>&)> completion;
+		std::function<void(std::vector<std::string>)> rejected;
+
+		std::mutex mutex;
+		size_t remaining = 0;
+		std::vector<std::string> dead_letters;
+		std::optional<std::string> error;
+	};
+
+	// Returns false when the lane parked on the gate
+	auto pass_gate(size_t lane_index, const std::shared_ptr<Gate>& gate) -> bool;
+
+	struct Lane
+	{
+		std::unique_ptr<Database::PostgresDB> db;
+		std::shared_ptr<DbJobExecutor> executor;
+
+		std::mutex mutex;
+		std::condition_variable condition;
+		std::deque<LaneTask> tasks;
+		bool draining = false;
+	};
+
+	std::shared_ptr<Configurations> configurations_;
+	std::unordered_map<std::string, std::vector<std::string>> partition_keys_;
+	size_t micro_batch_size_;
+	std::chrono::milliseconds micro_batch_wait_;
+
+	std::vector<std::unique_ptr<Lane>> lanes_;
+	std::shared_ptr<ThreadPool> thread_pool_;
+	// Gates are queued on all their lanes under this lock, so any two meet every lane in the same order
+	std::mutex gate_mutex_;
+};
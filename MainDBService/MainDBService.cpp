@@ -3,13 +3,15 @@
 
 #include <fmt/format.h>
 
+#include <algorithm>
+#include <limits>
 
-using namespace RabbitMQ;
+using namespace CommonMessageMQ;
 
-MainDBService::MainDBService(std::shared_ptr<Configurations> configurations, std::shared_ptr<DbJobExecutor> executor)
+MainDBService::MainDBService(std::shared_ptr<Configurations> configurations, std::shared_ptr<DbWorkerPool> worker_pool)
 	: configurations_(configurations)
-	, executor_(executor)
-	, consumer_(std::make_shared<RabbitMQWorkQueueConsume>(configurations_->rabbit_mq_host(), configurations_->rabbit_mq_port(), configurations_->rabbit_mq_user_name(), configurations_->rabbit_mq_password()))
+	, worker_pool_(worker_pool)
+	, consumer_(std::make_shared<RabbitMQConsumer>(configurations_->rabbit_mq_host(), configurations_->rabbit_mq_port(), configurations_->rabbit_mq_user_name(), configurations_->rabbit_mq_password(), configurations_->rabbit_channel_id(), configurations_->rabbit_heartbeat()))
 {
 }
 
@@ -48,6 +50,11 @@ auto MainDBService::stop() -> void
 		consumer_->stop();
 		consumer_.reset();
 	}
+
+	if (worker_pool_ != nullptr)
+	{
+		worker_pool_->stop();
+	}
 }
 
 auto MainDBService::consume_queue() -> std::tuple<bool, std::optional<std::string>>
@@ -58,12 +65,6 @@ auto MainDBService::consume_queue() -> std::tuple<bool, std::optional<std::strin
 		return { false, start_err };
 	}
 
-	auto [connected, conn_err] = consumer_->connect(configurations_->rabbit_heartbeat());
-	if (!connected)
-	{
-		return { false, conn_err };
-	}
-
 	{
 		std::optional<uint32_t> ttl_ms = std::nullopt;
 		if (configurations_->message_ttl_ms().has_value() && configurations_->message_ttl_ms().value() > 0)
@@ -73,37 +74,29 @@ auto MainDBService::consume_queue() -> std::tuple<bool, std::optional<std::strin
 		consumer_->set_queue_policies(configurations_->dlx_exchange(), configurations_->dlx_routing_key(), ttl_ms);
 	}
 
-	auto [opened, open_err] = consumer_->channel_open(configurations_->rabbit_channel_id(), configurations_->consume_queue_name());
-	if (!opened.has_value())
-	{
-		return { false, open_err };
-	}
-
-	auto [prepared, prep_err] = consumer_->prepare_consume();
-	if (!prepared)
-	{
-		return { false, prep_err };
-	}
-
 	consumer_->set_requeue_on_failure(configurations_->requeue_on_failure());
+	consumer_->set_prefetch_count(static_cast<uint16_t>(std::clamp(configurations_->prefetch_count(), 1, static_cast<int>(std::numeric_limits<uint16_t>::max()))));
+	consumer_->set_ack_batch(static_cast<size_t>(std::max(1, configurations_->ack_batch_count())), configurations_->ack_batch_interval_ms());
 
-	auto callback = [this](const std::string&, const std::string& body, const std::string& content_type) -> std::tuple<bool, std::optional<std::string>>
+	auto callback = [this](uint64_t delivery_tag, const std::string& body, const std::string& content_type)
 	{
-		if (content_type.rfind("application/json", 0) != 0)
+		// Unsupported content types are rejected by the worker pool along with malformed bodies
+		auto consumer = consumer_;
+		// Failed operations of a packed message, dead-lettered on their own when it is acked
+		auto dead_letters = std::make_shared<std::vector<std::string>>();
+		worker_pool_->dispatch_message(body, content_type, [consumer, delivery_tag, dead_letters](bool success, const std::optional<std::string>& error)
 		{
-			return { false, std::optional<std::string>("unsupported content-type: " + content_type) };
-		}
-		// TODO
-		// DATA(JSON) Validation
-
-		return executor_->handle_message(body);
+			if (!success)
+			{
+				Logger::handle().write(LogTypes::Error, fmt::format("db message failed: {}", error.value_or("unknown error")));
+			}
+			consumer->complete(delivery_tag, success, std::move(*dead_letters));
+		},
+		[dead_letters](std::vector<std::string> rejected)
+		{
+			*dead_letters = std::move(rejected);
+		});
 	};
 
-	auto [registered, registered_error] = consumer_->register_consume(configurations_->rabbit_channel_id(), configurations_->consume_queue_name(), callback);
-	if (!registered)
-	{
-		return { false, registered_error };
-	}
-
-	return consumer_->start_consume();
+	return consumer_->subscribe_deferred(configurations_->consume_queue_name(), callback);
 }
@@ -1,19 +1,17 @@
 #pragma once
 
 #include "Configurations.h"
-#include "DbJobExecutor.h"
-#include "RabbitMQWorkQueueConsume.h"
+#include "DbWorkerPool.h"
+#include "RabbitMQConsumer.h"
 
 #include <optional>
 #include <string>
 #include <memory>
 
-using namespace RabbitMQ;
-
 class MainDBService
 {
 public:
-	MainDBService(std::shared_ptr<Configurations> configurations, std::shared_ptr<DbJobExecutor> executor);
+	MainDBService(std::shared_ptr<Configurations> configurations, std::shared_ptr<DbWorkerPool> worker_pool);
 
 	auto start() -> std::tuple<bool, std::optional<std::string>>;
 	auto wait_stop() -> std::tuple<bool, std::optional<std::string>>;
@@ -24,9 +22,9 @@ protected:
 
 private:
 	std::shared_ptr<Configurations> configurations_;
-	std::shared_ptr<DbJobExecutor> executor_;
+	std::shared_ptr<DbWorkerPool> worker_pool_;
 
 
-	std::shared_ptr<RabbitMQWorkQueueConsume> consumer_;
+	std::shared_ptr<CommonMessageMQ::RabbitMQConsumer> consumer_;
 };
 
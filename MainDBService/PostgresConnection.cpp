@@ -0,0 +1,303 @@
+#include "PostgresConnection.h"
+
+#include "Logger.h"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+
+namespace
+{
+	constexpr size_t COPY_CHUNK_SIZE = 64 * 1024;
+}
+
+using namespace Utilities;
+
+PostgresConnection::PostgresConnection(const std::string& connection_string, size_t statement_cache_capacity)
+	: connection_string_(connection_string)
+	, connection_(nullptr)
+	, statement_cache_(statement_cache_capacity)
+{
+}
+
+PostgresConnection::~PostgresConnection(void)
+{
+	disconnect();
+}
+
+auto PostgresConnection::connect() -> std::tuple<bool, std::optional<std::string>>
+{
+	disconnect();
+
+	connection_ = PQconnectdb(connection_string_.c_str());
+	if (connection_ == nullptr)
+	{
+		return { false, "failed to allocate postgres connection" };
+	}
+
+	if (PQstatus(connection_) != CONNECTION_OK)
+	{
+		auto error = last_error();
+		disconnect();
+		return { false, error };
+	}
+
+	return { true, std::nullopt };
+}
+
+auto PostgresConnection::disconnect() -> void
+{
+	statement_cache_.clear();
+	undeallocated_.clear();
+
+	if (connection_ == nullptr)
+	{
+		return;
+	}
+
+	PQfinish(connection_);
+	connection_ = nullptr;
+}
+
+auto PostgresConnection::is_connected() const -> bool
+{
+	return connection_ != nullptr && PQstatus(connection_) == CONNECTION_OK;
+}
+
+auto PostgresConnection::execute_command(const std::string& sql) -> std::tuple<bool, std::optional<std::string>>
+{
+	auto [connected, connect_error] = ensure_connection();
+	if (!connected)
+	{
+		return { false, connect_error };
+	}
+
+	PGresult* result = PQexec(connection_, sql.c_str());
+	auto status = PQresultStatus(result);
+	if (status != PGRES_COMMAND_OK && status != PGRES_TUPLES_OK)
+	{
+		std::string error = PQresultErrorMessage(result);
+		PQclear(result);
+		return { false, error };
+	}
+
+	PQclear(result);
+	return { true, std::nullopt };
+}
+
+auto PostgresConnection::execute_query(const std::string& sql) -> std::tuple<Rows, std::optional<std::string>>
+{
+	auto [connected, connect_error] = ensure_connection();
+	if (!connected)
+	{
+		return { Rows(), connect_error };
+	}
+
+	PGresult* result = PQexec(connection_, sql.c_str());
+	if (PQresultStatus(result) != PGRES_TUPLES_OK)
+	{
+		std::string error = PQresultErrorMessage(result);
+		PQclear(result);
+		return { Rows(), error };
+	}
+
+	Rows rows(static_cast<size_t>(PQntuples(result)));
+	auto fields = PQnfields(result);
+	for (int row = 0; row < static_cast<int>(rows.size()); ++row)
+	{
+		auto& values = rows[static_cast<size_t>(row)];
+		values.reserve(static_cast<size_t>(fields));
+		for (int field = 0; field < fields; ++field)
+		{
+			if (PQgetisnull(result, row, field))
+			{
+				values.emplace_back(std::nullopt);
+				continue;
+			}
+			values.emplace_back(std::string(PQgetvalue(result, row, field), static_cast<size_t>(PQgetlength(result, row, field))));
+		}
+	}
+
+	PQclear(result);
+	return { std::move(rows), std::nullopt };
+}
+
+auto PostgresConnection::copy_from_stdin(const std::string& copy_sql, const std::string& data) -> std::tuple<bool, std::optional<std::string>>
+{
+	auto [connected, connect_error] = ensure_connection();
+	if (!connected)
+	{
+		return { false, connect_error };
+	}
+
+	PGresult* result = PQexec(connection_, copy_sql.c_str());
+	if (PQresultStatus(result) != PGRES_COPY_IN)
+	{
+		std::string error = PQresultErrorMessage(result);
+		PQclear(result);
+		return { false, error };
+	}
+	PQclear(result);
+
+	std::optional<std::string> copy_error = std::nullopt;
+	for (size_t offset = 0; offset < data.size(); offset += COPY_CHUNK_SIZE)
+	{
+		auto length = std::min(COPY_CHUNK_SIZE, data.size() - offset);
+		if (PQputCopyData(connection_, data.data() + offset, static_cast<int>(length)) != 1)
+		{
+			copy_error = last_error();
+			break;
+		}
+	}
+
+	if (PQputCopyEnd(connection_, copy_error.has_value() ? copy_error->c_str() : nullptr) != 1)
+	{
+		return { false, last_error() };
+	}
+
+	// Drain every result so the connection is usable again, keeping the first failure
+	while ((result = PQgetResult(connection_)) != nullptr)
+	{
+		if (PQresultStatus(result) != PGRES_COMMAND_OK && !copy_error.has_value())
+		{
+			copy_error = PQresultErrorMessage(result);
+		}
+		PQclear(result);
+	}
+
+	if (copy_error.has_value())
+	{
+		return { false, copy_error };
+	}
+
+	return { true, std::nullopt };
+}
+
+auto PostgresConnection::execute_prepared(const std::string& key, const std::string& sql, const std::vector<std::optional<std::string>>& params) -> std::tuple<bool, std::optional<std::string>>
+{
+	auto [connected, connect_error] = ensure_connection();
+	if (!connected)
+	{
+		return { false, connect_error };
+	}
+
+	auto name = statement_cache_.find(key);
+	if (!name.has_value())
+	{
+		auto [new_name, evicted] = statement_cache_.insert(key);
+		if (evicted.has_value())
+		{
+			undeallocated_.push_back(evicted.value());
+			deallocate_evicted();
+		}
+
+		PGresult* prepared = PQprepare(connection_, new_name.c_str(), sql.c_str(), static_cast<int>(params.size()), nullptr);
+		if (PQresultStatus(prepared) != PGRES_COMMAND_OK)
+		{
+			std::string error = PQresultErrorMessage(prepared);
+			PQclear(prepared);
+			statement_cache_.erase(key);
+			return { false, error };
+		}
+		PQclear(prepared);
+		name = new_name;
+	}
+
+	std::vector<const char*> values;
+	values.reserve(params.size());
+	for (const auto& param : params)
+	{
+		values.push_back(param.has_value() ? param->c_str() : nullptr);
+	}
+
+	PGresult* result = PQexecPrepared(connection_, name->c_str(), static_cast<int>(values.size()), values.data(), nullptr, nullptr, 0);
+	auto status = PQresultStatus(result);
+	if (status != PGRES_COMMAND_OK && status != PGRES_TUPLES_OK)
+	{
+		std::string error = PQresultErrorMessage(result);
+		PQclear(result);
+		return { false, error };
+	}
+
+	PQclear(result);
+	return { true, std::nullopt };
+}
+
+auto PostgresConnection::escape_string(std::string& out, std::string_view text) -> bool
+{
+	if (connection_ == nullptr)
+	{
+		auto [connected, connect_error] = ensure_connection();
+		if (!connected)
+		{
+			return false;
+		}
+	}
+
+	// Written straight into the caller's buffer; an invalid multibyte sequence is still escaped and left for the server to reject
+	auto start = out.size();
+	out.resize(start + text.size() * 2 + 1);
+	auto written = PQescapeStringConn(connection_, out.data() + start, text.data(), text.size(), nullptr);
+	out.resize(start + written);
+	return true;
+}
+
+auto PostgresConnection::statement_cache_stats() const -> StatementCache::Stats
+{
+	return statement_cache_.stats();
+}
+
+auto PostgresConnection::ensure_connection() -> std::tuple<bool, std::optional<std::string>>
+{
+	if (connection_ == nullptr)
+	{
+		return connect();
+	}
+
+	if (PQstatus(connection_) == CONNECTION_OK)
+	{
+		return { true, std::nullopt };
+	}
+
+	// Server-side prepared statements do not survive a reconnect
+	statement_cache_.clear();
+	undeallocated_.clear();
+	PQreset(connection_);
+	if (PQstatus(connection_) != CONNECTION_OK)
+	{
+		return { false, last_error() };
+	}
+
+	return { true, std::nullopt };
+}
+
+auto PostgresConnection::deallocate_evicted() -> void
+{
+	auto remaining = std::remove_if(undeallocated_.begin(), undeallocated_.end(), [this](const std::string& name)
+	{
+		PGresult* result = PQexec(connection_, ("DEALLOCATE " + name + ";").c_str());
+		auto status = PQresultStatus(result);
+		if (status == PGRES_COMMAND_OK)
+		{
+			PQclear(result);
+			return true;
+		}
+
+		// Still prepared on the server; kept so the next eviction retries it instead of leaking it for the session
+		Logger::handle().write(LogTypes::Error, fmt::format("DEALLOCATE {} failed: {}", name,
+			result != nullptr ? PQresultErrorMessage(result) : last_error()));
+		PQclear(result);
+		return false;
+	});
+	undeallocated_.erase(remaining, undeallocated_.end());
+}
+
+auto PostgresConnection::last_error() const -> std::string
+{
+	if (connection_ == nullptr)
+	{
+		return "postgres connection is null";
+	}
+
+	return PQerrorMessage(connection_);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "StatementCache.h"
+
+#include <libpq-fe.h>
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+// Thin libpq session used for the protocol features (COPY, prepared statements
+// with bound parameters) that the generic Database::PostgresDB wrapper does not expose.
+class PostgresConnection
+{
+public:
+	using Rows = std::vector<std::vector<std::optional<std::string>>>;
+
+	PostgresConnection(const std::string& connection_string, size_t statement_cache_capacity = 0);
+	virtual ~PostgresConnection(void);
+
+	auto connect() -> std::tuple<bool, std::optional<std::string>>;
+	auto disconnect() -> void;
+	auto is_connected() const -> bool;
+
+	auto execute_command(const std::string& sql) -> std::tuple<bool, std::optional<std::string>>;
+	// Every row of the result as text, NULL fields as nullopt
+	auto execute_query(const std::string& sql) -> std::tuple<Rows, std::optional<std::string>>;
+	auto copy_from_stdin(const std::string& copy_sql, const std::string& data) -> std::tuple<bool, std::optional<std::string>>;
+	auto execute_prepared(const std::string& key, const std::string& sql, const std::vector<std::optional<std::string>>& params) -> std::tuple<bool, std::optional<std::string>>;
+	// Appends text escaped for a '...' literal by PQescapeStringConn, which follows the session's client
+	// encoding and standard_conforming_strings. False when there is no connection to escape with.
+	auto escape_string(std::string& out, std::string_view text) -> bool;
+	auto statement_cache_stats() const -> StatementCache::Stats;
+
+private:
+	auto ensure_connection() -> std::tuple<bool, std::optional<std::string>>;
+	auto deallocate_evicted() -> void;
+	auto last_error() const -> std::string;
+
+private:
+	std::string connection_string_;
+	PGconn* connection_;
+	StatementCache statement_cache_;
+	// Evicted from the cache but still prepared on the server, because their DEALLOCATE failed
+	std::vector<std::string> undeallocated_;
+};
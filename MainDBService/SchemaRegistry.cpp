@@ -0,0 +1,430 @@
+#include "SchemaRegistry.h"
+
+#include "Logger.h"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <iterator>
+#include <limits>
+#include <map>
+
+using namespace Utilities;
+
+namespace
+{
+	// Same rule DbJobExecutor applies to names in messages: [A-Za-z_][A-Za-z0-9_]*
+	auto is_identifier(std::string_view name) -> bool
+	{
+		if (name.empty() || std::isdigit(static_cast<unsigned char>(name.front())))
+		{
+			return false;
+		}
+		return std::all_of(name.begin(), name.end(), [](char c) { return std::isalnum(static_cast<unsigned char>(c)) || c == '_'; });
+	}
+
+	auto kind_name(const boost::json::value& value) -> std::string_view
+	{
+		switch (value.kind())
+		{
+		case boost::json::kind::bool_:
+			return "a boolean";
+		case boost::json::kind::int64:
+		case boost::json::kind::uint64:
+			return "an integer";
+		case boost::json::kind::double_:
+			return "a number";
+		case boost::json::kind::string:
+			return "a string";
+		case boost::json::kind::array:
+			return "an array";
+		case boost::json::kind::object:
+			return "an object";
+		default:
+			return "null";
+		}
+	}
+
+	// PostgreSQL converts quoted literals to the column type itself, ignoring surrounding whitespace
+	auto trimmed(std::string_view text) -> std::string_view
+	{
+		while (!text.empty() && std::isspace(static_cast<unsigned char>(text.front())))
+		{
+			text.remove_prefix(1);
+		}
+		while (!text.empty() && std::isspace(static_cast<unsigned char>(text.back())))
+		{
+			text.remove_suffix(1);
+		}
+		return text;
+	}
+
+	auto lowered(std::string_view text) -> std::string
+	{
+		std::string result(text);
+		std::transform(result.begin(), result.end(), result.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+		return result;
+	}
+
+	auto integer_text(std::string_view text, int64_t minimum, int64_t maximum) -> bool
+	{
+		text = trimmed(text);
+		if (!text.empty() && text.front() == '+')
+		{
+			text.remove_prefix(1);
+		}
+		int64_t number = 0;
+		auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), number);
+		return !text.empty() && error == std::errc() && end == text.data() + text.size() && number >= minimum && number <= maximum;
+	}
+
+	auto numeric_text(std::string_view text) -> bool
+	{
+		text = trimmed(text);
+		auto special = lowered(text);
+		if (special == "nan" || special == "infinity" || special == "+infinity" || special == "-infinity")
+		{
+			return true;
+		}
+		if (!text.empty() && text.front() == '+')
+		{
+			text.remove_prefix(1);
+		}
+		double number = 0;
+		auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), number);
+		return !text.empty() && error == std::errc() && end == text.data() + text.size();
+	}
+
+	auto boolean_text(std::string_view text) -> bool
+	{
+		static const std::vector<std::string> spellings = { "t", "true", "y", "yes", "on", "1", "f", "false", "n", "no", "off", "0" };
+		auto spelling = lowered(trimmed(text));
+		return std::find(spellings.begin(), spellings.end(), spelling) != spellings.end();
+	}
+
+	auto field(const std::vector<std::optional<std::string>>& row, size_t index) -> std::string
+	{
+		return index < row.size() ? row[index].value_or("") : "";
+	}
+
+	// One row per column of every table in the search path's first schema, in column order
+	constexpr const char* columns_query =
+		"SELECT table_name, column_name, udt_name, is_nullable = 'YES', "
+		"is_nullable = 'NO' AND column_default IS NULL AND is_identity = 'NO' AND is_generated = 'NEVER' "
+		"FROM information_schema.columns WHERE table_schema = current_schema() "
+		"ORDER BY table_name, ordinal_position;";
+
+	constexpr const char* primary_keys_query =
+		"SELECT k.table_name, k.column_name FROM information_schema.table_constraints t "
+		"JOIN information_schema.key_column_usage k ON k.constraint_schema = t.constraint_schema "
+		"AND k.constraint_name = t.constraint_name AND k.table_name = t.table_name "
+		"WHERE t.constraint_type = 'PRIMARY KEY' AND t.table_schema = current_schema() "
+		"ORDER BY k.table_name, k.ordinal_position;";
+}
+
+auto SchemaRegistry::Table::column(std::string_view column_name) const -> const Column*
+{
+	auto found = column_index.find(column_name);
+	return found == column_index.end() ? nullptr : &columns[found->second];
+}
+
+SchemaRegistry::SchemaRegistry(void)
+{
+}
+
+SchemaRegistry::~SchemaRegistry(void)
+{
+}
+
+auto SchemaRegistry::introspect(PostgresConnection& connection, const std::vector<std::string>& allowed_tables) -> std::tuple<bool, std::optional<std::string>>
+{
+	auto [columns, columns_error] = connection.execute_query(columns_query);
+	if (columns_error.has_value())
+	{
+		return { false, fmt::format("schema introspection failed: {}", columns_error.value()) };
+	}
+	auto [keys, keys_error] = connection.execute_query(primary_keys_query);
+	if (keys_error.has_value())
+	{
+		return { false, fmt::format("schema introspection failed: {}", keys_error.value()) };
+	}
+
+	auto allowed = [&allowed_tables](const std::string& table_name)
+	{
+		return allowed_tables.empty() || std::find(allowed_tables.begin(), allowed_tables.end(), table_name) != allowed_tables.end();
+	};
+
+	std::map<std::string, std::unique_ptr<Table>> tables;
+	for (const auto& row : columns)
+	{
+		auto table_name = field(row, 0);
+		auto column_name = field(row, 1);
+		if (!allowed(table_name))
+		{
+			continue;
+		}
+		if (!is_identifier(table_name) || !is_identifier(column_name))
+		{
+			Logger::handle().write(LogTypes::Error, fmt::format("schema: skipping {}.{}, not a plain identifier", table_name, column_name));
+			continue;
+		}
+
+		auto& table = tables[table_name];
+		if (table == nullptr)
+		{
+			table = std::make_unique<Table>();
+			table->name = table_name;
+		}
+		table->columns.push_back(make_column(column_name, field(row, 2), field(row, 3) == "t", field(row, 4) == "t"));
+	}
+
+	for (const auto& row : keys)
+	{
+		auto found = tables.find(field(row, 0));
+		if (found != tables.end())
+		{
+			found->second->primary_key.emplace_back(field(row, 1));
+		}
+	}
+
+	for (auto& [table_name, table] : tables)
+	{
+		add_table(std::move(table));
+	}
+
+	return { true, std::nullopt };
+}
+
+auto SchemaRegistry::load(const boost::json::object& schema) -> std::tuple<bool, std::optional<std::string>>
+{
+	for (const auto& kv : schema)
+	{
+		std::string table_name(kv.key().data(), kv.key().size());
+		const auto* definition = kv.value().if_object();
+		const auto* columns = definition != nullptr ? definition->if_contains("columns") : nullptr;
+		if (!is_identifier(table_name) || columns == nullptr || !columns->is_object())
+		{
+			return { false, fmt::format("schema: {} needs a plain name and a \"columns\" object", table_name) };
+		}
+
+		auto names = [definition](const char* key)
+		{
+			std::vector<std::string> result;
+			if (const auto* list = definition->if_contains(key); list != nullptr && list->is_array())
+			{
+				for (const auto& name : list->as_array())
+				{
+					if (name.is_string())
+					{
+						result.emplace_back(name.as_string().c_str());
+					}
+				}
+			}
+			return result;
+		};
+		auto primary_key = names("primary_key");
+		auto required = names("required");
+		auto listed = [](const std::vector<std::string>& list, const std::string& name) { return std::find(list.begin(), list.end(), name) != list.end(); };
+
+		auto table = std::make_unique<Table>();
+		table->name = table_name;
+		for (const auto& column : columns->as_object())
+		{
+			std::string column_name(column.key().data(), column.key().size());
+			if (!is_identifier(column_name) || !column.value().is_string())
+			{
+				return { false, fmt::format("schema: {}.{} needs a plain name and a type string", table_name, column_name) };
+			}
+			auto is_required = listed(required, column_name);
+			table->columns.push_back(make_column(column_name, column.value().as_string().c_str(), !is_required && !listed(primary_key, column_name), is_required));
+		}
+		for (const auto& column_name : primary_key)
+		{
+			if (std::none_of(table->columns.begin(), table->columns.end(), [&column_name](const Column& column) { return column.name == column_name; }))
+			{
+				return { false, fmt::format("schema: primary key column {}.{} is not among its columns", table_name, column_name) };
+			}
+			table->primary_key.emplace_back(column_name);
+		}
+
+		add_table(std::move(table));
+	}
+
+	return { true, std::nullopt };
+}
+
+auto SchemaRegistry::table(std::string_view table_name) const -> const Table*
+{
+	auto found = index_.find(table_name);
+	return found == index_.end() ? nullptr : found->second;
+}
+
+auto SchemaRegistry::size() const -> size_t
+{
+	return tables_.size();
+}
+
+auto SchemaRegistry::check_columns(const Table& table, const boost::json::object& columns, Usage usage) -> std::optional<std::string>
+{
+	for (const auto& kv : columns)
+	{
+		std::string_view column_name(kv.key().data(), kv.key().size());
+		const auto* column = table.column(column_name);
+		if (column == nullptr)
+		{
+			return fmt::format("unknown column {} in {}", column_name, table.name);
+		}
+		if (usage == Usage::Where && kv.value().is_null())
+		{
+			continue;
+		}
+		if (auto error = check_value(*column, kv.value()); error.has_value())
+		{
+			return error;
+		}
+	}
+
+	if (usage == Usage::Insert)
+	{
+		for (const auto& column : table.columns)
+		{
+			if (column.required && !columns.contains(column.name))
+			{
+				return fmt::format("missing required column {} for {}", column.name, table.name);
+			}
+		}
+	}
+
+	return std::nullopt;
+}
+
+auto SchemaRegistry::check_value(const Column& column, const boost::json::value& value) -> std::optional<std::string>
+{
+	if (value.is_null())
+	{
+		if (column.nullable)
+		{
+			return std::nullopt;
+		}
+		return fmt::format("column {} is NOT NULL", column.name);
+	}
+
+	// Numbers and booleans written as strings are what the database would accept as a quoted literal
+	const auto* text = value.if_string();
+	auto accepted = true;
+	switch (column.kind)
+	{
+	case ColumnType::Boolean:
+		accepted = value.is_bool() || (text != nullptr && boolean_text(std::string_view(text->data(), text->size())));
+		break;
+	case ColumnType::Integer:
+		if (text != nullptr)
+		{
+			accepted = integer_text(std::string_view(text->data(), text->size()), column.minimum, column.maximum);
+		}
+		else if (value.is_int64())
+		{
+			accepted = value.get_int64() >= column.minimum && value.get_int64() <= column.maximum;
+		}
+		else if (value.is_uint64())
+		{
+			accepted = value.get_uint64() <= static_cast<uint64_t>(column.maximum);
+		}
+		else if (value.is_double())
+		{
+			// 5.0 is a fine integer; 5.5 would be rounded by the cast, so it is refused
+			auto number = value.get_double();
+			accepted = std::trunc(number) == number && number >= static_cast<double>(column.minimum) && number <= static_cast<double>(column.maximum);
+		}
+		else
+		{
+			accepted = false;
+		}
+		break;
+	case ColumnType::Numeric:
+		accepted = value.is_number() || (text != nullptr && numeric_text(std::string_view(text->data(), text->size())));
+		break;
+	default:
+		// Text takes anything (numbers and booleans by assignment cast, structures as JSON text);
+		// json and the types not classified here are left to the database
+		break;
+	}
+
+	if (accepted)
+	{
+		return std::nullopt;
+	}
+	if (value.is_number() && column.kind == ColumnType::Integer)
+	{
+		return fmt::format("value {} out of range for column {} ({})", boost::json::serialize(value), column.name, column.type);
+	}
+	if (text != nullptr)
+	{
+		return fmt::format("column {} ({}) does not accept {}", column.name, column.type, boost::json::serialize(value));
+	}
+	return fmt::format("column {} ({}) does not accept {}", column.name, column.type, kind_name(value));
+}
+
+auto SchemaRegistry::add_table(std::unique_ptr<Table> table) -> void
+{
+	table->column_index.clear();
+	for (size_t index = 0; index < table->columns.size(); ++index)
+	{
+		table->column_index.emplace(table->columns[index].name, index);
+	}
+
+	index_[table->name] = table.get();
+	tables_.push_back(std::move(table));
+}
+
+auto SchemaRegistry::make_column(std::string_view name, std::string_view type, bool nullable, bool required) -> Column
+{
+	Column column;
+	column.name = std::string(name);
+	column.type.reserve(type.size());
+	std::transform(type.begin(), type.end(), std::back_inserter(column.type), [](char c) { return static_cast<char>(std::tolower(static_cast<unsigned char>(c))); });
+	column.nullable = nullable;
+	column.required = required;
+
+	auto integer = [&column](int64_t minimum, int64_t maximum)
+	{
+		column.kind = ColumnType::Integer;
+		column.minimum = minimum;
+		column.maximum = maximum;
+	};
+
+	const auto& t = column.type;
+	if (t == "bool" || t == "boolean")
+	{
+		column.kind = ColumnType::Boolean;
+	}
+	else if (t == "int2" || t == "smallint")
+	{
+		integer(std::numeric_limits<int16_t>::min(), std::numeric_limits<int16_t>::max());
+	}
+	else if (t == "int4" || t == "int" || t == "integer")
+	{
+		integer(std::numeric_limits<int32_t>::min(), std::numeric_limits<int32_t>::max());
+	}
+	else if (t == "int8" || t == "bigint")
+	{
+		integer(std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max());
+	}
+	else if (t == "float4" || t == "float8" || t == "real" || t == "double precision" || t == "numeric" || t == "decimal")
+	{
+		column.kind = ColumnType::Numeric;
+	}
+	else if (t == "text" || t == "varchar" || t == "bpchar" || t == "name" || t == "citext" || t == "character varying")
+	{
+		column.kind = ColumnType::Text;
+	}
+	else if (t == "json" || t == "jsonb")
+	{
+		column.kind = ColumnType::Json;
+	}
+
+	return column;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "PostgresConnection.h"
+
+#include <boost/json.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+// Catalog of the tables MainDBService writes, loaded once at startup either from information_schema or
+// from the "schema" object in the configuration, and shared read-only by every lane.
+// Table and column names become hash lookups, values are checked against the column types and required
+// columns are enforced, so a malformed operation is rejected before it costs a round trip.
+// Names that are not plain identifiers are left out, so anything found here is safe to quote as is.
+class SchemaRegistry
+{
+public:
+	enum class ColumnType
+	{
+		Boolean,
+		Integer,
+		Numeric,
+		Text,
+		Json,
+		Other,
+	};
+
+	struct Column
+	{
+		std::string name;
+		// As reported by the database, e.g. int8 or varchar
+		std::string type;
+		ColumnType kind = ColumnType::Other;
+		// Range of Integer columns
+		int64_t minimum = 0;
+		int64_t maximum = 0;
+		bool nullable = true;
+		// NOT NULL without a default, so every insert has to supply it
+		bool required = false;
+	};
+
+	struct Table
+	{
+		std::string name;
+		std::vector<Column> columns;
+		// Primary key columns in key order, usable as an upsert conflict target
+		boost::json::array primary_key;
+		// Points into columns; built once the table is complete
+		std::unordered_map<std::string_view, size_t> column_index;
+
+		auto column(std::string_view column_name) const -> const Column*;
+	};
+
+	SchemaRegistry(void);
+	virtual ~SchemaRegistry(void);
+
+	// Only tables in allowed_tables are kept unless it is empty
+	auto introspect(PostgresConnection& connection, const std::vector<std::string>& allowed_tables) -> std::tuple<bool, std::optional<std::string>>;
+	// {"players": {"columns": {"player_id": "int8", "name": "text"}, "primary_key": ["player_id"], "required": ["name"]}}
+	auto load(const boost::json::object& schema) -> std::tuple<bool, std::optional<std::string>>;
+
+	auto table(std::string_view table_name) const -> const Table*;
+	auto size() const -> size_t;
+
+	// Insert also requires every required column; Where accepts NULL anywhere, since it only compares
+	enum class Usage
+	{
+		Insert,
+		Update,
+		Where,
+	};
+
+	// Null when every column exists and accepts its value, otherwise why not
+	static auto check_columns(const Table& table, const boost::json::object& columns, Usage usage) -> std::optional<std::string>;
+	static auto check_value(const Column& column, const boost::json::value& value) -> std::optional<std::string>;
+
+protected:
+	auto add_table(std::unique_ptr<Table> table) -> void;
+	static auto make_column(std::string_view name, std::string_view type, bool nullable, bool required) -> Column;
+
+private:
+	// Tables stay where they were allocated, so the string_view keys into their names remain valid
+	std::vector<std::unique_ptr<Table>> tables_;
+	std::unordered_map<std::string_view, const Table*> index_;
+};
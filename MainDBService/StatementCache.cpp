@@ -0,0 +1,78 @@
+#include "StatementCache.h"
+
+StatementCache::StatementCache(size_t capacity)
+	: capacity_(capacity)
+	, next_id_(0)
+	, hits_(0)
+	, misses_(0)
+	, evictions_(0)
+	, size_(0)
+{
+}
+
+StatementCache::~StatementCache(void)
+{
+}
+
+auto StatementCache::enabled() const -> bool
+{
+	return capacity_ > 0;
+}
+
+auto StatementCache::find(const std::string& key) -> std::optional<std::string>
+{
+	auto iter = index_.find(key);
+	if (iter == index_.end())
+	{
+		misses_++;
+		return std::nullopt;
+	}
+
+	entries_.splice(entries_.begin(), entries_, iter->second);
+	hits_++;
+	return iter->second->second;
+}
+
+auto StatementCache::insert(const std::string& key) -> std::tuple<std::string, std::optional<std::string>>
+{
+	std::optional<std::string> evicted = std::nullopt;
+	if (index_.size() >= capacity_ && !entries_.empty())
+	{
+		evicted = entries_.back().second;
+		index_.erase(entries_.back().first);
+		entries_.pop_back();
+		evictions_++;
+	}
+
+	auto name = "cached_stmt_" + std::to_string(++next_id_);
+	entries_.emplace_front(key, name);
+	index_[key] = entries_.begin();
+	size_ = index_.size();
+
+	return { name, evicted };
+}
+
+auto StatementCache::erase(const std::string& key) -> void
+{
+	auto iter = index_.find(key);
+	if (iter == index_.end())
+	{
+		return;
+	}
+
+	entries_.erase(iter->second);
+	index_.erase(iter);
+	size_ = index_.size();
+}
+
+auto StatementCache::clear() -> void
+{
+	entries_.clear();
+	index_.clear();
+	size_ = 0;
+}
+
+auto StatementCache::stats() const -> Stats
+{
+	return Stats{ hits_.load(), misses_.load(), evictions_.load(), size_.load() };
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+
+// LRU of server-side prepared statement names, keyed by statement shape.
+// One instance belongs to one connection; only the counters are thread-safe.
+class StatementCache
+{
+public:
+	struct Stats
+	{
+		uint64_t hits;
+		uint64_t misses;
+		uint64_t evictions;
+		size_t size;
+	};
+
+	StatementCache(size_t capacity);
+	virtual ~StatementCache(void);
+
+	auto enabled() const -> bool;
+	auto find(const std::string& key) -> std::optional<std::string>;
+	auto insert(const std::string& key) -> std::tuple<std::string, std::optional<std::string>>;
+	auto erase(const std::string& key) -> void;
+	auto clear() -> void;
+	auto stats() const -> Stats;
+
+private:
+	size_t capacity_;
+	uint64_t next_id_;
+
+	// front = most recently used
+	std::list<std::pair<std::string, std::string>> entries_;
+	std::unordered_map<std::string, std::list<std::pair<std::string, std::string>>::iterator> index_;
+
+	std::atomic<uint64_t> hits_;
+	std::atomic<uint64_t> misses_;
+	std::atomic<uint64_t> evictions_;
+	std::atomic<size_t> size_;
+};
@@ -4,9 +4,8 @@
 
 #include <ArgumentParser.h>
 #include <Configurations.h>
-#include <DbJobExecutor.h>
+#include <DbWorkerPool.h>
 #include <MainDBService.h>
-#include <PostgresDB.h>
 
 #include <fmt/format.h>
 
@@ -35,16 +34,15 @@ auto main(int argc, char* argv[]) -> int
 
 	Logger::handle().start(configurations_->service_title());
 
-	PostgresDB db(configurations_->postgres_conn());
-	auto [db_result, db_msg] = db.execute_query_and_get_result("SELECT 1;");
-	if (!db_result.has_value())
+	auto worker_pool = std::make_shared<DbWorkerPool>(configurations_);
+	auto [pool_ok, pool_err] = worker_pool->start();
+	if (!pool_ok)
 	{
-		Logger::handle().write(LogTypes::Error, fmt::format("database connection failed: {}", db_msg.value_or("unknown")));
+		Logger::handle().write(LogTypes::Error, fmt::format("database worker pool start failed: {}", pool_err.value_or("unknown")));
 		return -1;
 	}
 
-	auto executor = std::make_shared<DbJobExecutor>(db, configurations_->allowed_ops(), configurations_->allowed_tables());
-	main_db_service_ = std::make_shared<MainDBService>(configurations_, executor);
+	main_db_service_ = std::make_shared<MainDBService>(configurations_, worker_pool);
 
 	auto [ok, err] = main_db_service_->start();
 	if (!ok)
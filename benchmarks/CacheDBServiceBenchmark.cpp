@@ -0,0 +1,215 @@
+// Microbenchmarks for the CacheDBService write path: producers enqueueing operations and the
+// flush loop collecting, coalescing and packing them. Redis and RabbitMQ are not touched.
+
+#include "CacheDBService.h"
+#include "Configurations.h"
+#include "JsonValidator.h"
+
+#include <benchmark/benchmark.h>
+
+#include "fmt/format.h"
+
+#include "boost/json.hpp"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+class CacheDBServiceBenchmark
+{
+public:
+	// What start() sets up for the write path, without connecting anywhere
+	static auto prepare(CacheDBService& service) -> void
+	{
+		service.pending_queue_ = std::make_unique<BoundedMpmcQueue<CacheDBService::QueuedOperation>>(
+			static_cast<size_t>(std::max(1, service.configurations_->pending_queue_capacity())));
+		service.pending_operations_ = std::make_unique<WriteCoalescer>(service.configurations_->coalesce_writes(), service.configurations_->coalesce_keys());
+		service.pending_bytes_ = 0;
+		service.dropped_operations_ = 0;
+	}
+
+	// One flush cycle up to the point where the envelopes would be published; returns the envelope count
+	static auto flush(CacheDBService& service) -> size_t
+	{
+		service.collect_pending();
+		auto messages = service.pending_operations_->drain();
+		return service.pack_envelopes(messages).size();
+	}
+
+	static auto pending_count(const CacheDBService& service) -> size_t
+	{
+		return service.pending_count();
+	}
+};
+
+namespace
+{
+	std::shared_ptr<Configurations> configurations = nullptr;
+	std::unique_ptr<CacheDBService> service = nullptr;
+
+	std::atomic<bool> drain_stop{ false };
+	std::thread drain_thread;
+
+	auto make_operation(uint64_t id) -> std::string
+	{
+		return fmt::format(R"({{"op":"update","table":"players","values":{{"level":{},"gold":{}}},"where":{{"player_id":{}}}}})", id % 100, id * 10, id);
+	}
+
+	// Stands in for the flush loop so producers measure the queue, not a full queue rejecting them
+	void start_drain(const benchmark::State&)
+	{
+		CacheDBServiceBenchmark::prepare(*service);
+		drain_stop = false;
+		drain_thread = std::thread([]()
+		{
+			while (!drain_stop)
+			{
+				if (CacheDBServiceBenchmark::flush(*service) == 0)
+				{
+					std::this_thread::yield();
+				}
+			}
+		});
+	}
+
+	void stop_drain(const benchmark::State&)
+	{
+		drain_stop = true;
+		if (drain_thread.joinable())
+		{
+			drain_thread.join();
+		}
+	}
+
+	void reset_service(const benchmark::State&)
+	{
+		CacheDBServiceBenchmark::prepare(*service);
+	}
+}
+
+static void BM_EnqueueDatabaseOperation(benchmark::State& state)
+{
+	std::vector<std::string> bodies;
+	for (uint64_t id = 0; id < 1024; ++id)
+	{
+		bodies.push_back(make_operation(id * static_cast<uint64_t>(state.threads()) + static_cast<uint64_t>(state.thread_index())));
+	}
+
+	size_t index = 0;
+	int64_t rejected = 0;
+	for (auto _ : state)
+	{
+		auto [accepted, error] = service->enqueue_database_operation(bodies[index++ & 1023]);
+		if (!accepted)
+		{
+			++rejected;
+		}
+	}
+	state.SetItemsProcessed(state.iterations());
+	state.counters["rejected"] = benchmark::Counter(static_cast<double>(rejected), benchmark::Counter::kAvgThreadsRate);
+}
+BENCHMARK(BM_EnqueueDatabaseOperation)->Setup(start_drain)->Teardown(stop_drain)->ThreadRange(1, 16)->UseRealTime();
+
+// One flush cycle over state.range(0) operations on state.range(1) distinct rows, so coalescing has work to do
+static void BM_FlushPath(benchmark::State& state)
+{
+	const auto operations = static_cast<uint64_t>(state.range(0));
+	const auto rows = static_cast<uint64_t>(state.range(1));
+	std::vector<std::string> bodies;
+	for (uint64_t id = 0; id < operations; ++id)
+	{
+		bodies.push_back(make_operation(id % rows));
+	}
+
+	size_t envelopes = 0;
+	for (auto _ : state)
+	{
+		state.PauseTiming();
+		for (const auto& body : bodies)
+		{
+			service->enqueue_database_operation(body);
+		}
+		state.ResumeTiming();
+
+		envelopes = CacheDBServiceBenchmark::flush(*service);
+		benchmark::DoNotOptimize(envelopes);
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+	state.counters["envelopes"] = static_cast<double>(envelopes);
+}
+BENCHMARK(BM_FlushPath)->Setup(reset_service)->ArgsProduct({ { 64, 1024, 8192 }, { 16, 1 << 20 } });
+
+// What checking one body costs: a full parse on the default allocator (the enqueue path before the
+// validator), a parse into an arena released every 1024 bodies (the flush loop), and the SAX validator
+static void BM_ParseOperation(benchmark::State& state)
+{
+	const std::vector<std::string> labels = { "parse", "arena_parse", "validate" };
+	std::vector<std::string> bodies;
+	for (uint64_t id = 0; id < 1024; ++id)
+	{
+		bodies.push_back(make_operation(id));
+	}
+
+	boost::json::monotonic_resource arena;
+	boost::json::parser parser;
+	size_t index = 0;
+	for (auto _ : state)
+	{
+		const auto& body = bodies[index++ & 1023];
+		switch (state.range(0))
+		{
+		case 0:
+		{
+			auto value = boost::json::parse(body);
+			benchmark::DoNotOptimize(value);
+			break;
+		}
+		case 1:
+		{
+			if ((index & 1023) == 0)
+			{
+				arena.release();
+			}
+			parser.reset(boost::json::storage_ptr(&arena));
+			boost::json::error_code ec;
+			parser.write(body.data(), body.size(), ec);
+			auto value = parser.release();
+			benchmark::DoNotOptimize(value);
+			break;
+		}
+		default:
+		{
+			auto result = JsonValidator::validate_object(body);
+			benchmark::DoNotOptimize(result);
+			break;
+		}
+		}
+	}
+	state.SetLabel(labels[static_cast<size_t>(state.range(0))]);
+	state.SetItemsProcessed(state.iterations());
+	state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(bodies.front().size()));
+}
+BENCHMARK(BM_ParseOperation)->DenseRange(0, 2);
+
+auto main(int argc, char* argv[]) -> int
+{
+	benchmark::Initialize(&argc, argv);
+
+	// Remaining arguments are CacheDBService options, e.g. --coalesce_writes false or --pending_queue_capacity 65536.
+	// The spool is always off here: it measures the disk, which the flush path benchmark is not about.
+	std::vector<char*> arguments(argv, argv + argc);
+	std::string spool_flag = "--spool_enabled";
+	std::string spool_value = "false";
+	arguments.push_back(spool_flag.data());
+	arguments.push_back(spool_value.data());
+	configurations = std::make_shared<Configurations>(ArgumentParser(static_cast<int>(arguments.size()), arguments.data()));
+	service = std::make_unique<CacheDBService>(configurations);
+
+	benchmark::RunSpecifiedBenchmarks();
+	benchmark::Shutdown();
+
+	service.reset();
+	return 0;
+}
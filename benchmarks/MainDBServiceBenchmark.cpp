@@ -0,0 +1,483 @@
+// Microbenchmarks for message parsing and SQL generation in DbJobExecutor; nothing is executed against the database.
+// Each one also reports allocs_per_op from a counting operator new.
+
+#include "Configurations.h"
+#include "DbJobExecutor.h"
+#include "OperationCodec.h"
+#include "SchemaRegistry.h"
+
+#include "PostgresDB.h"
+
+#include <benchmark/benchmark.h>
+
+#include "fmt/format.h"
+
+#include "boost/json.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace Database;
+
+class DbJobExecutorBenchmark
+{
+public:
+	static auto write_sql(const DbJobExecutor& executor, std::string& sql, const boost::json::object& obj) -> void
+	{
+		executor.write_sql(sql, obj);
+	}
+
+	// Converts and hands the statements back to the pool, as handle_operation does around execution
+	static auto convert(DbJobExecutor& executor, const boost::json::object& obj) -> size_t
+	{
+		auto [ok, error] = executor.operation_to_statements(obj, executor.statements_);
+		auto count = executor.statements_.size();
+		executor.recycle_statements(executor.statements_);
+		return ok ? count : 0;
+	}
+
+	static auto write_prepared_statement(DbJobExecutor& executor, const boost::json::object& obj) -> size_t
+	{
+		auto statement = executor.take_statement();
+		executor.write_prepared_statement(statement, obj);
+		auto params = statement.params.size();
+		executor.statement_pool_.push_back(std::move(statement));
+		return params;
+	}
+
+	static auto write_insert_sql(const DbJobExecutor& executor, std::string& sql, std::string_view table, const boost::json::object& values) -> void
+	{
+		executor.write_insert_sql(sql, table, values);
+	}
+
+	static auto write_update_sql(const DbJobExecutor& executor, std::string& sql, std::string_view table, const boost::json::object& values, const boost::json::object& where) -> void
+	{
+		executor.write_update_sql(sql, table, values, where);
+	}
+
+	static auto write_upsert_sql(const DbJobExecutor& executor, std::string& sql, std::string_view table, const boost::json::object& values, const boost::json::array& conflict) -> void
+	{
+		executor.write_upsert_sql(sql, table, values, conflict);
+	}
+
+	static auto write_delete_sql(const DbJobExecutor& executor, std::string& sql, std::string_view table, const boost::json::object& where) -> void
+	{
+		executor.write_delete_sql(sql, table, where);
+	}
+
+	static auto write_sql_literal(const DbJobExecutor& executor, std::string& sql, const boost::json::value& value) -> void
+	{
+		executor.write_sql_literal(sql, value);
+	}
+};
+
+// Every heap allocation in the process is counted, so each benchmark can report allocations per operation
+namespace
+{
+	std::atomic<uint64_t> allocations{ 0 };
+
+	class AllocationCounter
+	{
+	public:
+		AllocationCounter(benchmark::State& state)
+			: state_(state)
+			, start_(allocations.load(std::memory_order_relaxed))
+		{
+		}
+
+		~AllocationCounter()
+		{
+			auto counted = allocations.load(std::memory_order_relaxed) - start_;
+			state_.counters["allocs_per_op"] = benchmark::Counter(static_cast<double>(counted), benchmark::Counter::kAvgIterations);
+		}
+
+	private:
+		benchmark::State& state_;
+		uint64_t start_;
+	};
+}
+
+auto operator new(std::size_t size) -> void*
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	if (auto* memory = std::malloc(size == 0 ? 1 : size))
+	{
+		return memory;
+	}
+	throw std::bad_alloc();
+}
+
+auto operator delete(void* memory) noexcept -> void
+{
+	std::free(memory);
+}
+
+auto operator delete(void* memory, std::size_t) noexcept -> void
+{
+	std::free(memory);
+}
+
+namespace
+{
+	std::shared_ptr<Configurations> configurations = nullptr;
+	std::unique_ptr<PostgresDB> db = nullptr;
+	std::unique_ptr<DbJobExecutor> executor = nullptr;
+	std::unique_ptr<DbJobExecutor> schema_executor = nullptr;
+
+	// A row shaped like the game's writes: an id, a few counters, a name and a JSON blob
+	auto make_values(int64_t id, size_t columns) -> boost::json::object
+	{
+		boost::json::object values;
+		values["player_id"] = id;
+		values["name"] = fmt::format("player-{}", id);
+		values["level"] = id % 100;
+		values["score"] = static_cast<double>(id) * 1.5;
+		values["online"] = (id % 2) == 0;
+		for (size_t index = values.size(); index < columns; ++index)
+		{
+			values[fmt::format("stat_{}", index)] = static_cast<int64_t>(index) * id;
+		}
+		return values;
+	}
+
+	auto make_operation(const std::string& op, int64_t id, size_t columns) -> boost::json::object
+	{
+		boost::json::object obj;
+		obj["op"] = op;
+		obj["table"] = "players";
+		if (op != "delete")
+		{
+			obj["values"] = make_values(id, columns);
+		}
+		if (op == "update" || op == "delete")
+		{
+			obj["where"] = boost::json::object{ { "player_id", id } };
+		}
+		if (op == "upsert")
+		{
+			obj["conflict"] = boost::json::array{ "player_id" };
+		}
+		return obj;
+	}
+
+	const std::vector<std::string> operations = { "insert", "update", "upsert", "delete" };
+
+	// The players table make_values writes, as a "schema" configuration entry would describe it
+	auto make_schema(size_t columns) -> std::shared_ptr<const SchemaRegistry>
+	{
+		boost::json::object types;
+		types["player_id"] = "int8";
+		types["name"] = "text";
+		types["level"] = "int4";
+		types["score"] = "float8";
+		types["online"] = "bool";
+		for (size_t index = types.size(); index < columns; ++index)
+		{
+			types[fmt::format("stat_{}", index)] = "int8";
+		}
+
+		boost::json::object players;
+		players["columns"] = std::move(types);
+		players["primary_key"] = boost::json::array{ "player_id" };
+
+		auto schema = std::make_shared<SchemaRegistry>();
+		schema->load(boost::json::object{ { "players", std::move(players) } });
+		return schema;
+	}
+}
+
+// A CacheDBService envelope parsed on the default allocator versus into a per-message arena the way
+// DbWorkerPool::parse_message does, which turns one allocation per node into a handful per message
+static void BM_ParseMessage(benchmark::State& state)
+{
+	boost::json::array batch;
+	for (int64_t id = 0; id < state.range(1); ++id)
+	{
+		batch.push_back(make_operation(operations[static_cast<size_t>(id % 4)], id, 8));
+	}
+	const auto message = boost::json::serialize(boost::json::object{ { "batch", std::move(batch) } });
+	const auto arena = state.range(0) != 0;
+
+	boost::json::parser parser;
+	{
+		AllocationCounter counter(state);
+		for (auto _ : state)
+		{
+			if (arena)
+			{
+				parser.reset(boost::json::make_shared_resource<boost::json::monotonic_resource>(message.size() * 2));
+			}
+			else
+			{
+				parser.reset();
+			}
+			boost::json::error_code ec;
+			parser.write(message.data(), message.size(), ec);
+			auto value = parser.release();
+			benchmark::DoNotOptimize(value);
+		}
+	}
+	state.SetLabel(arena ? "arena" : "default");
+	state.SetItemsProcessed(state.iterations() * state.range(1));
+	state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(message.size()));
+}
+BENCHMARK(BM_ParseMessage)->ArgsProduct({ { 0, 1 }, { 1, 64, 1024 } });
+
+// The same envelope as JSON text and in the binary operation format, both built into a per-message arena;
+// message_bytes is what the broker carries for each
+static void BM_DecodeMessage(benchmark::State& state)
+{
+	const auto binary = state.range(0) != 0;
+	boost::json::array batch;
+	for (int64_t id = 0; id < state.range(1); ++id)
+	{
+		batch.push_back(make_operation(operations[static_cast<size_t>(id % 4)], id, 8));
+	}
+
+	std::string message;
+	if (binary)
+	{
+		CommonMessageMQ::OperationCodec codec;
+		codec.begin(message, true);
+		for (const auto& item : batch)
+		{
+			codec.append(message, item.as_object());
+		}
+	}
+	else
+	{
+		message = boost::json::serialize(boost::json::object{ { "batch", batch } });
+	}
+
+	boost::json::parser parser;
+	{
+		AllocationCounter counter(state);
+		for (auto _ : state)
+		{
+			auto storage = boost::json::make_shared_resource<boost::json::monotonic_resource>(message.size() * 2);
+			if (binary)
+			{
+				auto [value, error] = CommonMessageMQ::OperationCodec::decode(message, storage);
+				benchmark::DoNotOptimize(value);
+				continue;
+			}
+			parser.reset(storage);
+			boost::json::error_code ec;
+			parser.write(message.data(), message.size(), ec);
+			auto value = parser.release();
+			benchmark::DoNotOptimize(value);
+		}
+	}
+	state.SetLabel(binary ? "binary" : "json");
+	state.SetItemsProcessed(state.iterations() * state.range(1));
+	state.counters["message_bytes"] = static_cast<double>(message.size());
+}
+BENCHMARK(BM_DecodeMessage)->ArgsProduct({ { 0, 1 }, { 1, 64, 1024 } });
+
+// SQL is written into one buffer reused across iterations, the way pooled statements reuse theirs
+static void BM_WriteSql(benchmark::State& state)
+{
+	auto obj = make_operation(operations[static_cast<size_t>(state.range(0))], 42, static_cast<size_t>(state.range(1)));
+	std::string sql;
+	{
+		AllocationCounter counter(state);
+		for (auto _ : state)
+		{
+			sql.clear();
+			DbJobExecutorBenchmark::write_sql(*executor, sql, obj);
+			benchmark::DoNotOptimize(sql.data());
+		}
+	}
+	state.SetLabel(operations[static_cast<size_t>(state.range(0))]);
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_WriteSql)->ArgsProduct({ { 0, 1, 2, 3 }, { 8, 32 } });
+
+static void BM_WriteInsertSql(benchmark::State& state)
+{
+	auto values = make_values(42, static_cast<size_t>(state.range(0)));
+	std::string sql;
+	{
+		AllocationCounter counter(state);
+		for (auto _ : state)
+		{
+			sql.clear();
+			DbJobExecutorBenchmark::write_insert_sql(*executor, sql, "players", values);
+			benchmark::DoNotOptimize(sql.data());
+		}
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_WriteInsertSql)->RangeMultiplier(4)->Range(8, 128);
+
+static void BM_WriteUpdateSql(benchmark::State& state)
+{
+	auto values = make_values(42, static_cast<size_t>(state.range(0)));
+	boost::json::object where{ { "player_id", 42 } };
+	std::string sql;
+	{
+		AllocationCounter counter(state);
+		for (auto _ : state)
+		{
+			sql.clear();
+			DbJobExecutorBenchmark::write_update_sql(*executor, sql, "players", values, where);
+			benchmark::DoNotOptimize(sql.data());
+		}
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_WriteUpdateSql)->RangeMultiplier(4)->Range(8, 128);
+
+static void BM_WriteUpsertSql(benchmark::State& state)
+{
+	auto values = make_values(42, static_cast<size_t>(state.range(0)));
+	boost::json::array conflict{ "player_id" };
+	std::string sql;
+	{
+		AllocationCounter counter(state);
+		for (auto _ : state)
+		{
+			sql.clear();
+			DbJobExecutorBenchmark::write_upsert_sql(*executor, sql, "players", values, conflict);
+			benchmark::DoNotOptimize(sql.data());
+		}
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_WriteUpsertSql)->RangeMultiplier(4)->Range(8, 128);
+
+static void BM_WriteDeleteSql(benchmark::State& state)
+{
+	boost::json::object where{ { "player_id", 42 }, { "season", 7 } };
+	std::string sql;
+	{
+		AllocationCounter counter(state);
+		for (auto _ : state)
+		{
+			sql.clear();
+			DbJobExecutorBenchmark::write_delete_sql(*executor, sql, "players", where);
+			benchmark::DoNotOptimize(sql.data());
+		}
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_WriteDeleteSql);
+
+static void BM_WriteSqlLiteral(benchmark::State& state)
+{
+	const std::vector<std::pair<std::string, boost::json::value>> samples = {
+		{ "null", nullptr },
+		{ "bool", true },
+		{ "int64", int64_t(9007199254740993) },
+		{ "double", 3.14159265358979 },
+		{ "string", "O'Brien's \"sword\" of +3 damage" },
+		{ "object", boost::json::object{ { "x", 1 }, { "y", 2 }, { "tags", boost::json::array{ "a", "b" } } } },
+	};
+	const auto& [label, value] = samples[static_cast<size_t>(state.range(0))];
+	std::string sql;
+	{
+		AllocationCounter counter(state);
+		for (auto _ : state)
+		{
+			sql.clear();
+			DbJobExecutorBenchmark::write_sql_literal(*executor, sql, value);
+			benchmark::DoNotOptimize(sql.data());
+		}
+	}
+	state.SetLabel(label);
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_WriteSqlLiteral)->DenseRange(0, 5);
+
+// Whole conversion of an operation into pooled statements; allocs_per_op is expected to be 0 once warmed up.
+// The second argument validates against a SchemaRegistry instead of checking names character by character
+static void BM_OperationToStatements(benchmark::State& state)
+{
+	auto& target = state.range(1) == 0 ? *executor : *schema_executor;
+	auto obj = make_operation(operations[static_cast<size_t>(state.range(0))], 42, 8);
+	DbJobExecutorBenchmark::convert(target, obj);
+	{
+		AllocationCounter counter(state);
+		for (auto _ : state)
+		{
+			auto statements = DbJobExecutorBenchmark::convert(target, obj);
+			benchmark::DoNotOptimize(statements);
+		}
+	}
+	state.SetLabel(operations[static_cast<size_t>(state.range(0))] + (state.range(1) == 0 ? "" : "/schema"));
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_OperationToStatements)->ArgsProduct({ { 0, 1, 2, 3 }, { 0, 1 } });
+
+// A CacheDBService envelope: inserts into one table coalesce into multi-row statements.
+// The second argument sends a flush of upserts instead, which coalesce under one ON CONFLICT clause
+static void BM_BatchToStatements(benchmark::State& state)
+{
+	boost::json::array batch;
+	for (int64_t id = 0; id < state.range(0); ++id)
+	{
+		batch.push_back(make_operation(state.range(1) == 1 ? "upsert" : id % 4 == 3 ? "update" : "insert", id, 8));
+	}
+	boost::json::object envelope{ { "batch", std::move(batch) } };
+	DbJobExecutorBenchmark::convert(*executor, envelope);
+
+	{
+		AllocationCounter counter(state);
+		for (auto _ : state)
+		{
+			auto statements = DbJobExecutorBenchmark::convert(*executor, envelope);
+			benchmark::DoNotOptimize(statements);
+		}
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_BatchToStatements)->ArgsProduct({ { 8, 64, 512, 4096 }, { 0, 1 } });
+
+static void BM_WritePreparedStatement(benchmark::State& state)
+{
+	auto obj = make_operation(operations[static_cast<size_t>(state.range(0))], 42, 8);
+	DbJobExecutorBenchmark::write_prepared_statement(*executor, obj);
+	{
+		AllocationCounter counter(state);
+		for (auto _ : state)
+		{
+			auto params = DbJobExecutorBenchmark::write_prepared_statement(*executor, obj);
+			benchmark::DoNotOptimize(params);
+		}
+	}
+	state.SetLabel(operations[static_cast<size_t>(state.range(0))]);
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_WritePreparedStatement)->DenseRange(0, 3);
+
+auto main(int argc, char* argv[]) -> int
+{
+	benchmark::Initialize(&argc, argv);
+
+	// Remaining arguments are MainDBService options, e.g. --postgres_conn; with the statement cache
+	// off no session is opened, and the text SQL path is what the benchmarks above measure. Text values
+	// are then escaped by PostgresDB, which returns a new string; with a session they are escaped in place.
+	std::vector<char*> arguments(argv, argv + argc);
+	std::string cache_flag = "--statement_cache_size";
+	std::string cache_size = "0";
+	arguments.push_back(cache_flag.data());
+	arguments.push_back(cache_size.data());
+	configurations = std::make_shared<Configurations>(ArgumentParser(static_cast<int>(arguments.size()), arguments.data()));
+
+	db = std::make_unique<PostgresDB>(configurations->postgres_conn());
+	executor = std::make_unique<DbJobExecutor>(*db, configurations);
+	schema_executor = std::make_unique<DbJobExecutor>(*db, configurations, make_schema(8));
+
+	benchmark::RunSpecifiedBenchmarks();
+	benchmark::Shutdown();
+
+	schema_executor.reset();
+	executor.reset();
+	db.reset();
+	return 0;
+}
@@ -0,0 +1,177 @@
+// End-to-end benchmark of the write pipeline against running services:
+//   Redis stream -> CacheDBService -> RabbitMQ -> MainDBService -> Postgres
+// Each operation inserts a row carrying its enqueue time and Postgres stamps it with clock_timestamp() as it
+// is written, so latency percentiles are computed by the database over every row of the run.
+// Services and endpoints are started by run_pipeline_benchmark.sh; the endpoints can be overridden through
+// BENCH_REDIS_HOST, BENCH_REDIS_PORT, BENCH_STREAM_KEY, BENCH_POSTGRES_CONN and BENCH_TIMEOUT_S.
+
+#include <benchmark/benchmark.h>
+#include <libpq-fe.h>
+#include <sw/redis++/redis++.h>
+
+#include "fmt/format.h"
+
+#include "boost/json.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+namespace
+{
+	auto environment(const char* name, const std::string& fallback) -> std::string
+	{
+		auto* value = std::getenv(name);
+		return value != nullptr && *value != '\0' ? std::string(value) : fallback;
+	}
+
+	auto now_us() -> int64_t
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	}
+
+	struct PgConnectionDeleter
+	{
+		void operator()(PGconn* connection) const { PQfinish(connection); }
+	};
+
+	struct PgResultDeleter
+	{
+		void operator()(PGresult* result) const { PQclear(result); }
+	};
+
+	using PgConnection = std::unique_ptr<PGconn, PgConnectionDeleter>;
+	using PgResult = std::unique_ptr<PGresult, PgResultDeleter>;
+
+	auto query(PGconn* connection, const std::string& sql, const std::vector<std::string>& params = {}) -> std::tuple<PgResult, std::optional<std::string>>
+	{
+		std::vector<const char*> values;
+		for (const auto& param : params)
+		{
+			values.push_back(param.c_str());
+		}
+
+		PgResult result(PQexecParams(connection, sql.c_str(), static_cast<int>(values.size()), nullptr, values.data(), nullptr, nullptr, 0));
+		auto status = PQresultStatus(result.get());
+		if (status != PGRES_TUPLES_OK && status != PGRES_COMMAND_OK)
+		{
+			return { nullptr, std::string(PQerrorMessage(connection)) };
+		}
+		return { std::move(result), std::nullopt };
+	}
+}
+
+// Pushes state.range(0) inserts as fast as the stream takes them and waits until all of them are committed
+static void BM_Pipeline(benchmark::State& state)
+{
+	const auto messages = state.range(0);
+	const auto stream_key = environment("BENCH_STREAM_KEY", "cache:changes");
+	const auto timeout = std::chrono::seconds(std::stoi(environment("BENCH_TIMEOUT_S", "120")));
+
+	PgConnection postgres(PQconnectdb(environment("BENCH_POSTGRES_CONN", "host=127.0.0.1 port=5432 dbname=game user=postgres password=postgres").c_str()));
+	if (PQstatus(postgres.get()) != CONNECTION_OK)
+	{
+		state.SkipWithError(fmt::format("postgres: {}", PQerrorMessage(postgres.get())).c_str());
+		return;
+	}
+
+	auto [created, create_error] = query(postgres.get(),
+		"CREATE TABLE IF NOT EXISTS bench_pipeline ("
+		"run_id text NOT NULL, seq bigint NOT NULL, enqueued_us bigint NOT NULL, "
+		"stored_at timestamptz NOT NULL DEFAULT clock_timestamp(), PRIMARY KEY (run_id, seq));");
+	if (create_error.has_value())
+	{
+		state.SkipWithError(create_error.value().c_str());
+		return;
+	}
+
+	sw::redis::ConnectionOptions options;
+	options.host = environment("BENCH_REDIS_HOST", "127.0.0.1");
+	options.port = std::stoi(environment("BENCH_REDIS_PORT", "6379"));
+	options.socket_timeout = std::chrono::milliseconds(5000);
+	std::unique_ptr<sw::redis::Redis> redis;
+	try
+	{
+		redis = std::make_unique<sw::redis::Redis>(options);
+		redis->ping();
+	}
+	catch (const sw::redis::Error& e)
+	{
+		state.SkipWithError(fmt::format("redis: {}", e.what()).c_str());
+		return;
+	}
+
+	for (auto _ : state)
+	{
+		const auto run_id = fmt::format("{}-{}", now_us(), messages);
+		const auto started = std::chrono::steady_clock::now();
+
+		constexpr int64_t entries_per_pipeline = 512;
+		for (int64_t sequence = 0; sequence < messages; sequence += entries_per_pipeline)
+		{
+			auto pipeline = redis->pipeline(false);
+			for (auto index = sequence; index < std::min(messages, sequence + entries_per_pipeline); ++index)
+			{
+				boost::json::object operation;
+				operation["op"] = "insert";
+				operation["table"] = "bench_pipeline";
+				operation["values"] = boost::json::object{ { "run_id", run_id }, { "seq", index }, { "enqueued_us", now_us() } };
+
+				std::vector<std::string> command{ "XADD", stream_key, "*", "body", boost::json::serialize(operation) };
+				pipeline.command(command.begin(), command.end());
+			}
+			pipeline.exec();
+		}
+
+		int64_t stored = 0;
+		while (stored < messages && std::chrono::steady_clock::now() - started < timeout)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+			auto [result, error] = query(postgres.get(), "SELECT count(*) FROM bench_pipeline WHERE run_id = $1;", { run_id });
+			if (error.has_value())
+			{
+				state.SkipWithError(error.value().c_str());
+				return;
+			}
+			stored = std::stoll(PQgetvalue(result.get(), 0, 0));
+		}
+		state.SetIterationTime(std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count());
+
+		if (stored < messages)
+		{
+			state.SkipWithError(fmt::format("only {} of {} operations reached postgres within {}s", stored, messages, timeout.count()).c_str());
+			return;
+		}
+
+		auto [result, error] = query(postgres.get(),
+			"SELECT percentile_cont(0.5) WITHIN GROUP (ORDER BY latency_us), "
+			"percentile_cont(0.99) WITHIN GROUP (ORDER BY latency_us), "
+			"percentile_cont(0.999) WITHIN GROUP (ORDER BY latency_us), "
+			"max(stored_us) - min(enqueued_us) "
+			"FROM (SELECT enqueued_us, extract(epoch FROM stored_at) * 1000000 AS stored_us, "
+			"extract(epoch FROM stored_at) * 1000000 - enqueued_us AS latency_us "
+			"FROM bench_pipeline WHERE run_id = $1) AS run;", { run_id });
+		if (error.has_value())
+		{
+			state.SkipWithError(error.value().c_str());
+			return;
+		}
+
+		auto span_us = std::stod(PQgetvalue(result.get(), 0, 3));
+		state.counters["msgs_per_s"] = span_us > 0 ? static_cast<double>(messages) * 1000000.0 / span_us : 0.0;
+		state.counters["p50_us"] = std::stod(PQgetvalue(result.get(), 0, 0));
+		state.counters["p99_us"] = std::stod(PQgetvalue(result.get(), 0, 1));
+		state.counters["p999_us"] = std::stod(PQgetvalue(result.get(), 0, 2));
+
+		query(postgres.get(), "DELETE FROM bench_pipeline WHERE run_id = $1;", { run_id });
+	}
+}
+BENCHMARK(BM_Pipeline)->Arg(10000)->Arg(100000)->Iterations(1)->UseManualTime()->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
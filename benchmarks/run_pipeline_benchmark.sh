@@ -0,0 +1,59 @@
+#!/bin/bash
+# Spawns throwaway redis-server, RabbitMQ and Postgres instances on non-default ports, starts
+# MainDBService and CacheDBService against them and runs PipelineBenchmark.
+# Needs redis-server, rabbitmq-server, rabbitmqctl, initdb and pg_ctl on PATH and a build with -DBUILD_BENCHMARKS=ON.
+# Extra arguments go to PipelineBenchmark, e.g. --benchmark_format=json --benchmark_out=pipeline.json
+
+set -euo pipefail
+
+cd "$(dirname "$0")/.."
+
+OUT_DIR="${OUT_DIR:-build/out}"
+REDIS_PORT="${REDIS_PORT:-16379}"
+RABBIT_PORT="${RABBIT_PORT:-15673}"
+POSTGRES_PORT="${POSTGRES_PORT:-15432}"
+STREAM_KEY="bench:pipeline"
+
+WORK_DIR="$(mktemp -d)"
+PIDS=()
+
+cleanup()
+{
+	for pid in "${PIDS[@]}"; do
+		kill "$pid" 2>/dev/null || true
+	done
+	wait 2>/dev/null || true
+	RABBITMQ_NODENAME="bench@localhost" rabbitmqctl stop >/dev/null 2>&1 || true
+	pg_ctl -D "$WORK_DIR/postgres" -m immediate stop >/dev/null 2>&1 || true
+	rm -rf "$WORK_DIR"
+}
+trap cleanup EXIT
+
+echo "Starting redis-server on $REDIS_PORT..."
+redis-server --port "$REDIS_PORT" --save "" --appendonly no --dir "$WORK_DIR" >"$WORK_DIR/redis.log" 2>&1 &
+PIDS+=($!)
+
+echo "Starting postgres on $POSTGRES_PORT..."
+initdb -D "$WORK_DIR/postgres" -U postgres --auth=trust >"$WORK_DIR/initdb.log" 2>&1
+pg_ctl -D "$WORK_DIR/postgres" -o "-p $POSTGRES_PORT -k $WORK_DIR -c fsync=off" -l "$WORK_DIR/postgres.log" -w start >/dev/null
+createdb -h 127.0.0.1 -p "$POSTGRES_PORT" -U postgres game
+
+echo "Starting rabbitmq-server on $RABBIT_PORT..."
+RABBITMQ_NODENAME="bench@localhost" RABBITMQ_NODE_PORT="$RABBIT_PORT" RABBITMQ_DIST_PORT="$((RABBIT_PORT + 20000))" \
+	RABBITMQ_MNESIA_BASE="$WORK_DIR/rabbitmq" RABBITMQ_LOG_BASE="$WORK_DIR/rabbitmq" \
+	rabbitmq-server >"$WORK_DIR/rabbitmq.log" 2>&1 &
+PIDS+=($!)
+RABBITMQ_NODENAME="bench@localhost" rabbitmqctl await_startup >/dev/null
+
+POSTGRES_CONN="host=127.0.0.1 port=$POSTGRES_PORT dbname=game user=postgres"
+
+echo "Starting MainDBService and CacheDBService..."
+"$OUT_DIR/MainDBService" --rabbit_mq_port "$RABBIT_PORT" --postgres_conn "$POSTGRES_CONN" --schema_source none >"$WORK_DIR/main_db_service.log" 2>&1 &
+PIDS+=($!)
+"$OUT_DIR/CacheDBService" --redis_port "$REDIS_PORT" --rabbit_mq_port "$RABBIT_PORT" \
+	--redis_stream_enabled true --redis_stream_key "$STREAM_KEY" --spool_enabled false >"$WORK_DIR/cache_db_service.log" 2>&1 &
+PIDS+=($!)
+sleep 2
+
+BENCH_REDIS_PORT="$REDIS_PORT" BENCH_STREAM_KEY="$STREAM_KEY" BENCH_POSTGRES_CONN="$POSTGRES_CONN" \
+	"$OUT_DIR/PipelineBenchmark" "$@"
@@ -0,0 +1,102 @@
+#include "ConsistentHashRing.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+namespace
+{
+	auto make_ring(size_t nodes) -> ConsistentHashRing
+	{
+		ConsistentHashRing ring(64);
+		for (size_t index = 0; index < nodes; ++index)
+		{
+			ring.add_node("redis-" + std::to_string(index));
+		}
+		return ring;
+	}
+}
+
+TEST(ConsistentHashRing, EmptyRingMapsToTheFirstNode)
+{
+	ConsistentHashRing ring(64);
+	EXPECT_EQ(ring.node_count(), 0u);
+	EXPECT_EQ(ring.node_for("player:1"), 0u);
+}
+
+TEST(ConsistentHashRing, RejectsADuplicateNode)
+{
+	ConsistentHashRing ring(64);
+	auto [added, add_error] = ring.add_node("redis-0");
+	EXPECT_TRUE(added);
+	EXPECT_FALSE(add_error.has_value());
+
+	auto [again, again_error] = ring.add_node("redis-0");
+	EXPECT_FALSE(again);
+	EXPECT_TRUE(again_error.has_value());
+	EXPECT_EQ(ring.node_count(), 1u);
+}
+
+TEST(ConsistentHashRing, HashTagSelectsTheBracedPart)
+{
+	EXPECT_EQ(ConsistentHashRing::hash_tag("player:{7}:inventory"), "7");
+	EXPECT_EQ(ConsistentHashRing::hash_tag("player:7"), "player:7");
+	EXPECT_EQ(ConsistentHashRing::hash_tag("player:{}:7"), "player:{}:7");
+	EXPECT_EQ(ConsistentHashRing::hash_tag("player:{7"), "player:{7");
+}
+
+TEST(ConsistentHashRing, KeysSharingATagShareANode)
+{
+	auto ring = make_ring(4);
+	for (int id = 0; id < 100; ++id)
+	{
+		auto tag = "{" + std::to_string(id) + "}";
+		EXPECT_EQ(ring.node_for("player:" + tag), ring.node_for("inventory:" + tag + ":bag"));
+	}
+}
+
+TEST(ConsistentHashRing, NodeOrderDoesNotMatter)
+{
+	ConsistentHashRing forward(64);
+	ConsistentHashRing backward(64);
+	std::vector<std::string> names{ "redis-a", "redis-b", "redis-c" };
+	for (const auto& name : names)
+	{
+		forward.add_node(name);
+	}
+	for (auto name = names.rbegin(); name != names.rend(); ++name)
+	{
+		backward.add_node(*name);
+	}
+
+	for (int id = 0; id < 1000; ++id)
+	{
+		auto key = "player:" + std::to_string(id);
+		EXPECT_EQ(forward.node_name(forward.node_for(key)), backward.node_name(backward.node_for(key)));
+	}
+}
+
+TEST(ConsistentHashRing, AddingANodeOnlyMovesKeysOntoIt)
+{
+	auto before = make_ring(4);
+	auto after = make_ring(5);
+
+	size_t moved = 0;
+	const size_t keys = 10000;
+	for (size_t id = 0; id < keys; ++id)
+	{
+		auto key = "player:" + std::to_string(id);
+		auto old_node = before.node_for(key);
+		auto new_node = after.node_for(key);
+		if (old_node != new_node)
+		{
+			EXPECT_EQ(new_node, 4u);
+			++moved;
+		}
+	}
+
+	// About a fifth of the keys belong to the new node; allow for the spread of 64 points per node
+	EXPECT_GT(moved, keys / 10);
+	EXPECT_LT(moved, keys * 3 / 10);
+}
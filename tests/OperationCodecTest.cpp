@@ -0,0 +1,110 @@
+#include "OperationCodec.h"
+
+#include <gtest/gtest.h>
+
+#include <boost/json.hpp>
+
+#include <string>
+
+using namespace CommonMessageMQ;
+
+namespace
+{
+	auto round_trip(const boost::json::value& message) -> boost::json::value
+	{
+		OperationCodec codec;
+		std::string out;
+		auto batch = message.is_object() && message.as_object().contains("batch");
+		auto packed = batch && message.as_object().contains("packed");
+		codec.begin(out, batch, packed);
+		if (batch)
+		{
+			for (const auto& item : message.as_object().at("batch").as_array())
+			{
+				codec.append(out, item);
+			}
+		}
+		else
+		{
+			codec.append(out, message);
+		}
+
+		auto [decoded, error] = OperationCodec::decode(out);
+		EXPECT_TRUE(decoded.has_value()) << error.value_or("");
+		return decoded.value_or(nullptr);
+	}
+}
+
+TEST(OperationCodec, RecognizesItsContentType)
+{
+	EXPECT_TRUE(OperationCodec::is_binary("application/x-db-operations"));
+	EXPECT_TRUE(OperationCodec::is_binary("application/x-db-operations; v=1"));
+	EXPECT_FALSE(OperationCodec::is_binary("application/json"));
+}
+
+TEST(OperationCodec, RoundTripsEveryValueKind)
+{
+	auto message = boost::json::parse(R"({"op":"update","table":"players",
+		"values":{"name":"kim","level":-3,"gold":18446744073709551615,"ratio":0.25,"active":true,"banned":false,"guild":null,
+			"tags":["a",1,[2,{"b":3}]]},
+		"where":{"player_id":7}})");
+	EXPECT_EQ(round_trip(message), message);
+}
+
+TEST(OperationCodec, RoundTripsABatch)
+{
+	auto message = boost::json::parse(R"({"batch":[
+		{"op":"insert","table":"players","values":{"player_id":1,"gold":10}},
+		{"op":"insert","table":"players","values":{"player_id":2,"gold":20}},
+		{"op":"delete","table":"items","where":{"item_id":3}}]})");
+	EXPECT_EQ(round_trip(message), message);
+}
+
+TEST(OperationCodec, KeepsThePackedFlag)
+{
+	auto message = boost::json::parse(R"({"batch":[{"op":"delete","table":"items","where":{"item_id":3}}],"packed":true})");
+	EXPECT_EQ(round_trip(message), message);
+}
+
+TEST(OperationCodec, SendsRepeatedNamesOnce)
+{
+	OperationCodec codec;
+	auto operation = boost::json::parse(R"({"op":"insert","table":"players","values":{"player_id":1,"gold":10}})").as_object();
+
+	std::string one;
+	codec.begin(one, true);
+	codec.append(one, operation);
+
+	std::string two;
+	codec.begin(two, true);
+	codec.append(two, operation);
+	auto first_size = two.size();
+	codec.append(two, operation);
+
+	EXPECT_EQ(one, two.substr(0, first_size));
+	EXPECT_LT(two.size() - first_size, first_size - 4);
+}
+
+TEST(OperationCodec, RejectsMalformedEnvelopes)
+{
+	auto [not_binary, not_binary_error] = OperationCodec::decode("{\"op\":\"insert\"}");
+	EXPECT_FALSE(not_binary.has_value());
+	EXPECT_TRUE(not_binary_error.has_value());
+
+	auto [old_version, version_error] = OperationCodec::decode(std::string("DB\x09\x00", 4));
+	EXPECT_FALSE(old_version.has_value());
+	EXPECT_TRUE(version_error.has_value());
+
+	OperationCodec codec;
+	std::string out;
+	codec.begin(out, false);
+	codec.append(out, boost::json::parse(R"({"op":"insert","table":"players","values":{"name":"kim"}})").as_object());
+
+	auto [truncated, truncated_error] = OperationCodec::decode(std::string_view(out).substr(0, out.size() - 2));
+	EXPECT_FALSE(truncated.has_value());
+	EXPECT_TRUE(truncated_error.has_value());
+
+	auto [trailing, trailing_error] = OperationCodec::decode(out + '\x00');
+	EXPECT_FALSE(trailing.has_value());
+	EXPECT_TRUE(trailing_error.has_value());
+}
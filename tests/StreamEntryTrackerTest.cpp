@@ -0,0 +1,126 @@
+#include "StreamEntryTracker.h"
+#include "WriteAheadSpool.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace
+{
+	class SpoolDirectory
+	{
+	public:
+		SpoolDirectory(void)
+			: path_(std::filesystem::temp_directory_path() /
+				("stream-test-" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count())))
+		{
+		}
+
+		~SpoolDirectory(void)
+		{
+			std::error_code error;
+			std::filesystem::remove_all(path_, error);
+		}
+
+		auto path() const -> std::string { return path_.string(); }
+
+	private:
+		std::filesystem::path path_;
+	};
+
+	// What the stream consumer does with an entry: spool its operation, then track its id
+	auto admit(WriteAheadSpool& spool, StreamEntryTracker& entries, const std::string& id) -> void
+	{
+		uint64_t sequence = 0;
+		auto [appended, append_error] = spool.append("{\"id\":\"" + id + "\"}", sequence);
+		ASSERT_TRUE(appended) << append_error.value_or("");
+		entries.admit(id, sequence);
+	}
+}
+
+TEST(StreamEntryTracker, DeliversIdsUpToTheSequenceInOrder)
+{
+	StreamEntryTracker entries;
+	entries.admit("1-0", 1);
+	entries.admit("2-0", 2);
+	entries.admit("3-0", 5);
+
+	EXPECT_TRUE(entries.delivered(0, 10).empty());
+	EXPECT_EQ(entries.delivered(4, 10), (std::vector<std::string>{ "1-0", "2-0" }));
+	EXPECT_EQ(entries.delivered(5, 1), std::vector<std::string>{ "1-0" });
+
+	entries.acknowledged(1);
+	EXPECT_FALSE(entries.in_flight("1-0"));
+	EXPECT_TRUE(entries.in_flight("2-0"));
+	EXPECT_EQ(entries.delivered(5, 10), (std::vector<std::string>{ "2-0", "3-0" }));
+}
+
+TEST(StreamEntryTracker, AdmitsAnIdOnlyOnce)
+{
+	StreamEntryTracker entries;
+	entries.admit("1-0", 1);
+	entries.admit("1-0", 2);
+	EXPECT_EQ(entries.size(), 1u);
+
+	entries.acknowledged(1);
+	EXPECT_EQ(entries.size(), 0u);
+	EXPECT_FALSE(entries.in_flight("1-0"));
+}
+
+TEST(StreamEntryTracker, IdAdmittedWhileEnvelopesAreUnconfirmedWaitsForItsRecord)
+{
+	SpoolDirectory directory;
+	WriteAheadSpool spool(directory.path(), 0, 4, 10);
+	ASSERT_TRUE(std::get<0>(spool.open()));
+	StreamEntryTracker entries;
+
+	// Flush cycle 1 collects the first entry's record, but its publish is not confirmed
+	admit(spool, entries, "1-0");
+	std::vector<std::string> records;
+	spool.read(100, records);
+	ASSERT_EQ(records.size(), 1u);
+
+	// Admitted meanwhile; cycle 2 retries the unconfirmed envelope without reading the spool
+	admit(spool, entries, "2-0");
+	ASSERT_TRUE(std::get<0>(spool.acknowledge()));
+	EXPECT_EQ(entries.delivered(spool.acknowledged_sequence(), 100), std::vector<std::string>{ "1-0" });
+	entries.acknowledged(1);
+
+	// Only once a later cycle has read and delivered its record
+	records.clear();
+	spool.read(100, records);
+	ASSERT_EQ(records.size(), 1u);
+	EXPECT_EQ(entries.delivered(spool.acknowledged_sequence(), 100), std::vector<std::string>{});
+	ASSERT_TRUE(std::get<0>(spool.acknowledge()));
+	EXPECT_EQ(entries.delivered(spool.acknowledged_sequence(), 100), std::vector<std::string>{ "2-0" });
+}
+
+TEST(StreamEntryTracker, RecoveredRecordsDoNotCountTowardsTheSequence)
+{
+	SpoolDirectory directory;
+	{
+		WriteAheadSpool spool(directory.path(), 0, 4, 10);
+		ASSERT_TRUE(std::get<0>(spool.open()));
+		ASSERT_TRUE(std::get<0>(spool.append("left over")));
+	}
+
+	WriteAheadSpool spool(directory.path(), 0, 4, 10);
+	ASSERT_TRUE(std::get<0>(spool.open()));
+	StreamEntryTracker entries;
+
+	// The leftover is read and delivered first; the new entry's record is still unread
+	std::vector<std::string> records;
+	spool.read(1, records);
+	ASSERT_EQ(records, std::vector<std::string>{ "left over" });
+	admit(spool, entries, "1-0");
+	ASSERT_TRUE(std::get<0>(spool.acknowledge()));
+	EXPECT_EQ(spool.acknowledged_sequence(), 0u);
+	EXPECT_TRUE(entries.delivered(spool.acknowledged_sequence(), 100).empty());
+
+	spool.read(1, records);
+	ASSERT_TRUE(std::get<0>(spool.acknowledge()));
+	EXPECT_EQ(entries.delivered(spool.acknowledged_sequence(), 100), std::vector<std::string>{ "1-0" });
+}
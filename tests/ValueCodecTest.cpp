@@ -0,0 +1,99 @@
+#include "ValueCodec.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <string>
+
+TEST(ValueCodec, DisabledStoresValuesUnchanged)
+{
+	ValueCodec codec(false, 16);
+	std::string value(1000, 'a');
+	EXPECT_EQ(codec.encode(value), value);
+
+	auto [decoded, error] = codec.decode(value);
+	ASSERT_TRUE(decoded.has_value());
+	EXPECT_EQ(decoded.value(), value);
+}
+
+TEST(ValueCodec, FramesAndDecodesASmallValue)
+{
+	ValueCodec codec(true, 1024);
+	std::string value = R"({"player_id":7,"gold":10})";
+	auto stored = codec.encode(value);
+	EXPECT_NE(stored, value);
+	EXPECT_EQ(stored.substr(0, 2), std::string("\x00\xC7", 2));
+
+	auto [decoded, error] = codec.decode(stored);
+	ASSERT_TRUE(decoded.has_value()) << error.value_or("");
+	EXPECT_EQ(decoded.value(), value);
+}
+
+TEST(ValueCodec, CompressesALargeValue)
+{
+	ValueCodec codec(true, 64);
+	std::string value;
+	for (int index = 0; index < 200; ++index)
+	{
+		value += R"({"item_id":1,"count":2},)";
+	}
+
+	auto stored = codec.encode(value);
+	EXPECT_LT(stored.size(), value.size());
+
+	auto [decoded, error] = codec.decode(stored);
+	ASSERT_TRUE(decoded.has_value()) << error.value_or("");
+	EXPECT_EQ(decoded.value(), value);
+}
+
+TEST(ValueCodec, CarriesTheRecomputeTime)
+{
+	ValueCodec codec(true, 64);
+	auto small = codec.encode("value", std::chrono::milliseconds(250));
+	EXPECT_EQ(codec.recompute_time(small), std::chrono::milliseconds(250));
+
+	auto large = codec.encode(std::string(4096, 'x'), std::chrono::milliseconds(1500));
+	EXPECT_EQ(codec.recompute_time(large), std::chrono::milliseconds(1500));
+	auto [decoded, error] = codec.decode(large);
+	ASSERT_TRUE(decoded.has_value()) << error.value_or("");
+	EXPECT_EQ(decoded.value(), std::string(4096, 'x'));
+
+	EXPECT_EQ(codec.recompute_time(codec.encode("value")), std::chrono::milliseconds(0));
+	EXPECT_EQ(codec.recompute_time("plain"), std::chrono::milliseconds(0));
+}
+
+TEST(ValueCodec, DecodesUnframedValuesUnchanged)
+{
+	// Written before the codec existed, or with binary disabled
+	ValueCodec codec(true, 64);
+	auto [decoded, error] = codec.decode("plain text");
+	ASSERT_TRUE(decoded.has_value());
+	EXPECT_EQ(decoded.value(), "plain text");
+}
+
+TEST(ValueCodec, RejectsACorruptFrame)
+{
+	ValueCodec codec(true, 64);
+	auto stored = codec.encode(std::string(4096, 'x'));
+	stored.resize(stored.size() / 2);
+
+	auto [decoded, error] = codec.decode(stored);
+	EXPECT_FALSE(decoded.has_value());
+	EXPECT_TRUE(error.has_value());
+
+	auto [unknown, version_error] = codec.decode(std::string("\x00\xC7\x09\x00value", 9));
+	EXPECT_FALSE(unknown.has_value());
+	EXPECT_TRUE(version_error.has_value());
+}
+
+TEST(ValueCodec, DisabledFramesValuesThatLookFramed)
+{
+	ValueCodec codec(false, 16);
+	std::string value("\x00\xC7\x01\x00payload", 11);
+	auto stored = codec.encode(value);
+	EXPECT_NE(stored, value);
+
+	auto [decoded, error] = codec.decode(stored);
+	ASSERT_TRUE(decoded.has_value()) << error.value_or("");
+	EXPECT_EQ(decoded.value(), value);
+}
@@ -0,0 +1,202 @@
+#include "WriteAheadSpool.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+	// Segment layout as written by the spool: 16-byte header, then { uint32 length word, uint32 checksum, payload }
+	// padded to 8 bytes
+	constexpr size_t first_record = 16;
+	constexpr uint32_t committed = 0x80000000u;
+
+	auto record_size(size_t length) -> size_t
+	{
+		return (8 + length + 7) & ~static_cast<size_t>(7);
+	}
+
+	class SpoolDirectory
+	{
+	public:
+		SpoolDirectory(void)
+			: path_(std::filesystem::temp_directory_path() /
+				("spool-test-" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count())))
+		{
+		}
+
+		~SpoolDirectory(void)
+		{
+			std::error_code error;
+			std::filesystem::remove_all(path_, error);
+		}
+
+		auto path() const -> std::string { return path_.string(); }
+		auto segment(uint64_t id) const -> std::filesystem::path { return path_ / (std::string(20 - std::to_string(id).size(), '0') + std::to_string(id) + ".seg"); }
+
+	private:
+		std::filesystem::path path_;
+	};
+
+	auto read_all(WriteAheadSpool& spool) -> std::vector<std::string>
+	{
+		std::vector<std::string> records;
+		spool.read(1000, records);
+		return records;
+	}
+
+	auto append_all(WriteAheadSpool& spool, const std::vector<std::string>& records) -> void
+	{
+		for (const auto& record : records)
+		{
+			auto [appended, append_error] = spool.append(record);
+			ASSERT_TRUE(appended) << append_error.value_or("");
+		}
+	}
+
+	auto read_word(const std::filesystem::path& path, size_t offset) -> uint32_t
+	{
+		std::ifstream file(path, std::ios::binary);
+		file.seekg(static_cast<std::streamoff>(offset));
+		uint32_t word = 0;
+		file.read(reinterpret_cast<char*>(&word), sizeof(word));
+		return word;
+	}
+
+	auto write_word(const std::filesystem::path& path, size_t offset, uint32_t word) -> void
+	{
+		std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+		file.seekp(static_cast<std::streamoff>(offset));
+		file.write(reinterpret_cast<const char*>(&word), sizeof(word));
+	}
+}
+
+TEST(WriteAheadSpool, ReadsWhatWasAppendedInOrder)
+{
+	SpoolDirectory directory;
+	WriteAheadSpool spool(directory.path(), 0, 4, 10);
+	ASSERT_TRUE(std::get<0>(spool.open()));
+
+	append_all(spool, { "first", "second", "third" });
+	EXPECT_EQ(spool.pending_records(), 3u);
+	EXPECT_EQ(spool.pending_bytes(), 16u);
+
+	std::vector<std::string> records;
+	EXPECT_FALSE(spool.read(2, records).has_value());
+	EXPECT_EQ(records, (std::vector<std::string>{ "first", "second" }));
+	EXPECT_EQ(read_all(spool), std::vector<std::string>{ "third" });
+	EXPECT_EQ(spool.pending_records(), 0u);
+
+	auto [acknowledged, acknowledge_error] = spool.acknowledge();
+	EXPECT_TRUE(acknowledged) << acknowledge_error.value_or("");
+	EXPECT_TRUE(read_all(spool).empty());
+}
+
+TEST(WriteAheadSpool, RejectsRecordsItCannotHold)
+{
+	SpoolDirectory directory;
+	WriteAheadSpool spool(directory.path(), 0, 4, 10);
+	EXPECT_FALSE(std::get<0>(spool.append("closed")));
+
+	ASSERT_TRUE(std::get<0>(spool.open()));
+	EXPECT_FALSE(std::get<0>(spool.append("")));
+	EXPECT_FALSE(std::get<0>(spool.append(std::string(8192, 'x'))));
+}
+
+TEST(WriteAheadSpool, ReopenReplaysOnlyWhatWasNotAcknowledged)
+{
+	SpoolDirectory directory;
+	{
+		WriteAheadSpool spool(directory.path(), 0, 4, 10);
+		ASSERT_TRUE(std::get<0>(spool.open()));
+		append_all(spool, { "first", "second" });
+
+		std::vector<std::string> records;
+		spool.read(1, records);
+		ASSERT_EQ(records, std::vector<std::string>{ "first" });
+		ASSERT_TRUE(std::get<0>(spool.acknowledge()));
+
+		// Read but not acknowledged: delivered again after the restart
+		append_all(spool, { "third" });
+		ASSERT_EQ(read_all(spool), (std::vector<std::string>{ "second", "third" }));
+	}
+
+	WriteAheadSpool spool(directory.path(), 0, 4, 10);
+	ASSERT_TRUE(std::get<0>(spool.open()));
+	EXPECT_EQ(spool.pending_records(), 2u);
+	append_all(spool, { "fourth" });
+	EXPECT_EQ(read_all(spool), (std::vector<std::string>{ "second", "third", "fourth" }));
+}
+
+TEST(WriteAheadSpool, SkipsARecordClaimedButNeverCommitted)
+{
+	SpoolDirectory directory;
+	{
+		WriteAheadSpool spool(directory.path(), 0, 4, 10);
+		ASSERT_TRUE(std::get<0>(spool.open()));
+		append_all(spool, { "first", "second", "third" });
+	}
+
+	// As if the process died between claiming "second" and committing it
+	auto offset = first_record + record_size(5);
+	auto word = read_word(directory.segment(1), offset);
+	ASSERT_EQ(word, committed | 6u);
+	write_word(directory.segment(1), offset, 6u);
+
+	WriteAheadSpool spool(directory.path(), 0, 4, 10);
+	ASSERT_TRUE(std::get<0>(spool.open()));
+	EXPECT_EQ(spool.pending_records(), 2u);
+	EXPECT_EQ(read_all(spool), (std::vector<std::string>{ "first", "third" }));
+}
+
+TEST(WriteAheadSpool, StopsAtALengthRunningPastTheSegment)
+{
+	SpoolDirectory directory;
+	{
+		WriteAheadSpool spool(directory.path(), 0, 4, 10);
+		ASSERT_TRUE(std::get<0>(spool.open()));
+		append_all(spool, { "first", "second", "third" });
+	}
+
+	auto offset = first_record + record_size(5);
+	write_word(directory.segment(1), offset, committed | 0x00FFFFFFu);
+
+	WriteAheadSpool spool(directory.path(), 0, 4, 10);
+	ASSERT_TRUE(std::get<0>(spool.open()));
+	EXPECT_EQ(read_all(spool), std::vector<std::string>{ "first" });
+
+	// Appends after the restart go to a fresh segment and are still reached
+	append_all(spool, { "fourth" });
+	EXPECT_EQ(read_all(spool), std::vector<std::string>{ "fourth" });
+}
+
+TEST(WriteAheadSpool, RollsAcrossSegmentsUpToTheLimit)
+{
+	SpoolDirectory directory;
+	// The smallest segment holds four 1000-byte records
+	WriteAheadSpool spool(directory.path(), 0, 3, 10);
+	ASSERT_TRUE(std::get<0>(spool.open()));
+
+	std::vector<std::string> appended;
+	for (int index = 0; index < 12; ++index)
+	{
+		appended.push_back(std::string(999, 'a' + index) + "\n");
+	}
+	append_all(spool, appended);
+
+	auto [full, full_error] = spool.append(std::string(1000, 'z'));
+	EXPECT_FALSE(full);
+	EXPECT_TRUE(full_error.has_value());
+
+	EXPECT_EQ(read_all(spool), appended);
+	ASSERT_TRUE(std::get<0>(spool.acknowledge()));
+
+	// Acknowledging frees the segments behind the read position
+	append_all(spool, { std::string(1000, 'z') });
+	EXPECT_EQ(read_all(spool), std::vector<std::string>{ std::string(1000, 'z') });
+}
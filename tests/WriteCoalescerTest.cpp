@@ -0,0 +1,174 @@
+#include "WriteCoalescer.h"
+
+#include <gtest/gtest.h>
+
+#include <boost/json.hpp>
+
+#include <string>
+#include <vector>
+
+namespace
+{
+	auto keys() -> std::unordered_map<std::string, std::vector<std::string>>
+	{
+		return { { "players", { "player_id" } }, { "items", { "item_id" } } };
+	}
+
+	auto add(WriteCoalescer& coalescer, const std::string& body) -> void
+	{
+		coalescer.add(body, boost::json::parse(body).as_object());
+	}
+
+	auto drained(WriteCoalescer& coalescer) -> std::vector<boost::json::object>
+	{
+		std::vector<boost::json::object> operations;
+		for (auto& operation : coalescer.drain())
+		{
+			// The body is what gets published, so check it rather than the parsed form
+			operations.push_back(boost::json::parse(operation.message_body).as_object());
+		}
+		return operations;
+	}
+}
+
+TEST(WriteCoalescer, UpdatesOnOneRowMergeTheirValues)
+{
+	WriteCoalescer coalescer(true, keys());
+	add(coalescer, R"({"op":"update","table":"players","values":{"level":1,"gold":10},"where":{"player_id":7}})");
+	add(coalescer, R"({"op":"update","table":"players","values":{"gold":20},"where":{"player_id":7}})");
+
+	auto operations = drained(coalescer);
+	ASSERT_EQ(operations.size(), 1u);
+	EXPECT_EQ(operations[0].at("values"), boost::json::parse(R"({"level":1,"gold":20})"));
+	EXPECT_EQ(coalescer.received_count(), 2u);
+	EXPECT_EQ(coalescer.emitted_count(), 1u);
+}
+
+TEST(WriteCoalescer, InsertThenUpdateBecomesTheInsert)
+{
+	WriteCoalescer coalescer(true, keys());
+	add(coalescer, R"({"op":"insert","table":"players","values":{"player_id":7,"gold":10}})");
+	add(coalescer, R"({"op":"update","table":"players","values":{"gold":20},"where":{"player_id":7}})");
+
+	auto operations = drained(coalescer);
+	ASSERT_EQ(operations.size(), 1u);
+	EXPECT_EQ(operations[0].at("op").as_string(), "insert");
+	EXPECT_EQ(operations[0].at("values"), boost::json::parse(R"({"player_id":7,"gold":20})"));
+}
+
+TEST(WriteCoalescer, UpsertsMerge)
+{
+	WriteCoalescer coalescer(true, keys());
+	add(coalescer, R"({"op":"upsert","table":"players","values":{"player_id":7,"gold":10}})");
+	add(coalescer, R"({"op":"upsert","table":"players","values":{"player_id":7,"level":3}})");
+
+	auto operations = drained(coalescer);
+	ASSERT_EQ(operations.size(), 1u);
+	EXPECT_EQ(operations[0].at("values"), boost::json::parse(R"({"player_id":7,"gold":10,"level":3})"));
+}
+
+TEST(WriteCoalescer, InsertThenDeleteCancels)
+{
+	WriteCoalescer coalescer(true, keys());
+	add(coalescer, R"({"op":"insert","table":"players","values":{"player_id":7,"gold":10}})");
+	add(coalescer, R"({"op":"delete","table":"players","where":{"player_id":7}})");
+
+	EXPECT_TRUE(coalescer.empty());
+	EXPECT_TRUE(drained(coalescer).empty());
+}
+
+TEST(WriteCoalescer, UpdateThenDeleteBecomesTheDeleteAtItsPosition)
+{
+	WriteCoalescer coalescer(true, keys());
+	add(coalescer, R"({"op":"update","table":"players","values":{"gold":10},"where":{"player_id":7}})");
+	add(coalescer, R"({"op":"update","table":"players","values":{"gold":10},"where":{"player_id":8}})");
+	add(coalescer, R"({"op":"delete","table":"players","where":{"player_id":7}})");
+
+	auto operations = drained(coalescer);
+	ASSERT_EQ(operations.size(), 2u);
+	EXPECT_EQ(operations[0].at("where").as_object().at("player_id").as_int64(), 8);
+	EXPECT_EQ(operations[1].at("op").as_string(), "delete");
+	EXPECT_EQ(operations[1].at("where").as_object().at("player_id").as_int64(), 7);
+}
+
+TEST(WriteCoalescer, MergedRowTakesThePositionOfItsLastWrite)
+{
+	WriteCoalescer coalescer(true, keys());
+	add(coalescer, R"({"op":"update","table":"players","values":{"gold":10},"where":{"player_id":7}})");
+	add(coalescer, R"({"op":"update","table":"players","values":{"gold":10},"where":{"player_id":8}})");
+	add(coalescer, R"({"op":"update","table":"players","values":{"level":2},"where":{"player_id":7}})");
+
+	auto operations = drained(coalescer);
+	ASSERT_EQ(operations.size(), 2u);
+	EXPECT_EQ(operations[0].at("where").as_object().at("player_id").as_int64(), 8);
+	EXPECT_EQ(operations[1].at("where").as_object().at("player_id").as_int64(), 7);
+	EXPECT_EQ(operations[1].at("values"), boost::json::parse(R"({"gold":10,"level":2})"));
+}
+
+TEST(WriteCoalescer, WriteToAnotherTableIsABarrier)
+{
+	// The item may reference the player, so neither player write may move across it
+	WriteCoalescer coalescer(true, keys());
+	add(coalescer, R"({"op":"insert","table":"players","values":{"player_id":7,"gold":10}})");
+	add(coalescer, R"({"op":"insert","table":"items","values":{"item_id":1,"owner":7}})");
+	add(coalescer, R"({"op":"update","table":"players","values":{"gold":20},"where":{"player_id":7}})");
+
+	auto operations = drained(coalescer);
+	ASSERT_EQ(operations.size(), 3u);
+	EXPECT_EQ(operations[0].at("op").as_string(), "insert");
+	EXPECT_EQ(operations[0].at("table").as_string(), "players");
+	EXPECT_EQ(operations[1].at("table").as_string(), "items");
+	EXPECT_EQ(operations[2].at("op").as_string(), "update");
+}
+
+TEST(WriteCoalescer, TableWithoutConfiguredKeyIsNotCoalesced)
+{
+	WriteCoalescer coalescer(true, keys());
+	add(coalescer, R"({"op":"update","table":"guilds","values":{"rank":1},"where":{"region":"eu"}})");
+	add(coalescer, R"({"op":"update","table":"guilds","values":{"rank":2},"where":{"region":"eu"}})");
+	add(coalescer, R"({"op":"upsert","table":"guilds","values":{"guild_id":1,"rank":3},"conflict":["guild_id"]})");
+	add(coalescer, R"({"op":"upsert","table":"guilds","values":{"guild_id":1,"rank":4},"conflict":["guild_id"]})");
+
+	EXPECT_EQ(drained(coalescer).size(), 4u);
+}
+
+TEST(WriteCoalescer, WhereOtherThanTheKeyIsNotCoalesced)
+{
+	WriteCoalescer coalescer(true, keys());
+	add(coalescer, R"({"op":"update","table":"players","values":{"gold":1},"where":{"player_id":7,"level":2}})");
+	add(coalescer, R"({"op":"update","table":"players","values":{"gold":2},"where":{"player_id":7,"level":2}})");
+
+	EXPECT_EQ(drained(coalescer).size(), 2u);
+}
+
+TEST(WriteCoalescer, UpdateOfTheKeyIsABarrier)
+{
+	WriteCoalescer coalescer(true, keys());
+	add(coalescer, R"({"op":"update","table":"players","values":{"gold":1},"where":{"player_id":7}})");
+	add(coalescer, R"({"op":"update","table":"players","values":{"player_id":9},"where":{"player_id":7}})");
+	add(coalescer, R"({"op":"update","table":"players","values":{"gold":2},"where":{"player_id":7}})");
+
+	EXPECT_EQ(drained(coalescer).size(), 3u);
+}
+
+TEST(WriteCoalescer, RawSqlIsABarrier)
+{
+	WriteCoalescer coalescer(true, keys());
+	add(coalescer, R"({"op":"update","table":"players","values":{"gold":1},"where":{"player_id":7}})");
+	add(coalescer, R"({"op":"exec","sql":"UPDATE players SET gold = 0"})");
+	add(coalescer, R"({"op":"update","table":"players","values":{"gold":2},"where":{"player_id":7}})");
+
+	EXPECT_EQ(drained(coalescer).size(), 3u);
+}
+
+TEST(WriteCoalescer, DisabledKeepsEveryOperation)
+{
+	WriteCoalescer coalescer(false, keys());
+	add(coalescer, R"({"op":"insert","table":"players","values":{"player_id":7,"gold":10}})");
+	add(coalescer, R"({"op":"delete","table":"players","where":{"player_id":7}})");
+
+	auto operations = drained(coalescer);
+	ASSERT_EQ(operations.size(), 2u);
+	EXPECT_EQ(operations[0].at("op").as_string(), "insert");
+	EXPECT_EQ(operations[1].at("op").as_string(), "delete");
+}